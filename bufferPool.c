@@ -0,0 +1,119 @@
+//
+//  bufferPool.c
+//  OMXPlayground
+//
+
+#include "bufferPool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+
+
+typedef struct {
+    uint8_t *buffer;        // NULL for an empty slot
+    size_t size;
+    bool inUse;
+} BufferPoolEntry_s;
+
+
+
+struct BufferPool_s {
+    pthread_mutex_t lock;
+    size_t alignment;
+    uint32_t maxBuffers;
+    BufferPoolEntry_s entries[];
+};
+
+
+
+static uint8_t * allocBuffer(const size_t in_ALIGNMENT, const size_t in_SIZE) {
+    void *buffer = NULL;
+    int ret = posix_memalign(&buffer, in_ALIGNMENT, in_SIZE);
+    assert(ret == 0);
+    return buffer;
+}
+
+
+
+BufferPool_s * bufferPoolInit(const uint32_t in_MAX_BUFFERS, const size_t in_ALIGNMENT) {
+    BufferPool_s *pool = calloc(1, sizeof(BufferPool_s) + in_MAX_BUFFERS * sizeof(BufferPoolEntry_s));
+    assert(pool != NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->alignment = (in_ALIGNMENT >= sizeof(void *)) ? in_ALIGNMENT : sizeof(void *);
+    pool->maxBuffers = in_MAX_BUFFERS;
+    return pool;
+}
+
+
+
+void bufferPoolDeinit(BufferPool_s * const in_out_pool) {
+    for (uint32_t i = 0; i < in_out_pool->maxBuffers; i++) {
+        assert(!in_out_pool->entries[i].inUse);
+        free(in_out_pool->entries[i].buffer);
+    }
+
+    pthread_mutex_destroy(&in_out_pool->lock);
+    free(in_out_pool);
+}
+
+
+
+uint8_t * bufferPoolGet(BufferPool_s * const in_out_pool, const size_t in_SIZE) {
+    pthread_mutex_lock(&in_out_pool->lock);
+    BufferPoolEntry_s *best = NULL;
+    BufferPoolEntry_s *empty = NULL;
+    BufferPoolEntry_s *tooSmall = NULL;
+
+    // the smallest idle buffer that fits, otherwise an empty slot, otherwise an idle buffer to grow
+    for (uint32_t i = 0; i < in_out_pool->maxBuffers; i++) {
+        BufferPoolEntry_s *entry = &in_out_pool->entries[i];
+
+        if (!entry->buffer) {
+            empty = empty ? empty : entry;
+        } else if (entry->inUse) {
+            continue;
+        } else if (entry->size >= in_SIZE) {
+            best = (!best || (entry->size < best->size)) ? entry : best;
+        } else {
+            tooSmall = tooSmall ? tooSmall : entry;
+        }
+    }
+
+    if (!best && (empty || tooSmall)) {
+        best = empty ? empty : tooSmall;
+        free(best->buffer);
+        best->buffer = allocBuffer(in_out_pool->alignment, in_SIZE);
+        best->size = in_SIZE;
+    }
+
+    uint8_t *buffer = NULL;
+
+    if (best) {
+        best->inUse = true;
+        buffer = best->buffer;
+    }
+
+    pthread_mutex_unlock(&in_out_pool->lock);
+    return buffer ? buffer : allocBuffer(in_out_pool->alignment, in_SIZE);
+}
+
+
+
+void bufferPoolPut(BufferPool_s * const in_out_pool, uint8_t * const in_BUFFER) {
+    pthread_mutex_lock(&in_out_pool->lock);
+
+    for (uint32_t i = 0; i < in_out_pool->maxBuffers; i++) {
+        if (in_out_pool->entries[i].buffer == in_BUFFER) {
+            assert(in_out_pool->entries[i].inUse);
+            in_out_pool->entries[i].inUse = false;
+            pthread_mutex_unlock(&in_out_pool->lock);
+            return;
+        }
+    }
+
+    pthread_mutex_unlock(&in_out_pool->lock);
+    free(in_BUFFER);
+}
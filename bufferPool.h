@@ -0,0 +1,29 @@
+//
+//  bufferPool.h
+//  OMXPlayground
+//
+
+#ifndef bufferPool_h
+#define bufferPool_h
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// forward declaration of a typedef struct
+struct BufferPool_s;
+typedef struct BufferPool_s BufferPool_s;
+
+
+// Keeps up to in_MAX_BUFFERS pixel buffers (aligned to in_ALIGNMENT) around between images, so that a batch
+// of decodes does not go through malloc/free and fresh page faults for every image. Thread safe.
+BufferPool_s * bufferPoolInit(const uint32_t in_MAX_BUFFERS, const size_t in_ALIGNMENT);
+void bufferPoolDeinit(BufferPool_s * const in_out_pool);
+
+// returns a buffer of at least in_SIZE bytes, falling back to a one-off allocation if all are in use
+uint8_t * bufferPoolGet(BufferPool_s * const in_out_pool, const size_t in_SIZE);
+void bufferPoolPut(BufferPool_s * const in_out_pool, uint8_t * const in_BUFFER);
+
+
+#endif /* bufferPool_h */
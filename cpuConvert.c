@@ -0,0 +1,679 @@
+//
+//  cpuConvert.c
+//  OMXPlayground
+//
+//  YCbCr <-> RGB with 2.14 fixed point coefficients. Images are converted in pairs of rows that share one row of
+//  chroma, bands of row pairs are handed out to the threads like in cpuResize. RGB sources other than ABGR8888
+//  are widened to ABGR8888 row by row, so only one kernel per direction needs a vector version.
+//
+
+#include "cpuConvert.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>  // MIN, MAX
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+
+#define CPU_CONVERT_PRECISION 14
+#define CPU_CONVERT_MAX_THREADS 16
+#define CPU_CONVERT_BAND_ROWS 32        // even, so that no row pair is split
+
+// Y from RGB
+#define CPU_CONVERT_Y_R 4899            // 0.299
+#define CPU_CONVERT_Y_G 9617            // 0.587
+#define CPU_CONVERT_Y_B 1868            // 0.114
+// Cb and Cr from RGB
+#define CPU_CONVERT_CB_R -2765          // -0.168736
+#define CPU_CONVERT_CB_G -5427          // -0.331264
+#define CPU_CONVERT_CB_B 8192           // 0.5
+#define CPU_CONVERT_CR_R 8192           // 0.5
+#define CPU_CONVERT_CR_G -6860          // -0.418688
+#define CPU_CONVERT_CR_B -1332          // -0.081312
+// RGB from Cb and Cr
+#define CPU_CONVERT_R_CR 22970          // 1.402
+#define CPU_CONVERT_G_CB -5638          // -0.344136
+#define CPU_CONVERT_G_CR -11700         // -0.714136
+#define CPU_CONVERT_B_CB 29032          // 1.772
+
+
+
+// the YUV image split into its planes, Cb and Cr are chromaStep bytes apart from one sample to the next
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    bool toRGB;
+    uint8_t *y;
+    uint32_t yStride;
+    uint8_t *u;
+    uint8_t *v;
+    uint32_t chromaStride;
+    uint32_t chromaStep;
+    uint8_t *rgb;
+    uint32_t rgbStride;
+    OMX_COLOR_FORMATTYPE rgbFormat;
+} CPUConvertPlanes_s;
+
+
+
+typedef struct {
+    uint8_t *rows;          // two ABGR8888 rows for sources in other RGB formats
+    size_t rowsSize;
+} CPUConvertWorker_s;
+
+
+
+struct CPUConvert_s {
+    uint32_t numThreads;
+    bool useSIMD;
+    CPUConvertWorker_s workers[CPU_CONVERT_MAX_THREADS];
+
+    // the current conversion
+    CPUConvertPlanes_s planes;
+    pthread_mutex_t lock;   // guards nextBand
+    uint32_t nextBand;
+    uint32_t numBands;
+};
+
+
+
+typedef struct {
+    CPUConvert_s *convert;
+    CPUConvertWorker_s *worker;
+} CPUConvertThread_s;
+
+
+
+static uint32_t bytesPerPixel(OMX_COLOR_FORMATTYPE eColorFormat) {
+    switch (eColorFormat) {
+        case OMX_COLOR_Format32bitABGR8888:
+            return 4;
+
+        case OMX_COLOR_Format24bitRGB888:
+        case OMX_COLOR_Format24bitBGR888:
+            return 3;
+
+        case OMX_COLOR_Format16bitRGB565:
+            return 2;
+
+        default:
+            return 0;
+    }
+}
+
+
+
+static bool isYUV(OMX_COLOR_FORMATTYPE eColorFormat) {
+    return (eColorFormat == OMX_COLOR_FormatYUV420PackedPlanar) || (eColorFormat == OMX_COLOR_FormatYUV420PackedSemiPlanar);
+}
+
+
+
+bool cpuConvertIsSupported(OMX_COLOR_FORMATTYPE in_SRC_FORMAT, OMX_COLOR_FORMATTYPE in_DST_FORMAT) {
+    return (isYUV(in_SRC_FORMAT) && (bytesPerPixel(in_DST_FORMAT) > 0)) || ((bytesPerPixel(in_SRC_FORMAT) > 0) && isYUV(in_DST_FORMAT));
+}
+
+
+
+static inline uint8_t clamp8(int32_t v) {
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+
+
+static inline void storeRGB(uint8_t *dst, OMX_COLOR_FORMATTYPE eColorFormat, int32_t r, int32_t g, int32_t b) {
+    switch (eColorFormat) {
+        case OMX_COLOR_Format32bitABGR8888:
+            dst[0] = clamp8(r);
+            dst[1] = clamp8(g);
+            dst[2] = clamp8(b);
+            dst[3] = 255;
+            break;
+
+        case OMX_COLOR_Format24bitRGB888:
+            dst[0] = clamp8(r);
+            dst[1] = clamp8(g);
+            dst[2] = clamp8(b);
+            break;
+
+        case OMX_COLOR_Format24bitBGR888:
+            dst[0] = clamp8(b);
+            dst[1] = clamp8(g);
+            dst[2] = clamp8(r);
+            break;
+
+        case OMX_COLOR_Format16bitRGB565: {
+            const uint16_t v = ((clamp8(r) >> 3) << 11) | ((clamp8(g) >> 2) << 5) | (clamp8(b) >> 3);
+            dst[0] = v & 0xFF;
+            dst[1] = v >> 8;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+
+
+// pixels x0 and up of one or two rows that share the chroma row
+static void yuvToRGBScalar(const CPUConvertPlanes_s *planes, uint32_t y, uint32_t numRows, uint32_t x0) {
+    const uint32_t bpp = bytesPerPixel(planes->rgbFormat);
+    const uint8_t *u = &planes->u[(y / 2) * planes->chromaStride];
+    const uint8_t *v = &planes->v[(y / 2) * planes->chromaStride];
+    const int32_t round = 1 << (CPU_CONVERT_PRECISION - 1);
+
+    for (uint32_t x = x0; x < planes->width; x += 2) {
+        const int32_t cb = u[(x / 2) * planes->chromaStep] - 128;
+        const int32_t cr = v[(x / 2) * planes->chromaStep] - 128;
+        const int32_t r = (CPU_CONVERT_R_CR * cr + round) >> CPU_CONVERT_PRECISION;
+        const int32_t g = (CPU_CONVERT_G_CB * cb + CPU_CONVERT_G_CR * cr + round) >> CPU_CONVERT_PRECISION;
+        const int32_t b = (CPU_CONVERT_B_CB * cb + round) >> CPU_CONVERT_PRECISION;
+        const uint32_t numPixels = MIN(2, planes->width - x);
+
+        for (uint32_t row = 0; row < numRows; row++) {
+            const uint8_t *luma = &planes->y[(y + row) * planes->yStride];
+            uint8_t *dst = &planes->rgb[(y + row) * planes->rgbStride];
+
+            for (uint32_t i = x; i < x + numPixels; i++) {
+                storeRGB(&dst[i * bpp], planes->rgbFormat, luma[i] + r, luma[i] + g, luma[i] + b);
+            }
+        }
+    }
+}
+
+
+
+// Pixels x0 and up of two ABGR8888 rows (rows[0] == rows[1] for the last row of odd heights). Chroma is
+// averaged over the 2x2 block, a missing last column repeats the one before.
+static void abgrToYUVScalar(const CPUConvertPlanes_s *planes, const uint8_t *rows[2], uint32_t y, uint32_t numRows, uint32_t x0) {
+    uint8_t *u = &planes->u[(y / 2) * planes->chromaStride];
+    uint8_t *v = &planes->v[(y / 2) * planes->chromaStride];
+    const int32_t round = 1 << (CPU_CONVERT_PRECISION - 1);
+
+    for (uint32_t row = 0; row < numRows; row++) {
+        uint8_t *luma = &planes->y[(y + row) * planes->yStride];
+
+        for (uint32_t x = x0; x < planes->width; x++) {
+            const uint8_t *p = &rows[row][x * 4];
+            luma[x] = clamp8((CPU_CONVERT_Y_R * p[0] + CPU_CONVERT_Y_G * p[1] + CPU_CONVERT_Y_B * p[2] + round) >> CPU_CONVERT_PRECISION);
+        }
+    }
+
+    for (uint32_t x = x0; x < planes->width; x += 2) {
+        const uint32_t x1 = MIN(x + 1, planes->width - 1);
+        int32_t sum[3];
+
+        for (int c = 0; c < 3; c++) {
+            sum[c] = rows[0][x * 4 + c] + rows[0][x1 * 4 + c] + rows[1][x * 4 + c] + rows[1][x1 * 4 + c];
+        }
+
+        // the sums are four times the average
+        const int32_t cb = (CPU_CONVERT_CB_R * sum[0] + CPU_CONVERT_CB_G * sum[1] + CPU_CONVERT_CB_B * sum[2] + (round << 2)) >> (CPU_CONVERT_PRECISION + 2);
+        const int32_t cr = (CPU_CONVERT_CR_R * sum[0] + CPU_CONVERT_CR_G * sum[1] + CPU_CONVERT_CR_B * sum[2] + (round << 2)) >> (CPU_CONVERT_PRECISION + 2);
+        u[(x / 2) * planes->chromaStep] = clamp8(cb + 128);
+        v[(x / 2) * planes->chromaStep] = clamp8(cr + 128);
+    }
+}
+
+
+
+static void toABGR(uint8_t *dst, const uint8_t *src, OMX_COLOR_FORMATTYPE eColorFormat, uint32_t width) {
+    switch (eColorFormat) {
+        case OMX_COLOR_Format24bitRGB888:
+            for (uint32_t x = 0; x < width; x++) {
+                dst[4 * x + 0] = src[3 * x + 0];
+                dst[4 * x + 1] = src[3 * x + 1];
+                dst[4 * x + 2] = src[3 * x + 2];
+                dst[4 * x + 3] = 255;
+            }
+
+            break;
+
+        case OMX_COLOR_Format24bitBGR888:
+            for (uint32_t x = 0; x < width; x++) {
+                dst[4 * x + 0] = src[3 * x + 2];
+                dst[4 * x + 1] = src[3 * x + 1];
+                dst[4 * x + 2] = src[3 * x + 0];
+                dst[4 * x + 3] = 255;
+            }
+
+            break;
+
+        case OMX_COLOR_Format16bitRGB565:
+            for (uint32_t x = 0; x < width; x++) {
+                const uint16_t v = src[2 * x] | (src[2 * x + 1] << 8);
+                const uint8_t r = (v >> 11) & 0x1F;
+                const uint8_t g = (v >> 5) & 0x3F;
+                const uint8_t b = v & 0x1F;
+                dst[4 * x + 0] = (r << 3) | (r >> 2);
+                dst[4 * x + 1] = (g << 2) | (g >> 4);
+                dst[4 * x + 2] = (b << 3) | (b >> 2);
+                dst[4 * x + 3] = 255;
+            }
+
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+
+#if defined(__SSE2__)
+
+// a pair of 16 bit coefficients for _mm_madd_epi16, a applies to the even and b to the odd lanes
+#define COEFFICIENTS(a, b) _mm_set1_epi32((int32_t)(((uint32_t)(uint16_t)(b) << 16) | (uint16_t)(a)))
+
+
+
+// 8 interleaved Cb, Cr pairs minus 128 -> 8 offsets in 16 bit
+static inline __m128i chromaOffsets(__m128i lo, __m128i hi, __m128i coefficients) {
+    const __m128i round = _mm_set1_epi32(1 << (CPU_CONVERT_PRECISION - 1));
+    const __m128i a = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(lo, coefficients), round), CPU_CONVERT_PRECISION);
+    const __m128i b = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(hi, coefficients), round), CPU_CONVERT_PRECISION);
+    return _mm_packs_epi32(a, b);
+}
+
+
+
+static inline __m128i addLuma(__m128i luma, __m128i offsetLo, __m128i offsetHi) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(luma, zero), offsetLo);
+    const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(luma, zero), offsetHi);
+    return _mm_packus_epi16(lo, hi);
+}
+
+
+
+static inline void storeRGB16(uint8_t *dst, OMX_COLOR_FORMATTYPE eColorFormat, __m128i r, __m128i g, __m128i b) {
+    const __m128i zero = _mm_setzero_si128();
+
+    if (eColorFormat == OMX_COLOR_Format16bitRGB565) {
+        const __m128i maskR = _mm_set1_epi16(0xF8);
+        const __m128i maskG = _mm_set1_epi16(0xFC);
+        const __m128i lo = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(_mm_unpacklo_epi8(r, zero), maskR), 8), _mm_slli_epi16(_mm_and_si128(_mm_unpacklo_epi8(g, zero), maskG), 3)), _mm_srli_epi16(_mm_unpacklo_epi8(b, zero), 3));
+        const __m128i hi = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(_mm_unpackhi_epi8(r, zero), maskR), 8), _mm_slli_epi16(_mm_and_si128(_mm_unpackhi_epi8(g, zero), maskG), 3)), _mm_srli_epi16(_mm_unpackhi_epi8(b, zero), 3));
+        _mm_storeu_si128((__m128i *)&dst[0], lo);
+        _mm_storeu_si128((__m128i *)&dst[16], hi);
+        return;
+    }
+
+    if (eColorFormat == OMX_COLOR_Format24bitBGR888) {
+        const __m128i t = r;
+        r = b;
+        b = t;
+    }
+
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    const __m128i rgLo = _mm_unpacklo_epi8(r, g);
+    const __m128i rgHi = _mm_unpackhi_epi8(r, g);
+    const __m128i baLo = _mm_unpacklo_epi8(b, alpha);
+    const __m128i baHi = _mm_unpackhi_epi8(b, alpha);
+    const __m128i pixels[4] = {
+        _mm_unpacklo_epi16(rgLo, baLo),
+        _mm_unpackhi_epi16(rgLo, baLo),
+        _mm_unpacklo_epi16(rgHi, baHi),
+        _mm_unpackhi_epi16(rgHi, baHi),
+    };
+
+    if (eColorFormat == OMX_COLOR_Format32bitABGR8888) {
+        for (int i = 0; i < 4; i++) {
+            _mm_storeu_si128((__m128i *)&dst[16 * i], pixels[i]);
+        }
+
+        return;
+    }
+
+    // SSE2 has no byte shuffle, so the 24 bit pixels are written with overlapping 32 bit stores
+    uint32_t abgr[16] __attribute__((aligned(16)));
+
+    for (int i = 0; i < 4; i++) {
+        _mm_store_si128((__m128i *)&abgr[4 * i], pixels[i]);
+    }
+
+    for (int i = 0; i < 15; i++) {
+        memcpy(&dst[3 * i], &abgr[i], 4);
+    }
+
+    memcpy(&dst[45], &abgr[15], 3);
+}
+
+
+
+// returns the number of pixels converted, a multiple of 16
+static uint32_t yuvToRGBSIMD(const CPUConvertPlanes_s *planes, uint32_t y, uint32_t numRows) {
+    const uint32_t bpp = bytesPerPixel(planes->rgbFormat);
+    const uint8_t *u = &planes->u[(y / 2) * planes->chromaStride];
+    const uint8_t *v = &planes->v[(y / 2) * planes->chromaStride];
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i coefficientsR = COEFFICIENTS(0, CPU_CONVERT_R_CR);
+    const __m128i coefficientsG = COEFFICIENTS(CPU_CONVERT_G_CB, CPU_CONVERT_G_CR);
+    const __m128i coefficientsB = COEFFICIENTS(CPU_CONVERT_B_CB, 0);
+    const uint32_t end = planes->width & ~15;
+
+    for (uint32_t x = 0; x < end; x += 16) {
+        __m128i cbcr;
+
+        if (planes->chromaStep == 2) {
+            cbcr = _mm_loadu_si128((const __m128i *)&u[x]);
+        } else {
+            cbcr = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&u[x / 2]), _mm_loadl_epi64((const __m128i *)&v[x / 2]));
+        }
+
+        const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(cbcr, zero), bias);
+        const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(cbcr, zero), bias);
+        const __m128i r = chromaOffsets(lo, hi, coefficientsR);
+        const __m128i g = chromaOffsets(lo, hi, coefficientsG);
+        const __m128i b = chromaOffsets(lo, hi, coefficientsB);
+
+        // every offset covers two neighbouring pixels
+        const __m128i rLo = _mm_unpacklo_epi16(r, r);
+        const __m128i rHi = _mm_unpackhi_epi16(r, r);
+        const __m128i gLo = _mm_unpacklo_epi16(g, g);
+        const __m128i gHi = _mm_unpackhi_epi16(g, g);
+        const __m128i bLo = _mm_unpacklo_epi16(b, b);
+        const __m128i bHi = _mm_unpackhi_epi16(b, b);
+
+        for (uint32_t row = 0; row < numRows; row++) {
+            const __m128i luma = _mm_loadu_si128((const __m128i *)&planes->y[(y + row) * planes->yStride + x]);
+            uint8_t *dst = &planes->rgb[(y + row) * planes->rgbStride + x * bpp];
+            storeRGB16(dst, planes->rgbFormat, addLuma(luma, rLo, rHi), addLuma(luma, gLo, gHi), addLuma(luma, bLo, bHi));
+        }
+    }
+
+    return end;
+}
+
+
+
+// 16 ABGR8888 pixels -> 16 R, G and B
+static inline void deinterleaveABGR(const uint8_t *src, __m128i *r, __m128i *g, __m128i *b) {
+    const __m128i p0 = _mm_loadu_si128((const __m128i *)&src[0]);
+    const __m128i p1 = _mm_loadu_si128((const __m128i *)&src[16]);
+    const __m128i p2 = _mm_loadu_si128((const __m128i *)&src[32]);
+    const __m128i p3 = _mm_loadu_si128((const __m128i *)&src[48]);
+    const __m128i t0 = _mm_unpacklo_epi8(p0, p1);
+    const __m128i t1 = _mm_unpackhi_epi8(p0, p1);
+    const __m128i t2 = _mm_unpacklo_epi8(p2, p3);
+    const __m128i t3 = _mm_unpackhi_epi8(p2, p3);
+    const __m128i u0 = _mm_unpacklo_epi8(t0, t1);
+    const __m128i u1 = _mm_unpackhi_epi8(t0, t1);
+    const __m128i u2 = _mm_unpacklo_epi8(t2, t3);
+    const __m128i u3 = _mm_unpackhi_epi8(t2, t3);
+    const __m128i rg0 = _mm_unpacklo_epi8(u0, u1);    // R0..R7 G0..G7
+    const __m128i ba0 = _mm_unpackhi_epi8(u0, u1);
+    const __m128i rg1 = _mm_unpacklo_epi8(u2, u3);    // R8..R15 G8..G15
+    const __m128i ba1 = _mm_unpackhi_epi8(u2, u3);
+    *r = _mm_unpacklo_epi64(rg0, rg1);
+    *g = _mm_unpackhi_epi64(rg0, rg1);
+    *b = _mm_unpacklo_epi64(ba0, ba1);
+}
+
+
+
+// 8 R, G, B in 16 bit -> 8 Y in 16 bit
+static inline __m128i luma16(__m128i r, __m128i g, __m128i b) {
+    const __m128i coefficientsRG = COEFFICIENTS(CPU_CONVERT_Y_R, CPU_CONVERT_Y_G);
+    const __m128i coefficientsB = COEFFICIENTS(CPU_CONVERT_Y_B, 1 << (CPU_CONVERT_PRECISION - 1));
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), coefficientsRG), _mm_madd_epi16(_mm_unpacklo_epi16(b, one), coefficientsB));
+    const __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), coefficientsRG), _mm_madd_epi16(_mm_unpackhi_epi16(b, one), coefficientsB));
+    return _mm_packs_epi32(_mm_srai_epi32(lo, CPU_CONVERT_PRECISION), _mm_srai_epi32(hi, CPU_CONVERT_PRECISION));
+}
+
+
+
+// 8 sums of 2x2 R, G and B -> 8 Cb or Cr in 16 bit
+static inline __m128i chroma16(__m128i r, __m128i g, __m128i b, __m128i coefficientsRG, __m128i coefficientsB) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (CPU_CONVERT_PRECISION + 1));
+    const __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(r, g), coefficientsRG), _mm_madd_epi16(_mm_unpacklo_epi16(b, zero), coefficientsB));
+    const __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(r, g), coefficientsRG), _mm_madd_epi16(_mm_unpackhi_epi16(b, zero), coefficientsB));
+    const __m128i a = _mm_srai_epi32(_mm_add_epi32(lo, round), CPU_CONVERT_PRECISION + 2);
+    const __m128i c = _mm_srai_epi32(_mm_add_epi32(hi, round), CPU_CONVERT_PRECISION + 2);
+    return _mm_add_epi16(_mm_packs_epi32(a, c), _mm_set1_epi16(128));
+}
+
+
+
+// 16 pixels in 16 bit -> 8 sums of horizontal pairs in 16 bit
+static inline __m128i pairSums(__m128i lo, __m128i hi) {
+    const __m128i one = _mm_set1_epi16(1);
+    return _mm_packs_epi32(_mm_madd_epi16(lo, one), _mm_madd_epi16(hi, one));
+}
+
+
+
+static uint32_t abgrToYUVSIMD(const CPUConvertPlanes_s *planes, const uint8_t *rows[2], uint32_t y, uint32_t numRows) {
+    uint8_t *u = &planes->u[(y / 2) * planes->chromaStride];
+    uint8_t *v = &planes->v[(y / 2) * planes->chromaStride];
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i coefficientsCbRG = COEFFICIENTS(CPU_CONVERT_CB_R, CPU_CONVERT_CB_G);
+    const __m128i coefficientsCbB = COEFFICIENTS(CPU_CONVERT_CB_B, 0);
+    const __m128i coefficientsCrRG = COEFFICIENTS(CPU_CONVERT_CR_R, CPU_CONVERT_CR_G);
+    const __m128i coefficientsCrB = COEFFICIENTS(CPU_CONVERT_CR_B, 0);
+    const uint32_t end = planes->width & ~15;
+
+    for (uint32_t x = 0; x < end; x += 16) {
+        __m128i sumLo[3] = { zero, zero, zero };
+        __m128i sumHi[3] = { zero, zero, zero };
+
+        for (uint32_t row = 0; row < 2; row++) {
+            __m128i rgb[3];
+            deinterleaveABGR(&rows[row][x * 4], &rgb[0], &rgb[1], &rgb[2]);
+            __m128i lo[3], hi[3];
+
+            for (int c = 0; c < 3; c++) {
+                lo[c] = _mm_unpacklo_epi8(rgb[c], zero);
+                hi[c] = _mm_unpackhi_epi8(rgb[c], zero);
+                sumLo[c] = _mm_add_epi16(sumLo[c], lo[c]);
+                sumHi[c] = _mm_add_epi16(sumHi[c], hi[c]);
+            }
+
+            if (row < numRows) {
+                const __m128i luma = _mm_packus_epi16(luma16(lo[0], lo[1], lo[2]), luma16(hi[0], hi[1], hi[2]));
+                _mm_storeu_si128((__m128i *)&planes->y[(y + row) * planes->yStride + x], luma);
+            }
+        }
+
+        const __m128i r = pairSums(sumLo[0], sumHi[0]);
+        const __m128i g = pairSums(sumLo[1], sumHi[1]);
+        const __m128i b = pairSums(sumLo[2], sumHi[2]);
+        const __m128i cb = _mm_packus_epi16(chroma16(r, g, b, coefficientsCbRG, coefficientsCbB), zero);
+        const __m128i cr = _mm_packus_epi16(chroma16(r, g, b, coefficientsCrRG, coefficientsCrB), zero);
+
+        if (planes->chromaStep == 2) {
+            _mm_storeu_si128((__m128i *)&u[x], _mm_unpacklo_epi8(cb, cr));
+        } else {
+            _mm_storel_epi64((__m128i *)&u[x / 2], cb);
+            _mm_storel_epi64((__m128i *)&v[x / 2], cr);
+        }
+    }
+
+    return end;
+}
+
+#else
+
+// Other architectures (including NEON on the Pi) use the scalar loops until a vector version has been checked
+// against them on the target.
+
+#endif
+
+
+
+static void convertRows(CPUConvert_s *convert, CPUConvertWorker_s *worker, uint32_t y, uint32_t numRows) {
+    const CPUConvertPlanes_s *planes = &convert->planes;
+    uint32_t x0 = 0;
+
+    if (planes->toRGB) {
+#if defined(__SSE2__)
+        if (convert->useSIMD) {
+            x0 = yuvToRGBSIMD(planes, y, numRows);
+        }
+#endif
+        yuvToRGBScalar(planes, y, numRows, x0);
+        return;
+    }
+
+    // the last row of odd heights stands in for the missing one in the chroma average
+    const uint8_t *rows[2] = {
+        &planes->rgb[y * planes->rgbStride],
+        &planes->rgb[(y + numRows - 1) * planes->rgbStride],
+    };
+
+    if (planes->rgbFormat != OMX_COLOR_Format32bitABGR8888) {
+        const size_t rowSize = planes->width * 4;
+
+        if (worker->rowsSize < 2 * rowSize) {
+            free(worker->rows);
+            worker->rowsSize = 2 * rowSize;
+            worker->rows = malloc(worker->rowsSize);
+        }
+
+        for (uint32_t row = 0; row < 2; row++) {
+            toABGR(&worker->rows[row * rowSize], rows[row], planes->rgbFormat, planes->width);
+            rows[row] = &worker->rows[row * rowSize];
+        }
+    }
+
+#if defined(__SSE2__)
+    if (convert->useSIMD) {
+        x0 = abgrToYUVSIMD(planes, rows, y, numRows);
+    }
+#endif
+    abgrToYUVScalar(planes, rows, y, numRows, x0);
+}
+
+
+
+static void * convertBands(void *in_out_userData) {
+    CPUConvertThread_s *thread = in_out_userData;
+    CPUConvert_s *convert = thread->convert;
+    const uint32_t height = convert->planes.height;
+
+    while (true) {
+        pthread_mutex_lock(&convert->lock);
+        const uint32_t band = convert->nextBand++;
+        pthread_mutex_unlock(&convert->lock);
+
+        if (band >= convert->numBands) {
+            return NULL;
+        }
+
+        const uint32_t y1 = MIN((band + 1) * CPU_CONVERT_BAND_ROWS, height);
+
+        for (uint32_t y = band * CPU_CONVERT_BAND_ROWS; y < y1; y += 2) {
+            convertRows(convert, thread->worker, y, MIN(2, height - y));
+        }
+    }
+}
+
+
+
+CPUConvert_s * cpuConvertInit(uint32_t numThreads) {
+    CPUConvert_s *convert = calloc(1, sizeof(CPUConvert_s));
+
+    if (numThreads == 0) {
+        numThreads = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    }
+
+    convert->numThreads = MIN(numThreads, CPU_CONVERT_MAX_THREADS);
+#if defined(__SSE2__)
+    convert->useSIMD = true;
+#endif
+    pthread_mutex_init(&convert->lock, NULL);
+    return convert;
+}
+
+
+
+void cpuConvertDeinit(CPUConvert_s *in_out_convert) {
+    for (int t = 0; t < CPU_CONVERT_MAX_THREADS; t++) {
+        free(in_out_convert->workers[t].rows);
+    }
+
+    pthread_mutex_destroy(&in_out_convert->lock);
+    free(in_out_convert);
+}
+
+
+
+void cpuConvertUseSIMD(CPUConvert_s *in_out_convert, bool in_ENABLED) {
+#if defined(__SSE2__)
+    in_out_convert->useSIMD = in_ENABLED;
+#else
+    (void)in_out_convert;
+    (void)in_ENABLED;
+#endif
+}
+
+
+
+bool cpuConvertProcess(CPUConvert_s *in_out_convert, CPUImage_s *out_dst, const CPUImage_s *in_SRC) {
+    if (!cpuConvertIsSupported(in_SRC->eColorFormat, out_dst->eColorFormat) || (out_dst->nWidth != in_SRC->nWidth) || (out_dst->nHeight != in_SRC->nHeight)) {
+        return false;
+    }
+
+    if ((in_SRC->nWidth == 0) || (in_SRC->nHeight == 0)) {
+        return true;
+    }
+
+    CPUConvertPlanes_s *planes = &in_out_convert->planes;
+    planes->toRGB = isYUV(in_SRC->eColorFormat);
+    const CPUImage_s *yuv = planes->toRGB ? in_SRC : out_dst;
+    const CPUImage_s *rgb = planes->toRGB ? out_dst : in_SRC;
+    const uint32_t sliceHeight = (yuv->nSliceHeight > 0) ? yuv->nSliceHeight : yuv->nHeight;
+    planes->width = in_SRC->nWidth;
+    planes->height = in_SRC->nHeight;
+    planes->y = yuv->pData;
+    planes->yStride = (yuv->nStride > 0) ? yuv->nStride : yuv->nWidth;
+
+    if (yuv->eColorFormat == OMX_COLOR_FormatYUV420PackedSemiPlanar) {
+        planes->u = planes->y + planes->yStride * sliceHeight;
+        planes->v = planes->u + 1;
+        planes->chromaStride = planes->yStride;
+        planes->chromaStep = 2;
+    } else {
+        planes->u = planes->y + planes->yStride * sliceHeight;
+        planes->v = planes->u + (planes->yStride / 2) * (sliceHeight / 2);
+        planes->chromaStride = planes->yStride / 2;
+        planes->chromaStep = 1;
+    }
+
+    planes->rgb = rgb->pData;
+    planes->rgbFormat = rgb->eColorFormat;
+    planes->rgbStride = (rgb->nStride > 0) ? rgb->nStride : rgb->nWidth * bytesPerPixel(rgb->eColorFormat);
+
+    in_out_convert->nextBand = 0;
+    in_out_convert->numBands = (planes->height + CPU_CONVERT_BAND_ROWS - 1) / CPU_CONVERT_BAND_ROWS;
+    const uint32_t numThreads = MIN(in_out_convert->numThreads, in_out_convert->numBands);
+    CPUConvertThread_s threads[numThreads];
+    pthread_t threadIds[numThreads];
+
+    for (uint32_t t = 0; t < numThreads; t++) {
+        threads[t].convert = in_out_convert;
+        threads[t].worker = &in_out_convert->workers[t];
+    }
+
+    for (uint32_t t = 1; t < numThreads; t++) {
+        pthread_create(&threadIds[t], NULL, convertBands, &threads[t]);
+    }
+
+    convertBands(&threads[0]);
+
+    for (uint32_t t = 1; t < numThreads; t++) {
+        pthread_join(threadIds[t], NULL);
+    }
+
+    return true;
+}
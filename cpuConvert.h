@@ -0,0 +1,45 @@
+//
+//  cpuConvert.h
+//  OMXPlayground
+//
+//  Host side colour conversion between YUV 4:2:0 and RGB, for when a resize component would only be there to
+//  change the colour format.
+//
+
+#ifndef cpuConvert_h
+#define cpuConvert_h
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Image.h>
+
+#include "cpuResize.h"
+
+
+// forward declaration of a typedef struct
+struct CPUConvert_s;
+typedef struct CPUConvert_s CPUConvert_s;
+
+
+// One side has to be YUV420PackedPlanar or YUV420PackedSemiPlanar, the other RGB888, BGR888, ABGR8888 or
+// RGB565 (byte orders as in soft/omxSoftImage.c). YUV420PackedSemiPlanar stores nSliceHeight rows of Y followed
+// by nSliceHeight / 2 rows of interleaved Cb and Cr with the full stride.
+bool cpuConvertIsSupported(OMX_COLOR_FORMATTYPE in_SRC_FORMAT, OMX_COLOR_FORMATTYPE in_DST_FORMAT);
+
+// numThreads 0 uses all online CPUs. It is not safe to use the returned object from several threads at once.
+CPUConvert_s * cpuConvertInit(uint32_t numThreads);
+void cpuConvertDeinit(CPUConvert_s *in_out_convert);
+
+// the vector kernels are on by default where SSE2 is available, switch them off for comparison
+void cpuConvertUseSIMD(CPUConvert_s *in_out_convert, bool in_ENABLED);
+
+// Full range BT.601 as in JFIF, which is what image_decode produces. Chroma is taken from the nearest sample
+// when converting to RGB and averaged over 2x2 pixels when converting to YUV. Both images need the same size.
+// Returns false for unsupported format pairs.
+bool cpuConvertProcess(CPUConvert_s *in_out_convert, CPUImage_s *out_dst, const CPUImage_s *in_SRC);
+
+
+#endif /* cpuConvert_h */
@@ -0,0 +1,370 @@
+//
+//  cpuConvertBench.c
+//  OMXPlayground
+//
+//  cpuConvert against a floating point reference and against letting OMX.broadcom.resize change the format.
+//
+
+#include "cpuConvertBench.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>  // MIN, MAX
+#include <time.h>
+
+#include "cHelper.h"
+#include "cpuConvert.h"
+#include "omxResize.h"
+
+
+
+static double seconds(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+
+
+static bool isYUV(OMX_COLOR_FORMATTYPE eColorFormat) {
+    return (eColorFormat == OMX_COLOR_FormatYUV420PackedPlanar) || (eColorFormat == OMX_COLOR_FormatYUV420PackedSemiPlanar);
+}
+
+
+
+static uint32_t bytesPerPixel(OMX_COLOR_FORMATTYPE eColorFormat) {
+    switch (eColorFormat) {
+        case OMX_COLOR_Format32bitABGR8888:
+            return 4;
+
+        case OMX_COLOR_Format24bitRGB888:
+        case OMX_COLOR_Format24bitBGR888:
+            return 3;
+
+        case OMX_COLOR_Format16bitRGB565:
+            return 2;
+
+        default:
+            return 1;
+    }
+}
+
+
+
+static void allocImage(CPUImage_s *image, OMX_COLOR_FORMATTYPE eColorFormat, uint32_t width, uint32_t height) {
+    image->eColorFormat = eColorFormat;
+    image->nWidth = width;
+    image->nHeight = height;
+    image->nStride = width * bytesPerPixel(eColorFormat);
+    image->nSliceHeight = 0;
+    image->pData = malloc(isYUV(eColorFormat) ? image->nStride * height * 3 / 2 : image->nStride * height);
+}
+
+
+
+static inline uint8_t round8(double v) {
+    return (v < 0) ? 0 : ((v > 255) ? 255 : (uint8_t)(v + 0.5));
+}
+
+
+
+// the channels as stored, 5 or 6 bit for RGB565
+static void readRGB(const CPUImage_s *image, uint32_t x, uint32_t y, uint8_t rgb[3]) {
+    const uint8_t *p = &image->pData[y * image->nStride + x * bytesPerPixel(image->eColorFormat)];
+
+    switch (image->eColorFormat) {
+        case OMX_COLOR_Format16bitRGB565: {
+            const uint16_t v = p[0] | (p[1] << 8);
+            rgb[0] = v >> 11;
+            rgb[1] = (v >> 5) & 0x3F;
+            rgb[2] = v & 0x1F;
+            break;
+        }
+
+        case OMX_COLOR_Format24bitBGR888:
+            rgb[0] = p[2];
+            rgb[1] = p[1];
+            rgb[2] = p[0];
+            break;
+
+        default:
+            memcpy(rgb, p, 3);
+            break;
+    }
+}
+
+
+
+static void writeRGB(CPUImage_s *image, uint32_t x, uint32_t y, const uint8_t rgb[3]) {
+    uint8_t *p = &image->pData[y * image->nStride + x * bytesPerPixel(image->eColorFormat)];
+
+    switch (image->eColorFormat) {
+        case OMX_COLOR_Format16bitRGB565: {
+            const uint16_t v = ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+            p[0] = v & 0xFF;
+            p[1] = v >> 8;
+            break;
+        }
+
+        case OMX_COLOR_Format24bitBGR888:
+            p[0] = rgb[2];
+            p[1] = rgb[1];
+            p[2] = rgb[0];
+            break;
+
+        case OMX_COLOR_Format32bitABGR8888:
+            memcpy(p, rgb, 3);
+            p[3] = 255;
+            break;
+
+        default:
+            memcpy(p, rgb, 3);
+            break;
+    }
+}
+
+
+
+// offsets of Cb and Cr of chroma sample (x, y) from the start of the image
+static void chromaOffsets(const CPUImage_s *image, uint32_t x, uint32_t y, size_t *cb, size_t *cr) {
+    const size_t lumaSize = image->nStride * image->nHeight;
+
+    if (image->eColorFormat == OMX_COLOR_FormatYUV420PackedSemiPlanar) {
+        *cb = lumaSize + y * image->nStride + 2 * x;
+        *cr = *cb + 1;
+    } else {
+        *cb = lumaSize + y * (image->nStride / 2) + x;
+        *cr = *cb + (image->nStride / 2) * (image->nHeight / 2);
+    }
+}
+
+
+
+static void referenceConvert(CPUImage_s *dst, const CPUImage_s *src) {
+    for (uint32_t y = 0; y < src->nHeight; y++) {
+        for (uint32_t x = 0; x < src->nWidth; x++) {
+            if (isYUV(src->eColorFormat)) {
+                size_t cb, cr;
+                chromaOffsets(src, x / 2, y / 2, &cb, &cr);
+                const double Y = src->pData[y * src->nStride + x];
+                const double Cb = src->pData[cb] - 128.0;
+                const double Cr = src->pData[cr] - 128.0;
+                const uint8_t rgb[3] = { round8(Y + 1.402 * Cr), round8(Y - 0.344136 * Cb - 0.714136 * Cr), round8(Y + 1.772 * Cb) };
+                writeRGB(dst, x, y, rgb);
+                continue;
+            }
+
+            uint8_t rgb[3];
+            readRGB(src, x, y, rgb);
+            dst->pData[y * dst->nStride + x] = round8(0.299 * rgb[0] + 0.587 * rgb[1] + 0.114 * rgb[2]);
+
+            if (((x | y) & 1) == 0) {
+                double sum[3] = { 0, 0, 0 };
+
+                for (uint32_t i = 0; i < 4; i++) {
+                    readRGB(src, MIN(x + (i & 1), src->nWidth - 1), MIN(y + i / 2, src->nHeight - 1), rgb);
+
+                    for (int c = 0; c < 3; c++) {
+                        sum[c] += rgb[c] / 4.0;
+                    }
+                }
+
+                size_t cb, cr;
+                chromaOffsets(dst, x / 2, y / 2, &cb, &cr);
+                dst->pData[cb] = round8(128 - 0.168736 * sum[0] - 0.331264 * sum[1] + 0.5 * sum[2]);
+                dst->pData[cr] = round8(128 + 0.5 * sum[0] - 0.418688 * sum[1] - 0.081312 * sum[2]);
+            }
+        }
+    }
+}
+
+
+
+static int maxDifference(const CPUImage_s *a, const CPUImage_s *b) {
+    int result = 0;
+
+    for (uint32_t y = 0; y < a->nHeight; y++) {
+        for (uint32_t x = 0; x < a->nWidth; x++) {
+            if (isYUV(a->eColorFormat)) {
+                size_t cbA, crA, cbB, crB;
+                chromaOffsets(a, x / 2, y / 2, &cbA, &crA);
+                chromaOffsets(b, x / 2, y / 2, &cbB, &crB);
+                result = MAX(result, abs(a->pData[y * a->nStride + x] - b->pData[y * b->nStride + x]));
+                result = MAX(result, abs(a->pData[cbA] - b->pData[cbB]));
+                result = MAX(result, abs(a->pData[crA] - b->pData[crB]));
+                continue;
+            }
+
+            uint8_t rgbA[3], rgbB[3];
+            readRGB(a, x, y, rgbA);
+            readRGB(b, x, y, rgbB);
+
+            for (int c = 0; c < 3; c++) {
+                result = MAX(result, abs(rgbA[c] - rgbB[c]));
+            }
+        }
+    }
+
+    return result;
+}
+
+
+
+static double timeConvert(CPUConvert_s *convert, CPUImage_s *dst, const CPUImage_s *src, int iterations) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        bool success = cpuConvertProcess(convert, dst, src);
+        assert(success);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return seconds(&start, &end) / iterations;
+}
+
+
+
+static void convertBenchmark(const CPUImage_s *src, OMX_COLOR_FORMATTYPE eColorFormat) {
+    const int iterations = 20;
+    CPUImage_s dst, reference;
+    allocImage(&dst, eColorFormat, src->nWidth, src->nHeight);
+    allocImage(&reference, eColorFormat, src->nWidth, src->nHeight);
+    referenceConvert(&reference, src);
+
+    printf(COLOR_YELLOW "%d x %d %s -> %s\n" COLOR_NC, src->nWidth, src->nHeight, omxColorFormatTypeEnum(src->eColorFormat), omxColorFormatTypeEnum(eColorFormat));
+
+    CPUConvert_s *convert = cpuConvertInit(1);
+    cpuConvertUseSIMD(convert, false);
+    const double scalarTime = timeConvert(convert, &dst, src, iterations);
+    printf(COLOR_YELLOW "    scalar, 1 thread:       %8.2f ms, max. difference %d\n" COLOR_NC, scalarTime * 1000, maxDifference(&dst, &reference));
+
+    cpuConvertUseSIMD(convert, true);
+    const double simdTime = timeConvert(convert, &dst, src, iterations);
+    printf(COLOR_YELLOW "    SIMD, 1 thread:         %8.2f ms, max. difference %d\n" COLOR_NC, simdTime * 1000, maxDifference(&dst, &reference));
+    cpuConvertDeinit(convert);
+
+    convert = cpuConvertInit(0);
+    const double threadedTime = timeConvert(convert, &dst, src, iterations);
+    printf(COLOR_YELLOW "    SIMD, all CPUs:         %8.2f ms, max. difference %d\n" COLOR_NC, threadedTime * 1000, maxDifference(&dst, &reference));
+    cpuConvertDeinit(convert);
+
+    free(dst.pData);
+    free(reference.pData);
+}
+
+
+
+typedef struct {
+    const CPUImage_s *image;
+    uint32_t sliceHeight;
+} PlanarPull_s;
+
+
+
+// Copies rows of a YUV420PackedPlanar image into the slice layout of the resize input port. Every slice but
+// the last has the port's nSliceHeight rows, so the first one tells where the chroma planes of the slice begin.
+static bool pullPlanar(void *userData, uint8_t *dst, uint32_t stride, uint32_t y, uint32_t rows) {
+    PlanarPull_s *pull = userData;
+    const CPUImage_s *image = pull->image;
+    const uint8_t *srcU = image->pData + image->nStride * image->nHeight;
+    const uint8_t *srcV = srcU + (image->nStride / 2) * (image->nHeight / 2);
+    uint8_t *dstU = dst + stride * pull->sliceHeight;
+    uint8_t *dstV = dstU + (stride / 2) * (pull->sliceHeight / 2);
+
+    if (y == 0) {
+        pull->sliceHeight = rows;
+        dstU = dst + stride * rows;
+        dstV = dstU + (stride / 2) * (rows / 2);
+    }
+
+    for (uint32_t r = 0; r < rows; r++) {
+        memcpy(&dst[r * stride], &image->pData[(y + r) * image->nStride], image->nWidth);
+    }
+
+    for (uint32_t r = 0; r < (rows + 1) / 2; r++) {
+        memcpy(&dstU[r * (stride / 2)], &srcU[(y / 2 + r) * (image->nStride / 2)], image->nWidth / 2);
+        memcpy(&dstV[r * (stride / 2)], &srcV[(y / 2 + r) * (image->nStride / 2)], image->nWidth / 2);
+    }
+
+    return true;
+}
+
+
+
+// the route omxTunnel takes: YUV through OMX.broadcom.resize at the same size just to get ABGR8888
+static void componentBenchmark(const CPUImage_s *src) {
+    const int iterations = 5;
+    const OMXSize_t size = { .nWidth = src->nWidth, .nHeight = src->nHeight };
+    const OMXRect_t crop = { 0, 0, 0, 0 };
+    OMXMemorySink_s memory = { .data = NULL, .size = 0, .capacity = 0, .growable = true };
+    double componentTime = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        PlanarPull_s pull = { .image = src, .sliceHeight = 0 };
+        memory.size = 0;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bool success = omxResizeStream(size, crop, OMX_COLOR_FormatYUV420PackedPlanar, size, OMX_COLOR_Format32bitABGR8888, pullPlanar, &pull, omxMemorySink(&memory));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        assert(success);
+        componentTime += seconds(&start, &end);
+    }
+
+    CPUImage_s dst;
+    allocImage(&dst, OMX_COLOR_Format32bitABGR8888, src->nWidth, src->nHeight);
+    CPUConvert_s *convert = cpuConvertInit(0);
+    timeConvert(convert, &dst, src, 1);
+    const double cpuTime = timeConvert(convert, &dst, src, iterations);
+    cpuConvertDeinit(convert);
+
+    printf(COLOR_YELLOW "%d x %d %s through OMX.broadcom.resize: %8.2f ms, cpuConvert to ABGR8888: %8.2f ms\n" COLOR_NC, src->nWidth, src->nHeight, omxColorFormatTypeEnum(src->eColorFormat), componentTime / iterations * 1000, cpuTime * 1000);
+    free(dst.pData);
+    free(memory.data);
+}
+
+
+
+void cpuConvertBench() {
+    CPUImage_s rgb;
+    allocImage(&rgb, OMX_COLOR_Format32bitABGR8888, 1920, 1080);
+    srand(1);
+
+    // gradients with some noise on top
+    for (uint32_t y = 0; y < rgb.nHeight; y++) {
+        for (uint32_t x = 0; x < rgb.nWidth; x++) {
+            uint8_t *pixel = &rgb.pData[y * rgb.nStride + x * 4];
+            pixel[0] = (x + rand() % 32) % 256;
+            pixel[1] = (y + rand() % 32) % 256;
+            pixel[2] = ((x ^ y) + rand() % 32) % 256;
+            pixel[3] = 255;
+        }
+    }
+
+    convertBenchmark(&rgb, OMX_COLOR_FormatYUV420PackedPlanar);
+    convertBenchmark(&rgb, OMX_COLOR_FormatYUV420PackedSemiPlanar);
+
+    CPUImage_s yuv;
+    allocImage(&yuv, OMX_COLOR_FormatYUV420PackedPlanar, rgb.nWidth, rgb.nHeight);
+    CPUConvert_s *convert = cpuConvertInit(0);
+    bool success = cpuConvertProcess(convert, &yuv, &rgb);
+    assert(success);
+
+    convertBenchmark(&yuv, OMX_COLOR_Format32bitABGR8888);
+    convertBenchmark(&yuv, OMX_COLOR_Format24bitRGB888);
+    convertBenchmark(&yuv, OMX_COLOR_Format24bitBGR888);
+    convertBenchmark(&yuv, OMX_COLOR_Format16bitRGB565);
+
+    CPUImage_s semiPlanar;
+    allocImage(&semiPlanar, OMX_COLOR_FormatYUV420PackedSemiPlanar, rgb.nWidth, rgb.nHeight);
+    success = cpuConvertProcess(convert, &semiPlanar, &rgb);
+    assert(success);
+    convertBenchmark(&semiPlanar, OMX_COLOR_Format32bitABGR8888);
+    cpuConvertDeinit(convert);
+
+    componentBenchmark(&yuv);
+
+    free(semiPlanar.pData);
+    free(yuv.pData);
+    free(rgb.pData);
+}
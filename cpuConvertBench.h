@@ -0,0 +1,13 @@
+//
+//  cpuConvertBench.h
+//  OMXPlayground
+//
+
+#ifndef cpuConvertBench_h
+#define cpuConvertBench_h
+
+
+void cpuConvertBench(void);
+
+
+#endif /* cpuConvertBench_h */
@@ -0,0 +1,535 @@
+//
+//  cpuResize.c
+//  OMXPlayground
+//
+//  Separable triangle filter with 2.14 fixed point coefficients. Every plane is filtered in bands of output
+//  rows: the source rows a band needs are scaled horizontally into a per thread buffer and then combined
+//  vertically. Bands are handed out to the threads like in jpegDecodeParallel.
+//
+
+#include "cpuResize.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>  // MIN, MAX
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+
+#define CPU_RESIZE_PRECISION 14
+#define CPU_RESIZE_FILTER_CACHE 8
+#define CPU_RESIZE_MAX_THREADS 16
+#define CPU_RESIZE_MAX_PLANES 3
+#define CPU_RESIZE_BAND_ROWS 32
+
+
+
+// One axis of the filter: output pixel i is the weighted sum of taps input pixels starting at start[i].
+// offset, srcLength and dstLength are the cache key.
+typedef struct {
+    uint32_t offset;
+    uint32_t srcLength;
+    uint32_t dstLength;
+    uint32_t lastUse;       // 0 for an empty slot
+    uint32_t taps;
+    uint32_t *start;
+    int16_t *weights;       // dstLength * taps, each group sums up to 1 << CPU_RESIZE_PRECISION
+} CPUResizeFilter_s;
+
+
+
+typedef struct {
+    const uint8_t *src;
+    uint32_t srcStride;
+    uint8_t *dst;
+    uint32_t dstStride;
+    uint32_t numChannels;
+    const CPUResizeFilter_s *horizontal;
+    const CPUResizeFilter_s *vertical;
+    uint32_t numBands;
+} CPUResizePlane_s;
+
+
+
+typedef struct {
+    uint8_t *rows;          // horizontally scaled source rows of the current band
+    size_t rowsSize;
+} CPUResizeWorker_s;
+
+
+
+struct CPUResize_s {
+    uint32_t numThreads;
+    bool useSIMD;
+    uint32_t useCounter;
+    CPUResizeFilter_s filters[CPU_RESIZE_FILTER_CACHE];
+    CPUResizeWorker_s workers[CPU_RESIZE_MAX_THREADS];
+
+    // the job of the current cpuResizeProcess call
+    CPUResizePlane_s planes[CPU_RESIZE_MAX_PLANES];
+    uint32_t numPlanes;
+    pthread_mutex_t lock;
+    uint32_t nextBand;
+    uint32_t numBands;
+};
+
+
+
+typedef struct {
+    CPUResize_s *resize;
+    CPUResizeWorker_s *worker;
+} CPUResizeThread_s;
+
+
+
+bool cpuResizeIsSupportedColorFormat(OMX_COLOR_FORMATTYPE eColorFormat) {
+    switch (eColorFormat) {
+        case OMX_COLOR_Format32bitABGR8888:
+        case OMX_COLOR_Format32bitARGB8888:
+        case OMX_COLOR_Format32bitBGRA8888:
+        case OMX_COLOR_Format24bitRGB888:
+        case OMX_COLOR_Format24bitBGR888:
+        case OMX_COLOR_FormatYUV420PackedPlanar:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+
+
+static uint32_t bytesPerPixel(OMX_COLOR_FORMATTYPE eColorFormat) {
+    switch (eColorFormat) {
+        case OMX_COLOR_Format24bitRGB888:
+        case OMX_COLOR_Format24bitBGR888:
+            return 3;
+
+        case OMX_COLOR_FormatYUV420PackedPlanar:
+            return 1;
+
+        default:
+            return 4;
+    }
+}
+
+
+
+static int32_t floorInt(double x) {
+    const int32_t i = (int32_t)x;
+    return (i > x) ? i - 1 : i;
+}
+
+
+
+static void buildFilter(CPUResizeFilter_s *filter, uint32_t offset, uint32_t srcLength, uint32_t dstLength) {
+    const double scale = (double)srcLength / dstLength;
+    const double support = MAX(scale, 1.0);     // radius of the triangle in source pixels
+    const int32_t begin = offset;
+    const int32_t end = offset + srcLength;
+    int32_t *first = malloc(dstLength * sizeof(int32_t));
+    int32_t *last = malloc(dstLength * sizeof(int32_t));
+    uint32_t taps = 1;
+
+    // the source pixels with a non-zero weight, |j + 0.5 - center| < support, clamped to the crop
+    for (uint32_t i = 0; i < dstLength; i++) {
+        const double center = offset + (i + 0.5) * scale;
+        const int32_t j0 = floorInt(center - support - 0.5) + 1;
+        const int32_t j1 = -floorInt(-(center + support - 0.5)) - 1;
+        first[i] = MIN(MAX(j0, begin), end - 1);
+        last[i] = MAX(MIN(j1, end - 1), first[i]);
+        taps = MAX(taps, (uint32_t)(last[i] - first[i] + 1));
+    }
+
+    free(filter->start);
+    free(filter->weights);
+    filter->offset = offset;
+    filter->srcLength = srcLength;
+    filter->dstLength = dstLength;
+    filter->taps = taps;
+    filter->start = malloc(dstLength * sizeof(uint32_t));
+    filter->weights = calloc(dstLength * taps, sizeof(int16_t));
+    double weights[taps];
+
+    for (uint32_t i = 0; i < dstLength; i++) {
+        const double center = offset + (i + 0.5) * scale;
+        const int32_t start = MIN(first[i], end - (int32_t)taps);
+        int16_t *w = &filter->weights[i * taps];
+        double sum = 0;
+
+        for (int32_t j = first[i]; j <= last[i]; j++) {
+            const double distance = (j + 0.5 - center) / support;
+            weights[j - first[i]] = MAX(0.0, 1.0 - ((distance < 0) ? -distance : distance));
+            sum += weights[j - first[i]];
+        }
+
+        int32_t total = 0;
+        uint32_t largest = first[i] - start;
+
+        for (int32_t j = first[i]; j <= last[i]; j++) {
+            const double weight = (sum > 0) ? weights[j - first[i]] / sum : 1.0 / (last[i] - first[i] + 1);
+            w[j - start] = (int16_t)(weight * (1 << CPU_RESIZE_PRECISION) + 0.5);
+            total += w[j - start];
+
+            if (w[j - start] > w[largest]) {
+                largest = j - start;
+            }
+        }
+
+        // rounding must neither brighten nor darken
+        w[largest] += (1 << CPU_RESIZE_PRECISION) - total;
+        filter->start[i] = start;
+    }
+
+    free(first);
+    free(last);
+}
+
+
+
+static const CPUResizeFilter_s * getFilter(CPUResize_s *resize, uint32_t offset, uint32_t srcLength, uint32_t dstLength) {
+    CPUResizeFilter_s *oldest = &resize->filters[0];
+    resize->useCounter++;
+
+    for (int i = 0; i < CPU_RESIZE_FILTER_CACHE; i++) {
+        CPUResizeFilter_s *filter = &resize->filters[i];
+
+        if ((filter->lastUse > 0) && (filter->offset == offset) && (filter->srcLength == srcLength) && (filter->dstLength == dstLength)) {
+            filter->lastUse = resize->useCounter;
+            return filter;
+        }
+
+        if (filter->lastUse < oldest->lastUse) {
+            oldest = filter;
+        }
+    }
+
+    buildFilter(oldest, offset, srcLength, dstLength);
+    oldest->lastUse = resize->useCounter;
+    return oldest;
+}
+
+
+
+static void horizontalScalar(uint8_t *dst, const uint8_t *src, uint32_t numChannels, const CPUResizeFilter_s *filter) {
+    for (uint32_t x = 0; x < filter->dstLength; x++) {
+        const uint8_t *s = &src[filter->start[x] * numChannels];
+        const int16_t *w = &filter->weights[x * filter->taps];
+
+        for (uint32_t c = 0; c < numChannels; c++) {
+            int32_t sum = 1 << (CPU_RESIZE_PRECISION - 1);
+
+            for (uint32_t t = 0; t < filter->taps; t++) {
+                sum += s[t * numChannels + c] * w[t];
+            }
+
+            dst[x * numChannels + c] = MIN(MAX(sum >> CPU_RESIZE_PRECISION, 0), 255);
+        }
+    }
+}
+
+
+
+// bytes [begin, rowSize) of a row from taps rows that are rowSize apart
+static void verticalRange(uint8_t *dst, const uint8_t *rows, size_t rowSize, size_t begin, uint32_t taps, const int16_t *w) {
+    for (size_t i = begin; i < rowSize; i++) {
+        int32_t sum = 1 << (CPU_RESIZE_PRECISION - 1);
+
+        for (uint32_t t = 0; t < taps; t++) {
+            sum += rows[t * rowSize + i] * w[t];
+        }
+
+        dst[i] = MIN(MAX(sum >> CPU_RESIZE_PRECISION, 0), 255);
+    }
+}
+
+
+
+static void verticalScalar(uint8_t *dst, const uint8_t *rows, size_t rowSize, uint32_t taps, const int16_t *w) {
+    verticalRange(dst, rows, rowSize, 0, taps, w);
+}
+
+
+
+#if defined(__SSE2__)
+
+// two taps per step: the 16 bit channels of neighbouring pixels are interleaved so that pmaddwd weighs both
+static void horizontal4SIMD(uint8_t *dst, const uint8_t *src, const CPUResizeFilter_s *filter) {
+    const __m128i zero = _mm_setzero_si128();
+
+    for (uint32_t x = 0; x < filter->dstLength; x++) {
+        const uint8_t *s = &src[filter->start[x] * 4];
+        const int16_t *w = &filter->weights[x * filter->taps];
+        __m128i sum = _mm_set1_epi32(1 << (CPU_RESIZE_PRECISION - 1));
+        uint32_t t = 0;
+
+        for (; t + 1 < filter->taps; t += 2) {
+            __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&s[t * 4]), zero);
+            pixels = _mm_unpacklo_epi16(pixels, _mm_srli_si128(pixels, 8));
+            const __m128i weights = _mm_set1_epi32((uint16_t)w[t] | ((uint32_t)(uint16_t)w[t + 1] << 16));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, weights));
+        }
+
+        if (t < filter->taps) {
+            int32_t pixel;
+            memcpy(&pixel, &s[t * 4], 4);
+            __m128i pixels = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero);
+            pixels = _mm_unpacklo_epi16(pixels, zero);
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(pixels, _mm_set1_epi32((uint16_t)w[t])));
+        }
+
+        sum = _mm_srai_epi32(sum, CPU_RESIZE_PRECISION);
+        sum = _mm_packus_epi16(_mm_packs_epi32(sum, sum), zero);
+        const int32_t pixel = _mm_cvtsi128_si32(sum);
+        memcpy(&dst[x * 4], &pixel, 4);
+    }
+}
+
+
+
+// eight bytes of two rows per step, interleaved for pmaddwd like in horizontal4SIMD
+static void verticalSIMD(uint8_t *dst, const uint8_t *rows, size_t rowSize, uint32_t taps, const int16_t *w) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rounding = _mm_set1_epi32(1 << (CPU_RESIZE_PRECISION - 1));
+    size_t i = 0;
+
+    for (; i + 8 <= rowSize; i += 8) {
+        __m128i sumLo = rounding;
+        __m128i sumHi = rounding;
+        uint32_t t = 0;
+
+        for (; t + 1 < taps; t += 2) {
+            const __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&rows[t * rowSize + i]), zero);
+            const __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&rows[(t + 1) * rowSize + i]), zero);
+            const __m128i weights = _mm_set1_epi32((uint16_t)w[t] | ((uint32_t)(uint16_t)w[t + 1] << 16));
+            sumLo = _mm_add_epi32(sumLo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), weights));
+            sumHi = _mm_add_epi32(sumHi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), weights));
+        }
+
+        if (t < taps) {
+            const __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&rows[t * rowSize + i]), zero);
+            const __m128i weights = _mm_set1_epi32((uint16_t)w[t]);
+            sumLo = _mm_add_epi32(sumLo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), weights));
+            sumHi = _mm_add_epi32(sumHi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), weights));
+        }
+
+        sumLo = _mm_srai_epi32(sumLo, CPU_RESIZE_PRECISION);
+        sumHi = _mm_srai_epi32(sumHi, CPU_RESIZE_PRECISION);
+        _mm_storel_epi64((__m128i *)&dst[i], _mm_packus_epi16(_mm_packs_epi32(sumLo, sumHi), zero));
+    }
+
+    verticalRange(dst, rows, rowSize, i, taps, w);
+}
+
+#else
+
+// Other architectures (including NEON on the Pi) use the scalar loops until a vector version has been checked
+// against them on the target.
+#define horizontal4SIMD(dst, src, filter) horizontalScalar(dst, src, 4, filter)
+#define verticalSIMD verticalScalar
+
+#endif
+
+
+
+static void resizeBand(CPUResize_s *resize, CPUResizeWorker_s *worker, const CPUResizePlane_s *plane, uint32_t band) {
+    const CPUResizeFilter_s *horizontal = plane->horizontal;
+    const CPUResizeFilter_s *vertical = plane->vertical;
+    const uint32_t y0 = band * CPU_RESIZE_BAND_ROWS;
+    const uint32_t y1 = MIN(y0 + CPU_RESIZE_BAND_ROWS, vertical->dstLength);
+    const uint32_t srcBegin = vertical->start[y0];
+    const uint32_t srcEnd = vertical->start[y1 - 1] + vertical->taps;
+    const size_t rowSize = horizontal->dstLength * plane->numChannels;
+
+    if (worker->rowsSize < (srcEnd - srcBegin) * rowSize) {
+        free(worker->rows);
+        worker->rowsSize = (srcEnd - srcBegin) * rowSize;
+        worker->rows = malloc(worker->rowsSize);
+    }
+
+    for (uint32_t y = srcBegin; y < srcEnd; y++) {
+        uint8_t *row = &worker->rows[(y - srcBegin) * rowSize];
+        const uint8_t *src = &plane->src[y * plane->srcStride];
+
+        if (resize->useSIMD && (plane->numChannels == 4)) {
+            horizontal4SIMD(row, src, horizontal);
+        } else {
+            horizontalScalar(row, src, plane->numChannels, horizontal);
+        }
+    }
+
+    for (uint32_t y = y0; y < y1; y++) {
+        uint8_t *dst = &plane->dst[y * plane->dstStride];
+        const uint8_t *rows = &worker->rows[(vertical->start[y] - srcBegin) * rowSize];
+        const int16_t *w = &vertical->weights[y * vertical->taps];
+
+        if (resize->useSIMD) {
+            verticalSIMD(dst, rows, rowSize, vertical->taps, w);
+        } else {
+            verticalScalar(dst, rows, rowSize, vertical->taps, w);
+        }
+    }
+}
+
+
+
+static void * resizeBands(void *in_out_userData) {
+    CPUResizeThread_s *thread = in_out_userData;
+    CPUResize_s *resize = thread->resize;
+
+    while (true) {
+        pthread_mutex_lock(&resize->lock);
+        uint32_t band = resize->nextBand++;
+        pthread_mutex_unlock(&resize->lock);
+
+        if (band >= resize->numBands) {
+            return NULL;
+        }
+
+        for (uint32_t p = 0; p < resize->numPlanes; p++) {
+            if (band < resize->planes[p].numBands) {
+                resizeBand(resize, thread->worker, &resize->planes[p], band);
+                break;
+            }
+
+            band -= resize->planes[p].numBands;
+        }
+    }
+}
+
+
+
+CPUResize_s * cpuResizeInit(uint32_t numThreads) {
+    CPUResize_s *resize = calloc(1, sizeof(CPUResize_s));
+
+    if (numThreads == 0) {
+        numThreads = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    }
+
+    resize->numThreads = MIN(numThreads, CPU_RESIZE_MAX_THREADS);
+#if defined(__SSE2__)
+    resize->useSIMD = true;
+#endif
+    pthread_mutex_init(&resize->lock, NULL);
+    return resize;
+}
+
+
+
+void cpuResizeDeinit(CPUResize_s *in_out_resize) {
+    for (int i = 0; i < CPU_RESIZE_FILTER_CACHE; i++) {
+        free(in_out_resize->filters[i].start);
+        free(in_out_resize->filters[i].weights);
+    }
+
+    for (int t = 0; t < CPU_RESIZE_MAX_THREADS; t++) {
+        free(in_out_resize->workers[t].rows);
+    }
+
+    pthread_mutex_destroy(&in_out_resize->lock);
+    free(in_out_resize);
+}
+
+
+
+void cpuResizeUseSIMD(CPUResize_s *in_out_resize, bool in_ENABLED) {
+#if defined(__SSE2__)
+    in_out_resize->useSIMD = in_ENABLED;
+#else
+    (void)in_out_resize;
+    (void)in_ENABLED;
+#endif
+}
+
+
+
+static void addPlane(CPUResize_s *resize, uint8_t *dst, uint32_t dstStride, uint32_t dstWidth, uint32_t dstHeight, const uint8_t *src, uint32_t srcStride, OMXRect_t crop, uint32_t numChannels) {
+    CPUResizePlane_s *plane = &resize->planes[resize->numPlanes++];
+    plane->src = src;
+    plane->srcStride = srcStride;
+    plane->dst = dst;
+    plane->dstStride = dstStride;
+    plane->numChannels = numChannels;
+    plane->horizontal = getFilter(resize, crop.nLeft, crop.nWidth, dstWidth);
+    plane->vertical = getFilter(resize, crop.nTop, crop.nHeight, dstHeight);
+    plane->numBands = (dstHeight + CPU_RESIZE_BAND_ROWS - 1) / CPU_RESIZE_BAND_ROWS;
+    resize->numBands += plane->numBands;
+}
+
+
+
+bool cpuResizeProcess(CPUResize_s *in_out_resize, CPUImage_s *out_dst, const CPUImage_s *in_SRC, OMXRect_t in_CROP) {
+    const OMX_COLOR_FORMATTYPE eColorFormat = in_SRC->eColorFormat;
+
+    if (!cpuResizeIsSupportedColorFormat(eColorFormat) || (out_dst->eColorFormat != eColorFormat)) {
+        return false;
+    }
+
+    if ((in_CROP.nWidth == 0) || (in_CROP.nHeight == 0)) {
+        in_CROP = (OMXRect_t){ .nLeft = 0, .nTop = 0, .nWidth = in_SRC->nWidth, .nHeight = in_SRC->nHeight };
+    }
+
+    if ((in_CROP.nLeft < 0) || (in_CROP.nTop < 0) || (in_CROP.nLeft + in_CROP.nWidth > in_SRC->nWidth) || (in_CROP.nTop + in_CROP.nHeight > in_SRC->nHeight)) {
+        return false;
+    }
+
+    if ((out_dst->nWidth == 0) || (out_dst->nHeight == 0)) {
+        return true;
+    }
+
+    const uint32_t numChannels = bytesPerPixel(eColorFormat);
+    const uint32_t srcStride = (in_SRC->nStride > 0) ? in_SRC->nStride : in_SRC->nWidth * numChannels;
+    const uint32_t dstStride = (out_dst->nStride > 0) ? out_dst->nStride : out_dst->nWidth * numChannels;
+    in_out_resize->numPlanes = 0;
+    in_out_resize->numBands = 0;
+    in_out_resize->nextBand = 0;
+    addPlane(in_out_resize, out_dst->pData, dstStride, out_dst->nWidth, out_dst->nHeight, in_SRC->pData, srcStride, in_CROP, numChannels);
+
+    if (eColorFormat == OMX_COLOR_FormatYUV420PackedPlanar) {
+        const uint32_t srcSliceHeight = (in_SRC->nSliceHeight > 0) ? in_SRC->nSliceHeight : in_SRC->nHeight;
+        const uint32_t dstSliceHeight = (out_dst->nSliceHeight > 0) ? out_dst->nSliceHeight : out_dst->nHeight;
+        const size_t srcPlaneSize = (srcStride / 2) * (srcSliceHeight / 2);
+        const size_t dstPlaneSize = (dstStride / 2) * (dstSliceHeight / 2);
+        const uint8_t *srcU = in_SRC->pData + srcStride * srcSliceHeight;
+        uint8_t *dstU = out_dst->pData + dstStride * dstSliceHeight;
+
+        // chroma covers the luma crop rounded outwards to even pixels
+        OMXRect_t crop = {
+            .nLeft = in_CROP.nLeft / 2,
+            .nTop = in_CROP.nTop / 2,
+            .nWidth = (in_CROP.nLeft + in_CROP.nWidth + 1) / 2 - in_CROP.nLeft / 2,
+            .nHeight = (in_CROP.nTop + in_CROP.nHeight + 1) / 2 - in_CROP.nTop / 2,
+        };
+
+        const uint32_t dstWidth = (out_dst->nWidth + 1) / 2;
+        const uint32_t dstHeight = (out_dst->nHeight + 1) / 2;
+        addPlane(in_out_resize, dstU, dstStride / 2, dstWidth, dstHeight, srcU, srcStride / 2, crop, 1);
+        addPlane(in_out_resize, dstU + dstPlaneSize, dstStride / 2, dstWidth, dstHeight, srcU + srcPlaneSize, srcStride / 2, crop, 1);
+    }
+
+    const uint32_t numThreads = MIN(in_out_resize->numThreads, in_out_resize->numBands);
+    CPUResizeThread_s threads[numThreads];
+    pthread_t threadIds[numThreads];
+
+    for (uint32_t t = 0; t < numThreads; t++) {
+        threads[t].resize = in_out_resize;
+        threads[t].worker = &in_out_resize->workers[t];
+    }
+
+    for (uint32_t t = 1; t < numThreads; t++) {
+        pthread_create(&threadIds[t], NULL, resizeBands, &threads[t]);
+    }
+
+    resizeBands(&threads[0]);
+
+    for (uint32_t t = 1; t < numThreads; t++) {
+        pthread_join(threadIds[t], NULL);
+    }
+
+    return true;
+}
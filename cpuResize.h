@@ -0,0 +1,56 @@
+//
+//  cpuResize.h
+//  OMXPlayground
+//
+//  Host side replacement for OMX.broadcom.resize, for when the component is busy or missing.
+//
+
+#ifndef cpuResize_h
+#define cpuResize_h
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Image.h>
+
+#include "omxHelper.h"
+
+
+// forward declaration of a typedef struct
+struct CPUResize_s;
+typedef struct CPUResize_s CPUResize_s;
+
+
+// An image laid out like an OMX image port buffer. YUV420PackedPlanar stores nSliceHeight rows of Y followed by
+// nSliceHeight / 2 rows of U and then of V, both with half the stride. nSliceHeight 0 means nHeight.
+typedef struct {
+    OMX_COLOR_FORMATTYPE eColorFormat;
+    OMX_U32 nWidth;
+    OMX_U32 nHeight;
+    OMX_U32 nStride;
+    OMX_U32 nSliceHeight;
+    OMX_U8 *pData;
+} CPUImage_s;
+
+
+// 32 and 24 bit RGB in any channel order and YUV420PackedPlanar
+bool cpuResizeIsSupportedColorFormat(OMX_COLOR_FORMATTYPE eColorFormat);
+
+// Filter coefficients are computed once per crop and output size and cached in the returned object, so keep it
+// around for a stream of equally sized frames. It is not safe to use from several threads at once.
+// numThreads 0 uses all online CPUs.
+CPUResize_s * cpuResizeInit(uint32_t numThreads);
+void cpuResizeDeinit(CPUResize_s *in_out_resize);
+
+// the vector kernels are on by default where SSE2 is available, switch them off for comparison
+void cpuResizeUseSIMD(CPUResize_s *in_out_resize, bool in_ENABLED);
+
+// Scales the crop rectangle of in_SRC to the size of out_dst with a triangle filter (bilinear when enlarging,
+// averaging over the covered pixels when shrinking). Both images need the same colour format, there is no
+// conversion. Returns false for unsupported formats or a crop that does not fit into in_SRC.
+bool cpuResizeProcess(CPUResize_s *in_out_resize, CPUImage_s *out_dst, const CPUImage_s *in_SRC, OMXRect_t in_CROP);
+
+
+#endif /* cpuResize_h */
@@ -0,0 +1,174 @@
+//
+//  cpuResizeBench.c
+//  OMXPlayground
+//
+//  cpuResize against a plain per pixel implementation of the same filter.
+//
+
+#include "cpuResizeBench.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/param.h>  // MIN, MAX
+#include <time.h>
+
+#include "cHelper.h"
+#include "cpuResize.h"
+
+
+
+static double seconds(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+
+
+static double triangle(double distance, double support) {
+    distance = ((distance < 0) ? -distance : distance) / support;
+    return (distance < 1) ? 1 - distance : 0;
+}
+
+
+
+// the triangle filter of cpuResize in floating point, weights are computed for every pixel
+static void referenceResize(CPUImage_s *dst, const CPUImage_s *src, OMXRect_t crop, uint32_t numChannels) {
+    const double scaleX = (double)crop.nWidth / dst->nWidth;
+    const double scaleY = (double)crop.nHeight / dst->nHeight;
+    const double supportX = (scaleX > 1) ? scaleX : 1;
+    const double supportY = (scaleY > 1) ? scaleY : 1;
+
+    for (uint32_t y = 0; y < dst->nHeight; y++) {
+        const double centerY = crop.nTop + (y + 0.5) * scaleY;
+
+        for (uint32_t x = 0; x < dst->nWidth; x++) {
+            const double centerX = crop.nLeft + (x + 0.5) * scaleX;
+
+            for (uint32_t c = 0; c < numChannels; c++) {
+                double sum = 0;
+                double weights = 0;
+
+                for (int32_t sy = MAX(crop.nTop, centerY - supportY - 1); sy < MIN(crop.nTop + crop.nHeight, centerY + supportY + 1); sy++) {
+                    const double wy = triangle(sy + 0.5 - centerY, supportY);
+
+                    if (wy == 0) {
+                        continue;
+                    }
+
+                    for (int32_t sx = MAX(crop.nLeft, centerX - supportX - 1); sx < MIN(crop.nLeft + crop.nWidth, centerX + supportX + 1); sx++) {
+                        const double w = wy * triangle(sx + 0.5 - centerX, supportX);
+                        sum += w * src->pData[sy * src->nStride + sx * numChannels + c];
+                        weights += w;
+                    }
+                }
+
+                dst->pData[y * dst->nStride + x * numChannels + c] = (uint8_t)(sum / weights + 0.5);
+            }
+        }
+    }
+}
+
+
+
+static void allocImage(CPUImage_s *image, uint32_t width, uint32_t height) {
+    image->eColorFormat = OMX_COLOR_Format32bitABGR8888;
+    image->nWidth = width;
+    image->nHeight = height;
+    image->nStride = width * 4;
+    image->nSliceHeight = 0;
+    image->pData = malloc(image->nStride * height);
+}
+
+
+
+static int maxDifference(const CPUImage_s *a, const CPUImage_s *b) {
+    int result = 0;
+
+    for (uint32_t i = 0; i < a->nStride * a->nHeight; i++) {
+        const int difference = abs(a->pData[i] - b->pData[i]);
+        result = (difference > result) ? difference : result;
+    }
+
+    return result;
+}
+
+
+
+static double timeResize(CPUResize_s *resize, CPUImage_s *dst, const CPUImage_s *src, OMXRect_t crop, int iterations) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        bool success = cpuResizeProcess(resize, dst, src, crop);
+        assert(success);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return seconds(&start, &end) / iterations;
+}
+
+
+
+static void resizeBenchmark(const CPUImage_s *src, OMXRect_t crop, uint32_t dstWidth, uint32_t dstHeight) {
+    const int iterations = 20;
+    CPUImage_s dst, reference;
+    allocImage(&dst, dstWidth, dstHeight);
+    allocImage(&reference, dstWidth, dstHeight);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    referenceResize(&reference, src, (crop.nWidth > 0) ? crop : (OMXRect_t){ 0, 0, src->nWidth, src->nHeight }, 4);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double referenceTime = seconds(&start, &end);
+
+    printf(COLOR_YELLOW "%d x %d (crop %d x %d at %d, %d) -> %d x %d\n" COLOR_NC, src->nWidth, src->nHeight, crop.nWidth, crop.nHeight, crop.nLeft, crop.nTop, dstWidth, dstHeight);
+    printf(COLOR_YELLOW "    reference:              %8.2f ms\n" COLOR_NC, referenceTime * 1000);
+
+    CPUResize_s *resize = cpuResizeInit(1);
+
+    // the first call also computes the coefficients
+    cpuResizeUseSIMD(resize, false);
+    const double firstTime = timeResize(resize, &dst, src, crop, 1);
+    const double scalarTime = timeResize(resize, &dst, src, crop, iterations);
+    printf(COLOR_YELLOW "    scalar, 1 thread:       %8.2f ms (%.2f ms with coefficients), max. difference %d\n" COLOR_NC, scalarTime * 1000, firstTime * 1000, maxDifference(&dst, &reference));
+
+    cpuResizeUseSIMD(resize, true);
+    const double simdTime = timeResize(resize, &dst, src, crop, iterations);
+    printf(COLOR_YELLOW "    SIMD, 1 thread:         %8.2f ms, max. difference %d\n" COLOR_NC, simdTime * 1000, maxDifference(&dst, &reference));
+    cpuResizeDeinit(resize);
+
+    resize = cpuResizeInit(0);
+    timeResize(resize, &dst, src, crop, 1);
+    const double threadedTime = timeResize(resize, &dst, src, crop, iterations);
+    printf(COLOR_YELLOW "    SIMD, all CPUs:         %8.2f ms, max. difference %d\n" COLOR_NC, threadedTime * 1000, maxDifference(&dst, &reference));
+    cpuResizeDeinit(resize);
+
+    free(dst.pData);
+    free(reference.pData);
+}
+
+
+
+void cpuResizeBench() {
+    CPUImage_s src;
+    allocImage(&src, 1920, 1080);
+    srand(1);
+
+    // gradients with some noise on top
+    for (uint32_t y = 0; y < src.nHeight; y++) {
+        for (uint32_t x = 0; x < src.nWidth; x++) {
+            uint8_t *pixel = &src.pData[y * src.nStride + x * 4];
+            pixel[0] = 255;
+            pixel[1] = (x + rand() % 32) % 256;
+            pixel[2] = (y + rand() % 32) % 256;
+            pixel[3] = ((x ^ y) + rand() % 32) % 256;
+        }
+    }
+
+    resizeBenchmark(&src, (OMXRect_t){ 0, 0, 0, 0 }, 640, 360);
+    resizeBenchmark(&src, (OMXRect_t){ 0, 0, 0, 0 }, 160, 90);
+    resizeBenchmark(&src, (OMXRect_t){ 0, 0, 0, 0 }, 1280, 1024);
+    resizeBenchmark(&src, (OMXRect_t){ 800, 400, 320, 240 }, 1280, 960);
+
+    free(src.pData);
+}
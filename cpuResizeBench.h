@@ -0,0 +1,13 @@
+//
+//  cpuResizeBench.h
+//  OMXPlayground
+//
+
+#ifndef cpuResizeBench_h
+#define cpuResizeBench_h
+
+
+void cpuResizeBench(void);
+
+
+#endif /* cpuResizeBench_h */
@@ -10,18 +10,47 @@
 
 
 #include <stdio.h>
+#include <string.h>
 
 #include <bcm_host.h>
 #define OMX_SKIP64BIT
 #include <IL/OMX_Core.h>
 
+#include "cpuConvertBench.h"
+#include "cpuResizeBench.h"
 #include "omxDump.h"
 #include "omxHelper.h"
 //#include "omxImageRead.h"
 #include "omxJPEGDec.h"
 #include "omxJPEGEnc.h"
+#include "omxJPEGEncPool.h"
 #include "omxResize.h"
+#include "omxResizeFanOut.h"
 #include "omxTunnel.h"
+#include "simpleJPEGBench.h"
+
+
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} Demo_s;
+
+
+
+// can be run by name from the command line, e.g. `OMXPlaygroundSoft omxJPEGEnc omxTunnel`
+static const Demo_s sDemos[] = {
+    { "cpuConvertBench", cpuConvertBench },
+    { "cpuResizeBench", cpuResizeBench },
+    { "omxJPEGDec", omxJPEGDec },
+    { "omxJPEGEnc", omxJPEGEnc },
+    { "omxJPEGEncPool", omxJPEGEncPool },
+    { "omxResize", omxResize },
+    { "omxResizeFanOut", omxResizeFanOut },
+    { "omxResizeTiles", omxResizeTiles },
+    { "omxTunnel", omxTunnel },
+    { "simpleJPEGBench", simpleJPEGBench },
+};
 
 
 
@@ -50,12 +79,39 @@ int main(int argc, const char * argv[]) {
     omxErr = OMX_Init();
     omxAssert(omxErr);
 
+    if (argc > 1) {
+        for (int a = 1; a < argc; a++) {
+            size_t d = 0;
+
+            while ((d < sizeof(sDemos) / sizeof(sDemos[0])) && (strcmp(argv[a], sDemos[d].name) != 0)) {
+                d++;
+            }
+
+            if (d == sizeof(sDemos) / sizeof(sDemos[0])) {
+                fprintf(stderr, "unknown demo %s\n", argv[a]);
+                return 1;
+            }
+
+            printf("=== %s\n", sDemos[d].name);
+            sDemos[d].run();
+        }
+
+        return 0;
+    }
+
+    //cpuConvertBench();
+    //cpuResizeBench();
     //omxDump(13);
+    //omxDumpFormatCache("formats.cache");
     //omxImageRead();
     //omxJPEGDec();
     omxJPEGEnc();
+    //omxJPEGEncPool();
     //omxResize();
+    //omxResizeFanOut();
+    //omxResizeTiles();
     //omxTunnel();
+    //simpleJPEGBench();
 
     return 0;
 }
@@ -19,6 +19,7 @@
 #include <IL/OMX_Core.h>
 
 #include "cHelper.h"
+#include "omxFormatCache.h"
 #include "omxHelper.h"
 
 
@@ -67,31 +68,16 @@ static void omxPrintComponentVersion(OMX_HANDLETYPE omxHandle) {
 
 
 
-static void omxListImagePortFormats(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex) {
-    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    OMX_IMAGE_PARAM_PORTFORMATTYPE portformat;
-    OMX_INIT_STRUCTURE(portformat);
-    portformat.nPortIndex = nPortIndex;
-    int i = 0;
-
-    do {
-        portformat.nIndex = i;
-        omxErr = OMX_GetParameter(omxHandle, OMX_IndexParamImagePortFormat, &portformat);
-
-        if (omxErr == OMX_ErrorNone) {
-            //printf(LEVEL_2 "%d:\n", i);
-
-            if (portformat.eCompressionFormat != OMX_IMAGE_CodingUnused) {
-                printf(LEVEL_3 "eCompressionFormat: %s\n", omxImageCodingTypeEnum(portformat.eCompressionFormat));
-            }
-
-            if (portformat.eColorFormat != OMX_COLOR_FormatUnused) {
-                printf(LEVEL_3 "eColorFormat:       %s\n", omxColorFormatTypeEnum(portformat.eColorFormat));
-            }
+static void omxListImagePortFormats(const OMXPortFormats_s *port) {
+    for (OMX_U32 i = 0; i < port->numFormats; i++) {
+        if (port->formats[i].eCompressionFormat != OMX_IMAGE_CodingUnused) {
+            printf(LEVEL_3 "eCompressionFormat: %s\n", omxImageCodingTypeEnum(port->formats[i].eCompressionFormat));
+        }
 
-            i++;
+        if (port->formats[i].eColorFormat != OMX_COLOR_FormatUnused) {
+            printf(LEVEL_3 "eColorFormat:       %s\n", omxColorFormatTypeEnum(port->formats[i].eColorFormat));
         }
-    } while (omxErr == OMX_ErrorNone);
+    }
 }
 
 
@@ -116,7 +102,7 @@ void omxPrintPort(OMX_HANDLETYPE omxHandle, OMX_U32 portIndex) {
 
         puts("");
         puts(LEVEL_2 COLOR_RED "**  Supported Image Formats  **" COLOR_NC);
-        omxListImagePortFormats(omxHandle, portIndex);
+        omxListImagePortFormats(omxFormatCacheLookup(omxHandle, portIndex));
     } else {
         assert(false);
     }
@@ -252,3 +238,28 @@ void omxDump(OMX_U32 componentIndex) {
     // insert code here...
     printf("Hello, World!\n");
 }
+
+
+
+void omxDumpFormatCache(const char *path) {
+    if (!omxFormatCacheLoad(path)) {
+        printf("%s not found, instantiating all components\n", path);
+        omxFormatCacheClear();
+        omxFormatCachePopulate();
+
+        if (!omxFormatCacheSave(path)) {
+            printf(COLOR_RED "failed to write %s\n" COLOR_NC, path);
+        }
+    }
+
+    puts(COLOR_GREEN "************************************" COLOR_NC);
+    puts(COLOR_GREEN "**  Supported Image Port Formats  **" COLOR_NC);
+    puts(COLOR_GREEN "************************************" COLOR_NC);
+
+    for (const OMXPortFormats_s *port = omxFormatCacheFirst(); port; port = port->next) {
+        printf("%s, port %u:\n", port->componentName, port->nPortIndex);
+        omxListImagePortFormats(port);
+    }
+
+    puts("");
+}
@@ -19,5 +19,8 @@ void omxPrintPort(OMX_HANDLETYPE omxHandle, OMX_U32 portIndex);
 
 void omxDump(OMX_U32 componentIndex);
 
+// prints the image port formats of all components, read from path or gathered once and written there
+void omxDumpFormatCache(const char *path);
+
 
 #endif /* omxDump_h */
@@ -0,0 +1,334 @@
+//
+//  omxFormatCache.c
+//  OMXPlayground
+//
+
+#include "omxFormatCache.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "omxHelper.h"
+
+
+
+// superseded entry, kept alive as callers may still hold on to it
+typedef struct OMXRetiredPort_s {
+    OMXPortFormats_s *port;
+    struct OMXRetiredPort_s *next;
+} OMXRetiredPort_s;
+
+
+static OMXPortFormats_s *sPorts = NULL;
+static OMXRetiredPort_s *sRetired = NULL;
+static pthread_mutex_t sPortsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+// expects sPortsMutex to be locked
+static OMXPortFormats_s * findPort(const char *componentName, OMX_U32 nPortIndex) {
+    OMXPortFormats_s *port = sPorts;
+
+    while (port && ((port->nPortIndex != nPortIndex) || (strcmp(port->componentName, componentName) != 0))) {
+        port = port->next;
+    }
+
+    return port;
+}
+
+
+
+// expects sPortsMutex to be locked, takes ownership of port. Entries are never modified once they are in the
+// list as they are read without the lock, an older entry for the same port is replaced by port and retired
+// until omxFormatCacheClear.
+static void insertPort(OMXPortFormats_s *port) {
+    OMXPortFormats_s **link = &sPorts;
+
+    while (*link && (((*link)->nPortIndex != port->nPortIndex) || (strcmp((*link)->componentName, port->componentName) != 0))) {
+        link = &(*link)->next;
+    }
+
+    OMXPortFormats_s *existing = *link;
+
+    if (existing) {
+        OMXRetiredPort_s *retired = malloc(sizeof(OMXRetiredPort_s));
+        assert(retired != NULL);
+        retired->port = existing;
+        retired->next = sRetired;
+        sRetired = retired;
+        port->next = existing->next;
+    } else {
+        port->next = NULL;
+    }
+
+    *link = port;
+}
+
+
+
+static void enumeratePortFormats(OMX_HANDLETYPE omxHandle, OMXPortFormats_s *port) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMX_IMAGE_PARAM_PORTFORMATTYPE portformat;
+    OMX_INIT_STRUCTURE(portformat);
+    portformat.nPortIndex = port->nPortIndex;
+    port->numFormats = 0;
+
+    while (port->numFormats < OMX_FORMAT_CACHE_MAX_FORMATS) {
+        portformat.nIndex = port->numFormats;
+        omxErr = OMX_GetParameter(omxHandle, OMX_IndexParamImagePortFormat, &portformat);
+
+        if (omxErr != OMX_ErrorNone) {
+            break;
+        }
+
+        port->formats[port->numFormats].eCompressionFormat = portformat.eCompressionFormat;
+        port->formats[port->numFormats].eColorFormat = portformat.eColorFormat;
+        port->numFormats++;
+    }
+}
+
+
+
+static void getComponentName(OMX_HANDLETYPE omxHandle, char componentName[OMX_MAX_STRINGNAME_SIZE]) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMX_VERSIONTYPE componentVersion;
+    OMX_VERSIONTYPE specVersion;
+    OMX_UUIDTYPE componentUUID;
+    omxErr = OMX_GetComponentVersion(omxHandle, componentName, &componentVersion, &specVersion, &componentUUID);
+    omxAssert(omxErr);
+}
+
+
+
+static const OMXPortFormats_s * lookupPort(OMX_HANDLETYPE omxHandle, const char *componentName, OMX_U32 nPortIndex) {
+    pthread_mutex_lock(&sPortsMutex);
+    OMXPortFormats_s *port = findPort(componentName, nPortIndex);
+    pthread_mutex_unlock(&sPortsMutex);
+
+    if (port) {
+        return port;
+    }
+
+    port = calloc(1, sizeof(OMXPortFormats_s));
+    assert(port != NULL);
+    strncpy(port->componentName, componentName, OMX_MAX_STRINGNAME_SIZE - 1);
+    port->nPortIndex = nPortIndex;
+    enumeratePortFormats(omxHandle, port);
+
+    // another thread may have been faster, keep its entry
+    pthread_mutex_lock(&sPortsMutex);
+    OMXPortFormats_s *existing = findPort(componentName, nPortIndex);
+
+    if (existing) {
+        free(port);
+        port = existing;
+    } else {
+        insertPort(port);
+    }
+
+    pthread_mutex_unlock(&sPortsMutex);
+    return port;
+}
+
+
+
+const OMXPortFormats_s * omxFormatCacheLookup(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex) {
+    // only handles from outside omxGetHandle cost a round trip to the component
+    const char *componentName = omxGetComponentName(omxHandle);
+    char queriedName[OMX_MAX_STRINGNAME_SIZE];
+
+    if (!componentName) {
+        getComponentName(omxHandle, queriedName);
+        componentName = queriedName;
+    }
+
+    return lookupPort(omxHandle, componentName, nPortIndex);
+}
+
+
+
+bool omxFormatCacheSupportsColorFormat(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex, OMX_COLOR_FORMATTYPE eColorFormat) {
+    const OMXPortFormats_s *port = omxFormatCacheLookup(omxHandle, nPortIndex);
+
+    for (OMX_U32 i = 0; i < port->numFormats; i++) {
+        if (port->formats[i].eColorFormat == eColorFormat) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+static OMX_ERRORTYPE omxEventHandler(
+                                     OMX_IN OMX_HANDLETYPE hComponent,
+                                     OMX_IN OMX_PTR pAppData,
+                                     OMX_IN OMX_EVENTTYPE eEvent,
+                                     OMX_IN OMX_U32 nData1,
+                                     OMX_IN OMX_U32 nData2,
+                                     OMX_IN OMX_PTR pEventData) {
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxEmptyBufferDone(
+                                        OMX_IN OMX_HANDLETYPE hComponent,
+                                        OMX_IN OMX_PTR pAppData,
+                                        OMX_IN OMX_BUFFERHEADERTYPE *pBuffer) {
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxFillBufferDone(
+                                       OMX_OUT OMX_HANDLETYPE hComponent,
+                                       OMX_OUT OMX_PTR pAppData,
+                                       OMX_OUT OMX_BUFFERHEADERTYPE *pBuffer) {
+    return OMX_ErrorNone;
+}
+
+
+
+void omxFormatCachePopulate() {
+    char componentName[OMX_MAX_STRINGNAME_SIZE];
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMX_CALLBACKTYPE omxCallbacks;
+    omxCallbacks.EventHandler = omxEventHandler;
+    omxCallbacks.EmptyBufferDone = omxEmptyBufferDone;
+    omxCallbacks.FillBufferDone = omxFillBufferDone;
+
+    for (OMX_U32 c = 0; OMX_ComponentNameEnum(componentName, OMX_MAX_STRINGNAME_SIZE, c) == OMX_ErrorNone; c++) {
+        OMX_HANDLETYPE omxHandle;
+        omxErr = OMX_GetHandle(&omxHandle, componentName, NULL, &omxCallbacks);
+
+        if (omxErr != OMX_ErrorNone) {
+            continue;
+        }
+
+        OMX_PORT_PARAM_TYPE ports;
+        OMX_INIT_STRUCTURE(ports);
+        omxErr = OMX_GetParameter(omxHandle, OMX_IndexParamImageInit, &ports);
+
+        if (omxErr == OMX_ErrorNone) {
+            for (OMX_U32 p = ports.nStartPortNumber; p < ports.nStartPortNumber + ports.nPorts; p++) {
+                lookupPort(omxHandle, componentName, p);
+            }
+        }
+
+        omxErr = OMX_FreeHandle(omxHandle);
+        omxAssert(omxErr);
+    }
+}
+
+
+
+bool omxFormatCacheLoad(const char *path) {
+    FILE *file = fopen(path, "r");
+
+    if (!file) {
+        return false;
+    }
+
+    char componentName[OMX_MAX_STRINGNAME_SIZE];
+    unsigned int nPortIndex;
+    unsigned int numFormats;
+    bool success = true;
+
+    while (fscanf(file, "%127s %u %u", componentName, &nPortIndex, &numFormats) == 3) {
+        if (numFormats > OMX_FORMAT_CACHE_MAX_FORMATS) {
+            success = false;
+            break;
+        }
+
+        OMXPortFormats_s *port = calloc(1, sizeof(OMXPortFormats_s));
+        assert(port != NULL);
+        strcpy(port->componentName, componentName);
+        port->nPortIndex = nPortIndex;
+
+        for (port->numFormats = 0; port->numFormats < numFormats; port->numFormats++) {
+            unsigned int eCompressionFormat;
+            unsigned int eColorFormat;
+
+            if (fscanf(file, " %x:%x", &eCompressionFormat, &eColorFormat) != 2) {
+                break;
+            }
+
+            port->formats[port->numFormats].eCompressionFormat = eCompressionFormat;
+            port->formats[port->numFormats].eColorFormat = eColorFormat;
+        }
+
+        if (port->numFormats != numFormats) {
+            free(port);
+            success = false;
+            break;
+        }
+
+        pthread_mutex_lock(&sPortsMutex);
+        insertPort(port);
+        pthread_mutex_unlock(&sPortsMutex);
+    }
+
+    success = success && feof(file);
+    fclose(file);
+    return success;
+}
+
+
+
+bool omxFormatCacheSave(const char *path) {
+    FILE *file = fopen(path, "w");
+
+    if (!file) {
+        return false;
+    }
+
+    pthread_mutex_lock(&sPortsMutex);
+
+    for (const OMXPortFormats_s *port = sPorts; port; port = port->next) {
+        fprintf(file, "%s %u %u", port->componentName, port->nPortIndex, port->numFormats);
+
+        for (OMX_U32 i = 0; i < port->numFormats; i++) {
+            fprintf(file, " %x:%x", port->formats[i].eCompressionFormat, port->formats[i].eColorFormat);
+        }
+
+        fputc('\n', file);
+    }
+
+    pthread_mutex_unlock(&sPortsMutex);
+    return fclose(file) == 0;
+}
+
+
+
+const OMXPortFormats_s * omxFormatCacheFirst() {
+    pthread_mutex_lock(&sPortsMutex);
+    const OMXPortFormats_s *port = sPorts;
+    pthread_mutex_unlock(&sPortsMutex);
+    return port;
+}
+
+
+
+void omxFormatCacheClear() {
+    pthread_mutex_lock(&sPortsMutex);
+
+    while (sPorts) {
+        OMXPortFormats_s *port = sPorts;
+        sPorts = port->next;
+        free(port);
+    }
+
+    while (sRetired) {
+        OMXRetiredPort_s *retired = sRetired;
+        sRetired = retired->next;
+        free(retired->port);
+        free(retired);
+    }
+
+    pthread_mutex_unlock(&sPortsMutex);
+}
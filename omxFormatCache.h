@@ -0,0 +1,55 @@
+//
+//  omxFormatCache.h
+//  OMXPlayground
+//
+
+#ifndef omxFormatCache_h
+#define omxFormatCache_h
+
+
+#include <stdbool.h>
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Component.h>
+#include <IL/OMX_Core.h>
+#include <IL/OMX_Image.h>
+
+
+#define OMX_FORMAT_CACHE_MAX_FORMATS 64
+
+
+typedef struct {
+    OMX_IMAGE_CODINGTYPE eCompressionFormat;
+    OMX_COLOR_FORMATTYPE eColorFormat;
+} OMXPortFormat_t;
+
+
+// everything OMX_IndexParamImagePortFormat reported for one port of one component
+typedef struct OMXPortFormats_s {
+    char componentName[OMX_MAX_STRINGNAME_SIZE];
+    OMX_U32 nPortIndex;
+    OMX_U32 numFormats;
+    OMXPortFormat_t formats[OMX_FORMAT_CACHE_MAX_FORMATS];
+
+    struct OMXPortFormats_s *next;
+} OMXPortFormats_s;
+
+
+// Looks the port up by component name and port index. The name is taken from omxGetHandle, only other handles
+// ask the component for it. The formats are enumerated on the first lookup only, entries never change and stay
+// valid until omxFormatCacheClear even if omxFormatCacheLoad supersedes them. Thread safe.
+const OMXPortFormats_s * omxFormatCacheLookup(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex);
+bool omxFormatCacheSupportsColorFormat(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex, OMX_COLOR_FORMATTYPE eColorFormat);
+
+// instantiates every component once and caches all of its image ports
+void omxFormatCachePopulate(void);
+
+// one line per port: component name, port index and a list of compression:color format pairs
+bool omxFormatCacheLoad(const char *path);
+bool omxFormatCacheSave(const char *path);
+
+const OMXPortFormats_s * omxFormatCacheFirst(void);
+void omxFormatCacheClear(void);
+
+
+#endif /* omxFormatCache_h */
@@ -10,9 +10,51 @@
 #include "omxHelper.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>  // MAX
+#include <time.h>
+#include <unistd.h>
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Core.h>
 
 #include "cHelper.h"
+#include "omxFormatCache.h"
+
+
+
+#define OMX_COMMAND_QUEUE_SIZE 16
+
+
+typedef struct {
+    OMX_COMMANDTYPE command;
+    OMX_U32 nParam;
+} OMXCommand_t;
+
+
+typedef struct OMXComponent_s {
+    OMX_HANDLETYPE handle;
+    char name[OMX_MAX_STRINGNAME_SIZE];
+    OMX_PTR pAppData;
+    OMX_CALLBACKTYPE callbacks;
+
+    pthread_mutex_t eventMutex;
+    pthread_cond_t eventCond;
+    OMXCommand_t completed[OMX_COMMAND_QUEUE_SIZE];
+    int numCompleted;
+    OMX_ERRORTYPE error;
+
+    struct OMXComponent_s *next;
+} OMXComponent_s;
+
+
+static OMXComponent_s *sComponents = NULL;
+static pthread_mutex_t sComponentsMutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 
@@ -284,68 +326,319 @@ void omxAssertState(OMX_HANDLETYPE handle, OMX_STATETYPE state) {
 
 
 bool omxAssertImagePortFormatSupported(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex, OMX_COLOR_FORMATTYPE eColorFormat) {
+    return omxFormatCacheSupportsColorFormat(omxHandle, nPortIndex, eColorFormat);
+}
+
+
+
+size_t omxUseMappedBuffers(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex, const void *data, size_t size, OMX_BUFFERHEADERTYPE **buffers, OMX_U32 maxBuffers, OMX_U32 *numBuffers) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    OMX_IMAGE_PARAM_PORTFORMATTYPE portformat;
-    OMX_INIT_STRUCTURE(portformat);
-    portformat.nPortIndex = nPortIndex;
-    int i = 0;
-
-    do {
-        portformat.nIndex = i;
-        omxErr = OMX_GetParameter(omxHandle, OMX_IndexParamImagePortFormat, &portformat);
-
-        if (omxErr == OMX_ErrorNone) {
-            if (portformat.eColorFormat == eColorFormat) {
-                return true;
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
+    OMX_INIT_STRUCTURE(portDefinition);
+    portDefinition.nPortIndex = nPortIndex;
+    omxErr = OMX_GetParameter(omxHandle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+
+    const size_t alignment = MAX(portDefinition.nBufferAlignment, 1);
+
+    if ((size == 0) || ((uintptr_t)data % pageSize != 0) || (pageSize % alignment != 0)) {
+        return 0;
+    }
+
+    size_t windowSize = MAX(portDefinition.nBufferSize, (size + maxBuffers - 1) / maxBuffers);
+    windowSize = (windowSize + pageSize - 1) / pageSize * pageSize;
+    const OMX_U32 numWindows = (size + windowSize - 1) / windowSize;
+    const OMX_U32 nBufferCount = MAX(numWindows, portDefinition.nBufferCountMin);
+
+    if (nBufferCount > maxBuffers) {
+        return 0;
+    }
+
+    if (portDefinition.nBufferCountActual != nBufferCount) {
+        portDefinition.nBufferCountActual = nBufferCount;
+        omxErr = OMX_SetParameter(omxHandle, OMX_IndexParamPortDefinition, &portDefinition);
+
+        if (omxErr != OMX_ErrorNone) {
+            return 0;
+        }
+    }
+
+    omxErr = omxSendCommand(omxHandle, OMX_CommandPortEnable, nPortIndex);
+    omxAssert(omxErr);
+
+    for (OMX_U32 i = 0; i < nBufferCount; i++) {
+        OMX_U8 *window = (OMX_U8 *)data + ((i < numWindows) ? i : 0) * windowSize;
+        omxErr = OMX_UseBuffer(omxHandle, &buffers[i], nPortIndex, NULL, windowSize, window);
+        omxAssert(omxErr);
+    }
+
+    omxErr = omxWaitForCommand(omxHandle, OMX_CommandPortEnable, nPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+
+    *numBuffers = nBufferCount;
+    return windowSize;
+}
+
+
+
+static OMX_ERRORTYPE omxComponentEventHandler(
+                                              OMX_IN OMX_HANDLETYPE hComponent,
+                                              OMX_IN OMX_PTR pAppData,
+                                              OMX_IN OMX_EVENTTYPE eEvent,
+                                              OMX_IN OMX_U32 nData1,
+                                              OMX_IN OMX_U32 nData2,
+                                              OMX_IN OMX_PTR pEventData) {
+    OMXComponent_s *component = (OMXComponent_s *)pAppData;
+
+    if ((eEvent == OMX_EventCmdComplete) || (eEvent == OMX_EventError)) {
+        pthread_mutex_lock(&component->eventMutex);
+
+        if (eEvent == OMX_EventCmdComplete) {
+            if (component->numCompleted == OMX_COMMAND_QUEUE_SIZE) {
+                // nobody is waiting for the oldest completion, drop it
+                memmove(&component->completed[0], &component->completed[1], (OMX_COMMAND_QUEUE_SIZE - 1) * sizeof(OMXCommand_t));
+                component->numCompleted--;
+            }
+
+            component->completed[component->numCompleted].command = nData1;
+            component->completed[component->numCompleted].nParam = nData2;
+            component->numCompleted++;
+        } else {
+            component->error = nData1;
+        }
+
+        pthread_cond_broadcast(&component->eventCond);
+        pthread_mutex_unlock(&component->eventMutex);
+    }
+
+    if (component->callbacks.EventHandler) {
+        return component->callbacks.EventHandler(hComponent, component->pAppData, eEvent, nData1, nData2, pEventData);
+    }
+
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxComponentEmptyBufferDone(
+                                                 OMX_IN OMX_HANDLETYPE hComponent,
+                                                 OMX_IN OMX_PTR pAppData,
+                                                 OMX_IN OMX_BUFFERHEADERTYPE *pBuffer) {
+    OMXComponent_s *component = (OMXComponent_s *)pAppData;
+    return component->callbacks.EmptyBufferDone(hComponent, component->pAppData, pBuffer);
+}
+
+
+
+static OMX_ERRORTYPE omxComponentFillBufferDone(
+                                                OMX_OUT OMX_HANDLETYPE hComponent,
+                                                OMX_OUT OMX_PTR pAppData,
+                                                OMX_OUT OMX_BUFFERHEADERTYPE *pBuffer) {
+    OMXComponent_s *component = (OMXComponent_s *)pAppData;
+    return component->callbacks.FillBufferDone(hComponent, component->pAppData, pBuffer);
+}
+
+
+
+// NULL for handles that were not obtained through omxGetHandle
+static OMXComponent_s *omxLookupComponent(OMX_HANDLETYPE omxHandle) {
+    pthread_mutex_lock(&sComponentsMutex);
+    OMXComponent_s *component = sComponents;
+
+    while (component && (component->handle != omxHandle)) {
+        component = component->next;
+    }
+
+    pthread_mutex_unlock(&sComponentsMutex);
+    return component;
+}
+
+
+
+static OMXComponent_s *omxFindComponent(OMX_HANDLETYPE omxHandle) {
+    OMXComponent_s *component = omxLookupComponent(omxHandle);
+    assert(component != NULL);
+    return component;
+}
+
+
+
+OMX_ERRORTYPE omxGetHandle(OMX_HANDLETYPE *pHandle, OMX_STRING cComponentName, OMX_PTR pAppData, OMX_CALLBACKTYPE *pCallbacks) {
+    OMXComponent_s *component = calloc(1, sizeof(OMXComponent_s));
+    assert(component != NULL);
+    strncpy(component->name, cComponentName, OMX_MAX_STRINGNAME_SIZE - 1);
+    component->pAppData = pAppData;
+    component->callbacks = *pCallbacks;
+    component->error = OMX_ErrorNone;
+    pthread_mutex_init(&component->eventMutex, NULL);
+    pthread_cond_init(&component->eventCond, NULL);
+
+    OMX_CALLBACKTYPE omxCallbacks;
+    omxCallbacks.EventHandler = omxComponentEventHandler;
+    omxCallbacks.EmptyBufferDone = omxComponentEmptyBufferDone;
+    omxCallbacks.FillBufferDone = omxComponentFillBufferDone;
+    OMX_ERRORTYPE omxErr = OMX_GetHandle(&component->handle, cComponentName, component, &omxCallbacks);
+
+    if (omxErr != OMX_ErrorNone) {
+        pthread_cond_destroy(&component->eventCond);
+        pthread_mutex_destroy(&component->eventMutex);
+        free(component);
+        return omxErr;
+    }
+
+    pthread_mutex_lock(&sComponentsMutex);
+    component->next = sComponents;
+    sComponents = component;
+    pthread_mutex_unlock(&sComponentsMutex);
+
+    *pHandle = component->handle;
+    return OMX_ErrorNone;
+}
+
+
+
+OMX_ERRORTYPE omxFreeHandle(OMX_HANDLETYPE omxHandle) {
+    OMXComponent_s *component = omxFindComponent(omxHandle);
+    OMX_ERRORTYPE omxErr = OMX_FreeHandle(omxHandle);
+
+    if (omxErr != OMX_ErrorNone) {
+        return omxErr;
+    }
+
+    pthread_mutex_lock(&sComponentsMutex);
+    OMXComponent_s **link = &sComponents;
+
+    while (*link != component) {
+        link = &(*link)->next;
+    }
+
+    *link = component->next;
+    pthread_mutex_unlock(&sComponentsMutex);
+
+    pthread_cond_destroy(&component->eventCond);
+    pthread_mutex_destroy(&component->eventMutex);
+    free(component);
+    return OMX_ErrorNone;
+}
+
+
+
+const char * omxGetComponentName(OMX_HANDLETYPE omxHandle) {
+    OMXComponent_s *component = omxLookupComponent(omxHandle);
+    return component ? component->name : NULL;
+}
+
+
+
+OMX_ERRORTYPE omxSendCommand(OMX_HANDLETYPE omxHandle, OMX_COMMANDTYPE command, OMX_U32 nParam) {
+    OMXComponent_s *component = omxFindComponent(omxHandle);
+
+    // neither errors nor completions reported before this command are attributed to it, a completion left over
+    // from an earlier command whose wait timed out would otherwise end the next wait right away
+    pthread_mutex_lock(&component->eventMutex);
+    component->error = OMX_ErrorNone;
+    int kept = 0;
+
+    for (int i = 0; i < component->numCompleted; i++) {
+        if ((component->completed[i].command != command) || (component->completed[i].nParam != nParam)) {
+            component->completed[kept++] = component->completed[i];
+        }
+    }
+
+    component->numCompleted = kept;
+    pthread_mutex_unlock(&component->eventMutex);
+
+    return OMX_SendCommand(omxHandle, command, nParam, NULL);
+}
+
+
+
+OMX_ERRORTYPE omxWaitForCommand(OMX_HANDLETYPE omxHandle, OMX_COMMANDTYPE command, OMX_U32 nParam, OMX_U32 timeoutMs) {
+    OMXComponent_s *component = omxFindComponent(omxHandle);
+    OMX_ERRORTYPE omxErr = OMX_ErrorTimeout;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeoutMs / 1000;
+    deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&component->eventMutex);
+
+    while (true) {
+        for (int i = 0; i < component->numCompleted; i++) {
+            if ((component->completed[i].command == command) && (component->completed[i].nParam == nParam)) {
+                component->numCompleted--;
+                memmove(&component->completed[i], &component->completed[i + 1], (component->numCompleted - i) * sizeof(OMXCommand_t));
+                pthread_mutex_unlock(&component->eventMutex);
+                return OMX_ErrorNone;
             }
+        }
 
-            i++;
+        if (component->error != OMX_ErrorNone) {
+            omxErr = component->error;
+            component->error = OMX_ErrorNone;
+            break;
         }
-    } while (omxErr == OMX_ErrorNone);
 
-    return false;
+        if (pthread_cond_timedwait(&component->eventCond, &component->eventMutex, &deadline) == ETIMEDOUT) {
+            omxErr = OMX_ErrorTimeout;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&component->eventMutex);
+    printf(COLOR_RED "%s(%u) failed: %s\n" COLOR_NC, omxCommandTypeEnum(command), nParam, omxErrorTypeEnum(omxErr));
+    return omxErr;
 }
 
 
 
-void omxEnablePort(OMX_HANDLETYPE omxHandle, OMX_U32 portIndex, OMX_BOOL enabled) {
+OMX_ERRORTYPE omxEnablePort(OMX_HANDLETYPE omxHandle, OMX_U32 portIndex, OMX_BOOL enabled) {
     static const OMX_COMMANDTYPE command[2] = {OMX_CommandPortDisable, OMX_CommandPortEnable};
-    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
-    OMX_INIT_STRUCTURE(portDefinition);
-    portDefinition.nPortIndex = portIndex;
+    OMX_ERRORTYPE omxErr = omxSendCommand(omxHandle, command[enabled], portIndex);
 
-    omxErr = OMX_SendCommand(omxHandle, command[enabled], portIndex, NULL);
-    omxAssert(omxErr);
+    if (omxErr != OMX_ErrorNone) {
+        return omxErr;
+    }
 
-    do {
-        omxErr = OMX_GetParameter(omxHandle, OMX_IndexParamPortDefinition, &portDefinition);
-        omxAssert(omxErr);
-    } while (portDefinition.bEnabled != enabled);
+    return omxWaitForCommand(omxHandle, command[enabled], portIndex, OMX_COMMAND_TIMEOUT_MS);
 }
 
 
 
-void omxSwitchToState(OMX_HANDLETYPE omxHandle, OMX_STATETYPE state) {
+OMX_ERRORTYPE omxSwitchToState(OMX_HANDLETYPE omxHandle, OMX_STATETYPE state) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
     OMX_STATETYPE omxState = OMX_StateInvalid;
     omxErr = OMX_GetState(omxHandle, &omxState);
-    omxAssert(omxErr);
 
-    if (omxState != state) {
-        omxErr = OMX_SendCommand(omxHandle, OMX_CommandStateSet, state, NULL);
-        printf("%x -> %x : %x\n", omxState, state, omxErr);
-        omxAssert(omxErr);
+    if ((omxErr != OMX_ErrorNone) || (omxState == state)) {
+        return omxErr;
+    }
 
-        int c = 10;
+    omxErr = omxSendCommand(omxHandle, OMX_CommandStateSet, state);
 
-        do {
-            c--;
-            omxErr = OMX_GetState(omxHandle, &omxState);
-            printf("test : %x -> %x : %x\n", omxState, state, omxErr);
-            omxAssert(omxErr);
-            //sleep(1);
-        } while (omxState != state && c);
+    if (omxErr != OMX_ErrorNone) {
+        return omxErr;
     }
+
+    return omxWaitForCommand(omxHandle, OMX_CommandStateSet, state, OMX_COMMAND_TIMEOUT_MS);
 }
 
+
+
+OMX_ERRORTYPE omxSetInputCrop(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex, OMXRect_t crop) {
+    OMX_CONFIG_RECTTYPE commonInputCrop;
+    OMX_INIT_STRUCTURE(commonInputCrop);
+    commonInputCrop.nPortIndex = nPortIndex;
+    commonInputCrop.nLeft = crop.nLeft;
+    commonInputCrop.nTop = crop.nTop;
+    commonInputCrop.nWidth = crop.nWidth;
+    commonInputCrop.nHeight = crop.nHeight;
+    return OMX_SetConfig(omxHandle, OMX_IndexConfigCommonInputCrop, &commonInputCrop);
+}
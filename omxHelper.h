@@ -43,6 +43,26 @@ memset((a), 0, size); \
 }
 
 
+// how long omxSwitchToState and omxEnablePort wait for OMX_EventCmdComplete
+#define OMX_COMMAND_TIMEOUT_MS 2000
+
+
+
+typedef struct {
+    OMX_U32 nWidth;
+    OMX_U32 nHeight;
+} OMXSize_t;
+
+
+// nWidth or nHeight 0 selects the whole frame, like OMX_IndexConfigCommonInputCrop
+typedef struct {
+    OMX_S32 nLeft;
+    OMX_S32 nTop;
+    OMX_U32 nWidth;
+    OMX_U32 nHeight;
+} OMXRect_t;
+
+
 extern const char *omxBoolEnum[];
 extern const char *omxDirTypeEnum[];
 extern const char *omxPortDomainTypeEnum[];
@@ -59,10 +79,38 @@ void omxDumpParamPortDefinition(OMX_PARAM_PORTDEFINITIONTYPE portDefinition);
 void omxDumpImagePortDefinition(OMX_IMAGE_PORTDEFINITIONTYPE image);
 
 void omxAssertState(OMX_HANDLETYPE handle, OMX_STATETYPE state);
+// answered from omxFormatCache, the port is only enumerated once per component
 bool omxAssertImagePortFormatSupported(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex, OMX_COLOR_FORMATTYPE eColorFormat);
 
-void omxEnablePort(OMX_HANDLETYPE omxHandle, OMX_U32 portIndex, OMX_BOOL enabled);
-void omxSwitchToState(OMX_HANDLETYPE omxHandle, OMX_STATETYPE state);
+// Enables the (disabled) input port with buffers that point straight into data (usually a mapped file) via
+// OMX_UseBuffer, so compressed data reaches the component without a host side copy. data is split into page
+// aligned windows of at least nBufferSize bytes, window i is buffers[i]. If the port needs more buffers than
+// there are windows the spare ones alias the first window and must not be emptied. The last window may
+// claim more bytes than there are left in data, only nFilledLen is ever read. Returns the window size or 0
+// without touching the port if the component's alignment or buffer count rule this out, the caller then
+// allocates buffers and copies as usual.
+size_t omxUseMappedBuffers(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex, const void *data, size_t size, OMX_BUFFERHEADERTYPE **buffers, OMX_U32 maxBuffers, OMX_U32 *numBuffers);
+
+// Wrappers around OMX_GetHandle / OMX_FreeHandle. The component's EventHandler is interposed so that
+// OMX_EventCmdComplete and OMX_EventError are recorded per handle before being forwarded to pCallbacks.
+OMX_ERRORTYPE omxGetHandle(OMX_HANDLETYPE *pHandle, OMX_STRING cComponentName, OMX_PTR pAppData, OMX_CALLBACKTYPE *pCallbacks);
+OMX_ERRORTYPE omxFreeHandle(OMX_HANDLETYPE omxHandle);
+// the name passed to omxGetHandle without asking the component, NULL for handles obtained elsewhere
+const char * omxGetComponentName(OMX_HANDLETYPE omxHandle);
+
+// Sends a command without waiting. Use this when the command can only complete after further work by the
+// client (e.g. enabling a port completes once its buffers are allocated) and pair it with omxWaitForCommand.
+OMX_ERRORTYPE omxSendCommand(OMX_HANDLETYPE omxHandle, OMX_COMMANDTYPE command, OMX_U32 nParam);
+OMX_ERRORTYPE omxWaitForCommand(OMX_HANDLETYPE omxHandle, OMX_COMMANDTYPE command, OMX_U32 nParam, OMX_U32 timeoutMs);
+
+// blocking, only valid for handles obtained through omxGetHandle
+OMX_ERRORTYPE omxEnablePort(OMX_HANDLETYPE omxHandle, OMX_U32 portIndex, OMX_BOOL enabled);
+OMX_ERRORTYPE omxSwitchToState(OMX_HANDLETYPE omxHandle, OMX_STATETYPE state);
+
+// OMX_IndexConfigCommonInputCrop through OMX_SetConfig, so it is also accepted while the port is enabled and the
+// component is executing. The component picks it up with the first input buffer of the next frame, a frame
+// that has already started keeps its crop.
+OMX_ERRORTYPE omxSetInputCrop(OMX_HANDLETYPE omxHandle, OMX_U32 nPortIndex, OMXRect_t crop);
 
 
 #endif /* omxHelper_h */
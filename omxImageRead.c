@@ -153,7 +153,8 @@ static void setupOutputPort(ComponentContext *ctx) {
     omxErr = OMX_GetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
     omxAssert(omxErr);
 
-    omxEnablePort(ctx->handle, ctx->outputPortIndex, OMX_TRUE);
+    omxErr = omxSendCommand(ctx->handle, OMX_CommandPortEnable, ctx->outputPortIndex);
+    omxAssert(omxErr);
     omxPrintPort(ctx->handle, ctx->outputPortIndex);
 
     for (int i = 0; i < portDefinition.nBufferCountActual; i++) {
@@ -161,6 +162,9 @@ static void setupOutputPort(ComponentContext *ctx) {
         omxErr = OMX_AllocateBuffer(ctx->handle, &ctx->outputBuffer[i], ctx->outputPortIndex, i, portDefinition.nBufferSize);
         omxAssert(omxErr);
     }
+
+    omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortEnable, ctx->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
 }
 
 
@@ -218,16 +222,18 @@ void omxImageRead() {
     omxCallbacks.EmptyBufferDone = omxEmptyBufferDone;
     omxCallbacks.FillBufferDone = omxFillBufferDone;
 
-    omxErr = OMX_GetHandle(&ctx.handle, omxComponentName, &ctx, &omxCallbacks);
+    omxErr = omxGetHandle(&ctx.handle, omxComponentName, &ctx, &omxCallbacks);
     omxAssert(omxErr);
     omxAssertState(ctx.handle, OMX_StateLoaded);
 
     omxGetPorts(&ctx);
-    omxEnablePort(ctx.handle, ctx.outputPortIndex, OMX_FALSE);
+    omxErr = omxEnablePort(ctx.handle, ctx.outputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
     setupInputPort(&ctx);
 
     puts("1");
-    omxSwitchToState(ctx.handle, OMX_StateIdle);
+    omxErr = omxSwitchToState(ctx.handle, OMX_StateIdle);
+    omxAssert(omxErr);
     puts("2");
 
     setupOutputPort(&ctx);
@@ -9,8 +9,16 @@
 #include "omxJPEGDec.h"
 
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>  // strcasecmp
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/param.h>  // MIN
 
@@ -18,23 +26,34 @@
 #include <IL/OMX_Broadcom.h>
 #include <IL/OMX_Component.h>
 #include <IL/OMX_Core.h>
-#include <interface/vcos/vcos.h>
 
 #include "cHelper.h"
 #include "mmapHelper.h"
 #include "omxHelper.h"
 #include "omxDump.h"
+#include "omxSink.h"
+#include "omxFormatCache.h"
+#include "simpleJPEG.h"
 
 
 
-typedef struct {
+#define OMX_JPEG_DEC_MAX_BUFFERS 16
+
+
+
+struct OMXImageDecode_s {
     OMX_HANDLETYPE handle;
 
     OMX_U32 inputPortIndex;
     //    OMX_PARAM_PORTDEFINITIONTYPE *inputPortDefinition;
     //    OMX_IMAGE_PARAM_PORTFORMATTYPE *inputImagePortFormat;
-    OMX_BUFFERHEADERTYPE *inputBuffer[3];
-    bool inputReady;
+    OMX_BUFFERHEADERTYPE *inputBuffers[OMX_JPEG_DEC_MAX_BUFFERS];
+    OMX_U32 numInputBuffers;
+    OMX_BUFFERHEADERTYPE *inputFree[OMX_JPEG_DEC_MAX_BUFFERS];      // empty input buffers owned by the host
+    OMX_U32 numInputFree;
+    const uint8_t *inputMapped;     // mapped JPEG the input port was last set up for, NULL for copying
+    size_t inputMappedSize;         // length of inputMapped the windows were laid out for
+    size_t inputWindowSize;         // inputBuffers point into inputMapped, 0 if the data is copied
 
     OMX_U32 outputPortIndex;
     //    OMX_PARAM_PORTDEFINITIONTYPE *outputPortDefinition;
@@ -47,12 +66,30 @@ typedef struct {
     //    OMX_CONFIG_CONTAINERNODECOUNTTYPE *outputContainerNodeCount;
     //    OMX_CONFIG_CONTAINERNODEIDTYPE *outputCounterNodeID;
     //    OMX_PARAM_COLORSPACETYPE *outputColorSpace;
-    OMX_BUFFERHEADERTYPE *outputBuffer;
-    bool outputReady;
+    OMX_PARAM_PORTDEFINITIONTYPE outputPortDefinition;  // what the output buffers were allocated for
+    OMX_U32 outputBufferCount;
+    OMX_BUFFERHEADERTYPE *outputBuffers[OMX_JPEG_DEC_MAX_BUFFERS];
+    OMX_U32 numOutputBuffers;
+    OMX_BUFFERHEADERTYPE *outputFilled[OMX_JPEG_DEC_MAX_BUFFERS];   // FIFO of buffers returned by FillBufferDone
+    OMX_U32 outputFilledHead;
+    OMX_U32 numOutputFilled;
+    OMX_BUFFERHEADERTYPE *outputFree[OMX_JPEG_DEC_MAX_BUFFERS];     // written by the consumer, to be refilled
+    OMX_U32 numOutputFree;
+    bool presizeOutput;             // size the output port from the JPEG header before feeding the data
+
+    pthread_mutex_t lock;           // guards the buffer lists and everything below
+    pthread_cond_t stateCond;       // signaled whenever a buffer comes back or an event arrives
+    pthread_cond_t outputCond;      // signaled by FillBufferDone
+    bool portSettingsChanged;
 
-    VCOS_SEMAPHORE_T handler_lock;
-    VCOS_SEMAPHORE_T portChangeLock;
-} OMXImageDecode_s;
+    // the consumer writes the filled output buffers to the sink on its own thread
+    pthread_t consumer;
+    bool stopping;
+    OMXSink_t sink;
+    bool sinkFailed;
+    OMX_U32 numStreams;             // images handed to the decoder
+    OMX_U32 numStreamsWritten;      // images the consumer has written to the sink
+};
 
 
 
@@ -94,7 +131,10 @@ static OMX_ERRORTYPE omxEventHandler(
 
         case OMX_EventPortSettingsChanged:
             printf("Port: %d  nData2: %x\n", nData1, nData2);
-            vcos_semaphore_post(&ctx->portChangeLock);
+            pthread_mutex_lock(&ctx->lock);
+            ctx->portSettingsChanged = true;
+            pthread_cond_broadcast(&ctx->stateCond);
+            pthread_mutex_unlock(&ctx->lock);
             break;
 
         case OMX_EventError:
@@ -119,11 +159,11 @@ static OMX_ERRORTYPE omxEmptyBufferDone(
                                         OMX_IN OMX_HANDLETYPE hComponent,
                                         OMX_IN OMX_PTR pAppData,
                                         OMX_IN OMX_BUFFERHEADERTYPE* pBuffer) {
-    puts("omxEmptyBufferDone");
     OMXImageDecode_s *ctx = (OMXImageDecode_s*)pAppData;
-    vcos_semaphore_wait(&ctx->handler_lock);
-    ctx->inputReady = true;
-    vcos_semaphore_post(&ctx->handler_lock);
+    pthread_mutex_lock(&ctx->lock);
+    ctx->inputFree[ctx->numInputFree++] = pBuffer;
+    pthread_cond_broadcast(&ctx->stateCond);
+    pthread_mutex_unlock(&ctx->lock);
     return OMX_ErrorNone;
 }
 
@@ -133,17 +173,21 @@ static OMX_ERRORTYPE omxFillBufferDone(
                                        OMX_OUT OMX_HANDLETYPE hComponent,
                                        OMX_OUT OMX_PTR pAppData,
                                        OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer) {
-    puts("omxFillBufferDone");
     OMXImageDecode_s *ctx = (OMXImageDecode_s*)pAppData;
-    vcos_semaphore_wait(&ctx->handler_lock);
-    ctx->outputReady = true;
-    vcos_semaphore_post(&ctx->handler_lock);
+    pthread_mutex_lock(&ctx->lock);
+    const OMX_U32 tail = (ctx->outputFilledHead + ctx->numOutputFilled) % OMX_JPEG_DEC_MAX_BUFFERS;
+    ctx->outputFilled[tail] = pBuffer;
+    ctx->numOutputFilled++;
+    pthread_cond_signal(&ctx->outputCond);
+    pthread_mutex_unlock(&ctx->lock);
     return OMX_ErrorNone;
 }
 
 
 
-static void setupInputPort(OMXImageDecode_s *ctx, OMX_IMAGE_CODINGTYPE format) {
+// With jpegData the input buffers are placed straight on the mapped file if the component allows it
+// (see omxUseMappedBuffers), otherwise they are allocated and the data gets copied into them.
+static void setupInputPort(OMXImageDecode_s *ctx, OMX_IMAGE_CODINGTYPE format, const uint8_t *jpegData, size_t jpegDataSize) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
     OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
     OMX_INIT_STRUCTURE(portDefinition);
@@ -160,12 +204,34 @@ static void setupInputPort(OMXImageDecode_s *ctx, OMX_IMAGE_CODINGTYPE format) {
     omxErr = OMX_SetParameter(ctx->handle, OMX_IndexParamImagePortFormat, &imagePortFormat);
     omxAssert(omxErr);
 
-    omxEnablePort(ctx->handle, ctx->inputPortIndex, OMX_TRUE);
+    if (jpegData) {
+        ctx->inputWindowSize = omxUseMappedBuffers(ctx->handle, ctx->inputPortIndex, jpegData, jpegDataSize, ctx->inputBuffers, OMX_JPEG_DEC_MAX_BUFFERS, &ctx->numInputBuffers);
 
-    for (int i = 0; i < portDefinition.nBufferCountActual; i++) {
-        omxErr = OMX_AllocateBuffer(ctx->handle, &ctx->inputBuffer[i], ctx->inputPortIndex, i, portDefinition.nBufferSize);
+        if (ctx->inputWindowSize > 0) {
+            for (OMX_U32 i = 0; i < ctx->numInputBuffers; i++) {
+                ctx->inputFree[ctx->numInputFree++] = ctx->inputBuffers[i];
+            }
+
+            return;
+        }
+
+        puts(COLOR_RED "omxJPEGDec: the component does not take the mapped file, copying" COLOR_NC);
+    }
+
+    omxErr = omxSendCommand(ctx->handle, OMX_CommandPortEnable, ctx->inputPortIndex);
+    omxAssert(omxErr);
+
+    assert(portDefinition.nBufferCountActual <= OMX_JPEG_DEC_MAX_BUFFERS);
+    ctx->numInputBuffers = portDefinition.nBufferCountActual;
+
+    for (OMX_U32 i = 0; i < ctx->numInputBuffers; i++) {
+        omxErr = OMX_AllocateBuffer(ctx->handle, &ctx->inputBuffers[i], ctx->inputPortIndex, NULL, portDefinition.nBufferSize);
         omxAssert(omxErr);
+        ctx->inputFree[ctx->numInputFree++] = ctx->inputBuffers[i];
     }
+
+    omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortEnable, ctx->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
 }
 
 
@@ -184,6 +250,8 @@ static void prepareOutputPort(OMXImageDecode_s *ctx) {
 
 
 
+// allocates outputBufferCount output buffers (clamped to what the component accepts) and hands them all to
+// the decoder, so that it can go on with the next image while the consumer is still writing the previous one
 static void setupOutputPort(OMXImageDecode_s *ctx) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
     OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
@@ -192,6 +260,74 @@ static void setupOutputPort(OMXImageDecode_s *ctx) {
     omxErr = OMX_GetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
     omxAssert(omxErr);
 
+    //printf("%d x %d\n", portDefinition.format.image.nFrameWidth, portDefinition.format.image.nFrameHeight);
+    //omxPrintPort(ctx->handle, ctx->outputPortIndex);
+
+    portDefinition.nBufferCountActual = MIN(MAX(ctx->outputBufferCount, portDefinition.nBufferCountMin), OMX_JPEG_DEC_MAX_BUFFERS);
+    omxErr = OMX_SetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+    ctx->numOutputBuffers = portDefinition.nBufferCountActual;
+    ctx->outputPortDefinition = portDefinition;
+
+    omxErr = omxSendCommand(ctx->handle, OMX_CommandPortEnable, ctx->outputPortIndex);
+    omxAssert(omxErr);
+
+    for (OMX_U32 i = 0; i < ctx->numOutputBuffers; i++) {
+        omxErr = OMX_AllocateBuffer(ctx->handle, &ctx->outputBuffers[i], ctx->outputPortIndex, NULL, portDefinition.nBufferSize);
+        omxAssert(omxErr);
+    }
+
+    omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortEnable, ctx->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+
+    for (OMX_U32 i = 0; i < ctx->numOutputBuffers; i++) {
+        omxErr = OMX_FillThisBuffer(ctx->handle, ctx->outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+}
+
+
+
+static bool isSameOutputFormat(const OMX_PARAM_PORTDEFINITIONTYPE *a, const OMX_PARAM_PORTDEFINITIONTYPE *b) {
+    const OMX_IMAGE_PORTDEFINITIONTYPE *imageA = &a->format.image;
+    const OMX_IMAGE_PORTDEFINITIONTYPE *imageB = &b->format.image;
+    return (imageA->nFrameWidth == imageB->nFrameWidth) && (imageA->nFrameHeight == imageB->nFrameHeight) && (imageA->nStride == imageB->nStride) && (imageA->nSliceHeight == imageB->nSliceHeight) && (imageA->eColorFormat == imageB->eColorFormat) && (a->nBufferSize <= b->nBufferSize);
+}
+
+
+
+// waits for the decoder to give back all output buffers, frees them and leaves the output port disabled
+static void freeOutputPort(OMXImageDecode_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    omxErr = omxSendCommand(ctx->handle, OMX_CommandPortDisable, ctx->outputPortIndex);
+    omxAssert(omxErr);
+
+    // the decoder returns its buffers through the consumer
+    pthread_mutex_lock(&ctx->lock);
+
+    while (ctx->numOutputFree < ctx->numOutputBuffers) {
+        pthread_cond_wait(&ctx->stateCond, &ctx->lock);
+    }
+
+    ctx->numOutputFree = 0;
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (OMX_U32 i = 0; i < ctx->numOutputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(ctx->handle, ctx->outputPortIndex, ctx->outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    ctx->numOutputBuffers = 0;
+    omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortDisable, ctx->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+}
+
+
+
+// Follows OMX_EventPortSettingsChanged. The output buffers are only freed and allocated again if the new
+// settings do not fit them, consecutive images of the same size keep their buffers.
+static void reconfigureOutputPort(OMXImageDecode_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
     OMX_PARAM_U32TYPE numAvailableStreams;
     OMX_INIT_STRUCTURE(numAvailableStreams);
     numAvailableStreams.nPortIndex = ctx->outputPortIndex;
@@ -199,13 +335,244 @@ static void setupOutputPort(OMXImageDecode_s *ctx) {
     omxAssert(omxErr);
     assert(numAvailableStreams.nU32 > 0);
 
-    //printf("%d x %d\n", portDefinition.format.image.nFrameWidth, portDefinition.format.image.nFrameHeight);
-    //omxPrintPort(ctx->handle, ctx->outputPortIndex);
+    if (ctx->numOutputBuffers > 0) {
+        OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
+        OMX_INIT_STRUCTURE(portDefinition);
+        portDefinition.nPortIndex = ctx->outputPortIndex;
+        omxErr = OMX_GetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
+        omxAssert(omxErr);
+
+        if (isSameOutputFormat(&portDefinition, &ctx->outputPortDefinition)) {
+            return;
+        }
+
+        freeOutputPort(ctx);
+    }
+
+    setupOutputPort(ctx);
+}
+
+
+
+// Runs on its own thread: passes every filled output buffer to the sink and queues it to be refilled. Only
+// this thread waits for the sink, the decoder keeps filling the other output buffers meanwhile.
+static void * consumeOutputBuffers(void *userData) {
+    OMXImageDecode_s *ctx = userData;
+    pthread_mutex_lock(&ctx->lock);
+
+    while (true) {
+        while ((ctx->numOutputFilled == 0) && !ctx->stopping) {
+            pthread_cond_wait(&ctx->outputCond, &ctx->lock);
+        }
+
+        if (ctx->numOutputFilled == 0) {
+            break;
+        }
+
+        OMX_BUFFERHEADERTYPE *outputBuffer = ctx->outputFilled[ctx->outputFilledHead];
+        ctx->outputFilledHead = (ctx->outputFilledHead + 1) % OMX_JPEG_DEC_MAX_BUFFERS;
+        ctx->numOutputFilled--;
+        bool sinkFailed = ctx->sinkFailed;
+        pthread_mutex_unlock(&ctx->lock);
+
+        struct iovec chunk = { .iov_base = outputBuffer->pBuffer + outputBuffer->nOffset, .iov_len = outputBuffer->nFilledLen };
+
+        if ((chunk.iov_len > 0) && !sinkFailed && !omxSinkWrite(ctx->sink, &chunk, 1)) {
+            puts(COLOR_RED "omxJPEGDec: writing to the sink failed" COLOR_NC);
+            sinkFailed = true;
+        }
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->sinkFailed = sinkFailed;
+
+        if (outputBuffer->nFlags & OMX_BUFFERFLAG_EOS) {
+            ctx->numStreamsWritten++;
+        }
+
+        ctx->outputFree[ctx->numOutputFree++] = outputBuffer;
+        pthread_cond_broadcast(&ctx->stateCond);
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+
+
+// Expects ctx->lock to be locked. Hands the output buffers the consumer is done with back to the decoder
+// and follows port settings changes, so that all OMX calls are made by the thread owning the session.
+// Returns false if there was nothing to do.
+static bool serviceDecoder(OMXImageDecode_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMX_BUFFERHEADERTYPE *outputBuffers[OMX_JPEG_DEC_MAX_BUFFERS];
+    const bool portSettingsChanged = ctx->portSettingsChanged;
+    OMX_U32 numOutputBuffers = 0;
+
+    if (!portSettingsChanged) {
+        numOutputBuffers = ctx->numOutputFree;
+        memcpy(outputBuffers, ctx->outputFree, numOutputBuffers * sizeof(OMX_BUFFERHEADERTYPE *));
+        ctx->numOutputFree = 0;
+    }
+
+    if (!portSettingsChanged && (numOutputBuffers == 0)) {
+        return false;
+    }
+
+    ctx->portSettingsChanged = false;
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (OMX_U32 i = 0; i < numOutputBuffers; i++) {
+        omxErr = OMX_FillThisBuffer(ctx->handle, outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    if (portSettingsChanged) {
+        reconfigureOutputPort(ctx);
+    }
+
+    pthread_mutex_lock(&ctx->lock);
+    return true;
+}
+
+
+
+// Expects ctx->lock to be locked. Blocks until the decoder returned inputBuffer or any input buffer if it
+// is NULL (the mapped windows have a fixed order).
+static OMX_BUFFERHEADERTYPE * takeInputBuffer(OMXImageDecode_s *ctx, OMX_BUFFERHEADERTYPE *inputBuffer) {
+    while (true) {
+        for (OMX_U32 i = 0; i < ctx->numInputFree; i++) {
+            if (!inputBuffer || (ctx->inputFree[i] == inputBuffer)) {
+                inputBuffer = ctx->inputFree[i];
+                ctx->inputFree[i] = ctx->inputFree[--ctx->numInputFree];
+                return inputBuffer;
+            }
+        }
+
+        if (!serviceDecoder(ctx)) {
+            pthread_cond_wait(&ctx->stateCond, &ctx->lock);
+        }
+    }
+}
+
+
+
+// Expects ctx->lock to be locked. Blocks until the consumer wrote every queued image.
+static void waitForStreams(OMXImageDecode_s *ctx) {
+    while (ctx->numStreamsWritten < ctx->numStreams) {
+        if (!serviceDecoder(ctx)) {
+            pthread_cond_wait(&ctx->stateCond, &ctx->lock);
+        }
+    }
+}
+
 
-    omxEnablePort(ctx->handle, ctx->outputPortIndex, OMX_TRUE);
 
-    omxErr = OMX_AllocateBuffer(ctx->handle, &ctx->outputBuffer, ctx->outputPortIndex, NULL, portDefinition.nBufferSize);
+static OMX_COLOR_FORMATTYPE outputColorFormat(OMXImageDecode_s *ctx, const JPEGHeader_s *header) {
+    if ((header->subsampling == JPEG_SUBSAMPLING_422) && omxFormatCacheSupportsColorFormat(ctx->handle, ctx->outputPortIndex, OMX_COLOR_FormatYUV422PackedPlanar)) {
+        return OMX_COLOR_FormatYUV422PackedPlanar;
+    }
+
+    return OMX_COLOR_FormatYUV420PackedPlanar;
+}
+
+
+
+// Sizes the output port from the frame header before the decoder has seen the data, so that it can start
+// writing right away instead of stopping for OMX_EventPortSettingsChanged. Returns false if the component
+// does not take the settings, the event then sorts it out as before.
+static bool presizeOutputPort(OMXImageDecode_s *ctx, const JPEGHeader_s *header) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    const OMX_COLOR_FORMATTYPE colorFormat = outputColorFormat(ctx, header);
+    const OMX_IMAGE_PORTDEFINITIONTYPE *current = &ctx->outputPortDefinition.format.image;
+
+    if ((ctx->numOutputBuffers > 0) && (current->nFrameWidth == header->width) && (current->nFrameHeight == header->height) && (current->eColorFormat == colorFormat)) {
+        return true;
+    }
+
+    if (ctx->numOutputBuffers > 0) {
+        // the previous image still needs the old buffers
+        pthread_mutex_lock(&ctx->lock);
+        waitForStreams(ctx);
+        pthread_mutex_unlock(&ctx->lock);
+        freeOutputPort(ctx);
+    }
+
+    OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
+    OMX_INIT_STRUCTURE(portDefinition);
+    portDefinition.nPortIndex = ctx->outputPortIndex;
+    omxErr = OMX_GetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
     omxAssert(omxErr);
+    portDefinition.format.image.nFrameWidth = header->width;
+    portDefinition.format.image.nFrameHeight = header->height;
+    portDefinition.format.image.nStride = 0;
+    portDefinition.format.image.nSliceHeight = 0;
+    portDefinition.format.image.eCompressionFormat = OMX_IMAGE_CodingUnused;
+    portDefinition.format.image.eColorFormat = colorFormat;
+    omxErr = OMX_SetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
+
+    if (omxErr != OMX_ErrorNone) {
+        printf(COLOR_YELLOW "omxJPEGDec: output port not presized (%s)\n" COLOR_NC, omxErrorTypeEnum(omxErr));
+        return false;
+    }
+
+    setupOutputPort(ctx);
+    return true;
+}
+
+
+
+static void freeInputBuffers(OMXImageDecode_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+    for (OMX_U32 i = 0; i < ctx->numInputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(ctx->handle, ctx->inputPortIndex, ctx->inputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    ctx->numInputBuffers = 0;
+    ctx->numInputFree = 0;
+    ctx->inputWindowSize = 0;
+}
+
+
+
+// Keeps the input port if it already suits mapped (NULL for copying). Mapped windows are tied to one file
+// and its length, so a different file - or the same buffer reused for a different JPEG - cycles the port once
+// the decoder returned all input buffers.
+static void prepareInputPort(OMXImageDecode_s *ctx, const uint8_t *mapped, size_t mappedSize) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+    if ((ctx->numInputBuffers > 0) && (ctx->inputMapped == mapped)) {
+        if (!mapped || (ctx->inputWindowSize == 0)) {
+            return;     // copying takes JPEGs of any size
+        }
+
+        if ((ctx->inputMappedSize == mappedSize) && (mappedSize <= ctx->numInputBuffers * ctx->inputWindowSize)) {
+            return;
+        }
+    }
+
+    if (ctx->numInputBuffers > 0) {
+        pthread_mutex_lock(&ctx->lock);
+
+        while (ctx->numInputFree < ctx->numInputBuffers) {
+            if (!serviceDecoder(ctx)) {
+                pthread_cond_wait(&ctx->stateCond, &ctx->lock);
+            }
+        }
+
+        pthread_mutex_unlock(&ctx->lock);
+
+        omxErr = omxSendCommand(ctx->handle, OMX_CommandPortDisable, ctx->inputPortIndex);
+        omxAssert(omxErr);
+        freeInputBuffers(ctx);
+        omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortDisable, ctx->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+        omxAssert(omxErr);
+    }
+
+    setupInputPort(ctx, OMX_IMAGE_CodingJPEG, mapped, mappedSize);
+    ctx->inputMapped = mapped;
+    ctx->inputMappedSize = mappedSize;
 }
 
 
@@ -239,159 +606,339 @@ static void omxGetPorts(OMXImageDecode_s *ctx) {
 
 
 
-void omxJPEGDec() {
-    MapFile_s map;
-    initMapFile(&map, "36903_9_1.jpg", MAP_RO);
-    assert(map.len > 0);
-    uint8_t *jpegData = map.data;
-    printf("jpegDataSize: %zu\n", map.len);
-
-    uint32_t rawImageWidth = 0;
-    uint32_t rawImageHeight = 0;
-    uint8_t rawImageChannels = 0;
-    uint8_t *rawImage = NULL;
-
-
+OMXImageDecode_s * omxJPEGDecInit(uint32_t outputBufferCount, OMXSink_t sink) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    OMX_STATETYPE omxState = OMX_StateInvalid;
-    VCOS_STATUS_T vcosErr = VCOS_SUCCESS;
 
-    bcm_host_init();
-    omxErr = OMX_Init();
-    omxAssert(omxErr);
-
-    //omxListComponents();
-
-    OMXImageDecode_s ctx;
-    memset(&ctx, 0, sizeof(ctx));
-    //ctx.inputPortDefinition = malloc(sizeof(OMX_PARAM_PORTDEFINITIONTYPE));
+    OMXImageDecode_s *ctx = calloc(1, sizeof(OMXImageDecode_s));
+    assert(ctx != NULL);
+    ctx->outputBufferCount = outputBufferCount;
+    ctx->presizeOutput = true;
+    ctx->sink = sink;
+    //ctx->inputPortDefinition = malloc(sizeof(OMX_PARAM_PORTDEFINITIONTYPE));
 
-    vcosErr = vcos_semaphore_create(&ctx.handler_lock, "handler_lock", 1);
-    assert(vcosErr == VCOS_SUCCESS);
-    vcosErr = vcos_semaphore_create(&ctx.portChangeLock, "portChangeLock", 1);
-    assert(vcosErr == VCOS_SUCCESS);
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->stateCond, NULL);
+    pthread_cond_init(&ctx->outputCond, NULL);
 
-    //OMX_HANDLETYPE ctx.handle = NULL;
     OMX_STRING omxComponentName = "OMX.broadcom.image_decode";
     OMX_CALLBACKTYPE omxCallbacks;
     omxCallbacks.EventHandler = omxEventHandler;
     omxCallbacks.EmptyBufferDone = omxEmptyBufferDone;
     omxCallbacks.FillBufferDone = omxFillBufferDone;
 
-    omxErr = OMX_GetHandle(&ctx.handle, omxComponentName, &ctx, &omxCallbacks);
+    omxErr = omxGetHandle(&ctx->handle, omxComponentName, ctx, &omxCallbacks);
+    omxAssert(omxErr);
+    omxAssertState(ctx->handle, OMX_StateLoaded);
+
+    omxGetPorts(ctx);
+    omxErr = omxEnablePort(ctx->handle, ctx->inputPortIndex, OMX_FALSE);
     omxAssert(omxErr);
-    omxAssertState(ctx.handle, OMX_StateLoaded);
+    omxErr = omxEnablePort(ctx->handle, ctx->outputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(ctx->handle, OMX_StateIdle);
+    omxAssert(omxErr);
+    prepareOutputPort(ctx);
+    omxErr = omxSwitchToState(ctx->handle, OMX_StateExecuting);
+    omxAssert(omxErr);
+
+    pthread_create(&ctx->consumer, NULL, consumeOutputBuffers, ctx);
+    return ctx;
+}
 
 
-    omxGetPorts(&ctx);
-    omxEnablePort(ctx.handle, ctx.inputPortIndex, OMX_FALSE);
-    omxEnablePort(ctx.handle, ctx.outputPortIndex, OMX_FALSE);
-    omxSwitchToState(ctx.handle, OMX_StateIdle);
-    setupInputPort(&ctx, OMX_IMAGE_CodingJPEG);
-    prepareOutputPort(&ctx);
-    omxSwitchToState(ctx.handle, OMX_StateExecuting);
 
+void omxJPEGDecDeinit(OMXImageDecode_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    omxJPEGDecFlush(ctx);
 
-    uint8_t *jpegDataPtr = jpegData;
-    size_t jpegDataRemaining = map.len;
-    int bufferIndex = 0;
-    ctx.inputReady = true;
-    ctx.outputReady = false;
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stopping = true;
+    pthread_cond_signal(&ctx->outputCond);
+    pthread_mutex_unlock(&ctx->lock);
+    pthread_join(ctx->consumer, NULL);
 
-    FILE * output = fopen("out.data", "wb");
+    omxErr = omxSwitchToState(ctx->handle, OMX_StateIdle);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(ctx->handle, OMX_CommandPortDisable, ctx->inputPortIndex);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(ctx->handle, OMX_CommandPortDisable, ctx->outputPortIndex);
+    omxAssert(omxErr);
 
-    while (true) {
-        if (ctx.outputReady) {
-            ctx.outputReady = false;
+    freeInputBuffers(ctx);
 
-            fwrite(ctx.outputBuffer->pBuffer + ctx.outputBuffer->nOffset, sizeof(uint8_t), ctx.outputBuffer->nFilledLen, output);
+    for (OMX_U32 i = 0; i < ctx->numOutputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(ctx->handle, ctx->outputPortIndex, ctx->outputBuffers[i]);
+        omxAssert(omxErr);
+    }
 
-            printf("nFilledLen: %d\n", ctx.outputBuffer->nFilledLen);
-            printf("nFlags: 0x%08x\n", ctx.outputBuffer->nFlags);
+    omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortDisable, ctx->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortDisable, ctx->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(ctx->handle, OMX_StateLoaded);
+    omxAssert(omxErr);
+    omxErr = omxFreeHandle(ctx->handle);
+    omxAssert(omxErr);
 
-            if (ctx.outputBuffer->nFlags & OMX_BUFFERFLAG_EOS) {
-                puts("received OMX_BUFFERFLAG_EOS");
-                break;
-            }
+    pthread_cond_destroy(&ctx->outputCond);
+    pthread_cond_destroy(&ctx->stateCond);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
 
-            puts("OMX_FillThisBuffer");
-            omxErr = OMX_FillThisBuffer(ctx.handle, ctx.outputBuffer);
-            omxAssert(omxErr);
-        }
 
-        if (ctx.inputReady) {
-            ctx.inputReady = false;
 
-            if (jpegDataRemaining == 0) {
-                continue;
-            }
+void omxJPEGDecProcess(OMXImageDecode_s *ctx, const uint8_t *jpegData, size_t jpegDataSize, bool mapped) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    prepareInputPort(ctx, mapped ? jpegData : NULL, jpegDataSize);
+    JPEGHeader_s header;
+
+    if (ctx->presizeOutput && jpegReadHeader(&header, jpegData, jpegDataSize)) {
+        presizeOutputPort(ctx, &header);
+    }
 
-            OMX_BUFFERHEADERTYPE *inBuffer = ctx.inputBuffer[bufferIndex];
-            bufferIndex++;
-            bufferIndex %= 3;
+    const uint8_t *jpegDataPtr = jpegData;
+    size_t jpegDataRemaining = jpegDataSize;
+    pthread_mutex_lock(&ctx->lock);
+    ctx->numStreams++;
+
+    for (int window = 0; jpegDataRemaining > 0; window++) {
+        OMX_BUFFERHEADERTYPE *inBuffer;
+
+        if (ctx->inputWindowSize > 0) {
+            inBuffer = takeInputBuffer(ctx, ctx->inputBuffers[window]);
+            pthread_mutex_unlock(&ctx->lock);
+            assert(inBuffer->pBuffer == jpegDataPtr);
+            inBuffer->nFilledLen = MIN(jpegDataRemaining, ctx->inputWindowSize);
+        } else {
+            inBuffer = takeInputBuffer(ctx, NULL);
+            pthread_mutex_unlock(&ctx->lock);
             inBuffer->nFilledLen = MIN(jpegDataRemaining, inBuffer->nAllocLen);
-            jpegDataRemaining -= inBuffer->nFilledLen;
             memcpy(inBuffer->pBuffer, jpegDataPtr, inBuffer->nFilledLen);
-            jpegDataPtr += inBuffer->nFilledLen;
+        }
 
-            inBuffer->nOffset = 0;
-            inBuffer->nFlags = 0;
+        jpegDataRemaining -= inBuffer->nFilledLen;
+        jpegDataPtr += inBuffer->nFilledLen;
 
-            if (jpegDataRemaining <= 0) {
-                puts("signaling OMX_BUFFERFLAG_EOS");
-                inBuffer->nFlags = OMX_BUFFERFLAG_EOS;
-            }
+        inBuffer->nOffset = 0;
+        inBuffer->nFlags = (jpegDataRemaining == 0) ? OMX_BUFFERFLAG_EOS : 0;
 
-            puts("OMX_EmptyThisBuffer");
-            omxErr = OMX_EmptyThisBuffer(ctx.handle, inBuffer);
-            omxAssert(omxErr);
+        omxErr = OMX_EmptyThisBuffer(ctx->handle, inBuffer);
+        omxAssert(omxErr);
+        pthread_mutex_lock(&ctx->lock);
+    }
 
-            if (!ctx.outputBuffer) {
-                puts("wait for port change...");
-                vcos_semaphore_wait(&ctx.portChangeLock);
-                puts("continuing...");
+    pthread_mutex_unlock(&ctx->lock);
+}
 
-                setupOutputPort(&ctx);
 
-                puts("OMX_FillThisBuffer");
-                omxErr = OMX_FillThisBuffer(ctx.handle, ctx.outputBuffer);
-                omxAssert(omxErr);
-            }
-        }
+
+bool omxJPEGDecFlush(OMXImageDecode_s *ctx) {
+    pthread_mutex_lock(&ctx->lock);
+    waitForStreams(ctx);
+
+    const bool sinkFailed = ctx->sinkFailed;
+    ctx->sinkFailed = false;
+    pthread_mutex_unlock(&ctx->lock);
+    return !sinkFailed;
+}
+
+
+
+typedef struct {
+    OMXSink_t sink;
+    useconds_t delay;
+} SlowSink_s;
+
+
+
+// stands in for a consumer with write latency (SD card, network)
+static bool slowSinkWrite(void *userData, const struct iovec *iov, int iovcnt) {
+    const SlowSink_s *slowSink = userData;
+    usleep(slowSink->delay);
+    return omxSinkWrite(slowSink->sink, iov, iovcnt);
+}
+
+
+
+// Decodes the same JPEG numStreams times in a row into out.data. mapped hands the mapped file to the
+// decoder instead of copying it into allocated buffers.
+static double omxJPEGDecBenchmark(const uint8_t *jpegData, size_t jpegDataSize, uint32_t numStreams, uint32_t outputBufferCount, useconds_t consumerDelay, bool mapped) {
+    int fd = open("out.data", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    SlowSink_s slowSink = { .sink = omxFdSink(fd), .delay = consumerDelay };
+    OMXImageDecode_s *ctx = omxJPEGDecInit(outputBufferCount, (OMXSink_t){ .write = slowSinkWrite, .userData = &slowSink });
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t s = 0; s < numStreams; s++) {
+        omxJPEGDecProcess(ctx, jpegData, jpegDataSize, mapped);
     }
 
-    fclose(output);
-    freeMapFile(&map);
+    bool success = omxJPEGDecFlush(ctx);
+    assert(success);
 
-    omxSwitchToState(ctx.handle, OMX_StateIdle);
-    omxEnablePort(ctx.handle, ctx.inputPortIndex, OMX_FALSE);
-    omxEnablePort(ctx.handle, ctx.outputPortIndex, OMX_FALSE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
 
-    // Deallocate input buffer
-    {
-        OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
-        OMX_INIT_STRUCTURE(portDefinition);
-        portDefinition.nPortIndex = ctx.inputPortIndex;
-        omxErr = OMX_GetParameter(ctx.handle, OMX_IndexParamPortDefinition, &portDefinition);
-        omxAssert(omxErr);
+    omxJPEGDecDeinit(ctx);
+    close(fd);
+    return numStreams / seconds;
+}
 
-        for (int i = 0; i < portDefinition.nBufferCountActual; i++) {
-            omxErr = OMX_FreeBuffer(ctx.handle, ctx.inputPortIndex, ctx.inputBuffer[i]);
-            omxAssert(omxErr);
+
+
+// maps up to maxMaps JPEGs of directory, returns how many
+static uint32_t mapDirectory(const char *directory, MapFile_s *maps, uint32_t maxMaps) {
+    DIR *dir = opendir(directory);
+
+    if (!dir) {
+        printf("%s not found, skipping the directory benchmarks\n", directory);
+        return 0;
+    }
+
+    uint32_t numMaps = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) && (numMaps < maxMaps)) {
+        const char *extension = strrchr(entry->d_name, '.');
+
+        if (!extension || (strcasecmp(extension, ".jpg") != 0)) {
+            continue;
         }
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        initMapFile(&maps[numMaps], path, MAP_RO);
+        numMaps++;
     }
-    
-    // Deallocate output buffer
-    {
-        omxErr = OMX_FreeBuffer(ctx.handle, ctx.outputPortIndex, ctx.outputBuffer);
-        omxAssert(omxErr);
+
+    closedir(dir);
+    return numMaps;
+}
+
+
+
+// all images once with a new decoder per image and once through one session
+static void omxJPEGDecDirectoryBenchmark(const MapFile_s *maps, uint32_t numMaps) {
+    int fd = open("/dev/null", O_WRONLY);
+    assert(fd >= 0);
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < numMaps; i++) {
+        OMXImageDecode_s *ctx = omxJPEGDecInit(2, omxFdSink(fd));
+        omxJPEGDecProcess(ctx, maps[i].data, maps[i].len, false);
+        omxJPEGDecDeinit(ctx);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    OMXImageDecode_s *ctx = omxJPEGDecInit(2, omxFdSink(fd));
+
+    for (uint32_t i = 0; i < numMaps; i++) {
+        omxJPEGDecProcess(ctx, maps[i].data, maps[i].len, false);
+    }
+
+    omxJPEGDecFlush(ctx);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secondsSession = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    omxJPEGDecDeinit(ctx);
+
+    printf(COLOR_YELLOW "%d images: %.2f images/s (decoder per image), %.2f images/s (session)\n" COLOR_NC, numMaps, numMaps / seconds, numMaps / secondsSession);
+
+    close(fd);
+}
+
+
+
+
+
+
+typedef struct {
+    OMXSink_t sink;
+    bool written;
+    struct timespec firstWrite;
+} FirstWriteSink_s;
+
+
+
+static bool firstWriteSinkWrite(void *userData, const struct iovec *iov, int iovcnt) {
+    FirstWriteSink_s *firstWriteSink = userData;
+
+    if (!firstWriteSink->written) {
+        clock_gettime(CLOCK_MONOTONIC, &firstWriteSink->firstWrite);
+        firstWriteSink->written = true;
+    }
+
+    return omxSinkWrite(firstWriteSink->sink, iov, iovcnt);
+}
+
+
+
+// Average time from handing over an image to its first decoded bytes reaching the sink, one image at a
+// time. With presizeOutput off every change of size costs an OMX_EventPortSettingsChanged round trip.
+static double omxJPEGDecLatencyBenchmark(const MapFile_s *maps, uint32_t numMaps, bool presizeOutput) {
+    int fd = open("/dev/null", O_WRONLY);
+    assert(fd >= 0);
+    FirstWriteSink_s firstWriteSink = { .sink = omxFdSink(fd) };
+    OMXImageDecode_s *ctx = omxJPEGDecInit(2, (OMXSink_t){ .write = firstWriteSinkWrite, .userData = &firstWriteSink });
+    ctx->presizeOutput = presizeOutput;
+    double seconds = 0;
+
+    for (uint32_t i = 0; i < numMaps; i++) {
+        struct timespec start;
+        firstWriteSink.written = false;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        omxJPEGDecProcess(ctx, maps[i].data, maps[i].len, false);
+        omxJPEGDecFlush(ctx);
+        seconds += (firstWriteSink.firstWrite.tv_sec - start.tv_sec) + (firstWriteSink.firstWrite.tv_nsec - start.tv_nsec) * 1e-9;
+    }
+
+    omxJPEGDecDeinit(ctx);
+    close(fd);
+    return seconds / numMaps;
+}
+
+
+
+void omxJPEGDec() {
+    MapFile_s map;
+    initMapFile(&map, "36903_9_1.jpg", MAP_RO);
+    assert(map.len > 0);
+    printf("jpegDataSize: %zu\n", map.len);
+
+    const uint32_t numStreams = 16;
+    const useconds_t consumerDelay = 20000;
+    uint32_t outputBufferCounts[] = { 1, 2, 3 };
+    int numOutputBufferCounts = sizeof(outputBufferCounts) / sizeof(outputBufferCounts[0]);
+
+    for (int i = 0; i < numOutputBufferCounts; i++) {
+        double fps = omxJPEGDecBenchmark(map.data, map.len, numStreams, outputBufferCounts[i], consumerDelay, false);
+        printf(COLOR_YELLOW "%d output buffers: %.2f fps (consumer needs %d ms per buffer)\n" COLOR_NC, outputBufferCounts[i], fps, consumerDelay / 1000);
+    }
+
+    double fps = omxJPEGDecBenchmark(map.data, map.len, numStreams, 3, 0, false);
+    double fpsZeroCopy = omxJPEGDecBenchmark(map.data, map.len, numStreams, 3, 0, true);
+    printf(COLOR_YELLOW "input: %.2f fps (copy), %.2f fps (mapped)\n" COLOR_NC, fps, fpsZeroCopy);
+
+    freeMapFile(&map);
+
+    MapFile_s maps[256];
+    uint32_t numMaps = mapDirectory("images", maps, 256);
+
+    if (numMaps > 0) {
+        omxJPEGDecDirectoryBenchmark(maps, numMaps);
+        double latency = omxJPEGDecLatencyBenchmark(maps, numMaps, false);
+        double latencyPresized = omxJPEGDecLatencyBenchmark(maps, numMaps, true);
+        printf(COLOR_YELLOW "first output: %.2f ms (port settings changed), %.2f ms (presized from the header)\n" COLOR_NC, latency * 1000, latencyPresized * 1000);
+    }
+
+    for (uint32_t i = 0; i < numMaps; i++) {
+        freeMapFile(&maps[i]);
     }
-    
-    omxSwitchToState(ctx.handle, OMX_StateLoaded);
-    omxErr = OMX_FreeHandle(ctx.handle);
-    omxAssert(omxErr);
-    
-    // insert code here...
-    printf("Hello, World!\n");
-    return 0;
 }
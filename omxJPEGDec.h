@@ -10,6 +10,30 @@
 #define omxJPEGDec_h
 
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "omxSink.h"
+
+
+// forward declaration of a typedef struct
+struct OMXImageDecode_s;
+typedef struct OMXImageDecode_s OMXImageDecode_s;
+
+
+// Decoder session: one handle decodes any number of JPEGs, the decoded frames are written to sink on a
+// consumer thread. The output buffers (outputBufferCount, clamped to what the component accepts) are kept
+// as long as consecutive images share size and colour format.
+OMXImageDecode_s * omxJPEGDecInit(uint32_t outputBufferCount, OMXSink_t sink);
+void omxJPEGDecDeinit(OMXImageDecode_s *ctx);
+
+// Queues one JPEG and returns as soon as the decoder took all of it. mapped hands jpegData to the decoder
+// in place instead of copying it, it then has to stay valid until omxJPEGDecFlush.
+void omxJPEGDecProcess(OMXImageDecode_s *ctx, const uint8_t *jpegData, size_t jpegDataSize, bool mapped);
+// waits until every queued image has been written, returns false if the sink failed since the last flush
+bool omxJPEGDecFlush(OMXImageDecode_s *ctx);
+
 void omxJPEGDec(void);
 
 
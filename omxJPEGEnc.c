@@ -12,16 +12,28 @@
 #include "omxJPEGEnc.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>  // MIN
+#include <time.h>
+#include <unistd.h>
 
 #define OMX_SKIP64BIT
 #include <IL/OMX_Core.h>
 #include <interface/vcos/vcos.h>
 
 #include "cHelper.h"
+#include "omxDump.h"
 #include "omxHelper.h"
+#include "omxSink.h"
+
+
+
+#define OMX_JPEG_ENC_MAX_BUFFERS 16
 
 
 
@@ -29,12 +41,20 @@ typedef struct {
     OMX_HANDLETYPE handle;
 
     OMX_U32 inputPortIndex;
-    OMX_BUFFERHEADERTYPE *inputBuffer;
-    bool inputReady;
+    OMX_U32 inputStride;
+    OMX_BUFFERHEADERTYPE *inputBuffers[OMX_JPEG_ENC_MAX_BUFFERS];
+    OMX_U32 numInputBuffers;
+    OMX_BUFFERHEADERTYPE *inputFree[OMX_JPEG_ENC_MAX_BUFFERS];      // empty input buffers owned by the host
+    OMX_U32 numInputFree;
 
-    OMX_BUFFERHEADERTYPE *outputBuffer;
     OMX_U32 outputPortIndex;
-    bool outputReady;
+    OMX_BUFFERHEADERTYPE *outputBuffers[OMX_JPEG_ENC_MAX_BUFFERS];
+    OMX_U32 numOutputBuffers;
+    OMX_BUFFERHEADERTYPE *outputFilled[OMX_JPEG_ENC_MAX_BUFFERS];   // FIFO of buffers returned by FillBufferDone
+    OMX_U32 outputFilledHead;
+    OMX_U32 numOutputFilled;
+
+    pthread_mutex_t lock;   // guards inputFree and outputFilled
 } OMXImageEncode_s;
 
 
@@ -42,6 +62,26 @@ typedef struct {
 struct OMXContext_s {
     OMXImageEncode_s imageEncode;
 
+    // current configuration, see omxJPEGEncReconfigure and omxJPEGEncSetQuality
+    uint32_t width;
+    uint32_t height;
+    uint32_t sliceHeight;
+    OMX_COLOR_FORMATTYPE colorFormat;
+    uint32_t bufferCount;
+    uint8_t quality;
+
+    // frame in progress, see omxJPEGEncBeginFrame
+    OMX_BUFFERHEADERTYPE *slice;
+    OMXSink_t sink;
+    size_t outputFill;
+    bool sinkFailed;
+    bool endOfFrame;
+
+    // batch in progress, see omxJPEGEncBatch
+    OMXJPEGEncFrame_s *batch;
+    uint32_t batchSize;
+    uint32_t batchOutput;   // frame the encoder output currently belongs to
+
     VCOS_SEMAPHORE_T handler_lock;
 };
 
@@ -104,8 +144,10 @@ static OMX_ERRORTYPE omxEmptyBufferDone(
                                         OMX_IN OMX_PTR pAppData,
                                         OMX_IN OMX_BUFFERHEADERTYPE *pBuffer) {
     OMXContext_s *ctx = (OMXContext_s*)pAppData;
-//    vcos_semaphore_wait(&ctx->handler_lock);
-    ctx->imageEncode.inputReady = true;
+    OMXImageEncode_s *component = &ctx->imageEncode;
+    pthread_mutex_lock(&component->lock);
+    component->inputFree[component->numInputFree++] = pBuffer;
+    pthread_mutex_unlock(&component->lock);
     vcos_semaphore_post(&ctx->handler_lock);
     return OMX_ErrorNone;
 }
@@ -117,8 +159,12 @@ static OMX_ERRORTYPE omxFillBufferDone(
                                        OMX_OUT OMX_PTR pAppData,
                                        OMX_OUT OMX_BUFFERHEADERTYPE *pBuffer) {
     OMXContext_s *ctx = (OMXContext_s*)pAppData;
-//    vcos_semaphore_wait(&ctx->handler_lock);
-    ctx->imageEncode.outputReady = true;
+    OMXImageEncode_s *component = &ctx->imageEncode;
+    pthread_mutex_lock(&component->lock);
+    const OMX_U32 tail = (component->outputFilledHead + component->numOutputFilled) % OMX_JPEG_ENC_MAX_BUFFERS;
+    component->outputFilled[tail] = pBuffer;
+    component->numOutputFilled++;
+    pthread_mutex_unlock(&component->lock);
     vcos_semaphore_post(&ctx->handler_lock);
     return OMX_ErrorNone;
 }
@@ -154,7 +200,7 @@ static void getImageEncodePorts(OMXImageEncode_s *component) {
 
 
 
-static bool setupImageEncodeInputPort(OMXImageEncode_s *component, OMX_U32 nFrameWidth, OMX_U32 nFrameHeight, OMX_U32 nSliceHeight, OMX_COLOR_FORMATTYPE eColorFormat) {
+static bool setupImageEncodeInputPort(OMXImageEncode_s *component, OMX_U32 nFrameWidth, OMX_U32 nFrameHeight, OMX_U32 nSliceHeight, OMX_COLOR_FORMATTYPE eColorFormat, OMX_U32 nBufferCount) {
     assert((nSliceHeight == 16) || (nSliceHeight == nFrameHeight));
     assert(omxAssertImagePortFormatSupported(component->handle, component->inputPortIndex, eColorFormat));
     // supports also OMX_COLOR_Format8bitPalette
@@ -172,6 +218,7 @@ static bool setupImageEncodeInputPort(OMXImageEncode_s *component, OMX_U32 nFram
     portDefinition.format.image.bFlagErrorConcealment = OMX_FALSE;
     portDefinition.format.image.eCompressionFormat = OMX_IMAGE_CodingUnused;
     portDefinition.format.image.eColorFormat = eColorFormat;
+    portDefinition.nBufferCountActual = MIN(MAX(nBufferCount, portDefinition.nBufferCountMin), OMX_JPEG_ENC_MAX_BUFFERS);
     omxErr = OMX_SetParameter(component->handle, OMX_IndexParamPortDefinition, &portDefinition);
 
     if (omxErr != OMX_ErrorNone) {
@@ -185,17 +232,28 @@ static bool setupImageEncodeInputPort(OMXImageEncode_s *component, OMX_U32 nFram
 
     omxPrintPort(component->handle, component->inputPortIndex);
     printf("%d %d (%d)\n", nFrameWidth, nSliceHeight, portDefinition.nBufferSize);
+    component->inputStride = portDefinition.format.image.nStride;
+
+    omxErr = omxSendCommand(component->handle, OMX_CommandPortEnable, component->inputPortIndex);
+    omxAssert(omxErr);
 
-    omxEnablePort(component->handle, component->inputPortIndex, OMX_TRUE);
+    component->numInputBuffers = portDefinition.nBufferCountActual;
+    component->numInputFree = 0;
 
-    omxErr = OMX_AllocateBuffer(component->handle, &component->inputBuffer, component->inputPortIndex, NULL, portDefinition.nBufferSize);
+    for (OMX_U32 i = 0; i < component->numInputBuffers; i++) {
+        omxErr = OMX_AllocateBuffer(component->handle, &component->inputBuffers[i], component->inputPortIndex, NULL, portDefinition.nBufferSize);
+        omxAssert(omxErr);
+        component->inputFree[component->numInputFree++] = component->inputBuffers[i];
+    }
+
+    omxErr = omxWaitForCommand(component->handle, OMX_CommandPortEnable, component->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
     omxAssert(omxErr);
     return true;
 }
 
 
 
-static void setupImageEncodeOutputPort(OMXImageEncode_s *component, OMX_U32 nQFactor) {
+static void setupImageEncodeOutputPort(OMXImageEncode_s *component, OMX_U32 nQFactor, OMX_U32 nBufferCount) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
     OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
     OMX_INIT_STRUCTURE(portDefinition);
@@ -205,6 +263,7 @@ static void setupImageEncodeOutputPort(OMXImageEncode_s *component, OMX_U32 nQFa
     portDefinition.format.image.bFlagErrorConcealment = OMX_FALSE;
     portDefinition.format.image.eCompressionFormat = OMX_IMAGE_CodingJPEG;
     portDefinition.format.image.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+    portDefinition.nBufferCountActual = MIN(MAX(nBufferCount, portDefinition.nBufferCountMin), OMX_JPEG_ENC_MAX_BUFFERS);
     omxErr = OMX_SetParameter(component->handle, OMX_IndexParamPortDefinition, &portDefinition);
     omxAssert(omxErr);
     omxErr = OMX_GetParameter(component->handle, OMX_IndexParamPortDefinition, &portDefinition);
@@ -217,25 +276,53 @@ static void setupImageEncodeOutputPort(OMXImageEncode_s *component, OMX_U32 nQFa
     omxErr = OMX_SetParameter(component->handle, OMX_IndexParamQFactor, &qFactor);
     omxAssert(omxErr);
 
-    omxEnablePort(component->handle, component->outputPortIndex, OMX_TRUE);
+    omxErr = omxSendCommand(component->handle, OMX_CommandPortEnable, component->outputPortIndex);
+    omxAssert(omxErr);
+
+    component->numOutputBuffers = portDefinition.nBufferCountActual;
+    component->numOutputFilled = 0;
+
+    for (OMX_U32 i = 0; i < component->numOutputBuffers; i++) {
+        omxErr = OMX_AllocateBuffer(component->handle, &component->outputBuffers[i], component->outputPortIndex, NULL, portDefinition.nBufferSize);
+        omxAssert(omxErr);
+    }
 
-    omxErr = OMX_AllocateBuffer(component->handle, &component->outputBuffer, component->outputPortIndex, NULL, portDefinition.nBufferSize);
+    omxErr = omxWaitForCommand(component->handle, OMX_CommandPortEnable, component->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
     omxAssert(omxErr);
 }
 
 
 
+static void freeImageEncodeInputBuffers(OMXImageEncode_s *component) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+    for (OMX_U32 i = 0; i < component->numInputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(component->handle, component->inputPortIndex, component->inputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    component->numInputBuffers = 0;
+    component->numInputFree = 0;
+}
+
+
+
 static void freeImageEncodeBuffers(OMXImageEncode_s *component) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    omxErr = OMX_FreeBuffer(component->handle, component->inputPortIndex, component->inputBuffer);
-    omxAssert(omxErr);
-    omxErr = OMX_FreeBuffer(component->handle, component->outputPortIndex, component->outputBuffer);
-    omxAssert(omxErr);
+    freeImageEncodeInputBuffers(component);
+
+    for (OMX_U32 i = 0; i < component->numOutputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(component->handle, component->outputPortIndex, component->outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    component->numOutputBuffers = 0;
+    component->numOutputFilled = 0;
 }
 
 
 
-OMXContext_s * omxJPEGEncInit(uint32_t rawImageWidth, uint32_t rawImageHeight, uint32_t sliceHeight, uint8_t outputQuality, OMX_COLOR_FORMATTYPE colorFormat) {
+OMXContext_s * omxJPEGEncInit(uint32_t rawImageWidth, uint32_t rawImageHeight, uint32_t sliceHeight, uint8_t outputQuality, OMX_COLOR_FORMATTYPE colorFormat, uint32_t bufferCount) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
     VCOS_STATUS_T vcosErr = VCOS_SUCCESS;
     int result;
@@ -245,227 +332,613 @@ OMXContext_s * omxJPEGEncInit(uint32_t rawImageWidth, uint32_t rawImageHeight, u
 
     vcosErr = vcos_semaphore_create(&ctx->handler_lock, "handler_lock", 1);
     assert(vcosErr == VCOS_SUCCESS);
+    result = pthread_mutex_init(&ctx->imageEncode.lock, NULL);
+    assert(result == 0);
 
     OMX_STRING omxComponentName = "OMX.broadcom.image_encode";
     OMX_CALLBACKTYPE omxCallbacks;
     omxCallbacks.EventHandler = omxEventHandler;
     omxCallbacks.EmptyBufferDone = omxEmptyBufferDone;
     omxCallbacks.FillBufferDone = omxFillBufferDone;
-    omxErr = OMX_GetHandle(&ctx->imageEncode.handle, omxComponentName, ctx, &omxCallbacks);
+    omxErr = omxGetHandle(&ctx->imageEncode.handle, omxComponentName, ctx, &omxCallbacks);
     omxAssert(omxErr);
     omxAssertState(ctx->imageEncode.handle, OMX_StateLoaded);
 
     getImageEncodePorts(&ctx->imageEncode);
-    omxEnablePort(ctx->imageEncode.handle, ctx->imageEncode.inputPortIndex, OMX_FALSE);
-    omxEnablePort(ctx->imageEncode.handle, ctx->imageEncode.outputPortIndex, OMX_FALSE);
-    omxSwitchToState(ctx->imageEncode.handle, OMX_StateIdle);
+    omxErr = omxEnablePort(ctx->imageEncode.handle, ctx->imageEncode.inputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
+    omxErr = omxEnablePort(ctx->imageEncode.handle, ctx->imageEncode.outputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(ctx->imageEncode.handle, OMX_StateIdle);
+    omxAssert(omxErr);
 
-    bool x = setupImageEncodeInputPort(&ctx->imageEncode, rawImageWidth, rawImageHeight, sliceHeight, colorFormat);
+    if (!setupImageEncodeInputPort(&ctx->imageEncode, rawImageWidth, rawImageHeight, sliceHeight, colorFormat, bufferCount)) {
+        omxErr = omxSwitchToState(ctx->imageEncode.handle, OMX_StateLoaded);
+        omxAssert(omxErr);
+        omxErr = omxFreeHandle(ctx->imageEncode.handle);
+        omxAssert(omxErr);
+        pthread_mutex_destroy(&ctx->imageEncode.lock);
+        vcos_semaphore_delete(&ctx->handler_lock);
+        free(ctx);
+        return NULL;
+    }
 
-    return (OMXContext_s *)x;
+    setupImageEncodeOutputPort(&ctx->imageEncode, outputQuality, bufferCount);
+    ctx->width = rawImageWidth;
+    ctx->height = rawImageHeight;
+    ctx->sliceHeight = sliceHeight;
+    ctx->colorFormat = colorFormat;
+    ctx->bufferCount = bufferCount;
+    ctx->quality = outputQuality;
 
-//    setupImageEncodeOutputPort(&ctx->imageEncode, outputQuality);
-//    omxSwitchToState(ctx->imageEncode.handle, OMX_StateExecuting);
+    omxErr = omxSwitchToState(ctx->imageEncode.handle, OMX_StateExecuting);
+    omxAssert(omxErr);
 
-//    return ctx;
+    // all output buffers stay with the encoder, each one is handed back as soon as it has been drained
+    for (OMX_U32 i = 0; i < ctx->imageEncode.numOutputBuffers; i++) {
+        omxErr = OMX_FillThisBuffer(ctx->imageEncode.handle, ctx->imageEncode.outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    return ctx;
 }
 
 
 
 void omxJPEGEncDeinit(OMXContext_s *ctx) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    omxSwitchToState(ctx->imageEncode.handle, OMX_StateIdle);
-    omxEnablePort(ctx->imageEncode.handle, ctx->imageEncode.inputPortIndex, OMX_FALSE);
-    omxEnablePort(ctx->imageEncode.handle, ctx->imageEncode.outputPortIndex, OMX_FALSE);
+    // the input port is left disabled if omxJPEGEncReconfigure could not restore it
+    bool inputEnabled = ctx->imageEncode.numInputBuffers > 0;
+    omxErr = omxSwitchToState(ctx->imageEncode.handle, OMX_StateIdle);
+    omxAssert(omxErr);
+
+    if (inputEnabled) {
+        omxErr = omxSendCommand(ctx->imageEncode.handle, OMX_CommandPortDisable, ctx->imageEncode.inputPortIndex);
+        omxAssert(omxErr);
+    }
+
+    omxErr = omxSendCommand(ctx->imageEncode.handle, OMX_CommandPortDisable, ctx->imageEncode.outputPortIndex);
+    omxAssert(omxErr);
     freeImageEncodeBuffers(&ctx->imageEncode);
-    omxSwitchToState(ctx->imageEncode.handle, OMX_StateLoaded);
+
+    if (inputEnabled) {
+        omxErr = omxWaitForCommand(ctx->imageEncode.handle, OMX_CommandPortDisable, ctx->imageEncode.inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+        omxAssert(omxErr);
+    }
+
+    omxErr = omxWaitForCommand(ctx->imageEncode.handle, OMX_CommandPortDisable, ctx->imageEncode.outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(ctx->imageEncode.handle, OMX_StateLoaded);
+    omxAssert(omxErr);
 
 
-    omxErr = OMX_FreeHandle(ctx->imageEncode.handle);
+    omxErr = omxFreeHandle(ctx->imageEncode.handle);
     omxAssert(omxErr);
+    pthread_mutex_destroy(&ctx->imageEncode.lock);
+    vcos_semaphore_delete(&ctx->handler_lock);
     free(ctx);
 }
 
 
 
-void omxJPEGEncProcess(OMXContext_s *ctx, uint8_t *output, size_t *outputFill, size_t outputSize, uint8_t *rawImage, size_t rawImageSize) {
+// Only the input port is cycled, the component stays in OMX_StateExecuting and the output buffers stay queued.
+bool omxJPEGEncReconfigure(OMXContext_s *ctx, uint32_t rawImageWidth, uint32_t rawImageHeight, uint32_t sliceHeight, OMX_COLOR_FORMATTYPE colorFormat) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMXImageEncode_s *component = &ctx->imageEncode;
+    assert(ctx->slice == NULL);
 
-    int pos = 0;
-    uint32_t sliceSize = ctx->imageEncode.inputBuffer->nAllocLen;
-    ctx->imageEncode.inputReady = true;
-    ctx->imageEncode.outputReady = false;
+    // a failed restore below leaves the input port disabled, the next Reconfigure only has to enable it again
+    bool inputEnabled = component->numInputBuffers > 0;
 
-    omxErr = OMX_FillThisBuffer(ctx->imageEncode.handle, ctx->imageEncode.outputBuffer);
-    omxAssert(omxErr);
+    if (inputEnabled && (rawImageWidth == ctx->width) && (rawImageHeight == ctx->height) && (sliceHeight == ctx->sliceHeight) && (colorFormat == ctx->colorFormat)) {
+        return true;
+    }
 
-    // FILE *output = fopen("out.jpg", "wb");
+    if (inputEnabled) {
+        omxErr = omxSendCommand(component->handle, OMX_CommandPortDisable, component->inputPortIndex);
+        omxAssert(omxErr);
 
-    while (true) {
-        if (ctx->imageEncode.outputReady) {
-            ctx->imageEncode.outputReady = false;
-            //fwrite(ctx->imageEncode.outputBuffer->pBuffer + ctx->imageEncode.outputBuffer->nOffset, sizeof(uint8_t), ctx->imageEncode.outputBuffer->nFilledLen, output);
+        // the encoder returns the input buffers it still holds before they may be freed
+        while (true) {
+            pthread_mutex_lock(&component->lock);
+            bool allReturned = component->numInputFree == component->numInputBuffers;
+            pthread_mutex_unlock(&component->lock);
 
-            if (ctx->imageEncode.outputBuffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) {
+            if (allReturned) {
                 break;
             }
 
-            omxErr = OMX_FillThisBuffer(ctx->imageEncode.handle, ctx->imageEncode.outputBuffer);
-            omxAssert(omxErr);
+            vcos_semaphore_wait(&ctx->handler_lock);
         }
 
-        if (ctx->imageEncode.inputReady) {
-            ctx->imageEncode.inputReady = false;
+        freeImageEncodeInputBuffers(component);
+        omxErr = omxWaitForCommand(component->handle, OMX_CommandPortDisable, component->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+        omxAssert(omxErr);
+    }
 
-            if (pos == rawImageSize) {
-                continue;
-            }
+    if (!setupImageEncodeInputPort(component, rawImageWidth, rawImageHeight, sliceHeight, colorFormat, ctx->bufferCount)) {
+        // back to the previous format, which the component accepted before, so that the port is enabled and
+        // populated again and the context stays usable
+        if (!setupImageEncodeInputPort(component, ctx->width, ctx->height, ctx->sliceHeight, ctx->colorFormat, ctx->bufferCount)) {
+            puts(COLOR_RED "omxJPEGEnc: restoring the previous input format failed, the input port stays disabled" COLOR_NC);
+        }
 
-            memcpy(ctx->imageEncode.inputBuffer->pBuffer, &rawImage[pos], sliceSize);
-            ctx->imageEncode.inputBuffer->nOffset = 0;
-            ctx->imageEncode.inputBuffer->nFilledLen = sliceSize;
-            pos += sliceSize;
+        return false;
+    }
 
-            if (pos + sliceSize > rawImageSize) {
-                sliceSize = rawImageSize - pos;
-            }
+    ctx->width = rawImageWidth;
+    ctx->height = rawImageHeight;
+    ctx->sliceHeight = sliceHeight;
+    ctx->colorFormat = colorFormat;
+    return true;
+}
+
+
+
+// applies from the next frame on, no port is touched
+void omxJPEGEncSetQuality(OMXContext_s *ctx, uint8_t outputQuality) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    assert(ctx->slice == NULL);
+
+    if (outputQuality == ctx->quality) {
+        return;
+    }
+
+    OMX_IMAGE_PARAM_QFACTORTYPE qFactor;
+    OMX_INIT_STRUCTURE(qFactor);
+    qFactor.nPortIndex = ctx->imageEncode.outputPortIndex;
+    qFactor.nQFactor = outputQuality;
+    omxErr = OMX_SetParameter(ctx->imageEncode.handle, OMX_IndexParamQFactor, &qFactor);
+    omxAssert(omxErr);
+    ctx->quality = outputQuality;
+}
+
+
+
+static void writeToSink(OMXContext_s *ctx, const struct iovec *chunks, int numChunks) {
+    if ((numChunks > 0) && !ctx->sinkFailed && !omxSinkWrite(ctx->sink, chunks, numChunks)) {
+        puts(COLOR_RED "omxJPEGEnc: writing to the sink failed, dropping the rest of the frame" COLOR_NC);
+        ctx->sinkFailed = true;
+    }
+}
+
+
+
+// in a batch the output following the end of a frame goes to the next frame's sink
+static void finishOutputFrame(OMXContext_s *ctx) {
+    if (!ctx->batch) {
+        ctx->endOfFrame = true;
+        return;
+    }
+
+    ctx->batch[ctx->batchOutput].outputFill = ctx->sinkFailed ? 0 : ctx->outputFill;
+    ctx->batchOutput++;
+    ctx->outputFill = 0;
+    ctx->sinkFailed = false;
 
-            omxErr = OMX_EmptyThisBuffer(ctx->imageEncode.handle, ctx->imageEncode.inputBuffer);
-            omxAssert(omxErr);
+    if (ctx->batchOutput < ctx->batchSize) {
+        ctx->sink = ctx->batch[ctx->batchOutput].sink;
+    } else {
+        ctx->endOfFrame = true;
+    }
+}
+
+
+
+// Passes all output buffers returned so far to the sink in one batch and hands them back to the encoder.
+// Returns false if there were none.
+static bool drainOutputBuffers(OMXContext_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMXImageEncode_s *component = &ctx->imageEncode;
+    OMX_BUFFERHEADERTYPE *outputBuffers[OMX_JPEG_ENC_MAX_BUFFERS];
+    struct iovec chunks[OMX_JPEG_ENC_MAX_BUFFERS];
+    int numOutputBuffers = 0;
+    int numChunks = 0;
+
+    pthread_mutex_lock(&component->lock);
+
+    while (component->numOutputFilled > 0) {
+        outputBuffers[numOutputBuffers++] = component->outputFilled[component->outputFilledHead];
+        component->outputFilledHead = (component->outputFilledHead + 1) % OMX_JPEG_ENC_MAX_BUFFERS;
+        component->numOutputFilled--;
+    }
+
+    pthread_mutex_unlock(&component->lock);
+
+    for (int i = 0; i < numOutputBuffers; i++) {
+        OMX_BUFFERHEADERTYPE *outputBuffer = outputBuffers[i];
+
+        if (outputBuffer->nFilledLen > 0) {
+            chunks[numChunks].iov_base = outputBuffer->pBuffer + outputBuffer->nOffset;
+            chunks[numChunks].iov_len = outputBuffer->nFilledLen;
+            ctx->outputFill += outputBuffer->nFilledLen;
+            numChunks++;
         }
 
-        vcos_semaphore_wait(&ctx->handler_lock);
-        puts(".");
-        //            vcos_semaphore_post(&ctx->handler_lock);
+        if (outputBuffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) {
+            writeToSink(ctx, chunks, numChunks);
+            numChunks = 0;
+            finishOutputFrame(ctx);
+        }
+    }
+
+    writeToSink(ctx, chunks, numChunks);
+
+    for (int i = 0; i < numOutputBuffers; i++) {
+        omxErr = OMX_FillThisBuffer(component->handle, outputBuffers[i]);
+        omxAssert(omxErr);
     }
 
-    //fclose(output);
-    puts(COLOR_RED "done" COLOR_NC " blaub " COLOR_GREEN "yes" COLOR_NC);
+    return numOutputBuffers > 0;
 }
 
 
 
+void omxJPEGEncBeginFrame(OMXContext_s *ctx, OMXSink_t sink) {
+    assert(ctx->slice == NULL);
+    ctx->sink = sink;
+    ctx->outputFill = 0;
+    ctx->sinkFailed = false;
+    ctx->endOfFrame = false;
+}
 
 
 
+uint8_t * omxJPEGEncGetSliceBuffer(OMXContext_s *ctx, uint32_t *stride, size_t *sliceSize) {
+    OMXImageEncode_s *component = &ctx->imageEncode;
+    assert(ctx->slice == NULL);
+    assert(component->numInputBuffers > 0);     // no input port after a failed omxJPEGEncReconfigure
 
-void omxJPEGEnc() {
-    OMX_U32 outputQuality = 20;      // [1, 100] as in libJPEG 9
-
-    uint32_t rawImageWidth = 640;
-    uint32_t rawImageHeight = 480;
-    OMX_S32 sliceHeight = rawImageHeight;
-    uint8_t rawImageChannels = 3;
-    size_t rawImageSize = rawImageWidth * rawImageHeight * rawImageChannels;
-    uint8_t *rawImage = (uint8_t *)malloc(rawImageSize);
-
-    for (uint32_t y = 0; y < rawImageHeight; y++) {
-        for (uint32_t x = 0; x < rawImageWidth; x++) {
-            ssize_t index = (x + rawImageWidth * y) * rawImageChannels;
-            rawImage[index + 0] = x % 256;
-            rawImage[index + 1] = y % 256;
-            rawImage[index + 2] = (x + y) % 256;
+    while (true) {
+        pthread_mutex_lock(&component->lock);
+
+        if (component->numInputFree > 0) {
+            ctx->slice = component->inputFree[--component->numInputFree];
+        }
+
+        pthread_mutex_unlock(&component->lock);
+
+        if (ctx->slice) {
+            break;
+        }
+
+        // the encoder may be waiting for an output buffer before it can release the next input buffer
+        if (!drainOutputBuffers(ctx)) {
+            vcos_semaphore_wait(&ctx->handler_lock);
+        }
+    }
+
+    *stride = component->inputStride;
+    *sliceSize = ctx->slice->nAllocLen;
+    return ctx->slice->pBuffer;
+}
+
+
+
+void omxJPEGEncEmptySlice(OMXContext_s *ctx, size_t sliceFill, bool endOfFrame) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMX_BUFFERHEADERTYPE *inputBuffer = ctx->slice;
+    assert(inputBuffer != NULL);
+    ctx->slice = NULL;
+
+    inputBuffer->nOffset = 0;
+    inputBuffer->nFilledLen = sliceFill;
+    inputBuffer->nFlags = endOfFrame ? OMX_BUFFERFLAG_ENDOFFRAME : 0;
+    omxErr = OMX_EmptyThisBuffer(ctx->imageEncode.handle, inputBuffer);
+    omxAssert(omxErr);
+}
+
+
+
+size_t omxJPEGEncEndFrame(OMXContext_s *ctx) {
+    assert(ctx->slice == NULL);
+
+    while (!ctx->endOfFrame) {
+        if (!drainOutputBuffers(ctx)) {
+            vcos_semaphore_wait(&ctx->handler_lock);
         }
     }
 
+    return ctx->sinkFailed ? 0 : ctx->outputFill;
+}
+
+
+
+// Keeps every input buffer in flight: while the encoder works on one slice the next ones are already being
+// copied.
+size_t omxJPEGEncProcessToSink(OMXContext_s *ctx, OMXSink_t sink, uint8_t *rawImage, size_t rawImageSize) {
+    omxJPEGEncBeginFrame(ctx, sink);
+
+    for (size_t pos = 0; pos < rawImageSize;) {
+        uint32_t stride;
+        size_t sliceSize;
+        uint8_t *slice = omxJPEGEncGetSliceBuffer(ctx, &stride, &sliceSize);
+        sliceSize = MIN(sliceSize, rawImageSize - pos);
+        memcpy(slice, &rawImage[pos], sliceSize);
+        pos += sliceSize;
+        omxJPEGEncEmptySlice(ctx, sliceSize, pos == rawImageSize);
+    }
+
+    return omxJPEGEncEndFrame(ctx);
+}
+
 
-    OMX_COLOR_FORMATTYPE test[] = {
-        OMX_COLOR_FormatUnused,
-        OMX_COLOR_Format16bitRGB565,
-        OMX_COLOR_Format24bitRGB888,
-        OMX_COLOR_Format24bitBGR888,
-        OMX_COLOR_Format32bitARGB8888,
-        OMX_COLOR_FormatYUV420PackedPlanar,
-        OMX_COLOR_FormatYUV422PackedPlanar,
-        OMX_COLOR_FormatYCbYCr,
-        OMX_COLOR_FormatYCrYCb,
-        OMX_COLOR_FormatCbYCrY,
-        OMX_COLOR_FormatCrYCbY,
-        OMX_COLOR_Format32bitABGR8888,
-        OMX_COLOR_Format8bitPalette,
-
-
-
-
-        OMX_COLOR_FormatUnused,
-        OMX_COLOR_FormatMonochrome,
-        OMX_COLOR_Format8bitRGB332,
-        OMX_COLOR_Format12bitRGB444,
-        OMX_COLOR_Format16bitARGB4444,
-        OMX_COLOR_Format16bitARGB1555,
-        OMX_COLOR_Format16bitRGB565,
-        OMX_COLOR_Format16bitBGR565,
-        OMX_COLOR_Format18bitRGB666,
-        OMX_COLOR_Format18bitARGB1665,
-        OMX_COLOR_Format19bitARGB1666,
-        OMX_COLOR_Format24bitRGB888,
-        OMX_COLOR_Format24bitBGR888,
-        OMX_COLOR_Format24bitARGB1887,
-        OMX_COLOR_Format25bitARGB1888,
-        OMX_COLOR_Format32bitBGRA8888,
-        OMX_COLOR_Format32bitARGB8888,
-        OMX_COLOR_FormatYUV411Planar,
-        OMX_COLOR_FormatYUV411PackedPlanar,
-        OMX_COLOR_FormatYUV420Planar,
-        OMX_COLOR_FormatYUV420PackedPlanar,
-        OMX_COLOR_FormatYUV420SemiPlanar,
-        OMX_COLOR_FormatYUV422Planar,
-        OMX_COLOR_FormatYUV422PackedPlanar,
-        OMX_COLOR_FormatYUV422SemiPlanar,
-        OMX_COLOR_FormatYCbYCr,
-        OMX_COLOR_FormatYCrYCb,
-        OMX_COLOR_FormatCbYCrY,
-        OMX_COLOR_FormatCrYCbY,
-        OMX_COLOR_FormatYUV444Interleaved,
-        OMX_COLOR_FormatRawBayer8bit,
-        OMX_COLOR_FormatRawBayer10bit,
-        OMX_COLOR_FormatRawBayer8bitcompressed,
-        OMX_COLOR_FormatL2,
-        OMX_COLOR_FormatL4,
-        OMX_COLOR_FormatL8,
-        OMX_COLOR_FormatL16,
-        OMX_COLOR_FormatL24,
-        OMX_COLOR_FormatL32,
-        OMX_COLOR_FormatYUV420PackedSemiPlanar,
-        OMX_COLOR_FormatYUV422PackedSemiPlanar,
-        OMX_COLOR_Format18BitBGR666,
-        OMX_COLOR_Format24BitARGB6666,
-        OMX_COLOR_Format24BitABGR6666,
-        OMX_COLOR_Format32bitABGR8888,
-        OMX_COLOR_Format8bitPalette,
-        OMX_COLOR_FormatYUVUV128,
-        OMX_COLOR_FormatRawBayer12bit,
-        OMX_COLOR_FormatBRCMEGL,
-        OMX_COLOR_FormatBRCMOpaque,
-        OMX_COLOR_FormatYVU420PackedPlanar,
-        OMX_COLOR_FormatYVU420PackedSemiPlanar,
-        OMX_COLOR_FormatRawBayer16bit,
-        OMX_COLOR_FormatYUV420_16PackedPlanar,
-        OMX_COLOR_FormatYUVUV64_16,
-    };
-    int numTest = sizeof(test)/sizeof(test[0]);
-
-    for (int i = 0; i < numTest; i++) {
-        //size_t outputSize = rawImageWidth * rawImageHeight * sizeof(uint8_t);
-        //size_t outputFill = 0;
-        //uint8_t *output = malloc(outputSize);
-
-
-        printf(COLOR_YELLOW "--> %d:\n" COLOR_NC, i);
-        OMXContext_s *ctx = omxJPEGEncInit(rawImageWidth, rawImageHeight, sliceHeight, outputQuality, test[i]);
-
-
-        if (ctx) {
-            puts(omxColorFormatTypeEnum(test[i]));
-            puts(COLOR_GREEN "WIN" COLOR_NC);
+
+// Every slice is pulled straight into a free input buffer, so only the input buffers hold raw rows and the
+// encoder starts on the first slice while the producer is still working on the next.
+size_t omxJPEGEncProcessStream(OMXContext_s *ctx, OMXSink_t sink, OMXJPEGEncPull_t pull, void *userData) {
+    bool pullFailed = false;
+    omxJPEGEncBeginFrame(ctx, sink);
+
+    for (uint32_t y = 0; y < ctx->height;) {
+        uint32_t stride;
+        size_t sliceSize;
+        uint8_t *slice = omxJPEGEncGetSliceBuffer(ctx, &stride, &sliceSize);
+        const uint32_t rows = MIN(ctx->sliceHeight, ctx->height - y);
+        pullFailed = !pull(userData, slice, stride, y, rows);
+        y += rows;
+
+        // the encoder still needs an end of frame to get back into a clean state
+        if (pullFailed) {
+            puts(COLOR_RED "omxJPEGEnc: the producer failed, cutting the frame short" COLOR_NC);
+            omxJPEGEncEmptySlice(ctx, 0, true);
+            break;
         }
 
-        // for (int i = 0; i < 100; i++) {
-        //    omxJPEGEncProcess(ctx, output, &outputFill, outputSize, rawImage, rawImageSize);
-        // }
-        
-        
-        //omxJPEGEncDeinit(ctx);
-        //free(output);
+        omxJPEGEncEmptySlice(ctx, rows * stride, y == ctx->height);
     }
+
+    const size_t outputFill = omxJPEGEncEndFrame(ctx);
+    return pullFailed ? 0 : outputFill;
+}
+
+
+
+// The input of frame i + 1 is queued as soon as there is a free input buffer, while frame i is still being
+// compressed and its output drained. drainOutputBuffers routes the output by its end of frame flags.
+uint32_t omxJPEGEncBatch(OMXContext_s *ctx, OMXJPEGEncFrame_s *frames, uint32_t numFrames) {
+    if (numFrames == 0) {
+        return 0;
+    }
+
+    omxJPEGEncBeginFrame(ctx, frames[0].sink);
+    ctx->batch = frames;
+    ctx->batchSize = numFrames;
+    ctx->batchOutput = 0;
+
+    for (uint32_t i = 0; i < numFrames; i++) {
+        const OMXJPEGEncFrame_s *frame = &frames[i];
+
+        for (size_t pos = 0; pos < frame->rawImageSize;) {
+            uint32_t stride;
+            size_t sliceSize;
+            uint8_t *slice = omxJPEGEncGetSliceBuffer(ctx, &stride, &sliceSize);
+            sliceSize = MIN(sliceSize, frame->rawImageSize - pos);
+            memcpy(slice, &frame->rawImage[pos], sliceSize);
+            pos += sliceSize;
+            omxJPEGEncEmptySlice(ctx, sliceSize, pos == frame->rawImageSize);
+        }
+    }
+
+    omxJPEGEncEndFrame(ctx);
+    ctx->batch = NULL;
+
+    uint32_t numEncoded = 0;
+
+    for (uint32_t i = 0; i < numFrames; i++) {
+        numEncoded += (frames[i].outputFill > 0) ? 1 : 0;
+    }
+
+    return numEncoded;
+}
+
+
+
+void omxJPEGEncProcess(OMXContext_s *ctx, uint8_t *output, size_t *outputFill, size_t outputSize, uint8_t *rawImage, size_t rawImageSize) {
+    OMXMemorySink_s memory = { .data = output, .size = 0, .capacity = outputSize, .growable = false };
+    *outputFill = omxJPEGEncProcessToSink(ctx, omxMemorySink(&memory), rawImage, rawImageSize);
+}
+
+
+
+static void renderTestPattern(uint8_t *dst, uint32_t stride, uint32_t width, uint32_t y0, uint32_t rows, uint32_t frame) {
+    for (uint32_t y = y0; y < y0 + rows; y++) {
+        uint8_t *row = dst + (y - y0) * stride;
+
+        for (uint32_t x = 0; x < width; x++) {
+            row[3 * x + 0] = (x + frame) % 256;
+            row[3 * x + 1] = y % 256;
+            row[3 * x + 2] = (x + y) % 256;
+        }
+    }
+}
+
+
+
+typedef struct {
+    uint32_t width;
+    uint32_t frame;
+} TestPatternProducer_s;
+
+
+
+static bool pullTestPattern(void *userData, uint8_t *dst, uint32_t stride, uint32_t y, uint32_t rows) {
+    const TestPatternProducer_s *producer = userData;
+    renderTestPattern(dst, stride, producer->width, y, rows, producer->frame);
+    return true;
+}
+
+
+
+// zeroCopy pulls every slice through omxJPEGEncProcessStream straight into the encoder's input buffers,
+// otherwise the frame is rendered into host memory first and copied by omxJPEGEncProcess
+static double omxJPEGEncBenchmark(uint32_t bufferCount, bool zeroCopy, uint32_t numFrames, uint32_t rawImageWidth, uint32_t rawImageHeight) {
+    OMX_U32 outputQuality = 75;
+    OMX_U32 sliceHeight = 16;
+    uint32_t rawImageStride = rawImageWidth * 3;
+    size_t rawImageSize = rawImageStride * rawImageHeight;
+    uint8_t *rawImage = malloc(rawImageSize);
+    OMXMemorySink_s memory = { .data = NULL, .size = 0, .capacity = 0, .growable = true };
+
+    OMXContext_s *ctx = omxJPEGEncInit(rawImageWidth, rawImageHeight, sliceHeight, outputQuality, OMX_COLOR_Format24bitRGB888, bufferCount);
+    assert(ctx != NULL);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < numFrames; i++) {
+        memory.size = 0;
+
+        if (zeroCopy) {
+            TestPatternProducer_s producer = { .width = rawImageWidth, .frame = i };
+            omxJPEGEncProcessStream(ctx, omxMemorySink(&memory), pullTestPattern, &producer);
+        } else {
+            renderTestPattern(rawImage, rawImageStride, rawImageWidth, 0, rawImageHeight, i);
+            omxJPEGEncProcessToSink(ctx, omxMemorySink(&memory), rawImage, rawImageSize);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    // the last frame once more, streamed straight into the file
+    renderTestPattern(rawImage, rawImageStride, rawImageWidth, 0, rawImageHeight, numFrames - 1);
+    int fd = open("out.jpg", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    size_t outputFill = omxJPEGEncProcessToSink(ctx, omxFdSink(fd), rawImage, rawImageSize);
+    assert(outputFill == memory.size);
+    close(fd);
+
+    omxJPEGEncDeinit(ctx);
+    free(memory.data);
+    free(rawImage);
+    return numFrames / seconds;
+}
+
+
+
+// thumbnail service pattern: a stream of small requests with varying size and quality
+static void omxJPEGEncSessionBenchmark(bool reuse) {
+    const OMXSize_t sizes[] = { { 160, 120 }, { 320, 240 }, { 320, 240 }, { 640, 480 } };
+    const uint8_t qualities[] = { 50, 75, 90 };
+    const uint32_t numRequests = 48;
+    const uint32_t sliceHeight = 16;
+    uint8_t *rawImage = malloc(640 * 480 * 3);
+    OMXMemorySink_s memory = { .data = NULL, .size = 0, .capacity = 0, .growable = true };
+    OMXContext_s *ctx = NULL;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < numRequests; i++) {
+        const OMXSize_t size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+        const uint8_t quality = qualities[i % (sizeof(qualities) / sizeof(qualities[0]))];
+        const size_t rawImageSize = size.nWidth * size.nHeight * 3;
+        renderTestPattern(rawImage, size.nWidth * 3, size.nWidth, 0, size.nHeight, i);
+
+        if (!ctx) {
+            ctx = omxJPEGEncInit(size.nWidth, size.nHeight, sliceHeight, quality, OMX_COLOR_Format24bitRGB888, 2);
+        } else {
+            omxJPEGEncReconfigure(ctx, size.nWidth, size.nHeight, sliceHeight, OMX_COLOR_Format24bitRGB888);
+            omxJPEGEncSetQuality(ctx, quality);
+        }
+
+        memory.size = 0;
+        omxJPEGEncProcessToSink(ctx, omxMemorySink(&memory), rawImage, rawImageSize);
+
+        if (!reuse) {
+            omxJPEGEncDeinit(ctx);
+            ctx = NULL;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf(COLOR_YELLOW "%s: %.2f ms per request\n" COLOR_NC, reuse ? "session" : "init/deinit", seconds * 1000 / numRequests);
+
+    if (ctx) {
+        omxJPEGEncDeinit(ctx);
+    }
+
+    free(memory.data);
+    free(rawImage);
+}
+
+
+
+// the same frames encoded one omxJPEGEncProcessToSink call at a time and as one omxJPEGEncBatch
+static void omxJPEGEncBatchBenchmark(uint32_t numFrames, uint32_t rawImageWidth, uint32_t rawImageHeight) {
+    const uint32_t numImages = 4;
+    uint32_t rawImageStride = rawImageWidth * 3;
+    size_t rawImageSize = rawImageStride * rawImageHeight;
+    uint8_t *rawImages[numImages];
+    OMXMemorySink_s memories[numFrames];
+    OMXJPEGEncFrame_s frames[numFrames];
+
+    for (uint32_t i = 0; i < numImages; i++) {
+        rawImages[i] = malloc(rawImageSize);
+        renderTestPattern(rawImages[i], rawImageStride, rawImageWidth, 0, rawImageHeight, i);
+    }
+
+    for (uint32_t i = 0; i < numFrames; i++) {
+        memories[i] = (OMXMemorySink_s){ .data = NULL, .size = 0, .capacity = 0, .growable = true };
+        frames[i] = (OMXJPEGEncFrame_s){ .rawImage = rawImages[i % numImages], .rawImageSize = rawImageSize, .sink = omxMemorySink(&memories[i]) };
+    }
+
+    OMXContext_s *ctx = omxJPEGEncInit(rawImageWidth, rawImageHeight, 16, 75, OMX_COLOR_Format24bitRGB888, 3);
+    assert(ctx != NULL);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < numFrames; i++) {
+        omxJPEGEncProcessToSink(ctx, frames[i].sink, frames[i].rawImage, frames[i].rawImageSize);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    for (uint32_t i = 0; i < numFrames; i++) {
+        memories[i].size = 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t numEncoded = omxJPEGEncBatch(ctx, frames, numFrames);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secondsBatch = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    assert(numEncoded == numFrames);
+
+    for (uint32_t i = 0; i < numFrames; i++) {
+        assert(frames[i].outputFill == memories[i].size);
+        assert(memories[i].size == memories[i % numImages].size);
+        free(memories[i].data);
+    }
+
+    printf(COLOR_YELLOW "%d frames: %.2f fps (one by one), %.2f fps (batch)\n" COLOR_NC, numFrames, numFrames / seconds, numFrames / secondsBatch);
+
+    omxJPEGEncDeinit(ctx);
+
+    for (uint32_t i = 0; i < numImages; i++) {
+        free(rawImages[i]);
+    }
+}
+
+
+
+void omxJPEGEnc() {
+    uint32_t rawImageWidth = 1920;
+    uint32_t rawImageHeight = 1080;
+    uint32_t numFrames = 30;
+    uint32_t bufferCounts[] = { 1, 2, 3, 4 };
+    int numBufferCounts = sizeof(bufferCounts) / sizeof(bufferCounts[0]);
+
+    for (int i = 0; i < numBufferCounts; i++) {
+        double fps = omxJPEGEncBenchmark(bufferCounts[i], false, numFrames, rawImageWidth, rawImageHeight);
+        double fpsZeroCopy = omxJPEGEncBenchmark(bufferCounts[i], true, numFrames, rawImageWidth, rawImageHeight);
+        printf(COLOR_YELLOW "%d buffers: %.2f fps (copy), %.2f fps (zero copy)\n" COLOR_NC, bufferCounts[i], fps, fpsZeroCopy);
+    }
+
+    omxJPEGEncSessionBenchmark(false);
+    omxJPEGEncSessionBenchmark(true);
+    omxJPEGEncBatchBenchmark(numFrames, rawImageWidth, rawImageHeight);
 }
@@ -10,22 +10,64 @@
 #define omxJPEGEnc_h
 
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #define OMX_SKIP64BIT
 #include <IL/OMX_Component.h>
 
+#include "omxSink.h"
+
 
 // forward declaration of a typedef struct
 struct OMXContext_s;
 typedef struct OMXContext_s OMXContext_s;
 
 
-OMXContext_s * omxJPEGEncInit(uint32_t rawImageWidth, uint32_t rawImageHeight, uint32_t sliceHeight, uint8_t outputQuality, OMX_COLOR_FORMATTYPE colorFormat);
+typedef struct {
+    uint8_t *rawImage;
+    size_t rawImageSize;
+    OMXSink_t sink;
+    size_t outputFill;      // set by omxJPEGEncBatch, 0 if the sink failed
+} OMXJPEGEncFrame_s;
+
+
+// bufferCount input and output buffers are kept in flight (clamped to what the component accepts)
+OMXContext_s * omxJPEGEncInit(uint32_t rawImageWidth, uint32_t rawImageHeight, uint32_t sliceHeight, uint8_t outputQuality, OMX_COLOR_FORMATTYPE colorFormat, uint32_t bufferCount);
 void omxJPEGEncDeinit(OMXContext_s *ctx);
+
+// Session use: keep one context around and change its parameters between frames. Reconfigure only cycles
+// the input port if size, slice height or colour format actually change. Returns false (and restores the previous
+// input port format) if the component rejects the new format. Should the restore fail too, the input port stays
+// disabled until a later Reconfigure succeeds; Deinit copes with that.
+bool omxJPEGEncReconfigure(OMXContext_s *ctx, uint32_t rawImageWidth, uint32_t rawImageHeight, uint32_t sliceHeight, OMX_COLOR_FORMATTYPE colorFormat);
+void omxJPEGEncSetQuality(OMXContext_s *ctx, uint8_t outputQuality);
+// *outputFill is 0 if the JPEG did not fit into outputSize
 void omxJPEGEncProcess(OMXContext_s *ctx, uint8_t *output, size_t *outputFill, size_t outputSize, uint8_t *rawImage, size_t rawImageSize);
 
+// streams the JPEG into sink as the encoder produces it, returns its length or 0 if the sink failed
+size_t omxJPEGEncProcessToSink(OMXContext_s *ctx, OMXSink_t sink, uint8_t *rawImage, size_t rawImageSize);
+
+// Streaming encode for camera and scanline producers: pull is called for every slice of sliceHeight rows
+// (fewer for the last one) and writes them at dst with the given stride. Returning false aborts the frame.
+// Returns the length of the JPEG or 0 if the producer or the sink failed.
+typedef bool (*OMXJPEGEncPull_t)(void *userData, uint8_t *dst, uint32_t stride, uint32_t y, uint32_t rows);
+size_t omxJPEGEncProcessStream(OMXContext_s *ctx, OMXSink_t sink, OMXJPEGEncPull_t pull, void *userData);
+
+// encodes numFrames frames back to back without waiting for each JPEG to finish before feeding the next
+// frame, returns the number of frames whose sink did not fail
+uint32_t omxJPEGEncBatch(OMXContext_s *ctx, OMXJPEGEncFrame_s *frames, uint32_t numFrames);
+
+// Zero-copy encode: the caller renders each slice straight into the encoder's input buffers.
+// omxJPEGEncGetSliceBuffer blocks until an input buffer is free and returns it along with its stride and
+// size, omxJPEGEncEmptySlice hands it to the encoder. omxJPEGEncEndFrame waits for the JPEG to be
+// complete and returns its length (0 if the sink failed).
+void omxJPEGEncBeginFrame(OMXContext_s *ctx, OMXSink_t sink);
+uint8_t * omxJPEGEncGetSliceBuffer(OMXContext_s *ctx, uint32_t *stride, size_t *sliceSize);
+void omxJPEGEncEmptySlice(OMXContext_s *ctx, size_t sliceFill, bool endOfFrame);
+size_t omxJPEGEncEndFrame(OMXContext_s *ctx);
+
 void omxJPEGEnc(void);
 
 
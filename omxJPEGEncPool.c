@@ -0,0 +1,270 @@
+//
+//  omxJPEGEncPool.c
+//  OMXPlayground
+//
+
+#include "omxJPEGEncPool.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cHelper.h"
+
+
+
+typedef struct {
+    OMXContext_s *ctx;      // NULL if the slot is empty or still being set up
+    uint32_t width;
+    uint32_t height;
+    OMX_COLOR_FORMATTYPE colorFormat;
+    bool inUse;
+} OMXJPEGEncPoolEntry_s;
+
+
+
+struct OMXJPEGEncPool_s {
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+
+    uint32_t sliceHeight;
+    uint8_t quality;
+    uint32_t bufferCount;
+
+    OMXJPEGEncPoolEntry_s *entries;
+    uint32_t numEntries;
+};
+
+
+
+OMXJPEGEncPool_s * omxJPEGEncPoolInit(uint32_t maxContexts, uint32_t sliceHeight, uint8_t outputQuality, uint32_t bufferCount) {
+    assert(maxContexts > 0);
+
+    OMXJPEGEncPool_s *pool = calloc(1, sizeof(OMXJPEGEncPool_s));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->available, NULL);
+    pool->sliceHeight = sliceHeight;
+    pool->quality = outputQuality;
+    pool->bufferCount = bufferCount;
+    pool->entries = calloc(maxContexts, sizeof(OMXJPEGEncPoolEntry_s));
+    pool->numEntries = maxContexts;
+    return pool;
+}
+
+
+
+void omxJPEGEncPoolDeinit(OMXJPEGEncPool_s *pool) {
+    for (uint32_t i = 0; i < pool->numEntries; i++) {
+        assert(!pool->entries[i].inUse);
+
+        if (pool->entries[i].ctx) {
+            omxJPEGEncDeinit(pool->entries[i].ctx);
+        }
+    }
+
+    pthread_cond_destroy(&pool->available);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->entries);
+    free(pool);
+}
+
+
+
+// empties a slot whose setup failed
+static void removeEntry(OMXJPEGEncPool_s *pool, OMXJPEGEncPoolEntry_s *entry) {
+    pthread_mutex_lock(&pool->lock);
+    entry->ctx = NULL;
+    entry->inUse = false;
+    pthread_cond_broadcast(&pool->available);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+
+OMXContext_s * omxJPEGEncPoolCheckout(OMXJPEGEncPool_s *pool, uint32_t rawImageWidth, uint32_t rawImageHeight, OMX_COLOR_FORMATTYPE colorFormat) {
+    OMXJPEGEncPoolEntry_s *entry = NULL;
+    bool create = false;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (!entry) {
+        OMXJPEGEncPoolEntry_s *idle = NULL;
+        OMXJPEGEncPoolEntry_s *empty = NULL;
+
+        for (uint32_t i = 0; i < pool->numEntries; i++) {
+            OMXJPEGEncPoolEntry_s *e = &pool->entries[i];
+
+            if (e->inUse) {
+                continue;
+            }
+
+            if (!e->ctx) {
+                empty = e;
+                continue;
+            }
+
+            if ((e->width == rawImageWidth) && (e->height == rawImageHeight) && (e->colorFormat == colorFormat)) {
+                entry = e;
+                break;
+            }
+
+            idle = e;
+        }
+
+        if (entry) {
+            break;
+        }
+
+        if (empty) {
+            entry = empty;
+            create = true;
+        } else if (idle) {
+            entry = idle;
+        } else {
+            pthread_cond_wait(&pool->available, &pool->lock);
+        }
+    }
+
+    entry->inUse = true;
+    const bool matches = !create && (entry->width == rawImageWidth) && (entry->height == rawImageHeight) && (entry->colorFormat == colorFormat);
+    entry->width = rawImageWidth;
+    entry->height = rawImageHeight;
+    entry->colorFormat = colorFormat;
+    OMXContext_s *ctx = entry->ctx;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (matches) {
+        omxJPEGEncSetQuality(ctx, pool->quality);
+        return ctx;
+    }
+
+    // setting up or reconfiguring a component takes a while, so it happens outside of the lock
+    if (create) {
+        ctx = omxJPEGEncInit(rawImageWidth, rawImageHeight, pool->sliceHeight, pool->quality, colorFormat, pool->bufferCount);
+
+        if (!ctx) {
+            removeEntry(pool, entry);
+            return NULL;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        entry->ctx = ctx;
+        pthread_mutex_unlock(&pool->lock);
+        return ctx;
+    }
+
+    if (!omxJPEGEncReconfigure(ctx, rawImageWidth, rawImageHeight, pool->sliceHeight, colorFormat)) {
+        omxJPEGEncDeinit(ctx);
+        removeEntry(pool, entry);
+        return NULL;
+    }
+
+    omxJPEGEncSetQuality(ctx, pool->quality);
+    return ctx;
+}
+
+
+
+void omxJPEGEncPoolCheckin(OMXJPEGEncPool_s *pool, OMXContext_s *ctx) {
+    pthread_mutex_lock(&pool->lock);
+
+    for (uint32_t i = 0; i < pool->numEntries; i++) {
+        if (pool->entries[i].ctx == ctx) {
+            assert(pool->entries[i].inUse);
+            pool->entries[i].inUse = false;
+            pthread_cond_signal(&pool->available);
+            pthread_mutex_unlock(&pool->lock);
+            return;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    assert(false);
+}
+
+
+
+typedef struct {
+    OMXJPEGEncPool_s *pool;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numFrames;
+} OMXJPEGEncPoolWorker_s;
+
+
+
+static void * encodeWorker(void *userData) {
+    const OMXJPEGEncPoolWorker_s *worker = userData;
+    const size_t rawImageSize = worker->width * worker->height * 3;
+    uint8_t *rawImage = malloc(rawImageSize);
+    const size_t outputSize = rawImageSize;
+    uint8_t *output = malloc(outputSize);
+
+    for (size_t i = 0; i < rawImageSize; i++) {
+        rawImage[i] = (uint8_t)((i / 3) % worker->width + (i % 3) * 64);
+    }
+
+    for (uint32_t f = 0; f < worker->numFrames; f++) {
+        OMXContext_s *ctx = omxJPEGEncPoolCheckout(worker->pool, worker->width, worker->height, OMX_COLOR_Format24bitRGB888);
+        assert(ctx);
+        size_t outputFill = 0;
+        omxJPEGEncProcess(ctx, output, &outputFill, outputSize, rawImage, rawImageSize);
+        omxJPEGEncPoolCheckin(worker->pool, ctx);
+        assert(outputFill > 0);
+    }
+
+    free(output);
+    free(rawImage);
+    return NULL;
+}
+
+
+
+void omxJPEGEncPool() {
+    const uint32_t threadCounts[] = { 1, 2, 4, 8 };
+    const uint32_t maxContexts = 4;
+    const uint32_t framesPerThread = 32;
+    const uint32_t width = 640;
+    const uint32_t height = 480;
+
+    OMXJPEGEncPool_s *pool = omxJPEGEncPoolInit(maxContexts, 16, 75, 2);
+
+    // warm the pool so that component setup is not part of the measurement
+    OMXContext_s *warm[maxContexts];
+
+    for (uint32_t i = 0; i < maxContexts; i++) {
+        warm[i] = omxJPEGEncPoolCheckout(pool, width, height, OMX_COLOR_Format24bitRGB888);
+        assert(warm[i]);
+    }
+
+    for (uint32_t i = 0; i < maxContexts; i++) {
+        omxJPEGEncPoolCheckin(pool, warm[i]);
+    }
+
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); t++) {
+        const uint32_t numThreads = threadCounts[t];
+        pthread_t threads[numThreads];
+        OMXJPEGEncPoolWorker_s worker = { .pool = pool, .width = width, .height = height, .numFrames = framesPerThread };
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (uint32_t i = 0; i < numThreads; i++) {
+            pthread_create(&threads[i], NULL, encodeWorker, &worker);
+        }
+
+        for (uint32_t i = 0; i < numThreads; i++) {
+            pthread_join(threads[i], NULL);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+        printf(COLOR_YELLOW "%d threads, %d contexts: %.2f fps\n" COLOR_NC, numThreads, maxContexts, numThreads * framesPerThread / seconds);
+    }
+
+    omxJPEGEncPoolDeinit(pool);
+}
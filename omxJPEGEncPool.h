@@ -0,0 +1,36 @@
+//
+//  omxJPEGEncPool.h
+//  OMXPlayground
+//
+
+#ifndef omxJPEGEncPool_h
+#define omxJPEGEncPool_h
+
+
+#include <stdint.h>
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Component.h>
+
+#include "omxJPEGEnc.h"
+
+
+// forward declaration of a typedef struct
+struct OMXJPEGEncPool_s;
+typedef struct OMXJPEGEncPool_s OMXJPEGEncPool_s;
+
+
+// A bounded set of encoder contexts shared between threads. Checkout prefers an idle context that already
+// matches (width, height, colorFormat), creates a new one while the pool is below maxContexts and otherwise
+// reconfigures an idle one. It blocks if all contexts are checked out. Returns NULL if no encoder could be
+// set up for the requested format.
+OMXJPEGEncPool_s * omxJPEGEncPoolInit(uint32_t maxContexts, uint32_t sliceHeight, uint8_t outputQuality, uint32_t bufferCount);
+void omxJPEGEncPoolDeinit(OMXJPEGEncPool_s *pool);
+
+OMXContext_s * omxJPEGEncPoolCheckout(OMXJPEGEncPool_s *pool, uint32_t rawImageWidth, uint32_t rawImageHeight, OMX_COLOR_FORMATTYPE colorFormat);
+void omxJPEGEncPoolCheckin(OMXJPEGEncPool_s *pool, OMXContext_s *ctx);
+
+void omxJPEGEncPool(void);
+
+
+#endif /* omxJPEGEncPool_h */
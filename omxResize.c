@@ -9,21 +9,31 @@
 #include "omxResize.h"
 
 #include <assert.h>
-#include <stdbool.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/param.h>  // MIN, MAX
 
 #define OMX_SKIP64BIT
 #include <IL/OMX_Broadcom.h>
 #include <IL/OMX_Component.h>
 #include <IL/OMX_Core.h>
-#include <interface/vcos/vcos.h>
 
 #include "cHelper.h"
+#include "cpuResize.h"
 #include "mmapHelper.h"
+#include "omxDump.h"
 #include "omxHelper.h"
 
 
 
+#define OMX_RESIZE_STREAM_BUFFERS 2
+
+
+
 typedef struct {
     OMX_HANDLETYPE handle;
 
@@ -34,41 +44,33 @@ typedef struct {
     //OMX_PARAM_CAMERAPOOLTOENCODERFUNCTIONTYPE inputCameraPoolToEncoderFunction; // missing
     OMX_IMAGE_PARAM_PORTFORMATTYPE inputImagePortFormat;
     OMX_CONFIG_PORTBOOLEANTYPE inputBrcmSupportsSlices;
-    OMX_BUFFERHEADERTYPE *inputBuffer;
-    bool inputReady;
+    OMX_BUFFERHEADERTYPE *inputBuffers[OMX_RESIZE_STREAM_BUFFERS];
+    OMX_U32 numInputBuffers;
+    OMX_BUFFERHEADERTYPE *inputFree[OMX_RESIZE_STREAM_BUFFERS];
+    OMX_U32 numInputFree;
 
     OMX_U32 outputPortIndex;
     OMX_PARAM_PORTDEFINITIONTYPE outputPortDefinition;
     OMX_PARAM_RESIZETYPE outputResize;
     OMX_IMAGE_PARAM_PORTFORMATTYPE outputImagePortFormat;
     OMX_CONFIG_PORTBOOLEANTYPE outputBrcmSupportsSlices;
-    OMX_BUFFERHEADERTYPE *outputBuffer;
-    bool outputReady;
+    OMX_BUFFERHEADERTYPE *outputBuffers[OMX_RESIZE_STREAM_BUFFERS];
+    OMX_U32 numOutputBuffers;
+    OMX_BUFFERHEADERTYPE *outputFilled[OMX_RESIZE_STREAM_BUFFERS];     // FIFO of buffers returned by FillBufferDone
+    OMX_U32 outputFilledHead;
+    OMX_U32 numOutputFilled;
 } OMXResize_s;
 
 
 
-typedef struct {
+struct OMXResizeSession_s {
     OMXResize_s resize;
+    OMXSize_t inputSize;
+    OMX_COLOR_FORMATTYPE eInputColorFormat;
 
-    VCOS_SEMAPHORE_T handler_lock;
-    VCOS_SEMAPHORE_T portChangeLock;
-} OMXContext_s;
-
-
-
-typedef struct {
-    OMX_U32 nWidth;
-    OMX_U32 nHeight;
-} OMXSize_t;
-
-
-typedef struct {
-    OMX_S32 nLeft;
-    OMX_S32 nTop;
-    OMX_U32 nWidth;
-    OMX_U32 nHeight;
-} OMXRect_t;
+    pthread_mutex_t lock;           // guards the buffer lists
+    pthread_cond_t bufferCond;      // signaled whenever a buffer comes back
+};
 
 
 
@@ -82,7 +84,7 @@ static OMX_ERRORTYPE omxEventHandler(
 
     printf("eEvent: %s,  ", omxEventTypeEnum(eEvent));
     //printf("eEvent: %s,  nData1: %x,  nData2: %x\n", omxEventTypeEnum(eEvent), nData1, nData2);
-    OMXContext_s* ctx = (OMXContext_s*)pAppData;
+    OMXResizeSession_s* ctx = (OMXResizeSession_s*)pAppData;
 
     switch(eEvent) {
         case OMX_EventCmdComplete:
@@ -131,10 +133,11 @@ static OMX_ERRORTYPE omxEmptyBufferDone(
                                         OMX_IN OMX_HANDLETYPE hComponent,
                                         OMX_IN OMX_PTR pAppData,
                                         OMX_IN OMX_BUFFERHEADERTYPE* pBuffer) {
-    OMXContext_s *ctx = (OMXContext_s*)pAppData;
-    vcos_semaphore_wait(&ctx->handler_lock);
-    ctx->resize.inputReady = true;
-    vcos_semaphore_post(&ctx->handler_lock);
+    OMXResizeSession_s *ctx = (OMXResizeSession_s*)pAppData;
+    pthread_mutex_lock(&ctx->lock);
+    ctx->resize.inputFree[ctx->resize.numInputFree++] = pBuffer;
+    pthread_cond_broadcast(&ctx->bufferCond);
+    pthread_mutex_unlock(&ctx->lock);
     return OMX_ErrorNone;
 }
 
@@ -144,10 +147,14 @@ static OMX_ERRORTYPE omxFillBufferDone(
                                        OMX_OUT OMX_HANDLETYPE hComponent,
                                        OMX_OUT OMX_PTR pAppData,
                                        OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer) {
-    OMXContext_s *ctx = (OMXContext_s*)pAppData;
-    vcos_semaphore_wait(&ctx->handler_lock);
-    ctx->resize.outputReady = true;
-    vcos_semaphore_post(&ctx->handler_lock);
+    OMXResizeSession_s *ctx = (OMXResizeSession_s*)pAppData;
+    OMXResize_s *resize = &ctx->resize;
+    pthread_mutex_lock(&ctx->lock);
+    const OMX_U32 tail = (resize->outputFilledHead + resize->numOutputFilled) % OMX_RESIZE_STREAM_BUFFERS;
+    resize->outputFilled[tail] = pBuffer;
+    resize->numOutputFilled++;
+    pthread_cond_broadcast(&ctx->bufferCond);
+    pthread_mutex_unlock(&ctx->lock);
     return OMX_ErrorNone;
 }
 
@@ -182,7 +189,7 @@ static void getPorts(OMXResize_s *component) {
 
 
 
-static void setupInputPort(OMXResize_s *component, OMXSize_t frameSize, OMXRect_t cropRect, OMX_COLOR_FORMATTYPE eColorFormat) {
+static void setupInputPort(OMXResize_s *component, OMXSize_t frameSize, OMX_COLOR_FORMATTYPE eColorFormat) {
     assert(omxAssertImagePortFormatSupported(component->handle, component->inputPortIndex, eColorFormat));
 
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
@@ -198,6 +205,9 @@ static void setupInputPort(OMXResize_s *component, OMXSize_t frameSize, OMXRect_
     omxErr = OMX_GetParameter(component->handle, OMX_IndexParamPortDefinition, portDefinition);
     omxAssert(omxErr);
 
+    // two buffers so that the next slice is pulled while the component works on the previous one
+    assert(portDefinition->nBufferCountMin <= OMX_RESIZE_STREAM_BUFFERS);
+    portDefinition->nBufferCountActual = OMX_RESIZE_STREAM_BUFFERS;
     portDefinition->format.image.nFrameWidth = frameSize.nWidth;
     portDefinition->format.image.nFrameHeight = frameSize.nHeight;
     portDefinition->format.image.nSliceHeight = (brcmSupportsSlices->bEnabled == OMX_TRUE) ? 16 : 0;
@@ -211,30 +221,23 @@ static void setupInputPort(OMXResize_s *component, OMXSize_t frameSize, OMXRect_
     omxErr = OMX_GetParameter(component->handle, OMX_IndexParamPortDefinition, portDefinition);
     omxAssert(omxErr);
 
-    OMX_CONFIG_RECTTYPE *commonInputCrop = &component->inputCommonInputCrop;
-    OMX_INIT_STRUCTURE2(commonInputCrop);
-    commonInputCrop->nPortIndex = component->inputPortIndex;
-    omxErr = OMX_GetParameter(component->handle, OMX_IndexConfigCommonInputCrop, commonInputCrop);
-    omxAssert(omxErr);
-
-    commonInputCrop->nWidth = cropRect.nWidth;
-    commonInputCrop->nHeight = cropRect.nHeight;
-    commonInputCrop->nLeft = cropRect.nLeft;
-    commonInputCrop->nTop = cropRect.nTop;
-    omxErr = OMX_SetParameter(component->handle, OMX_IndexConfigCommonInputCrop, commonInputCrop);
+    omxErr = omxSendCommand(component->handle, OMX_CommandPortEnable, component->inputPortIndex);
     omxAssert(omxErr);
 
-    omxErr = OMX_GetParameter(component->handle, OMX_IndexConfigCommonInputCrop, commonInputCrop);
-    omxAssert(omxErr);
+    //omxPrintPort(component->handle, component->inputPortIndex);
 
 
-    omxEnablePort(component->handle, component->inputPortIndex, OMX_TRUE);
+    component->numInputBuffers = portDefinition->nBufferCountActual;
 
-    omxPrintPort(component->handle, component->inputPortIndex);
-    printf("pos: %dx%d    dim: %dx%d\n", commonInputCrop->nLeft, commonInputCrop->nTop, commonInputCrop->nWidth, commonInputCrop->nHeight);
+    for (OMX_U32 i = 0; i < component->numInputBuffers; i++) {
+        omxErr = OMX_AllocateBuffer(component->handle, &component->inputBuffers[i], component->inputPortIndex, NULL, portDefinition->nBufferSize);
+        omxAssert(omxErr);
+        component->inputFree[i] = component->inputBuffers[i];
+    }
 
+    component->numInputFree = component->numInputBuffers;
 
-    omxErr = OMX_AllocateBuffer(component->handle, &component->inputBuffer, component->inputPortIndex, NULL, portDefinition->nBufferSize);
+    omxErr = omxWaitForCommand(component->handle, OMX_CommandPortEnable, component->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
     omxAssert(omxErr);
 }
 
@@ -258,6 +261,8 @@ static void setupOutputPort(OMXResize_s *component, OMXSize_t frameSize, OMX_COL
 
     omxPrintPort(component->handle, component->outputPortIndex);
 
+    assert(portDefinition->nBufferCountMin <= OMX_RESIZE_STREAM_BUFFERS);
+    portDefinition->nBufferCountActual = OMX_RESIZE_STREAM_BUFFERS;
     portDefinition->format.image.nFrameWidth = frameSize.nWidth;
     portDefinition->format.image.nFrameHeight = frameSize.nHeight;
     portDefinition->format.image.nSliceHeight = (brcmSupportsSlices->bEnabled == OMX_TRUE) ? 16 : frameSize.nHeight;
@@ -274,133 +279,499 @@ static void setupOutputPort(OMXResize_s *component, OMXSize_t frameSize, OMX_COL
     omxPrintPort(component->handle, component->outputPortIndex);
 
 
-    omxEnablePort(component->handle, component->outputPortIndex, OMX_TRUE);
+    omxErr = omxSendCommand(component->handle, OMX_CommandPortEnable, component->outputPortIndex);
+    omxAssert(omxErr);
+
+
+    component->numOutputBuffers = portDefinition->nBufferCountActual;
 
+    for (OMX_U32 i = 0; i < component->numOutputBuffers; i++) {
+        omxErr = OMX_AllocateBuffer(component->handle, &component->outputBuffers[i], component->outputPortIndex, NULL, portDefinition->nBufferSize);
+        omxAssert(omxErr);
+    }
 
-    omxErr = OMX_AllocateBuffer(component->handle, &component->outputBuffer, component->outputPortIndex, NULL, portDefinition->nBufferSize);
+    omxErr = omxWaitForCommand(component->handle, OMX_CommandPortEnable, component->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
     omxAssert(omxErr);
 }
 
 
 
+static void freeInputBuffers(OMXResize_s *component) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+    for (OMX_U32 i = 0; i < component->numInputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(component->handle, component->inputPortIndex, component->inputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    component->numInputBuffers = 0;
+    component->numInputFree = 0;
+}
+
+
+
 static void freeBuffers(OMXResize_s *component) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    omxErr = OMX_FreeBuffer(component->handle, component->inputPortIndex, component->inputBuffer);
-    omxAssert(omxErr);
-    omxErr = OMX_FreeBuffer(component->handle, component->outputPortIndex, component->outputBuffer);
-    omxAssert(omxErr);
+    freeInputBuffers(component);
+
+    for (OMX_U32 i = 0; i < component->numOutputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(component->handle, component->outputPortIndex, component->outputBuffers[i]);
+        omxAssert(omxErr);
+    }
 }
 
 
 
-void omxResize() {
-    uint32_t rawImageWidth = 640;
-    uint32_t rawImageHeight = 480;
-    uint8_t rawImageChannels = 4;
-    size_t rawImageSize = rawImageWidth * rawImageHeight * rawImageChannels;
-    uint8_t *rawImage = (uint8_t *)malloc(rawImageSize);
-
-    for (uint32_t y = 0; y < rawImageHeight; y++) {
-        for (uint32_t x = 0; x < rawImageWidth; x++) {
-            ssize_t index = (x + rawImageWidth * y) * rawImageChannels;
-            rawImage[index + 0] = x % 256;
-            rawImage[index + 1] = y % 256;
-            rawImage[index + 2] = (x + y) % 256;
-            rawImage[index + 3] = 255;
+
+
+
+static bool isPlanar(OMX_COLOR_FORMATTYPE eColorFormat) {
+    return (eColorFormat == OMX_COLOR_FormatYUV420PackedPlanar) || (eColorFormat == OMX_COLOR_FormatYUV420Planar);
+}
+
+
+
+static uint32_t bytesPerPixel(OMX_COLOR_FORMATTYPE eColorFormat) {
+    switch (eColorFormat) {
+        case OMX_COLOR_Format32bitABGR8888:
+        case OMX_COLOR_Format32bitARGB8888:
+        case OMX_COLOR_Format32bitBGRA8888:
+            return 4;
+
+        case OMX_COLOR_Format24bitRGB888:
+        case OMX_COLOR_Format24bitBGR888:
+            return 3;
+
+        default:
+            return 0;
+    }
+}
+
+
+
+// Same output as the component path, for when OMX.broadcom.resize cannot be had. cpuResize clamps its filter
+// to the crop, so only the rows of the crop are kept and the slices above and below it are pulled into one slice
+// buffer and dropped.
+static bool cpuResizeStream(OMXSize_t inputSize, OMXRect_t inputCrop, OMXSize_t outputSize, OMX_COLOR_FORMATTYPE eColorFormat, OMXResizePull_t pull, void *userData, OMXSink_t sink) {
+    const uint32_t sliceHeight = 16;
+    const uint32_t numChannels = bytesPerPixel(eColorFormat);
+    const uint32_t top = (inputCrop.nHeight > 0) ? inputCrop.nTop : 0;
+    const uint32_t height = (inputCrop.nHeight > 0) ? inputCrop.nHeight : inputSize.nHeight;
+
+    if ((numChannels == 0) || (inputCrop.nTop < 0) || (top + height > inputSize.nHeight)) {
+        puts(COLOR_RED "omxResize: the CPU fallback only streams packed RGB formats within the frame" COLOR_NC);
+        return false;
+    }
+
+    CPUImage_s input = { .eColorFormat = eColorFormat, .nWidth = inputSize.nWidth, .nHeight = height, .nStride = inputSize.nWidth * numChannels };
+    CPUImage_s output = { .eColorFormat = eColorFormat, .nWidth = outputSize.nWidth, .nHeight = outputSize.nHeight, .nStride = outputSize.nWidth * numChannels };
+    input.pData = malloc(input.nStride * input.nHeight);
+    output.pData = malloc(output.nStride * output.nHeight);
+    uint8_t *slice = malloc(input.nStride * sliceHeight);
+    assert((input.pData != NULL) && (output.pData != NULL) && (slice != NULL));
+    bool success = true;
+
+    for (uint32_t y = 0; success && (y < inputSize.nHeight); y += sliceHeight) {
+        const uint32_t rows = MIN(sliceHeight, inputSize.nHeight - y);
+        success = pull(userData, slice, input.nStride, y, rows);
+
+        // the part of the slice that lies within the crop
+        const uint32_t y0 = MAX(y, top);
+        const uint32_t y1 = MIN(y + rows, top + height);
+
+        if (success && (y0 < y1)) {
+            memcpy(input.pData + (y0 - top) * input.nStride, slice + (y0 - y) * input.nStride, (y1 - y0) * input.nStride);
         }
     }
 
-    OMXSize_t inputFrameSize = { .nWidth = rawImageWidth, .nHeight = rawImageHeight };
-    //OMXRect_t inputFrameCrop = { .nWidth = 256, .nHeight = 256, .nLeft = 128, .nTop = 128 };
-    OMXRect_t inputFrameCrop = { .nWidth = 0, .nHeight = 0, .nLeft = 0, .nTop = 0 };
-    OMXSize_t outputFrameSize = { .nWidth = rawImageWidth, .nHeight = rawImageHeight };
+    if (success) {
+        CPUResize_s *resize = cpuResizeInit(0);
+        inputCrop.nTop = 0;
+        success = cpuResizeProcess(resize, &output, &input, inputCrop);
+        cpuResizeDeinit(resize);
+    }
 
+    if (success) {
+        struct iovec chunk = { .iov_base = output.pData, .iov_len = output.nStride * output.nHeight };
+        success = omxSinkWrite(sink, &chunk, 1);
+    }
 
-    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
-    OMX_STATETYPE omxState = OMX_StateInvalid;
-    VCOS_STATUS_T vcosErr = VCOS_SUCCESS;
+    free(slice);
+    free(output.pData);
+    free(input.pData);
+    return success;
+}
 
-    OMXContext_s ctx;
-    memset(&ctx, 0, sizeof(ctx));
 
-    vcosErr = vcos_semaphore_create(&ctx.handler_lock, "handler_lock", 1);
-    assert(vcosErr == VCOS_SUCCESS);
+
+OMXResizeSession_s * omxResizeInit(OMXSize_t inputSize, OMX_COLOR_FORMATTYPE eInputColorFormat, OMXSize_t outputSize, OMX_COLOR_FORMATTYPE eOutputColorFormat) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+    OMXResizeSession_s *ctx = calloc(1, sizeof(OMXResizeSession_s));
+    assert(ctx != NULL);
+    ctx->inputSize = inputSize;
+    ctx->eInputColorFormat = eInputColorFormat;
 
     OMX_STRING omxComponentName = "OMX.broadcom.resize";
     OMX_CALLBACKTYPE omxCallbacks;
     omxCallbacks.EventHandler = omxEventHandler;
     omxCallbacks.EmptyBufferDone = omxEmptyBufferDone;
     omxCallbacks.FillBufferDone = omxFillBufferDone;
-    omxErr = OMX_GetHandle(&ctx.resize.handle, omxComponentName, &ctx, &omxCallbacks);
+    omxErr = omxGetHandle(&ctx->resize.handle, omxComponentName, ctx, &omxCallbacks);
+
+    if (omxErr != OMX_ErrorNone) {
+        printf(COLOR_YELLOW "%s unavailable (%s)\n" COLOR_NC, omxComponentName, omxErrorTypeEnum(omxErr));
+        free(ctx);
+        return NULL;
+    }
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->bufferCond, NULL);
+    omxAssertState(ctx->resize.handle, OMX_StateLoaded);
+
+    getPorts(&ctx->resize);
+    omxErr = omxEnablePort(ctx->resize.handle, ctx->resize.inputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
+    omxErr = omxEnablePort(ctx->resize.handle, ctx->resize.outputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(ctx->resize.handle, OMX_StateIdle);
+    omxAssert(omxErr);
+    setupInputPort(&ctx->resize, inputSize, eInputColorFormat);
+    setupOutputPort(&ctx->resize, outputSize, eOutputColorFormat);
+    omxErr = omxSwitchToState(ctx->resize.handle, OMX_StateExecuting);
+    omxAssert(omxErr);
+
+    const OMX_PARAM_PORTDEFINITIONTYPE *inputDefinition = &ctx->resize.inputPortDefinition;
+    const OMX_PARAM_PORTDEFINITIONTYPE *outputDefinition = &ctx->resize.outputPortDefinition;
+    const size_t bufferMemory = ctx->resize.numInputBuffers * inputDefinition->nBufferSize + ctx->resize.numOutputBuffers * outputDefinition->nBufferSize;
+    printf(COLOR_YELLOW "streaming %dx%d in slices of %d rows through %zu bytes of buffers\n" COLOR_NC, inputSize.nWidth, inputSize.nHeight, inputDefinition->format.image.nSliceHeight, bufferMemory);
+
+    // the output buffers stay with the component between frames
+    for (OMX_U32 i = 0; i < ctx->resize.numOutputBuffers; i++) {
+        omxErr = OMX_FillThisBuffer(ctx->resize.handle, ctx->resize.outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    return ctx;
+}
+
+
+
+void omxResizeDeinit(OMXResizeSession_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+    // going to Idle returns the buffers still held by the component
+    omxErr = omxSwitchToState(ctx->resize.handle, OMX_StateIdle);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(ctx->resize.handle, OMX_CommandPortDisable, ctx->resize.inputPortIndex);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(ctx->resize.handle, OMX_CommandPortDisable, ctx->resize.outputPortIndex);
+    omxAssert(omxErr);
+    freeBuffers(&ctx->resize);
+    omxErr = omxWaitForCommand(ctx->resize.handle, OMX_CommandPortDisable, ctx->resize.inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxWaitForCommand(ctx->resize.handle, OMX_CommandPortDisable, ctx->resize.outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(ctx->resize.handle, OMX_StateLoaded);
+    omxAssert(omxErr);
+    omxErr = omxFreeHandle(ctx->resize.handle);
     omxAssert(omxErr);
-    omxAssertState(ctx.resize.handle, OMX_StateLoaded);
 
+    pthread_cond_destroy(&ctx->bufferCond);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+
+
+void omxResizeSetCrop(OMXResizeSession_s *ctx, OMXRect_t inputCrop) {
+    // omxResizeProcess only returns once the frame is through, so this always lands between two frames
+    OMX_ERRORTYPE omxErr = omxSetInputCrop(ctx->resize.handle, ctx->resize.inputPortIndex, inputCrop);
+    omxAssert(omxErr);
+}
 
-    getPorts(&ctx.resize);
-    omxEnablePort(ctx.resize.handle, ctx.resize.inputPortIndex, OMX_FALSE);
-    omxEnablePort(ctx.resize.handle, ctx.resize.outputPortIndex, OMX_FALSE);
-    omxSwitchToState(ctx.resize.handle, OMX_StateIdle);
-    setupInputPort(&ctx.resize, inputFrameSize, inputFrameCrop, OMX_COLOR_Format32bitABGR8888);
-    setupOutputPort(&ctx.resize, outputFrameSize, OMX_COLOR_Format32bitABGR8888);
-    omxSwitchToState(ctx.resize.handle, OMX_StateExecuting);
 
 
-    int pos = 0;
-    ctx.resize.inputReady = true;
-    ctx.resize.outputReady = false;
-    uint32_t sliceSize = ctx.resize.inputBuffer->nAllocLen;
+// The old way of changing the crop: disable the input port, free its buffers, set the crop and enable the port
+// again with new buffers. Only kept to compare against omxResizeSetCrop.
+static void cycleInputPort(OMXResizeSession_s *ctx, OMXRect_t inputCrop) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    omxErr = omxSendCommand(ctx->resize.handle, OMX_CommandPortDisable, ctx->resize.inputPortIndex);
+    omxAssert(omxErr);
+    freeInputBuffers(&ctx->resize);
+    omxErr = omxWaitForCommand(ctx->resize.handle, OMX_CommandPortDisable, ctx->resize.inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
 
-    omxErr = OMX_FillThisBuffer(ctx.resize.handle, ctx.resize.outputBuffer);
+    omxErr = omxSetInputCrop(ctx->resize.handle, ctx->resize.inputPortIndex, inputCrop);
     omxAssert(omxErr);
+    setupInputPort(&ctx->resize, ctx->inputSize, ctx->eInputColorFormat);
+}
 
-    FILE * output = fopen("out2.data", "wb");
 
-    while (true) {
-        if (ctx.resize.outputReady) {
-            ctx.resize.outputReady = false;
-            //printf("got: %d\n", ctx.resize.outputBuffer->nFilledLen);
-            fwrite(ctx.resize.outputBuffer->pBuffer + ctx.resize.outputBuffer->nOffset, sizeof(uint8_t), ctx.resize.outputBuffer->nFilledLen, output);
 
-            if (ctx.resize.outputBuffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) {
-                break;
+bool omxResizeProcess(OMXResizeSession_s *ctx, OMXResizePull_t pull, void *userData, OMXSink_t sink) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMXResize_s *resize = &ctx->resize;
+    const OMXSize_t inputSize = ctx->inputSize;
+    const OMX_PARAM_PORTDEFINITIONTYPE *inputDefinition = &resize->inputPortDefinition;
+    const uint32_t stride = inputDefinition->format.image.nStride;
+    const uint32_t sliceHeight = (inputDefinition->format.image.nSliceHeight > 0) ? inputDefinition->format.image.nSliceHeight : inputSize.nHeight;
+
+    bool pullFailed = false;
+    bool sinkFailed = false;
+    bool endOfFrame = false;
+    uint32_t y = 0;
+    pthread_mutex_lock(&ctx->lock);
+
+    while (!endOfFrame) {
+        if (resize->numOutputFilled > 0) {
+            OMX_BUFFERHEADERTYPE *outBuffer = resize->outputFilled[resize->outputFilledHead];
+            resize->outputFilledHead = (resize->outputFilledHead + 1) % OMX_RESIZE_STREAM_BUFFERS;
+            resize->numOutputFilled--;
+            pthread_mutex_unlock(&ctx->lock);
+
+            struct iovec chunk = { .iov_base = outBuffer->pBuffer + outBuffer->nOffset, .iov_len = outBuffer->nFilledLen };
+
+            if (!sinkFailed && (chunk.iov_len > 0) && !omxSinkWrite(sink, &chunk, 1)) {
+                puts(COLOR_RED "omxResize: writing to the sink failed" COLOR_NC);
+                sinkFailed = true;
             }
 
-            omxErr = OMX_FillThisBuffer(ctx.resize.handle, ctx.resize.outputBuffer);
+            endOfFrame = (outBuffer->nFlags & (OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_EOS)) != 0;
+            omxErr = OMX_FillThisBuffer(resize->handle, outBuffer);
             omxAssert(omxErr);
+
+            pthread_mutex_lock(&ctx->lock);
+            continue;
         }
 
-        if (ctx.resize.inputReady) {
-            ctx.resize.inputReady = false;
+        if ((resize->numInputFree > 0) && (y < inputSize.nHeight)) {
+            OMX_BUFFERHEADERTYPE *inBuffer = resize->inputFree[--resize->numInputFree];
+            pthread_mutex_unlock(&ctx->lock);
 
-            if (pos == rawImageSize) {
-                continue;
-            }
+            // the slice is written straight into the input buffer, there is no frame in host memory to copy from
+            const uint32_t rows = MIN(sliceHeight, inputSize.nHeight - y);
+            const bool firstSlice = (y == 0);
+            pullFailed = !pull(userData, inBuffer->pBuffer, stride, y, rows);
+            y += rows;
+
+            inBuffer->nOffset = 0;
+            inBuffer->nFilledLen = (isPlanar(ctx->eInputColorFormat) || (rows == sliceHeight)) ? inputDefinition->nBufferSize : rows * stride;
+            inBuffer->nFlags = (y == inputSize.nHeight) ? OMX_BUFFERFLAG_ENDOFFRAME : 0;
+
+            if (pullFailed) {
+                puts(COLOR_RED "omxResize: the producer failed, cutting the frame short" COLOR_NC);
 
-            memcpy(ctx.resize.inputBuffer->pBuffer, &rawImage[pos], sliceSize);
-            ctx.resize.inputBuffer->nOffset = 0;
-            ctx.resize.inputBuffer->nFilledLen = sliceSize;
-            pos += sliceSize;
+                if (firstSlice) {
+                    // nothing reached the component, there is no frame to finish
+                    pthread_mutex_lock(&ctx->lock);
+                    resize->inputFree[resize->numInputFree++] = inBuffer;
+                    break;
+                }
 
-            if (pos + sliceSize > rawImageSize) {
-                sliceSize = rawImageSize - pos;
+                // finish the frame with what the component has so that it is ready for the next one
+                y = inputSize.nHeight;
+                inBuffer->nFilledLen = 0;
+                inBuffer->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
             }
 
-            omxErr = OMX_EmptyThisBuffer(ctx.resize.handle, ctx.resize.inputBuffer);
+            omxErr = OMX_EmptyThisBuffer(resize->handle, inBuffer);
             omxAssert(omxErr);
+
+            pthread_mutex_lock(&ctx->lock);
+            continue;
         }
+
+        pthread_cond_wait(&ctx->bufferCond, &ctx->lock);
     }
 
+    // a crop set after returning must not meet a slice of this frame still in the component
+    while (resize->numInputFree < resize->numInputBuffers) {
+        pthread_cond_wait(&ctx->bufferCond, &ctx->lock);
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+    return !pullFailed && !sinkFailed;
+}
+
+
+
+bool omxResizeStream(OMXSize_t inputSize, OMXRect_t inputCrop, OMX_COLOR_FORMATTYPE eInputColorFormat, OMXSize_t outputSize, OMX_COLOR_FORMATTYPE eOutputColorFormat, OMXResizePull_t pull, void *userData, OMXSink_t sink) {
+    OMXResizeSession_s *ctx = omxResizeInit(inputSize, eInputColorFormat, outputSize, eOutputColorFormat);
+
+    if (ctx == NULL) {
+        puts(COLOR_YELLOW "omxResize: resizing on the CPU" COLOR_NC);
+
+        if (eInputColorFormat != eOutputColorFormat) {
+            puts(COLOR_RED "omxResize: the CPU fallback does not convert between colour formats" COLOR_NC);
+            return false;
+        }
+
+        return cpuResizeStream(inputSize, inputCrop, outputSize, eInputColorFormat, pull, userData, sink);
+    }
+
+    omxResizeSetCrop(ctx, inputCrop);
+    bool success = omxResizeProcess(ctx, pull, userData, sink);
+    omxResizeDeinit(ctx);
+    return success;
+}
+
+
+
+typedef struct {
+    uint32_t width;
+    FILE *file;             // receives the generated rows for comparison, may be NULL
+} GradientProducer_s;
+
+
+
+static bool pullGradient(void *userData, uint8_t *dst, uint32_t stride, uint32_t y, uint32_t rows) {
+    GradientProducer_s *producer = userData;
+
+    for (uint32_t r = y; r < y + rows; r++) {
+        uint8_t *row = dst + (r - y) * stride;
+
+        for (uint32_t x = 0; x < producer->width; x++) {
+            row[4 * x + 0] = x % 256;
+            row[4 * x + 1] = r % 256;
+            row[4 * x + 2] = (x + r) % 256;
+            row[4 * x + 3] = 255;
+        }
+
+        if (producer->file != NULL) {
+            fwrite(row, sizeof(uint8_t), producer->width * 4, producer->file);
+        }
+    }
+
+    return true;
+}
+
+
+
+void omxResize() {
+    OMXSize_t inputFrameSize = { .nWidth = 640, .nHeight = 480 };
+    //OMXRect_t inputFrameCrop = { .nWidth = 256, .nHeight = 256, .nLeft = 128, .nTop = 128 };
+    OMXRect_t inputFrameCrop = { .nWidth = 0, .nHeight = 0, .nLeft = 0, .nTop = 0 };
+    OMXSize_t outputFrameSize = { .nWidth = 640, .nHeight = 480 };
+
+    GradientProducer_s producer = { .width = inputFrameSize.nWidth, .file = fopen("out1.data", "wb") };
+    FILE *output = fopen("out2.data", "wb");
+    assert((producer.file != NULL) && (output != NULL));
+
+    bool success = omxResizeStream(inputFrameSize, inputFrameCrop, OMX_COLOR_Format32bitABGR8888, outputFrameSize, OMX_COLOR_Format32bitABGR8888, pullGradient, &producer, omxFdSink(fileno(output)));
+    assert(success);
+
     fclose(output);
-    output = fopen("out1.data", "wb");
-    fwrite(rawImage, sizeof(uint8_t), rawImageSize, output);
+    fclose(producer.file);
+}
+
+
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+} TileSource_s;
+
+
+
+// unlike pullGradient no two tiles of the image look the same
+static bool pullTileSource(void *userData, uint8_t *dst, uint32_t stride, uint32_t y, uint32_t rows) {
+    const TileSource_s *source = userData;
+
+    for (uint32_t r = y; r < y + rows; r++) {
+        uint8_t *row = dst + (r - y) * stride;
+
+        for (uint32_t x = 0; x < source->width; x++) {
+            row[4 * x + 0] = x * 255 / source->width;
+            row[4 * x + 1] = r * 255 / source->height;
+            row[4 * x + 2] = (x ^ r) % 256;
+            row[4 * x + 3] = 255;
+        }
+    }
+
+    return true;
+}
+
+
+
+static double elapsed(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+
+
+// Cuts an image into tiles with one component that stays in Executing, once changing the crop with
+// omxResizeSetCrop and once with a port disable / enable cycle per tile.
+void omxResizeTiles() {
+    const OMXSize_t inputFrameSize = { .nWidth = 1024, .nHeight = 768 };
+    const OMXSize_t outputFrameSize = { .nWidth = 128, .nHeight = 128 };
+    const uint32_t tileSize = 256;
+    const uint32_t tilesX = inputFrameSize.nWidth / tileSize;
+    const uint32_t numTiles = tilesX * (inputFrameSize.nHeight / tileSize);
+    const int iterations = 5;
+
+    TileSource_s source = { .width = inputFrameSize.nWidth, .height = inputFrameSize.nHeight };
+    OMXMemorySink_s memories[2][numTiles];
+    memset(memories, 0, sizeof(memories));
+    double totalTime[2] = { 0, 0 };
+    double cropTime[2] = { 0, 0 };
+
+    for (int method = 0; method < 2; method++) {
+        OMXResizeSession_s *ctx = omxResizeInit(inputFrameSize, OMX_COLOR_Format32bitABGR8888, outputFrameSize, OMX_COLOR_Format32bitABGR8888);
+
+        if (ctx == NULL) {
+            return;
+        }
+
+        for (int i = 0; i < iterations; i++) {
+            for (uint32_t t = 0; t < numTiles; t++) {
+                OMXRect_t crop = { .nLeft = (t % tilesX) * tileSize, .nTop = (t / tilesX) * tileSize, .nWidth = tileSize, .nHeight = tileSize };
+                OMXMemorySink_s *memory = &memories[method][t];
+                memory->size = 0;
+                memory->growable = true;
+
+                struct timespec start, cropped, end;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+
+                if (method == 0) {
+                    omxResizeSetCrop(ctx, crop);
+                } else {
+                    cycleInputPort(ctx, crop);
+                }
+
+                clock_gettime(CLOCK_MONOTONIC, &cropped);
+                bool success = omxResizeProcess(ctx, pullTileSource, &source, omxMemorySink(memory));
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                assert(success);
+
+                cropTime[method] += elapsed(start, cropped);
+                totalTime[method] += elapsed(start, end);
+            }
+        }
+
+        omxResizeDeinit(ctx);
+    }
+
+    FILE *output = fopen("tiles.data", "wb");
+    assert(output != NULL);
+
+    for (uint32_t t = 0; t < numTiles; t++) {
+        assert(memories[0][t].size == memories[1][t].size);
+        assert(memcmp(memories[0][t].data, memories[1][t].data, memories[0][t].size) == 0);
+        assert((t == 0) || (memcmp(memories[0][t].data, memories[0][0].data, memories[0][t].size) != 0));
+        fwrite(memories[0][t].data, sizeof(uint8_t), memories[0][t].size, output);
+    }
+
     fclose(output);
 
+    // only now, every tile is compared against the first one above
+    for (uint32_t t = 0; t < numTiles; t++) {
+        free(memories[0][t].data);
+        free(memories[1][t].data);
+    }
 
-    omxSwitchToState(ctx.resize.handle, OMX_StateIdle);
-    omxEnablePort(ctx.resize.handle, ctx.resize.inputPortIndex, OMX_FALSE);
-    omxEnablePort(ctx.resize.handle, ctx.resize.outputPortIndex, OMX_FALSE);
-    freeBuffers(&ctx.resize);
-    omxSwitchToState(ctx.resize.handle, OMX_StateLoaded);
-    omxErr = OMX_FreeHandle(ctx.resize.handle);
-    omxAssert(omxErr);
-};
+    const double ms = 1000.0 / (iterations * numTiles);
+    printf(COLOR_YELLOW "%d tiles of %dx%d -> %dx%d\n" COLOR_NC, numTiles, tileSize, tileSize, outputFrameSize.nWidth, outputFrameSize.nHeight);
+    printf(COLOR_YELLOW "OMX_SetConfig:       %.3f ms per tile (%.3f ms changing the crop)\n" COLOR_NC, totalTime[0] * ms, cropTime[0] * ms);
+    printf(COLOR_YELLOW "port disable/enable: %.3f ms per tile (%.3f ms changing the crop)\n" COLOR_NC, totalTime[1] * ms, cropTime[1] * ms);
+}
@@ -10,7 +10,43 @@
 #define omxResize_h
 
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Image.h>
+
+#include "omxHelper.h"
+#include "omxSink.h"
+
+
+// Streaming resize for images that should never be in host memory as a whole: pull is called for every input
+// slice of the port's nSliceHeight rows (fewer for the last one) and writes them at dst with the given stride.
+// For YUV420PackedPlanar dst is laid out like an input buffer of the port. The resized slices go to sink as soon
+// as the component returns them, so only its input and output buffers ever hold rows. The component also
+// converts from eInputColorFormat to eOutputColorFormat. Falls back to cpuResize (which keeps the rows of the
+// crop and cannot convert) if the component is unavailable. Returns false if pull or sink failed.
+typedef bool (*OMXResizePull_t)(void *userData, uint8_t *dst, uint32_t stride, uint32_t y, uint32_t rows);
+bool omxResizeStream(OMXSize_t inputSize, OMXRect_t inputCrop, OMX_COLOR_FORMATTYPE eInputColorFormat, OMXSize_t outputSize, OMX_COLOR_FORMATTYPE eOutputColorFormat, OMXResizePull_t pull, void *userData, OMXSink_t sink);
+
+
+// forward declaration of a typedef struct
+struct OMXResizeSession_s;
+typedef struct OMXResizeSession_s OMXResizeSession_s;
+
+
+// Keeps one component in Executing for any number of frames of the same input and output size and format, e.g.
+// the tiles of a large image or the steps of a pan and zoom. Returns NULL if the component is unavailable.
+OMXResizeSession_s * omxResizeInit(OMXSize_t inputSize, OMX_COLOR_FORMATTYPE eInputColorFormat, OMXSize_t outputSize, OMX_COLOR_FORMATTYPE eOutputColorFormat);
+void omxResizeDeinit(OMXResizeSession_s *ctx);
+
+// Changes the crop through OMX_SetConfig without touching the ports. It applies from the next omxResizeProcess on.
+void omxResizeSetCrop(OMXResizeSession_s *ctx, OMXRect_t inputCrop);
+// Resizes one frame like omxResizeStream and returns once the component has handed back all of it.
+bool omxResizeProcess(OMXResizeSession_s *ctx, OMXResizePull_t pull, void *userData, OMXSink_t sink);
+
 void omxResize(void);
+void omxResizeTiles(void);
 
 
 #endif /* omxResize_h */
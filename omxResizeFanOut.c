@@ -0,0 +1,994 @@
+//
+//  omxResizeFanOut.c
+//  OMXPlayground
+//
+//  A port can only be tunneled to one other port, so the decoded slices come back to the host and are emptied
+//  into every resize component from there. The input buffers of the resize components are OMX_UseBuffer
+//  headers on the memory of the decoder's output buffers (input buffer i of every resize component is output
+//  buffer i of the decoder), so nothing is copied. A decoded buffer is handed back to the decoder once all
+//  resize components returned it.
+//
+
+#include "omxResizeFanOut.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/param.h>  // MIN, MAX
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Broadcom.h>
+#include <IL/OMX_Component.h>
+#include <IL/OMX_Core.h>
+
+#include "cHelper.h"
+#include "mmapHelper.h"
+#include "omxDump.h"
+
+
+
+#define OMX_RESIZE_FAN_OUT_MAX_BUFFERS 16
+#define OMX_RESIZE_FAN_OUT_DECODED_BUFFERS 3
+#define OMX_RESIZE_FAN_OUT_RESIZED_BUFFERS 2
+
+
+
+typedef struct {
+    OMX_HANDLETYPE handle;
+
+    OMX_U32 inputPortIndex;
+    OMX_BUFFERHEADERTYPE *inputBuffers[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];    // alias the decoded buffers
+    OMX_U32 numInputBuffers;
+    OMXRect_t inputCrop;            // last crop handed to the component
+
+    OMX_U32 outputPortIndex;
+    OMX_PARAM_PORTDEFINITIONTYPE outputPortDefinition;
+    OMX_BUFFERHEADERTYPE *outputBuffers[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];
+    OMX_U32 numOutputBuffers;
+    OMX_BUFFERHEADERTYPE *outputFilled[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];    // FIFO of buffers returned by FillBufferDone
+    OMX_U32 outputFilledHead;
+    OMX_U32 numOutputFilled;
+    OMX_BUFFERHEADERTYPE *outputFree[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];      // owned by the host
+    OMX_U32 numOutputFree;
+
+    // the output of the current image
+    bool active;
+    bool done;
+    bool sinkFailed;
+    OMXSink_t sink;
+} OMXFanOutResize_s;
+
+
+
+struct OMXResizeFanOut_s {
+    OMX_HANDLETYPE handle;
+
+    OMX_U32 inputPortIndex;
+    OMX_BUFFERHEADERTYPE *inputBuffers[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];
+    OMX_U32 numInputBuffers;
+    OMX_BUFFERHEADERTYPE *inputFree[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];
+    OMX_U32 numInputFree;
+
+    OMX_U32 outputPortIndex;
+    OMX_PARAM_PORTDEFINITIONTYPE outputPortDefinition;
+    OMX_BUFFERHEADERTYPE *outputBuffers[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];   // pAppPrivate is the index
+    OMX_U32 numOutputBuffers;
+    OMX_BUFFERHEADERTYPE *outputFilled[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];    // FIFO of decoded slices
+    OMX_U32 outputFilledHead;
+    OMX_U32 numOutputFilled;
+    OMX_U32 outputReaders[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];                 // resize components still reading buffer i
+    OMX_BUFFERHEADERTYPE *outputFree[OMX_RESIZE_FAN_OUT_MAX_BUFFERS];      // read by everyone, to be refilled
+    OMX_U32 numOutputFree;
+
+    OMXFanOutResize_s resizes[OMX_RESIZE_FAN_OUT_MAX_OUTPUTS];
+    OMX_U32 numResizes;
+
+    pthread_mutex_t lock;           // guards the buffer lists and everything below
+    pthread_cond_t stateCond;       // signaled whenever a buffer comes back or an event arrives
+    bool portSettingsChanged;
+};
+
+
+
+static OMX_ERRORTYPE omxEventHandler(
+                                     OMX_IN OMX_HANDLETYPE hComponent,
+                                     OMX_IN OMX_PTR pAppData,
+                                     OMX_IN OMX_EVENTTYPE eEvent,
+                                     OMX_IN OMX_U32 nData1,
+                                     OMX_IN OMX_U32 nData2,
+                                     OMX_IN OMX_PTR pEventData) {
+
+    printf("eEvent: %s,  ", omxEventTypeEnum(eEvent));
+    OMXResizeFanOut_s* ctx = (OMXResizeFanOut_s*)pAppData;
+
+    switch(eEvent) {
+        case OMX_EventCmdComplete:
+            printf("Command: %s,  ", omxCommandTypeEnum(nData1));
+
+            switch (nData1) {
+                case OMX_CommandStateSet:
+                    printf("State: %s\n", omxStateTypeEnum(nData2));
+                    break;
+
+                case OMX_CommandPortDisable:
+                case OMX_CommandPortEnable:
+                    printf("Port: %d\n", nData2);
+                    break;
+
+                default:
+                    printf("nData2: 0x%x\n", nData2);
+            }
+
+            break;
+
+        case OMX_EventPortSettingsChanged:
+            printf("Port: %d  nData2: %x\n", nData1, nData2);
+
+            // only the decoder's output matters, the resize components are told their format
+            if (hComponent == ctx->handle) {
+                pthread_mutex_lock(&ctx->lock);
+                ctx->portSettingsChanged = true;
+                pthread_cond_broadcast(&ctx->stateCond);
+                pthread_mutex_unlock(&ctx->lock);
+            }
+
+            break;
+
+        case OMX_EventError:
+            printf(COLOR_RED "ErrorType: %s,  nData2: %x\n" COLOR_NC, omxErrorTypeEnum(nData1), nData2);
+
+            if (nData1 != OMX_ErrorStreamCorrupt) {
+                assert(NULL);
+            }
+            break;
+
+        default:
+            printf("unhandeled event 0x%08x: 0x%08x 0x%08x\n", eEvent, nData1, nData2);
+            break;
+    }
+
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxDecoderEmptyBufferDone(
+                                               OMX_IN OMX_HANDLETYPE hComponent,
+                                               OMX_IN OMX_PTR pAppData,
+                                               OMX_IN OMX_BUFFERHEADERTYPE* pBuffer) {
+    OMXResizeFanOut_s *ctx = (OMXResizeFanOut_s*)pAppData;
+    pthread_mutex_lock(&ctx->lock);
+    ctx->inputFree[ctx->numInputFree++] = pBuffer;
+    pthread_cond_broadcast(&ctx->stateCond);
+    pthread_mutex_unlock(&ctx->lock);
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxDecoderFillBufferDone(
+                                              OMX_OUT OMX_HANDLETYPE hComponent,
+                                              OMX_OUT OMX_PTR pAppData,
+                                              OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer) {
+    OMXResizeFanOut_s *ctx = (OMXResizeFanOut_s*)pAppData;
+    pthread_mutex_lock(&ctx->lock);
+    const OMX_U32 tail = (ctx->outputFilledHead + ctx->numOutputFilled) % OMX_RESIZE_FAN_OUT_MAX_BUFFERS;
+    ctx->outputFilled[tail] = pBuffer;
+    ctx->numOutputFilled++;
+    pthread_cond_broadcast(&ctx->stateCond);
+    pthread_mutex_unlock(&ctx->lock);
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxResizeEmptyBufferDone(
+                                              OMX_IN OMX_HANDLETYPE hComponent,
+                                              OMX_IN OMX_PTR pAppData,
+                                              OMX_IN OMX_BUFFERHEADERTYPE* pBuffer) {
+    OMXResizeFanOut_s *ctx = (OMXResizeFanOut_s*)pAppData;
+    const uintptr_t index = (uintptr_t)pBuffer->pAppPrivate;
+    pthread_mutex_lock(&ctx->lock);
+    assert(ctx->outputReaders[index] > 0);
+
+    if (--ctx->outputReaders[index] == 0) {
+        ctx->outputFree[ctx->numOutputFree++] = ctx->outputBuffers[index];
+        pthread_cond_broadcast(&ctx->stateCond);
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxResizeFillBufferDone(
+                                             OMX_OUT OMX_HANDLETYPE hComponent,
+                                             OMX_OUT OMX_PTR pAppData,
+                                             OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer) {
+    OMXResizeFanOut_s *ctx = (OMXResizeFanOut_s*)pAppData;
+    OMXFanOutResize_s *resize = pBuffer->pAppPrivate;
+    pthread_mutex_lock(&ctx->lock);
+    const OMX_U32 tail = (resize->outputFilledHead + resize->numOutputFilled) % OMX_RESIZE_FAN_OUT_MAX_BUFFERS;
+    resize->outputFilled[tail] = pBuffer;
+    resize->numOutputFilled++;
+    pthread_cond_broadcast(&ctx->stateCond);
+    pthread_mutex_unlock(&ctx->lock);
+    return OMX_ErrorNone;
+}
+
+
+
+static void getPorts(OMX_HANDLETYPE handle, OMX_U32 *inputPortIndex, OMX_U32 *outputPortIndex) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMX_PORT_PARAM_TYPE ports;
+    OMX_INIT_STRUCTURE(ports);
+    omxErr = OMX_GetParameter(handle, OMX_IndexParamImageInit, &ports);
+    omxAssert(omxErr);
+    const OMX_U32 pEnd = ports.nStartPortNumber + ports.nPorts;
+
+    for (OMX_U32 p = ports.nStartPortNumber; p < pEnd; p++) {
+        OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
+        OMX_INIT_STRUCTURE(portDefinition);
+        portDefinition.nPortIndex = p;
+        omxErr = OMX_GetParameter(handle, OMX_IndexParamPortDefinition, &portDefinition);
+        omxAssert(omxErr);
+
+        if (portDefinition.eDir == OMX_DirInput) {
+            *inputPortIndex = p;
+        }
+
+        if (portDefinition.eDir == OMX_DirOutput) {
+            *outputPortIndex = p;
+        }
+    }
+}
+
+
+
+static void setupDecoderInputPort(OMXResizeFanOut_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
+    OMX_INIT_STRUCTURE(portDefinition);
+    portDefinition.nPortIndex = ctx->inputPortIndex;
+    omxErr = OMX_GetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+
+    OMX_IMAGE_PARAM_PORTFORMATTYPE imagePortFormat;
+    OMX_INIT_STRUCTURE(imagePortFormat);
+    imagePortFormat.nPortIndex = ctx->inputPortIndex;
+    imagePortFormat.eCompressionFormat = OMX_IMAGE_CodingJPEG;
+    omxErr = OMX_SetParameter(ctx->handle, OMX_IndexParamImagePortFormat, &imagePortFormat);
+    omxAssert(omxErr);
+
+    omxErr = omxSendCommand(ctx->handle, OMX_CommandPortEnable, ctx->inputPortIndex);
+    omxAssert(omxErr);
+
+    assert(portDefinition.nBufferCountActual <= OMX_RESIZE_FAN_OUT_MAX_BUFFERS);
+    ctx->numInputBuffers = portDefinition.nBufferCountActual;
+
+    for (OMX_U32 i = 0; i < ctx->numInputBuffers; i++) {
+        omxErr = OMX_AllocateBuffer(ctx->handle, &ctx->inputBuffers[i], ctx->inputPortIndex, NULL, portDefinition.nBufferSize);
+        omxAssert(omxErr);
+        ctx->inputFree[ctx->numInputFree++] = ctx->inputBuffers[i];
+    }
+
+    omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortEnable, ctx->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+}
+
+
+
+// Expects ctx->lock to be locked. Hands decoded slices to the resize components, decoded buffers they are
+// done with back to the decoder and resized slices to the sinks. All OMX calls are made by the thread owning
+// the session. Returns false if there was nothing to do.
+static bool serviceComponents(OMXResizeFanOut_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    bool busy = false;
+
+    while (ctx->numOutputFree > 0) {
+        OMX_BUFFERHEADERTYPE *decoded = ctx->outputFree[--ctx->numOutputFree];
+        pthread_mutex_unlock(&ctx->lock);
+        omxErr = OMX_FillThisBuffer(ctx->handle, decoded);
+        omxAssert(omxErr);
+        pthread_mutex_lock(&ctx->lock);
+        busy = true;
+    }
+
+    while (ctx->numOutputFilled > 0) {
+        OMX_BUFFERHEADERTYPE *decoded = ctx->outputFilled[ctx->outputFilledHead];
+        ctx->outputFilledHead = (ctx->outputFilledHead + 1) % OMX_RESIZE_FAN_OUT_MAX_BUFFERS;
+        ctx->numOutputFilled--;
+        const uintptr_t index = (uintptr_t)decoded->pAppPrivate;
+        OMX_U32 numReaders = 0;
+
+        for (OMX_U32 r = 0; r < ctx->numResizes; r++) {
+            numReaders += (ctx->resizes[r].active && !ctx->resizes[r].done) ? 1 : 0;
+        }
+
+        // set before the first resize component can give the buffer back
+        ctx->outputReaders[index] = numReaders;
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (numReaders == 0) {
+            omxErr = OMX_FillThisBuffer(ctx->handle, decoded);
+            omxAssert(omxErr);
+        }
+
+        for (OMX_U32 r = 0; r < ctx->numResizes; r++) {
+            OMXFanOutResize_s *resize = &ctx->resizes[r];
+
+            if (!resize->active || resize->done) {
+                continue;
+            }
+
+            OMX_BUFFERHEADERTYPE *inBuffer = resize->inputBuffers[index];
+            inBuffer->nOffset = decoded->nOffset;
+            inBuffer->nFilledLen = decoded->nFilledLen;
+            inBuffer->nFlags = decoded->nFlags;
+            omxErr = OMX_EmptyThisBuffer(resize->handle, inBuffer);
+            omxAssert(omxErr);
+        }
+
+        pthread_mutex_lock(&ctx->lock);
+        busy = true;
+    }
+
+    for (OMX_U32 r = 0; r < ctx->numResizes; r++) {
+        OMXFanOutResize_s *resize = &ctx->resizes[r];
+
+        while (resize->numOutputFilled > 0) {
+            OMX_BUFFERHEADERTYPE *outBuffer = resize->outputFilled[resize->outputFilledHead];
+            resize->outputFilledHead = (resize->outputFilledHead + 1) % OMX_RESIZE_FAN_OUT_MAX_BUFFERS;
+            resize->numOutputFilled--;
+            busy = true;
+
+            if (!resize->active || resize->done) {
+                // flushed by a port disable
+                resize->outputFree[resize->numOutputFree++] = outBuffer;
+                continue;
+            }
+
+            pthread_mutex_unlock(&ctx->lock);
+            struct iovec chunk = { .iov_base = outBuffer->pBuffer + outBuffer->nOffset, .iov_len = outBuffer->nFilledLen };
+
+            if ((chunk.iov_len > 0) && !resize->sinkFailed && !omxSinkWrite(resize->sink, &chunk, 1)) {
+                puts(COLOR_RED "omxResizeFanOut: writing to the sink failed" COLOR_NC);
+                resize->sinkFailed = true;
+            }
+
+            resize->done = (outBuffer->nFlags & (OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_EOS)) != 0;
+
+            if (!resize->done) {
+                omxErr = OMX_FillThisBuffer(resize->handle, outBuffer);
+                omxAssert(omxErr);
+            }
+
+            pthread_mutex_lock(&ctx->lock);
+
+            if (resize->done) {
+                resize->outputFree[resize->numOutputFree++] = outBuffer;
+            }
+        }
+    }
+
+    return busy;
+}
+
+
+
+// Expects ctx->lock to be locked.
+static void waitForResizeInput(OMXResizeFanOut_s *ctx) {
+    while (true) {
+        OMX_U32 numReaders = 0;
+
+        for (OMX_U32 i = 0; i < ctx->numOutputBuffers; i++) {
+            numReaders += ctx->outputReaders[i];
+        }
+
+        if (numReaders == 0) {
+            return;
+        }
+
+        if (!serviceComponents(ctx)) {
+            pthread_cond_wait(&ctx->stateCond, &ctx->lock);
+        }
+    }
+}
+
+
+
+// The resize component's input port takes the decoder's output format and uses its buffers. All decoded
+// buffers have to be with the host or the decoder, not with a resize component.
+static void setupResizeInputPort(OMXResizeFanOut_s *ctx, OMXFanOutResize_s *resize) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    const OMX_IMAGE_PORTDEFINITIONTYPE *decoded = &ctx->outputPortDefinition.format.image;
+    assert(omxAssertImagePortFormatSupported(resize->handle, resize->inputPortIndex, decoded->eColorFormat));
+
+    OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
+    OMX_INIT_STRUCTURE(portDefinition);
+    portDefinition.nPortIndex = resize->inputPortIndex;
+    omxErr = OMX_GetParameter(resize->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+    portDefinition.nBufferCountActual = ctx->numOutputBuffers;
+    portDefinition.format.image.nFrameWidth = decoded->nFrameWidth;
+    portDefinition.format.image.nFrameHeight = decoded->nFrameHeight;
+    portDefinition.format.image.nStride = decoded->nStride;
+    portDefinition.format.image.nSliceHeight = decoded->nSliceHeight;
+    portDefinition.format.image.eCompressionFormat = OMX_IMAGE_CodingUnused;
+    portDefinition.format.image.eColorFormat = decoded->eColorFormat;
+    omxErr = OMX_SetParameter(resize->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+    omxErr = OMX_GetParameter(resize->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+    assert(portDefinition.nBufferCountActual == ctx->numOutputBuffers);
+    assert(portDefinition.nBufferSize <= ctx->outputPortDefinition.nBufferSize);
+
+    omxErr = omxSetInputCrop(resize->handle, resize->inputPortIndex, resize->inputCrop);
+    omxAssert(omxErr);
+
+    omxErr = omxSendCommand(resize->handle, OMX_CommandPortEnable, resize->inputPortIndex);
+    omxAssert(omxErr);
+
+    for (uintptr_t i = 0; i < ctx->numOutputBuffers; i++) {
+        OMX_BUFFERHEADERTYPE *decodedBuffer = ctx->outputBuffers[i];
+        assert(((uintptr_t)decodedBuffer->pBuffer % MAX(portDefinition.nBufferAlignment, 1)) == 0);
+        omxErr = OMX_UseBuffer(resize->handle, &resize->inputBuffers[i], resize->inputPortIndex, (OMX_PTR)i, decodedBuffer->nAllocLen, decodedBuffer->pBuffer);
+        omxAssert(omxErr);
+    }
+
+    resize->numInputBuffers = ctx->numOutputBuffers;
+    omxErr = omxWaitForCommand(resize->handle, OMX_CommandPortEnable, resize->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+}
+
+
+
+// the resize component holds none of the input buffers between images
+static void freeResizeInputPort(OMXFanOutResize_s *resize) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+    if (resize->numInputBuffers == 0) {
+        return;
+    }
+
+    omxErr = omxSendCommand(resize->handle, OMX_CommandPortDisable, resize->inputPortIndex);
+    omxAssert(omxErr);
+
+    for (OMX_U32 i = 0; i < resize->numInputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(resize->handle, resize->inputPortIndex, resize->inputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    resize->numInputBuffers = 0;
+    omxErr = omxWaitForCommand(resize->handle, OMX_CommandPortDisable, resize->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+}
+
+
+
+static bool isSameSize(OMXSize_t size, OMX_COLOR_FORMATTYPE eColorFormat, const OMX_PARAM_PORTDEFINITIONTYPE *portDefinition) {
+    const OMX_IMAGE_PORTDEFINITIONTYPE *image = &portDefinition->format.image;
+    return (image->nFrameWidth == size.nWidth) && (image->nFrameHeight == size.nHeight) && (image->eColorFormat == eColorFormat);
+}
+
+
+
+static bool isSameCrop(OMXRect_t a, OMXRect_t b) {
+    return (a.nLeft == b.nLeft) && (a.nTop == b.nTop) && (a.nWidth == b.nWidth) && (a.nHeight == b.nHeight);
+}
+
+
+
+// waits until the resize component returned all output buffers (it has to be inactive or done), frees them
+// and leaves the output port disabled
+static void freeResizeOutputPort(OMXResizeFanOut_s *ctx, OMXFanOutResize_s *resize) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    omxErr = omxSendCommand(resize->handle, OMX_CommandPortDisable, resize->outputPortIndex);
+    omxAssert(omxErr);
+
+    pthread_mutex_lock(&ctx->lock);
+
+    while (resize->numOutputFree < resize->numOutputBuffers) {
+        if (!serviceComponents(ctx)) {
+            pthread_cond_wait(&ctx->stateCond, &ctx->lock);
+        }
+    }
+
+    resize->numOutputFree = 0;
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (OMX_U32 i = 0; i < resize->numOutputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(resize->handle, resize->outputPortIndex, resize->outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    resize->numOutputBuffers = 0;
+    omxErr = omxWaitForCommand(resize->handle, OMX_CommandPortDisable, resize->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+}
+
+
+
+static void setupResizeOutputPort(OMXResizeFanOut_s *ctx, OMXFanOutResize_s *resize, OMXSize_t size, OMX_COLOR_FORMATTYPE eColorFormat) {
+    if (resize->numOutputBuffers > 0) {
+        if (isSameSize(size, eColorFormat, &resize->outputPortDefinition)) {
+            return;
+        }
+
+        freeResizeOutputPort(ctx, resize);
+    }
+
+    assert(omxAssertImagePortFormatSupported(resize->handle, resize->outputPortIndex, eColorFormat));
+
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMX_CONFIG_PORTBOOLEANTYPE brcmSupportsSlices;
+    OMX_INIT_STRUCTURE(brcmSupportsSlices);
+    brcmSupportsSlices.nPortIndex = resize->outputPortIndex;
+    omxErr = OMX_GetParameter(resize->handle, OMX_IndexParamBrcmSupportsSlices, &brcmSupportsSlices);
+    omxAssert(omxErr);
+
+    OMX_PARAM_PORTDEFINITIONTYPE *portDefinition = &resize->outputPortDefinition;
+    OMX_INIT_STRUCTURE2(portDefinition);
+    portDefinition->nPortIndex = resize->outputPortIndex;
+    omxErr = OMX_GetParameter(resize->handle, OMX_IndexParamPortDefinition, portDefinition);
+    omxAssert(omxErr);
+
+    portDefinition->nBufferCountActual = MIN(MAX(OMX_RESIZE_FAN_OUT_RESIZED_BUFFERS, portDefinition->nBufferCountMin), OMX_RESIZE_FAN_OUT_MAX_BUFFERS);
+    portDefinition->format.image.nFrameWidth = size.nWidth;
+    portDefinition->format.image.nFrameHeight = size.nHeight;
+    portDefinition->format.image.nSliceHeight = (brcmSupportsSlices.bEnabled == OMX_TRUE) ? 16 : size.nHeight;
+    portDefinition->format.image.nStride = 0;
+    portDefinition->format.image.bFlagErrorConcealment = OMX_FALSE;
+    portDefinition->format.image.eCompressionFormat = OMX_IMAGE_CodingUnused;
+    portDefinition->format.image.eColorFormat = eColorFormat;
+    omxErr = OMX_SetParameter(resize->handle, OMX_IndexParamPortDefinition, portDefinition);
+    omxAssert(omxErr);
+    omxErr = OMX_GetParameter(resize->handle, OMX_IndexParamPortDefinition, portDefinition);
+    omxAssert(omxErr);
+
+    omxErr = omxSendCommand(resize->handle, OMX_CommandPortEnable, resize->outputPortIndex);
+    omxAssert(omxErr);
+
+    resize->numOutputBuffers = portDefinition->nBufferCountActual;
+
+    for (OMX_U32 i = 0; i < resize->numOutputBuffers; i++) {
+        omxErr = OMX_AllocateBuffer(resize->handle, &resize->outputBuffers[i], resize->outputPortIndex, resize, portDefinition->nBufferSize);
+        omxAssert(omxErr);
+        resize->outputFree[i] = resize->outputBuffers[i];
+    }
+
+    resize->numOutputFree = resize->numOutputBuffers;
+    omxErr = omxWaitForCommand(resize->handle, OMX_CommandPortEnable, resize->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+}
+
+
+
+// waits for the decoder to give back all output buffers, frees them and leaves the output port disabled
+static void freeDecoderOutputPort(OMXResizeFanOut_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    omxErr = omxSendCommand(ctx->handle, OMX_CommandPortDisable, ctx->outputPortIndex);
+    omxAssert(omxErr);
+
+    // flushed buffers come back through FillBufferDone, nothing is being resized at this point
+    pthread_mutex_lock(&ctx->lock);
+
+    while (ctx->numOutputFilled + ctx->numOutputFree < ctx->numOutputBuffers) {
+        pthread_cond_wait(&ctx->stateCond, &ctx->lock);
+    }
+
+    ctx->numOutputFilled = 0;
+    ctx->numOutputFree = 0;
+    pthread_mutex_unlock(&ctx->lock);
+
+    for (OMX_U32 i = 0; i < ctx->numOutputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(ctx->handle, ctx->outputPortIndex, ctx->outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    ctx->numOutputBuffers = 0;
+    omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortDisable, ctx->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+}
+
+
+
+static bool isSameOutputFormat(const OMX_PARAM_PORTDEFINITIONTYPE *a, const OMX_PARAM_PORTDEFINITIONTYPE *b) {
+    const OMX_IMAGE_PORTDEFINITIONTYPE *imageA = &a->format.image;
+    const OMX_IMAGE_PORTDEFINITIONTYPE *imageB = &b->format.image;
+    return (imageA->nFrameWidth == imageB->nFrameWidth) && (imageA->nFrameHeight == imageB->nFrameHeight) && (imageA->nStride == imageB->nStride) && (imageA->nSliceHeight == imageB->nSliceHeight) && (imageA->eColorFormat == imageB->eColorFormat) && (a->nBufferSize <= b->nBufferSize);
+}
+
+
+
+// Follows OMX_EventPortSettingsChanged of the decoder. The decoded buffers and with them the input ports of
+// the resize components are only set up again if the new format does not fit them.
+static void reconfigureDecoderOutputPort(OMXResizeFanOut_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
+    OMX_INIT_STRUCTURE(portDefinition);
+    portDefinition.nPortIndex = ctx->outputPortIndex;
+    omxErr = OMX_GetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+
+    if ((ctx->numOutputBuffers > 0) && isSameOutputFormat(&portDefinition, &ctx->outputPortDefinition)) {
+        return;
+    }
+
+    if (ctx->numOutputBuffers > 0) {
+        for (OMX_U32 r = 0; r < ctx->numResizes; r++) {
+            freeResizeInputPort(&ctx->resizes[r]);
+        }
+
+        freeDecoderOutputPort(ctx);
+    }
+
+    OMX_U32 numBuffers = MAX(OMX_RESIZE_FAN_OUT_DECODED_BUFFERS, portDefinition.nBufferCountMin);
+
+    for (OMX_U32 r = 0; r < ctx->numResizes; r++) {
+        OMX_PARAM_PORTDEFINITIONTYPE resizeDefinition;
+        OMX_INIT_STRUCTURE(resizeDefinition);
+        resizeDefinition.nPortIndex = ctx->resizes[r].inputPortIndex;
+        omxErr = OMX_GetParameter(ctx->resizes[r].handle, OMX_IndexParamPortDefinition, &resizeDefinition);
+        omxAssert(omxErr);
+        numBuffers = MAX(numBuffers, resizeDefinition.nBufferCountMin);
+    }
+
+    portDefinition.nBufferCountActual = MIN(numBuffers, OMX_RESIZE_FAN_OUT_MAX_BUFFERS);
+    omxErr = OMX_SetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+    omxErr = OMX_GetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+    ctx->outputPortDefinition = portDefinition;
+    ctx->numOutputBuffers = portDefinition.nBufferCountActual;
+
+    omxErr = omxSendCommand(ctx->handle, OMX_CommandPortEnable, ctx->outputPortIndex);
+    omxAssert(omxErr);
+
+    for (uintptr_t i = 0; i < ctx->numOutputBuffers; i++) {
+        omxErr = OMX_AllocateBuffer(ctx->handle, &ctx->outputBuffers[i], ctx->outputPortIndex, (OMX_PTR)i, portDefinition.nBufferSize);
+        omxAssert(omxErr);
+        ctx->outputReaders[i] = 0;
+    }
+
+    omxErr = omxWaitForCommand(ctx->handle, OMX_CommandPortEnable, ctx->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+
+    for (OMX_U32 r = 0; r < ctx->numResizes; r++) {
+        setupResizeInputPort(ctx, &ctx->resizes[r]);
+    }
+
+    for (OMX_U32 i = 0; i < ctx->numOutputBuffers; i++) {
+        omxErr = OMX_FillThisBuffer(ctx->handle, ctx->outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+}
+
+
+
+// Expects ctx->lock to be locked. Like serviceComponents, but also follows the decoder's port settings.
+static bool service(OMXResizeFanOut_s *ctx) {
+    if (ctx->portSettingsChanged) {
+        ctx->portSettingsChanged = false;
+        pthread_mutex_unlock(&ctx->lock);
+        reconfigureDecoderOutputPort(ctx);
+        pthread_mutex_lock(&ctx->lock);
+        return true;
+    }
+
+    return serviceComponents(ctx);
+}
+
+
+
+static void addResize(OMXResizeFanOut_s *ctx) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    OMXFanOutResize_s *resize = &ctx->resizes[ctx->numResizes];
+
+    OMX_STRING omxComponentName = "OMX.broadcom.resize";
+    OMX_CALLBACKTYPE omxCallbacks;
+    omxCallbacks.EventHandler = omxEventHandler;
+    omxCallbacks.EmptyBufferDone = omxResizeEmptyBufferDone;
+    omxCallbacks.FillBufferDone = omxResizeFillBufferDone;
+    omxErr = omxGetHandle(&resize->handle, omxComponentName, ctx, &omxCallbacks);
+    omxAssert(omxErr);
+    omxAssertState(resize->handle, OMX_StateLoaded);
+
+    getPorts(resize->handle, &resize->inputPortIndex, &resize->outputPortIndex);
+    omxErr = omxEnablePort(resize->handle, resize->inputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
+    omxErr = omxEnablePort(resize->handle, resize->outputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(resize->handle, OMX_StateIdle);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(resize->handle, OMX_StateExecuting);
+    omxAssert(omxErr);
+    ctx->numResizes++;
+
+    // joins an image format that is already decoded into
+    if (ctx->numOutputBuffers > 0) {
+        setupResizeInputPort(ctx, resize);
+    }
+}
+
+
+
+OMXResizeFanOut_s * omxResizeFanOutInit() {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+
+    OMXResizeFanOut_s *ctx = calloc(1, sizeof(OMXResizeFanOut_s));
+    assert(ctx != NULL);
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->stateCond, NULL);
+
+    OMX_STRING omxComponentName = "OMX.broadcom.image_decode";
+    OMX_CALLBACKTYPE omxCallbacks;
+    omxCallbacks.EventHandler = omxEventHandler;
+    omxCallbacks.EmptyBufferDone = omxDecoderEmptyBufferDone;
+    omxCallbacks.FillBufferDone = omxDecoderFillBufferDone;
+    omxErr = omxGetHandle(&ctx->handle, omxComponentName, ctx, &omxCallbacks);
+    omxAssert(omxErr);
+    omxAssertState(ctx->handle, OMX_StateLoaded);
+
+    getPorts(ctx->handle, &ctx->inputPortIndex, &ctx->outputPortIndex);
+    omxErr = omxEnablePort(ctx->handle, ctx->inputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
+    omxErr = omxEnablePort(ctx->handle, ctx->outputPortIndex, OMX_FALSE);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(ctx->handle, OMX_StateIdle);
+    omxAssert(omxErr);
+    setupDecoderInputPort(ctx);
+
+    OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
+    OMX_INIT_STRUCTURE(portDefinition);
+    portDefinition.nPortIndex = ctx->outputPortIndex;
+    omxErr = OMX_GetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+    portDefinition.format.image.eCompressionFormat = OMX_IMAGE_CodingAutoDetect;
+    omxErr = OMX_SetParameter(ctx->handle, OMX_IndexParamPortDefinition, &portDefinition);
+    omxAssert(omxErr);
+
+    omxErr = omxSwitchToState(ctx->handle, OMX_StateExecuting);
+    omxAssert(omxErr);
+    return ctx;
+}
+
+
+
+static void freeComponent(OMX_HANDLETYPE handle, OMX_U32 inputPortIndex, OMX_BUFFERHEADERTYPE **inputBuffers, OMX_U32 numInputBuffers, OMX_U32 outputPortIndex, OMX_BUFFERHEADERTYPE **outputBuffers, OMX_U32 numOutputBuffers) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    omxErr = omxSwitchToState(handle, OMX_StateIdle);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(handle, OMX_CommandPortDisable, inputPortIndex);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(handle, OMX_CommandPortDisable, outputPortIndex);
+    omxAssert(omxErr);
+
+    for (OMX_U32 i = 0; i < numInputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(handle, inputPortIndex, inputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    for (OMX_U32 i = 0; i < numOutputBuffers; i++) {
+        omxErr = OMX_FreeBuffer(handle, outputPortIndex, outputBuffers[i]);
+        omxAssert(omxErr);
+    }
+
+    omxErr = omxWaitForCommand(handle, OMX_CommandPortDisable, inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxWaitForCommand(handle, OMX_CommandPortDisable, outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(handle, OMX_StateLoaded);
+    omxAssert(omxErr);
+    omxErr = omxFreeHandle(handle);
+    omxAssert(omxErr);
+}
+
+
+
+void omxResizeFanOutDeinit(OMXResizeFanOut_s *ctx) {
+    // the resize components first, their input buffers live in the decoded buffers
+    for (OMX_U32 r = 0; r < ctx->numResizes; r++) {
+        OMXFanOutResize_s *resize = &ctx->resizes[r];
+        freeComponent(resize->handle, resize->inputPortIndex, resize->inputBuffers, resize->numInputBuffers, resize->outputPortIndex, resize->outputBuffers, resize->numOutputBuffers);
+    }
+
+    freeComponent(ctx->handle, ctx->inputPortIndex, ctx->inputBuffers, ctx->numInputBuffers, ctx->outputPortIndex, ctx->outputBuffers, ctx->numOutputBuffers);
+
+    pthread_cond_destroy(&ctx->stateCond);
+    pthread_mutex_destroy(&ctx->lock);
+    free(ctx);
+}
+
+
+
+uint32_t omxResizeFanOutProcess(OMXResizeFanOut_s *ctx, const uint8_t *jpegData, size_t jpegDataSize, const OMXResizeOutput_s *outputs, uint32_t numOutputs) {
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    assert(numOutputs <= OMX_RESIZE_FAN_OUT_MAX_OUTPUTS);
+
+    while (ctx->numResizes < numOutputs) {
+        addResize(ctx);
+    }
+
+    for (OMX_U32 r = 0; r < ctx->numResizes; r++) {
+        OMXFanOutResize_s *resize = &ctx->resizes[r];
+        resize->active = false;
+
+        if (r >= numOutputs) {
+            continue;
+        }
+
+        setupResizeOutputPort(ctx, resize, outputs[r].size, outputs[r].eColorFormat);
+
+        // no image is in flight, so the new crop applies to this one without cycling the input port
+        if (!isSameCrop(resize->inputCrop, outputs[r].crop)) {
+            resize->inputCrop = outputs[r].crop;
+            omxErr = omxSetInputCrop(resize->handle, resize->inputPortIndex, resize->inputCrop);
+            omxAssert(omxErr);
+        }
+
+        resize->sink = outputs[r].sink;
+        resize->sinkFailed = false;
+        resize->done = false;
+        resize->active = true;
+
+        pthread_mutex_lock(&ctx->lock);
+        OMX_U32 numOutputFree = resize->numOutputFree;
+        resize->numOutputFree = 0;
+        pthread_mutex_unlock(&ctx->lock);
+
+        for (OMX_U32 i = 0; i < numOutputFree; i++) {
+            omxErr = OMX_FillThisBuffer(resize->handle, resize->outputFree[i]);
+            omxAssert(omxErr);
+        }
+    }
+
+    const uint8_t *jpegDataPtr = jpegData;
+    size_t jpegDataRemaining = jpegDataSize;
+    pthread_mutex_lock(&ctx->lock);
+
+    while (jpegDataRemaining > 0) {
+        while (ctx->numInputFree == 0) {
+            if (!service(ctx)) {
+                pthread_cond_wait(&ctx->stateCond, &ctx->lock);
+            }
+        }
+
+        OMX_BUFFERHEADERTYPE *inBuffer = ctx->inputFree[--ctx->numInputFree];
+        pthread_mutex_unlock(&ctx->lock);
+
+        inBuffer->nFilledLen = MIN(jpegDataRemaining, inBuffer->nAllocLen);
+        memcpy(inBuffer->pBuffer, jpegDataPtr, inBuffer->nFilledLen);
+        jpegDataRemaining -= inBuffer->nFilledLen;
+        jpegDataPtr += inBuffer->nFilledLen;
+        inBuffer->nOffset = 0;
+        inBuffer->nFlags = (jpegDataRemaining == 0) ? OMX_BUFFERFLAG_EOS : 0;
+        omxErr = OMX_EmptyThisBuffer(ctx->handle, inBuffer);
+        omxAssert(omxErr);
+        pthread_mutex_lock(&ctx->lock);
+    }
+
+    uint32_t numWritten = 0;
+
+    for (OMX_U32 r = 0; r < numOutputs; r++) {
+        OMXFanOutResize_s *resize = &ctx->resizes[r];
+
+        while (!resize->done) {
+            if (!service(ctx)) {
+                pthread_cond_wait(&ctx->stateCond, &ctx->lock);
+            }
+        }
+
+        numWritten += resize->sinkFailed ? 0 : 1;
+    }
+
+    // the next image may cycle the resize input ports
+    waitForResizeInput(ctx);
+    serviceComponents(ctx);
+    pthread_mutex_unlock(&ctx->lock);
+    return numWritten;
+}
+
+
+
+typedef struct {
+    const char *name;
+    OMXRect_t crop;
+    OMXSize_t size;
+} Thumbnail_s;
+
+
+
+static double fanOut(OMXResizeFanOut_s *ctx, const MapFile_s *map, const Thumbnail_s *thumbnails, OMXMemorySink_s *memories, uint32_t numThumbnails) {
+    OMXResizeOutput_s outputs[numThumbnails];
+
+    for (uint32_t i = 0; i < numThumbnails; i++) {
+        memories[i].size = 0;
+        outputs[i].crop = thumbnails[i].crop;
+        outputs[i].size = thumbnails[i].size;
+        outputs[i].eColorFormat = OMX_COLOR_Format32bitABGR8888;
+        outputs[i].sink = omxMemorySink(&memories[i]);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t numWritten = omxResizeFanOutProcess(ctx, map->data, map->len, outputs, numThumbnails);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    assert(numWritten == numThumbnails);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+
+
+void omxResizeFanOut() {
+    MapFile_s map;
+    initMapFile(&map, "36903_9_1.jpg", MAP_RO);
+    assert(map.len > 0);
+
+    const Thumbnail_s thumbnails[] = {
+        { "large", { 0, 0, 0, 0 }, { 800, 600 } },
+        { "medium", { 0, 0, 0, 0 }, { 400, 300 } },
+        { "small", { 0, 0, 0, 0 }, { 160, 120 } },
+        { "square", { 125, 0, 750, 750 }, { 256, 256 } },
+        { "detail", { 400, 300, 200, 150 }, { 400, 300 } },
+    };
+    const uint32_t numThumbnails = sizeof(thumbnails) / sizeof(thumbnails[0]);
+    const int iterations = 10;
+    OMXMemorySink_s memories[numThumbnails];
+    OMXMemorySink_s separateMemories[numThumbnails];
+    memset(memories, 0, sizeof(memories));
+    memset(separateMemories, 0, sizeof(separateMemories));
+
+    for (uint32_t i = 0; i < numThumbnails; i++) {
+        memories[i].growable = true;
+        separateMemories[i].growable = true;
+    }
+
+    // one decode for all sizes
+    OMXResizeFanOut_s *ctx = omxResizeFanOutInit();
+    fanOut(ctx, &map, thumbnails, memories, numThumbnails);
+    double fanOutTime = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        fanOutTime += fanOut(ctx, &map, thumbnails, memories, numThumbnails);
+    }
+
+    omxResizeFanOutDeinit(ctx);
+
+    // one decode per size, as with a decode -> resize tunnel per thumbnail
+    OMXResizeFanOut_s *separate[numThumbnails];
+    double separateTime = 0;
+
+    for (uint32_t t = 0; t < numThumbnails; t++) {
+        separate[t] = omxResizeFanOutInit();
+        fanOut(separate[t], &map, &thumbnails[t], &separateMemories[t], 1);
+    }
+
+    for (int i = 0; i < iterations; i++) {
+        for (uint32_t t = 0; t < numThumbnails; t++) {
+            separateTime += fanOut(separate[t], &map, &thumbnails[t], &separateMemories[t], 1);
+        }
+    }
+
+    for (uint32_t t = 0; t < numThumbnails; t++) {
+        omxResizeFanOutDeinit(separate[t]);
+        assert(memories[t].size == separateMemories[t].size);
+        assert(memcmp(memories[t].data, separateMemories[t].data, memories[t].size) == 0);
+
+        char fileName[64];
+        snprintf(fileName, sizeof(fileName), "fanout_%s.data", thumbnails[t].name);
+        FILE *file = fopen(fileName, "wb");
+        fwrite(memories[t].data, sizeof(uint8_t), memories[t].size, file);
+        fclose(file);
+        free(memories[t].data);
+        free(separateMemories[t].data);
+    }
+
+    printf(COLOR_YELLOW "%d sizes: %.2f ms (one decode), %.2f ms (one decode per size)\n" COLOR_NC, numThumbnails, fanOutTime / iterations * 1000, separateTime / iterations * 1000);
+    freeMapFile(&map);
+}
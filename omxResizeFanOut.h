@@ -0,0 +1,52 @@
+//
+//  omxResizeFanOut.h
+//  OMXPlayground
+//
+//  One image_decode feeding several resize components, for producing many sizes of one JPEG.
+//
+
+#ifndef omxResizeFanOut_h
+#define omxResizeFanOut_h
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Image.h>
+
+#include "omxHelper.h"
+#include "omxSink.h"
+
+
+#define OMX_RESIZE_FAN_OUT_MAX_OUTPUTS 8
+
+
+// forward declaration of a typedef struct
+struct OMXResizeFanOut_s;
+typedef struct OMXResizeFanOut_s OMXResizeFanOut_s;
+
+
+typedef struct {
+    OMXRect_t crop;                     // in decoded pixels, nWidth or nHeight 0 for the whole image
+    OMXSize_t size;
+    OMX_COLOR_FORMATTYPE eColorFormat;
+    OMXSink_t sink;                     // receives the resized image slice by slice
+} OMXResizeOutput_s;
+
+
+// The components are kept for the whole session. Ports are only cycled when the decoded format or an output
+// size or format differs from the previous image, a different crop is set while executing.
+OMXResizeFanOut_s * omxResizeFanOutInit(void);
+void omxResizeFanOutDeinit(OMXResizeFanOut_s *ctx);
+
+// Decodes jpegData once and hands every decoded slice to one resize component per output (up to
+// OMX_RESIZE_FAN_OUT_MAX_OUTPUTS) without copying it. Returns once all outputs are written, with the number
+// of outputs whose sink did not fail.
+uint32_t omxResizeFanOutProcess(OMXResizeFanOut_s *ctx, const uint8_t *jpegData, size_t jpegDataSize, const OMXResizeOutput_s *outputs, uint32_t numOutputs);
+
+void omxResizeFanOut(void);
+
+
+#endif /* omxResizeFanOut_h */
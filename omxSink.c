@@ -0,0 +1,133 @@
+//
+//  omxSink.c
+//  OMXPlayground
+//
+
+#include "omxSink.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+
+#define OMX_SINK_MAX_IOV 64     // well below IOV_MAX everywhere
+
+
+
+static bool fdWrite(void *userData, const struct iovec *iov, int iovcnt) {
+    const int fd = (int)(intptr_t)userData;
+    struct iovec pending[OMX_SINK_MAX_IOV];
+    bool isSocket = true;
+
+    while (iovcnt > 0) {
+        const int batch = (iovcnt < OMX_SINK_MAX_IOV) ? iovcnt : OMX_SINK_MAX_IOV;
+        int count = batch;
+        memcpy(pending, iov, count * sizeof(struct iovec));
+        struct iovec *p = pending;
+
+        while (count > 0) {
+            ssize_t written = -1;
+
+            if (isSocket) {
+                struct msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = p;
+                msg.msg_iovlen = count;
+                written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+
+                if ((written < 0) && (errno == ENOTSOCK)) {
+                    isSocket = false;
+                    continue;
+                }
+            } else {
+                written = writev(fd, p, count);
+            }
+
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+
+                return false;
+            }
+
+            // skip what has been written and retry the rest
+            while ((count > 0) && ((size_t)written >= p->iov_len)) {
+                written -= p->iov_len;
+                p++;
+                count--;
+            }
+
+            if (count > 0) {
+                p->iov_base = (uint8_t *)p->iov_base + written;
+                p->iov_len -= written;
+            }
+        }
+
+        iov += batch;
+        iovcnt -= batch;
+    }
+
+    return true;
+}
+
+
+
+static bool memoryWrite(void *userData, const struct iovec *iov, int iovcnt) {
+    OMXMemorySink_s *memory = (OMXMemorySink_s *)userData;
+    size_t total = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+
+    if (memory->size + total > memory->capacity) {
+        if (!memory->growable) {
+            return false;
+        }
+
+        size_t capacity = (memory->capacity > 0) ? memory->capacity : 65536;
+
+        while (capacity < memory->size + total) {
+            capacity *= 2;
+        }
+
+        uint8_t *data = realloc(memory->data, capacity);
+
+        if (!data) {
+            return false;
+        }
+
+        memory->data = data;
+        memory->capacity = capacity;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(memory->data + memory->size, iov[i].iov_base, iov[i].iov_len);
+        memory->size += iov[i].iov_len;
+    }
+
+    return true;
+}
+
+
+
+OMXSink_t omxFdSink(int fd) {
+    OMXSink_t sink = { .write = fdWrite, .userData = (void *)(intptr_t)fd };
+    return sink;
+}
+
+
+
+OMXSink_t omxMemorySink(OMXMemorySink_s *memory) {
+    OMXSink_t sink = { .write = memoryWrite, .userData = memory };
+    return sink;
+}
+
+
+
+bool omxSinkWrite(OMXSink_t sink, const struct iovec *iov, int iovcnt) {
+    return sink.write(sink.userData, iov, iovcnt);
+}
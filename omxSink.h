@@ -0,0 +1,46 @@
+//
+//  omxSink.h
+//  OMXPlayground
+//
+//  Destinations for data coming out of a component. Chunks are handed over in batches (one call per batch of
+//  returned buffers) so a sink can use writev and never needs to see the whole image at once.
+//
+
+#ifndef omxSink_h
+#define omxSink_h
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+
+// returns false if the data could not be written, the remaining chunks of the frame are dropped then
+typedef bool (*OMXSinkWrite_t)(void *userData, const struct iovec *iov, int iovcnt);
+
+
+typedef struct {
+    OMXSinkWrite_t write;
+    void *userData;
+} OMXSink_t;
+
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    bool growable;      // realloc data as needed, otherwise writing past capacity fails
+} OMXMemorySink_s;
+
+
+// file, pipe or socket (sent with MSG_NOSIGNAL), partial writes are retried
+OMXSink_t omxFdSink(int fd);
+
+// appends to memory->data, which may be NULL initially if growable
+OMXSink_t omxMemorySink(OMXMemorySink_s *memory);
+
+bool omxSinkWrite(OMXSink_t sink, const struct iovec *iov, int iovcnt);
+
+
+#endif /* omxSink_h */
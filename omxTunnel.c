@@ -27,6 +27,10 @@
 
 
 
+#define OMX_TUNNEL_MAX_BUFFERS 16
+
+
+
 
 typedef struct {
     OMX_HANDLETYPE handle;
@@ -34,7 +38,9 @@ typedef struct {
     OMX_U32 inputPortIndex;
     //    OMX_PARAM_PORTDEFINITIONTYPE *inputPortDefinition;
     //    OMX_IMAGE_PARAM_PORTFORMATTYPE *inputImagePortFormat;
-    OMX_BUFFERHEADERTYPE *inputBuffer[3];
+    OMX_BUFFERHEADERTYPE *inputBuffer[OMX_TUNNEL_MAX_BUFFERS];
+    OMX_U32 numInputBuffers;
+    size_t inputWindowSize;     // inputBuffer point into the mapped JPEG, 0 if the data is copied
     bool inputReady;
 
     OMX_U32 outputPortIndex;
@@ -88,21 +94,6 @@ typedef struct {
 
 
 
-typedef struct {
-    OMX_U32 nWidth;
-    OMX_U32 nHeight;
-} OMXSize_t;
-
-
-typedef struct {
-    OMX_S32 nLeft;
-    OMX_S32 nTop;
-    OMX_U32 nWidth;
-    OMX_U32 nHeight;
-} OMXRect_t;
-
-
-
 static OMX_ERRORTYPE omxEventHandler(
                                      OMX_IN OMX_HANDLETYPE hComponent,
                                      OMX_IN OMX_PTR pAppData,
@@ -256,7 +247,8 @@ static void getResizePorts(OMXResize_s *component) {
 
 
 
-static void setupImageDecodeInputPort(OMXImageDecode_s *component, OMX_IMAGE_CODINGTYPE format) {
+// tries to place the input buffers straight on the mapped JPEG first, see omxUseMappedBuffers
+static void setupImageDecodeInputPort(OMXImageDecode_s *component, OMX_IMAGE_CODINGTYPE format, const MapFile_s *map) {
     OMX_ERRORTYPE omxErr = OMX_ErrorNone;
     OMX_PARAM_PORTDEFINITIONTYPE portDefinition;
     OMX_INIT_STRUCTURE(portDefinition);
@@ -275,14 +267,28 @@ static void setupImageDecodeInputPort(OMXImageDecode_s *component, OMX_IMAGE_COD
     omxErr = OMX_SetParameter(component->handle, OMX_IndexParamImagePortFormat, &imagePortFormat);
     omxAssert(omxErr);
 
-    omxEnablePort(component->handle, component->inputPortIndex, OMX_TRUE);
+    component->inputWindowSize = omxUseMappedBuffers(component->handle, component->inputPortIndex, map->data, map->len, component->inputBuffer, OMX_TUNNEL_MAX_BUFFERS, &component->numInputBuffers);
+
+    if (component->inputWindowSize > 0) {
+        return;
+    }
+
+    puts(COLOR_RED "omxTunnel: the component does not take the mapped file, copying" COLOR_NC);
+    omxErr = omxSendCommand(component->handle, OMX_CommandPortEnable, component->inputPortIndex);
+    omxAssert(omxErr);
 
 //    omxPrintPort(component->handle, component->inputPortIndex);
 
+    assert(portDefinition.nBufferCountActual <= OMX_TUNNEL_MAX_BUFFERS);
+    component->numInputBuffers = portDefinition.nBufferCountActual;
+
     for (int i = 0; i < portDefinition.nBufferCountActual; i++) {
         omxErr = OMX_AllocateBuffer(component->handle, &component->inputBuffer[i], component->inputPortIndex, i, portDefinition.nBufferSize);
         omxAssert(omxErr);
     }
+
+    omxErr = omxWaitForCommand(component->handle, OMX_CommandPortEnable, component->inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
 }
 
 
@@ -357,25 +363,20 @@ static void setupResizeInputPort(OMXResize_s *component, OMXSize_t frameSize, OM
 //    omxErr = OMX_GetParameter(component->handle, OMX_IndexParamPortDefinition, portDefinition);
 //    omxAssert(omxErr);
 
+    omxErr = omxSetInputCrop(component->handle, component->inputPortIndex, cropRect);
+    omxAssert(omxErr);
+
     OMX_CONFIG_RECTTYPE *commonInputCrop = &component->inputCommonInputCrop;
     OMX_INIT_STRUCTURE2(commonInputCrop);
     commonInputCrop->nPortIndex = component->inputPortIndex;
     omxErr = OMX_GetParameter(component->handle, OMX_IndexConfigCommonInputCrop, commonInputCrop);
     omxAssert(omxErr);
 
-    commonInputCrop->nWidth = cropRect.nWidth;
-    commonInputCrop->nHeight = cropRect.nHeight;
-    commonInputCrop->nLeft = cropRect.nLeft;
-    commonInputCrop->nTop = cropRect.nTop;
-    omxErr = OMX_SetParameter(component->handle, OMX_IndexConfigCommonInputCrop, commonInputCrop);
-    omxAssert(omxErr);
 
-    omxErr = OMX_GetParameter(component->handle, OMX_IndexConfigCommonInputCrop, commonInputCrop);
+    // tunneled port, completes together with the decoder's output port
+    omxErr = omxSendCommand(component->handle, OMX_CommandPortEnable, component->inputPortIndex);
     omxAssert(omxErr);
 
-
-    omxEnablePort(component->handle, component->inputPortIndex, OMX_TRUE);
-
     //omxPrintPort(component->handle, component->inputPortIndex);
     printf("pos: %dx%d    dim: %dx%d\n", commonInputCrop->nLeft, commonInputCrop->nTop, commonInputCrop->nWidth, commonInputCrop->nHeight);
 
@@ -418,11 +419,15 @@ static void setupResizeOutputPort(OMXResize_s *component, OMXSize_t frameSize, O
     //omxPrintPort(component->handle, component->outputPortIndex);
 
 
-    omxEnablePort(component->handle, component->outputPortIndex, OMX_TRUE);
+    omxErr = omxSendCommand(component->handle, OMX_CommandPortEnable, component->outputPortIndex);
+    omxAssert(omxErr);
 
 
     omxErr = OMX_AllocateBuffer(component->handle, &component->outputBuffer, component->outputPortIndex, NULL, portDefinition->nBufferSize);
     omxAssert(omxErr);
+
+    omxErr = omxWaitForCommand(component->handle, OMX_CommandPortEnable, component->outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
 }
 
 
@@ -491,7 +496,7 @@ void omxTunnel() {
 
     vcosErr = vcos_semaphore_create(&ctx.handler_lock, "handler_lock", 1);
     assert(vcosErr == VCOS_SUCCESS);
-    vcosErr = vcos_semaphore_create(&ctx.portChangeLock, "portChangeLock", 1);
+    vcosErr = vcos_semaphore_create(&ctx.portChangeLock, "portChangeLock", 0);
     assert(vcosErr == VCOS_SUCCESS);
 
 
@@ -501,16 +506,20 @@ void omxTunnel() {
         omxCallbacks.EventHandler = omxEventHandler;
         omxCallbacks.EmptyBufferDone = omxEmptyBufferDone;
         omxCallbacks.FillBufferDone = omxNOP;
-        omxErr = OMX_GetHandle(&ctx.imageDecode.handle, omxComponentName, &ctx, &omxCallbacks);
+        omxErr = omxGetHandle(&ctx.imageDecode.handle, omxComponentName, &ctx, &omxCallbacks);
         omxAssert(omxErr);
         omxAssertState(ctx.imageDecode.handle, OMX_StateLoaded);
         getImageDecodePorts(&ctx.imageDecode);
-        omxEnablePort(ctx.imageDecode.handle, ctx.imageDecode.inputPortIndex, OMX_FALSE);
-        omxEnablePort(ctx.imageDecode.handle, ctx.imageDecode.outputPortIndex, OMX_FALSE);
-        omxSwitchToState(ctx.imageDecode.handle, OMX_StateIdle);
-        setupImageDecodeInputPort(&ctx.imageDecode, OMX_IMAGE_CodingJPEG);
+        omxErr = omxEnablePort(ctx.imageDecode.handle, ctx.imageDecode.inputPortIndex, OMX_FALSE);
+        omxAssert(omxErr);
+        omxErr = omxEnablePort(ctx.imageDecode.handle, ctx.imageDecode.outputPortIndex, OMX_FALSE);
+        omxAssert(omxErr);
+        omxErr = omxSwitchToState(ctx.imageDecode.handle, OMX_StateIdle);
+        omxAssert(omxErr);
+        setupImageDecodeInputPort(&ctx.imageDecode, OMX_IMAGE_CodingJPEG, &map);
         prepareImageDecodeOutputPort(&ctx.imageDecode);
-        omxSwitchToState(ctx.imageDecode.handle, OMX_StateExecuting);
+        omxErr = omxSwitchToState(ctx.imageDecode.handle, OMX_StateExecuting);
+        omxAssert(omxErr);
     }
 
     {
@@ -519,13 +528,16 @@ void omxTunnel() {
         omxCallbacks.EventHandler = omxEventHandler;
         omxCallbacks.EmptyBufferDone = omxNOP;
         omxCallbacks.FillBufferDone = omxFillBufferDone;
-        omxErr = OMX_GetHandle(&ctx.resize.handle, omxComponentName, &ctx, &omxCallbacks);
+        omxErr = omxGetHandle(&ctx.resize.handle, omxComponentName, &ctx, &omxCallbacks);
         omxAssert(omxErr);
         omxAssertState(ctx.resize.handle, OMX_StateLoaded);
         getResizePorts(&ctx.resize);
-        omxEnablePort(ctx.resize.handle, ctx.resize.inputPortIndex, OMX_FALSE);
-        omxEnablePort(ctx.resize.handle, ctx.resize.outputPortIndex, OMX_FALSE);
-        omxSwitchToState(ctx.resize.handle, OMX_StateIdle);
+        omxErr = omxEnablePort(ctx.resize.handle, ctx.resize.inputPortIndex, OMX_FALSE);
+        omxAssert(omxErr);
+        omxErr = omxEnablePort(ctx.resize.handle, ctx.resize.outputPortIndex, OMX_FALSE);
+        omxAssert(omxErr);
+        omxErr = omxSwitchToState(ctx.resize.handle, OMX_StateIdle);
+        omxAssert(omxErr);
         setupResizeOutputPort(&ctx.resize, outputFrameSize, OMX_COLOR_Format32bitABGR8888);
     }
 
@@ -568,10 +580,17 @@ void omxTunnel() {
 
             OMX_BUFFERHEADERTYPE *inBuffer = ctx.imageDecode.inputBuffer[bufferIndex];
             bufferIndex++;
-            bufferIndex %= 3;
-            inBuffer->nFilledLen = MIN(jpegDataRemaining, inBuffer->nAllocLen);
+
+            if (ctx.imageDecode.inputWindowSize > 0) {
+                // every window is only emptied once, there is nothing to copy
+                inBuffer->nFilledLen = MIN(jpegDataRemaining, ctx.imageDecode.inputWindowSize);
+            } else {
+                bufferIndex %= ctx.imageDecode.numInputBuffers;
+                inBuffer->nFilledLen = MIN(jpegDataRemaining, inBuffer->nAllocLen);
+                memcpy(inBuffer->pBuffer, jpegDataPtr, inBuffer->nFilledLen);
+            }
+
             jpegDataRemaining -= inBuffer->nFilledLen;
-            memcpy(inBuffer->pBuffer, jpegDataPtr, inBuffer->nFilledLen);
             jpegDataPtr += inBuffer->nFilledLen;
 
             inBuffer->nOffset = 0;
@@ -604,9 +623,15 @@ void omxTunnel() {
                 omxAssert(omxErr);
 
 
-                omxEnablePort(ctx.imageDecode.handle, ctx.imageDecode.outputPortIndex, OMX_TRUE);
+                omxErr = omxSendCommand(ctx.imageDecode.handle, OMX_CommandPortEnable, ctx.imageDecode.outputPortIndex);
+                omxAssert(omxErr);
                 setupResizeInputPort(&ctx.resize, inputFrameSize, inputFrameCrop, OMX_COLOR_Format32bitABGR8888);
-                omxSwitchToState(ctx.resize.handle, OMX_StateExecuting);
+                omxErr = omxWaitForCommand(ctx.imageDecode.handle, OMX_CommandPortEnable, ctx.imageDecode.outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+                omxAssert(omxErr);
+                omxErr = omxWaitForCommand(ctx.resize.handle, OMX_CommandPortEnable, ctx.resize.inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+                omxAssert(omxErr);
+                omxErr = omxSwitchToState(ctx.resize.handle, OMX_StateExecuting);
+                omxAssert(omxErr);
 
 
                 omxPrintPort(ctx.imageDecode.handle, ctx.imageDecode.inputPortIndex);
@@ -624,25 +649,44 @@ void omxTunnel() {
     }
 
     fclose(output);
-    freeMapFile(&map);
 
 
 
-    omxSwitchToState(ctx.imageDecode.handle, OMX_StateIdle);
-    omxSwitchToState(ctx.resize.handle, OMX_StateIdle);
-    omxEnablePort(ctx.imageDecode.handle, ctx.imageDecode.inputPortIndex, OMX_FALSE);
-    omxEnablePort(ctx.imageDecode.handle, ctx.imageDecode.outputPortIndex, OMX_FALSE);
-    omxEnablePort(ctx.resize.handle, ctx.resize.inputPortIndex, OMX_FALSE);
-    omxEnablePort(ctx.resize.handle, ctx.resize.outputPortIndex, OMX_FALSE);
+    omxErr = omxSwitchToState(ctx.imageDecode.handle, OMX_StateIdle);
+    omxAssert(omxErr);
+    omxErr = omxSwitchToState(ctx.resize.handle, OMX_StateIdle);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(ctx.imageDecode.handle, OMX_CommandPortDisable, ctx.imageDecode.inputPortIndex);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(ctx.imageDecode.handle, OMX_CommandPortDisable, ctx.imageDecode.outputPortIndex);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(ctx.resize.handle, OMX_CommandPortDisable, ctx.resize.inputPortIndex);
+    omxAssert(omxErr);
+    omxErr = omxSendCommand(ctx.resize.handle, OMX_CommandPortDisable, ctx.resize.outputPortIndex);
+    omxAssert(omxErr);
 
     freeImageDecodeBuffers(&ctx.imageDecode);
-    omxSwitchToState(ctx.imageDecode.handle, OMX_StateLoaded);
-    omxErr = OMX_FreeHandle(ctx.imageDecode.handle);
+    freeResizeBuffers(&ctx.resize);
+    // the input buffers may live in the mapped file
+    freeMapFile(&map);
+
+    omxErr = omxWaitForCommand(ctx.imageDecode.handle, OMX_CommandPortDisable, ctx.imageDecode.inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxWaitForCommand(ctx.imageDecode.handle, OMX_CommandPortDisable, ctx.imageDecode.outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxWaitForCommand(ctx.resize.handle, OMX_CommandPortDisable, ctx.resize.inputPortIndex, OMX_COMMAND_TIMEOUT_MS);
+    omxAssert(omxErr);
+    omxErr = omxWaitForCommand(ctx.resize.handle, OMX_CommandPortDisable, ctx.resize.outputPortIndex, OMX_COMMAND_TIMEOUT_MS);
     omxAssert(omxErr);
 
-    freeResizeBuffers(&ctx.resize);
-    omxSwitchToState(ctx.resize.handle, OMX_StateLoaded);
-    omxErr = OMX_FreeHandle(ctx.resize.handle);
+    omxErr = omxSwitchToState(ctx.imageDecode.handle, OMX_StateLoaded);
+    omxAssert(omxErr);
+    omxErr = omxFreeHandle(ctx.imageDecode.handle);
+    omxAssert(omxErr);
+
+    omxErr = omxSwitchToState(ctx.resize.handle, OMX_StateLoaded);
+    omxAssert(omxErr);
+    omxErr = omxFreeHandle(ctx.resize.handle);
     omxAssert(omxErr);
 
     // insert code here...
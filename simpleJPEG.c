@@ -1,11 +1,15 @@
 #include "simpleJPEG.h"
 
+#include <assert.h>
 #include <stdio.h>
 
 #include <jpeglib.h> // lacks header completeness
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>  // MIN, MAX
 #include <sys/stat.h>
 
 
@@ -18,38 +22,275 @@ bool jpegIsJPEG(const uint8_t * const in_JPEG_DATA) {
 
 
 
-bool jpegDecode(uint8_t **out_image, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const bool in_FLIP_Y) {
+static JPEGSubsampling jpegSubsampling(const uint8_t * const in_COMPONENTS, const uint32_t in_NUM_COMPONENTS) {
+    if (in_NUM_COMPONENTS == 1) {
+        return JPEG_SUBSAMPLING_GRAY;
+    }
+
+    // only luma may be sampled higher than 1x1 for the common layouts
+    for (uint32_t c = 1; c < in_NUM_COMPONENTS; c++) {
+        if (in_COMPONENTS[c * 3 + 1] != 0x11) {
+            return JPEG_SUBSAMPLING_OTHER;
+        }
+    }
+
+    switch (in_COMPONENTS[1]) {
+        case 0x11: return JPEG_SUBSAMPLING_444;
+        case 0x21: return JPEG_SUBSAMPLING_422;
+        case 0x12: return JPEG_SUBSAMPLING_440;
+        case 0x22: return JPEG_SUBSAMPLING_420;
+        case 0x41: return JPEG_SUBSAMPLING_411;
+        default: return JPEG_SUBSAMPLING_OTHER;
+    }
+}
+
+
+
+bool jpegReadHeader(JPEGHeader_s * const out_header, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE) {
+    if ((in_JPEG_SIZE < 4) || !jpegIsJPEG(in_JPEG_DATA)) {
+        return false;
+    }
+
+    size_t pos = 2;
+
+    while (pos + 4 <= in_JPEG_SIZE) {
+        if (in_JPEG_DATA[pos] != 0xFF) {
+            return false;
+        }
+
+        const uint8_t marker = in_JPEG_DATA[pos + 1];
+
+        // fill bytes and markers without a length
+        if ((marker == 0xFF) || (marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD7))) {
+            pos++;
+            continue;
+        }
+
+        const size_t length = (in_JPEG_DATA[pos + 2] << 8) | in_JPEG_DATA[pos + 3];
+        const bool isSOF = (marker >= 0xC0) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC);
+
+        if ((marker == 0xD9) || (marker == 0xDA)) {
+            return false;
+        }
+
+        if (isSOF) {
+            const uint8_t *sof = in_JPEG_DATA + pos + 4;
+            const uint32_t numComponents = (pos + 10 <= in_JPEG_SIZE) ? sof[5] : 0;
+
+            if ((numComponents == 0) || (length < 8 + 3 * numComponents) || (pos + 2 + length > in_JPEG_SIZE)) {
+                return false;
+            }
+
+            out_header->height = (sof[1] << 8) | sof[2];
+            out_header->width = (sof[3] << 8) | sof[4];
+            out_header->numComponents = numComponents;
+            out_header->subsampling = jpegSubsampling(sof + 6, numComponents);
+            // SOF2, SOF6, SOF10 and SOF14
+            out_header->progressive = (marker & 0x03) == 0x02;
+            return true;
+        }
+
+        pos += 2 + length;
+    }
+
+    return false;
+}
+
+
+
+uint32_t jpegScaleDenom(const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_MIN_WIDTH, const uint32_t in_MIN_HEIGHT) {
+    uint32_t denom = 1;
+
+    // libjpeg rounds the scaled size up
+    while ((denom < 8) && ((in_WIDTH + 2 * denom - 1) / (2 * denom) >= in_MIN_WIDTH) && ((in_HEIGHT + 2 * denom - 1) / (2 * denom) >= in_MIN_HEIGHT)) {
+        denom *= 2;
+    }
+
+    return denom;
+}
+
+
+
+// reads rec_outbuf_height rows per call, in_STRIDE may be negative to flip the image
+static void jpegReadRows(j_decompress_ptr cinfo, uint8_t *in_out_row, const ptrdiff_t in_STRIDE) {
+    JSAMPROW rows[16];
+    const JDIMENSION numRows = MIN(MAX(cinfo->rec_outbuf_height, 1), 16);
+
+    while (cinfo->output_scanline < cinfo->output_height) {
+        for (JDIMENSION r = 0; r < numRows; r++) {
+            rows[r] = in_out_row + r * in_STRIDE;
+        }
+
+        const JDIMENSION rowsRead = jpeg_read_scanlines(cinfo, rows, MIN(numRows, cinfo->output_height - cinfo->output_scanline));
+        in_out_row += rowsRead * in_STRIDE;
+    }
+}
+
+
+
+bool jpegDecode(uint8_t **out_image, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_SCALE_DENOM, const bool in_FLIP_Y) {
     struct jpeg_decompress_struct cinfo;
     struct jpeg_error_mgr jerr;
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_decompress(&cinfo);
     jpeg_mem_src(&cinfo, in_JPEG_DATA, in_JPEG_SIZE);
     jpeg_read_header(&cinfo, TRUE);
+
+    // the IDCT produces the smaller image directly, skipping most of the work
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = in_SCALE_DENOM;
     jpeg_start_decompress(&cinfo);
 
-    JDIMENSION w = cinfo.image_width;
-    JDIMENSION h = cinfo.image_height;
-    uint32_t c = cinfo.num_components;
+    JDIMENSION w = cinfo.output_width;
+    JDIMENSION h = cinfo.output_height;
+    uint32_t c = cinfo.output_components;
     uint8_t *image = (uint8_t*)malloc(w * h * c * sizeof(uint8_t));
-    uint8_t *imagePtr = image;
+    ptrdiff_t row_stride = w * c;
 
     if (in_FLIP_Y) {
-        imagePtr = image + w * (h - 1) * c;
+        jpegReadRows(&cinfo, image + row_stride * (h - 1), -row_stride);
+    } else {
+        jpegReadRows(&cinfo, image, row_stride);
     }
 
-    size_t row_stride = cinfo.output_width * cinfo.output_components;
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
 
-    while (cinfo.output_scanline < cinfo.output_height) {
-        jpeg_read_scanlines(&cinfo, &imagePtr, 1);
+    *out_image = image;
+    *out_width = w;
+    *out_height = h;
+    *out_numChannels = c;
 
-        if (in_FLIP_Y) {
-            imagePtr -= row_stride;
-        } else {
-            imagePtr += row_stride;
-        }
+    return true;
+}
+
+
+
+uint32_t jpegAlignedStride(const uint32_t in_WIDTH, const uint32_t in_NUM_CHANNELS, const uint32_t in_ALIGNMENT) {
+    const uint32_t stride = in_WIDTH * in_NUM_CHANNELS;
+    return (in_ALIGNMENT > 1) ? (stride + in_ALIGNMENT - 1) / in_ALIGNMENT * in_ALIGNMENT : stride;
+}
+
+
+
+// Expects the header to be read. Leaves cinfo idle (or aborted if the image does not fit), but not destroyed.
+static bool jpegDecompressInto(j_decompress_ptr cinfo, uint8_t * const out_image, const uint32_t in_STRIDE, const size_t in_IMAGE_SIZE, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint32_t in_SCALE_DENOM) {
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = in_SCALE_DENOM;
+    jpeg_calc_output_dimensions(cinfo);
+
+    *out_width = cinfo->output_width;
+    *out_height = cinfo->output_height;
+    *out_numChannels = cinfo->output_components;
+
+    const size_t rowSize = cinfo->output_width * cinfo->output_components;
+    const size_t stride = (in_STRIDE > 0) ? in_STRIDE : rowSize;
+
+    if ((stride < rowSize) || (stride * (cinfo->output_height - 1) + rowSize > in_IMAGE_SIZE)) {
+        jpeg_abort_decompress(cinfo);
+        return false;
     }
 
-    jpeg_finish_decompress(&cinfo);
+    jpeg_start_decompress(cinfo);
+    jpegReadRows(cinfo, out_image, stride);
+    jpeg_finish_decompress(cinfo);
+    return true;
+}
+
+
+
+bool jpegDecodeInto(uint8_t * const out_image, const uint32_t in_STRIDE, const size_t in_IMAGE_SIZE, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_SCALE_DENOM) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, in_JPEG_DATA, in_JPEG_SIZE);
+    jpeg_read_header(&cinfo, TRUE);
+    bool success = jpegDecompressInto(&cinfo, out_image, in_STRIDE, in_IMAGE_SIZE, out_width, out_height, out_numChannels, in_SCALE_DENOM);
+    jpeg_destroy_decompress(&cinfo);
+    return success;
+}
+
+
+
+struct JPEGDecoder_s {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+};
+
+
+
+JPEGDecoder_s * jpegDecoderInit() {
+    JPEGDecoder_s *decoder = calloc(1, sizeof(JPEGDecoder_s));
+    assert(decoder != NULL);
+    decoder->cinfo.err = jpeg_std_error(&decoder->jerr);
+    jpeg_create_decompress(&decoder->cinfo);
+    return decoder;
+}
+
+
+
+void jpegDecoderDeinit(JPEGDecoder_s * const in_out_decoder) {
+    jpeg_destroy_decompress(&in_out_decoder->cinfo);
+    free(in_out_decoder);
+}
+
+
+
+bool jpegDecoderDecode(JPEGDecoder_s * const in_out_decoder, uint8_t * const out_image, const uint32_t in_STRIDE, const size_t in_IMAGE_SIZE, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_SCALE_DENOM) {
+    // the source manager and the permanent pool survive from the previous image
+    jpeg_mem_src(&in_out_decoder->cinfo, in_JPEG_DATA, in_JPEG_SIZE);
+    jpeg_read_header(&in_out_decoder->cinfo, TRUE);
+    return jpegDecompressInto(&in_out_decoder->cinfo, out_image, in_STRIDE, in_IMAGE_SIZE, out_width, out_height, out_numChannels, in_SCALE_DENOM);
+}
+
+
+
+bool jpegDecodeRegion(uint8_t **out_image, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_LEFT, const uint32_t in_TOP, const uint32_t in_WIDTH, const uint32_t in_HEIGHT) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, in_JPEG_DATA, in_JPEG_SIZE);
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+
+    if ((in_LEFT >= cinfo.output_width) || (in_TOP >= cinfo.output_height) || (in_WIDTH == 0) || (in_HEIGHT == 0)) {
+        fprintf(stderr, "region outside of the image\n");
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    JDIMENSION w = (in_WIDTH < cinfo.output_width - in_LEFT) ? in_WIDTH : cinfo.output_width - in_LEFT;
+    JDIMENSION h = (in_HEIGHT < cinfo.output_height - in_TOP) ? in_HEIGHT : cinfo.output_height - in_TOP;
+    uint32_t c = cinfo.output_components;
+    JDIMENSION xOffset = in_LEFT;
+
+#ifdef LIBJPEG_TURBO_VERSION
+    // Only the iMCU columns covering the region get decoded. One more pixel on either side (and one row
+    // above) keeps fancy upsampling at the region's edges the same as in a full decode.
+    xOffset = (in_LEFT > 0) ? in_LEFT - 1 : 0;
+    JDIMENSION cropWidth = ((in_LEFT + w < cinfo.output_width) ? in_LEFT + w + 1 : cinfo.output_width) - xOffset;
+    jpeg_crop_scanline(&cinfo, &xOffset, &cropWidth);
+    jpeg_skip_scanlines(&cinfo, (in_TOP > 0) ? in_TOP - 1 : 0);
+#else
+    xOffset = 0;
+#endif
+
+    JSAMPROW row = (JSAMPROW)malloc(cinfo.output_width * c);
+    uint8_t *image = (uint8_t*)malloc(w * h * c * sizeof(uint8_t));
+
+    while (cinfo.output_scanline < in_TOP) {
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    for (JDIMENSION y = 0; y < h; y++) {
+        jpeg_read_scanlines(&cinfo, &row, 1);
+        memcpy(image + y * w * c, row + (in_LEFT - xOffset) * c, w * c);
+    }
+
+    free(row);
+    // the scanlines below the region are never decoded
     jpeg_destroy_decompress(&cinfo);
 
     *out_image = image;
@@ -62,42 +303,521 @@ bool jpegDecode(uint8_t **out_image, uint32_t *out_width, uint32_t *out_height,
 
 
 
+typedef struct {
+    const uint8_t *jpegData;
+    size_t sofHeightOffset;     // position of the frame height in the SOF segment
+    size_t headerSize;          // everything up to the entropy coded data of the (only) scan
+    size_t dataEnd;             // EOI or the end of the data
+    size_t *intervals;          // start of the entropy coded data of every restart interval
+    uint32_t numIntervals;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mcuHeight;
+    uint32_t mcusPerRow;
+    uint32_t mcuRows;
+    uint32_t restartInterval;
+    uint32_t rowsPerUnit;       // the fewest MCU rows that start and end at interval boundaries
+    uint32_t rowsPerBand;       // a multiple of rowsPerUnit
+    uint32_t numBands;
+
+    uint8_t *image;
+    uint32_t numChannels;
+
+    pthread_mutex_t lock;
+    uint32_t nextBand;
+} JPEGRestartIndex_s;
+
+
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b != 0) {
+        const uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+
+
+// Indexes the restart intervals of a single scan baseline JPEG. Returns false if there are none or if
+// they do not fit the layout (progressive, multiple scans, DNL, missing markers).
+static bool jpegIndexRestartIntervals(JPEGRestartIndex_s * const out_index, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE) {
+    JPEGRestartIndex_s index = { .jpegData = in_JPEG_DATA };
+    uint32_t maxH = 1;
+    uint32_t maxV = 1;
+    uint32_t numComponents = 0;
+    size_t pos = 2;
+
+    if ((in_JPEG_SIZE < 4) || !jpegIsJPEG(in_JPEG_DATA)) {
+        return false;
+    }
+
+    while (index.headerSize == 0) {
+        if ((pos + 4 > in_JPEG_SIZE) || (in_JPEG_DATA[pos] != 0xFF)) {
+            return false;
+        }
+
+        const uint8_t marker = in_JPEG_DATA[pos + 1];
+
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+
+        const size_t length = (in_JPEG_DATA[pos + 2] << 8) | in_JPEG_DATA[pos + 3];
+        const uint8_t *segment = in_JPEG_DATA + pos + 4;
+
+        if (pos + 2 + length > in_JPEG_SIZE) {
+            return false;
+        }
+
+        if ((marker == 0xC0) || (marker == 0xC1)) {
+            numComponents = segment[5];
+
+            if (length < 8 + 3 * numComponents) {
+                return false;
+            }
+
+            index.sofHeightOffset = pos + 5;
+            index.height = (segment[1] << 8) | segment[2];
+            index.width = (segment[3] << 8) | segment[4];
+
+            for (uint32_t c = 0; c < numComponents; c++) {
+                maxH = MAX(maxH, segment[6 + c * 3 + 1] >> 4);
+                maxV = MAX(maxV, segment[6 + c * 3 + 1] & 0x0F);
+            }
+        } else if ((marker >= 0xC2) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC)) {
+            return false;
+        } else if (marker == 0xDD) {
+            index.restartInterval = (segment[0] << 8) | segment[1];
+        } else if (marker == 0xDA) {
+            // a single non-interleaved component is coded in plain 8x8 blocks
+            if ((numComponents == 0) || (segment[0] != numComponents)) {
+                return false;
+            }
+
+            index.headerSize = pos + 2 + length;
+        }
+
+        pos += 2 + length;
+    }
+
+    if ((index.restartInterval == 0) || (index.height == 0) || ((numComponents != 1) && (numComponents != 3))) {
+        return false;
+    }
+
+    const uint32_t mcuWidth = (numComponents == 1) ? 8 : 8 * maxH;
+    index.mcuHeight = (numComponents == 1) ? 8 : 8 * maxV;
+    index.mcusPerRow = (index.width + mcuWidth - 1) / mcuWidth;
+    index.mcuRows = (index.height + index.mcuHeight - 1) / index.mcuHeight;
+
+    const uint32_t expectedIntervals = (index.mcusPerRow * index.mcuRows + index.restartInterval - 1) / index.restartInterval;
+    index.intervals = malloc(expectedIntervals * sizeof(size_t));
+    index.intervals[index.numIntervals++] = index.headerSize;
+    index.dataEnd = in_JPEG_SIZE;
+
+    for (pos = index.headerSize; pos + 1 < in_JPEG_SIZE; pos++) {
+        if ((in_JPEG_DATA[pos] != 0xFF) || (in_JPEG_DATA[pos + 1] == 0x00) || (in_JPEG_DATA[pos + 1] == 0xFF)) {
+            continue;
+        }
+
+        const uint8_t marker = in_JPEG_DATA[pos + 1];
+
+        if ((marker < 0xD0) || (marker > 0xD7)) {
+            index.dataEnd = pos;
+            break;
+        }
+
+        if ((index.numIntervals == expectedIntervals) || (marker != 0xD0 + (index.numIntervals - 1) % 8)) {
+            free(index.intervals);
+            return false;
+        }
+
+        index.intervals[index.numIntervals++] = pos + 2;
+        pos++;
+    }
+
+    if (index.numIntervals != expectedIntervals) {
+        free(index.intervals);
+        return false;
+    }
+
+    // bands may only start where an interval starts
+    index.rowsPerUnit = index.restartInterval / gcd(index.restartInterval, index.mcusPerRow);
+    index.numChannels = numComponents;
+    *out_index = index;
+    return true;
+}
+
+
+
+// Decodes the MCU rows of one band into the shared image. Fancy upsampling needs the neighbouring rows,
+// so one unit of rows above and one MCU row below are decoded and dropped.
+static void jpegDecodeBand(const JPEGRestartIndex_s * const index, const uint32_t in_BAND) {
+    const uint32_t firstRow = in_BAND * index->rowsPerBand;
+    const uint32_t lastRow = MIN(firstRow + index->rowsPerBand, index->mcuRows);
+    const uint32_t decodeFirstRow = (firstRow > 0) ? firstRow - index->rowsPerUnit : 0;
+    const uint32_t decodeLastRow = MIN(lastRow + 1, index->mcuRows);
+    const uint32_t decodeHeight = MIN(decodeLastRow * index->mcuHeight, index->height) - decodeFirstRow * index->mcuHeight;
+    const uint32_t firstInterval = decodeFirstRow * index->mcusPerRow / index->restartInterval;
+    const uint32_t endInterval = (decodeLastRow * index->mcusPerRow + index->restartInterval - 1) / index->restartInterval;
+    const size_t dataStart = index->intervals[firstInterval];
+    const size_t dataEnd = (endInterval < index->numIntervals) ? index->intervals[endInterval] - 2 : index->dataEnd;
+
+    // the original header with the band's height, its intervals with restart markers counting from 0, EOI
+    const size_t size = index->headerSize + (dataEnd - dataStart) + 2;
+    uint8_t *jpeg = malloc(size);
+    memcpy(jpeg, index->jpegData, index->headerSize);
+    jpeg[index->sofHeightOffset] = decodeHeight >> 8;
+    jpeg[index->sofHeightOffset + 1] = decodeHeight & 0xFF;
+    memcpy(jpeg + index->headerSize, index->jpegData + dataStart, dataEnd - dataStart);
+
+    for (uint32_t i = firstInterval + 1; i < endInterval; i++) {
+        jpeg[index->headerSize + index->intervals[i] - 1 - dataStart] = 0xD0 + (i - firstInterval - 1) % 8;
+    }
+
+    jpeg[size - 2] = 0xFF;
+    jpeg[size - 1] = 0xD9;
+
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg, size);
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+
+    const size_t rowStride = index->width * index->numChannels;
+    const uint32_t keepFirst = firstRow * index->mcuHeight;
+    const uint32_t keepLast = MIN(lastRow * index->mcuHeight, index->height);
+    JSAMPROW row = (JSAMPROW)malloc(rowStride);
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        const uint32_t y = decodeFirstRow * index->mcuHeight + cinfo.output_scanline;
+        JSAMPROW dst = ((y >= keepFirst) && (y < keepLast)) ? index->image + y * rowStride : row;
+        jpeg_read_scanlines(&cinfo, &dst, 1);
+
+        if (y >= keepLast) {
+            break;
+        }
+    }
+
+    free(row);
+    jpeg_destroy_decompress(&cinfo);
+    free(jpeg);
+}
+
+
+
+static void * jpegDecodeBands(void *in_out_userData) {
+    JPEGRestartIndex_s *index = in_out_userData;
+
+    while (true) {
+        pthread_mutex_lock(&index->lock);
+        const uint32_t band = index->nextBand++;
+        pthread_mutex_unlock(&index->lock);
+
+        if (band >= index->numBands) {
+            return NULL;
+        }
+
+        jpegDecodeBand(index, band);
+    }
+}
+
+
+
+bool jpegDecodeParallel(uint8_t **out_image, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_NUM_THREADS) {
+    JPEGRestartIndex_s index;
+
+    if ((in_NUM_THREADS < 2) || !jpegIndexRestartIntervals(&index, in_JPEG_DATA, in_JPEG_SIZE)) {
+        return jpegDecode(out_image, out_width, out_height, out_numChannels, in_JPEG_DATA, in_JPEG_SIZE, 1, false);
+    }
+
+    // a few bands per thread even out the work, but every band decodes some rows twice
+    const uint32_t numUnits = (index.mcuRows + index.rowsPerUnit - 1) / index.rowsPerUnit;
+    index.rowsPerBand = index.rowsPerUnit * MAX(1, numUnits / (2 * in_NUM_THREADS));
+    index.numBands = (index.mcuRows + index.rowsPerBand - 1) / index.rowsPerBand;
+
+    if (index.numBands < 2) {
+        free(index.intervals);
+        return jpegDecode(out_image, out_width, out_height, out_numChannels, in_JPEG_DATA, in_JPEG_SIZE, 1, false);
+    }
+
+    index.image = (uint8_t*)malloc(index.width * index.height * index.numChannels * sizeof(uint8_t));
+    index.nextBand = 0;
+    pthread_mutex_init(&index.lock, NULL);
+
+    const uint32_t numThreads = MIN(in_NUM_THREADS, index.numBands);
+    pthread_t threads[numThreads];
+
+    for (uint32_t t = 1; t < numThreads; t++) {
+        pthread_create(&threads[t], NULL, jpegDecodeBands, &index);
+    }
+
+    jpegDecodeBands(&index);
+
+    for (uint32_t t = 1; t < numThreads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    pthread_mutex_destroy(&index.lock);
+    free(index.intervals);
+
+    *out_image = index.image;
+    *out_width = index.width;
+    *out_height = index.height;
+    *out_numChannels = index.numChannels;
+    return true;
+}
+
+
+
+static bool jpegSetInputColorSpace(j_compress_ptr cinfo, const uint32_t in_NUM_CHANNELS) {
+    switch (in_NUM_CHANNELS) {
+            case 1:
+            cinfo->input_components = 1;
+            cinfo->in_color_space = JCS_GRAYSCALE;
+            return true;
+
+            case 3:
+            cinfo->input_components = 3;
+            cinfo->in_color_space = JCS_RGB;
+            return true;
+
+        default:
+            fprintf(stderr, "unsupported colorspace\n");
+            return false;
+    }
+}
+
+
+
+static void jpegWriteRows(j_compress_ptr cinfo, const uint8_t *in_IMAGE, const size_t in_STRIDE) {
+    JSAMPROW rows[16];
+
+    while (cinfo->next_scanline < cinfo->image_height) {
+        const JDIMENSION numRows = MIN(16, cinfo->image_height - cinfo->next_scanline);
+
+        for (JDIMENSION r = 0; r < numRows; r++) {
+            rows[r] = (JSAMPROW)in_IMAGE + (cinfo->next_scanline + r) * in_STRIDE;
+        }
+
+        jpeg_write_scanlines(cinfo, rows, numRows);
+    }
+}
+
+
+
 bool jpegEncode(uint8_t ** const out_jpegData, size_t * out_jpegSize, uint8_t * const in_IMAGE, const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_NUM_CHANNELS, const uint32_t in_QUALITY) {
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
-    JSAMPROW row_pointer[1];
     unsigned long outsize = 0;
     uint8_t *outbuffer = NULL;
     cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_compress(&cinfo);
-    jpeg_mem_dest(&cinfo, &outbuffer, &outsize);
     cinfo.image_width = in_WIDTH;
     cinfo.image_height = in_HEIGHT;
 
-    switch (in_NUM_CHANNELS) {
-            case 1:
-            cinfo.input_components = 1;
-            cinfo.in_color_space = JCS_GRAYSCALE;
-            break;
+    if (!jpegSetInputColorSpace(&cinfo, in_NUM_CHANNELS)) {
+        jpeg_destroy_compress(&cinfo);
+        return false;
+    }
 
-            case 3:
-            cinfo.input_components = 3;
-            cinfo.in_color_space = JCS_RGB;
-            break;
+    jpeg_mem_dest(&cinfo, &outbuffer, &outsize);
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, in_QUALITY, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    jpegWriteRows(&cinfo, in_IMAGE, in_WIDTH * in_NUM_CHANNELS);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
 
-        default:
-            fprintf(stderr, "unsupported colorspace\n");
+    *out_jpegData = outbuffer;
+    *out_jpegSize = outsize;
+    return true;
+}
+
+
+
+struct JPEGEncoder_s {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    struct jpeg_destination_mgr dest;
+    uint32_t quality;
+    uint32_t numChannels;       // what the tables were set up for, 0 before the first frame
+    uint8_t *buffer;            // grows to the largest JPEG so far and stays
+    size_t bufferSize;
+};
+
+
+
+static void jpegEncoderInitDestination(j_compress_ptr cinfo) {
+    JPEGEncoder_s *encoder = cinfo->client_data;
+    encoder->dest.next_output_byte = encoder->buffer;
+    encoder->dest.free_in_buffer = encoder->bufferSize;
+}
+
+
+
+static boolean jpegEncoderEmptyOutputBuffer(j_compress_ptr cinfo) {
+    JPEGEncoder_s *encoder = cinfo->client_data;
+    const size_t used = encoder->bufferSize;
+    encoder->bufferSize *= 2;
+    encoder->buffer = realloc(encoder->buffer, encoder->bufferSize);
+    assert(encoder->buffer != NULL);
+    encoder->dest.next_output_byte = encoder->buffer + used;
+    encoder->dest.free_in_buffer = encoder->bufferSize - used;
+    return TRUE;
+}
+
+
+
+// the encoded size is read from free_in_buffer after jpeg_finish_compress, there is nothing to flush
+static void jpegEncoderTermDestination(j_compress_ptr cinfo) {
+    (void)cinfo;
+}
+
+
+
+JPEGEncoder_s * jpegEncoderInit(const uint32_t in_QUALITY, const size_t in_BUFFER_SIZE) {
+    JPEGEncoder_s *encoder = calloc(1, sizeof(JPEGEncoder_s));
+    assert(encoder != NULL);
+    encoder->cinfo.err = jpeg_std_error(&encoder->jerr);
+    jpeg_create_compress(&encoder->cinfo);
+    encoder->cinfo.client_data = encoder;
+    encoder->dest.init_destination = jpegEncoderInitDestination;
+    encoder->dest.empty_output_buffer = jpegEncoderEmptyOutputBuffer;
+    encoder->dest.term_destination = jpegEncoderTermDestination;
+    encoder->cinfo.dest = &encoder->dest;
+    encoder->quality = in_QUALITY;
+    encoder->bufferSize = MAX(in_BUFFER_SIZE, 4096);
+    encoder->buffer = malloc(encoder->bufferSize);
+    assert(encoder->buffer != NULL);
+    return encoder;
+}
+
+
+
+void jpegEncoderDeinit(JPEGEncoder_s * const in_out_encoder) {
+    jpeg_destroy_compress(&in_out_encoder->cinfo);
+    free(in_out_encoder->buffer);
+    free(in_out_encoder);
+}
+
+
+
+void jpegEncoderSetQuality(JPEGEncoder_s * const in_out_encoder, const uint32_t in_QUALITY) {
+    // before the first frame the quality is picked up along with the defaults
+    if ((in_out_encoder->quality != in_QUALITY) && (in_out_encoder->numChannels > 0)) {
+        jpeg_set_quality(&in_out_encoder->cinfo, in_QUALITY, TRUE);
+    }
+
+    in_out_encoder->quality = in_QUALITY;
+}
+
+
+
+bool jpegEncoderEncode(JPEGEncoder_s * const in_out_encoder, const uint8_t ** const out_jpegData, size_t * const out_jpegSize, const uint8_t * const in_IMAGE, const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_STRIDE, const uint32_t in_NUM_CHANNELS) {
+    j_compress_ptr cinfo = &in_out_encoder->cinfo;
+
+    // the parameters and tables of the previous frame stay valid as long as the input has the same layout
+    if (in_out_encoder->numChannels != in_NUM_CHANNELS) {
+        if (!jpegSetInputColorSpace(cinfo, in_NUM_CHANNELS)) {
             return false;
+        }
+
+        jpeg_set_defaults(cinfo);
+        jpeg_set_quality(cinfo, in_out_encoder->quality, TRUE);
+        in_out_encoder->numChannels = in_NUM_CHANNELS;
     }
 
+    cinfo->image_width = in_WIDTH;
+    cinfo->image_height = in_HEIGHT;
+    jpeg_start_compress(cinfo, TRUE);
+    jpegWriteRows(cinfo, in_IMAGE, (in_STRIDE > 0) ? in_STRIDE : in_WIDTH * in_NUM_CHANNELS);
+    jpeg_finish_compress(cinfo);
+
+    *out_jpegData = in_out_encoder->buffer;
+    *out_jpegSize = in_out_encoder->bufferSize - in_out_encoder->dest.free_in_buffer;
+    return true;
+}
+
+
+
+// Planar 4:2:0 in the OMX_COLOR_FormatYUV420PackedPlanar layout: the Y plane with in_STRIDE bytes per row and
+// in_SLICE_HEIGHT rows, followed by the U and V planes at half the stride and half the slice height.
+static void jpegYUV420Planes(uint8_t * const in_IMAGE, const uint32_t in_STRIDE, const uint32_t in_SLICE_HEIGHT, uint8_t *out_planes[3]) {
+    out_planes[0] = in_IMAGE;
+    out_planes[1] = out_planes[0] + in_STRIDE * in_SLICE_HEIGHT;
+    out_planes[2] = out_planes[1] + (in_STRIDE / 2) * (in_SLICE_HEIGHT / 2);
+}
+
+
+
+// raw data is passed in whole 8x8 blocks of every component, so rows must be wide enough for them
+static bool jpegIsValidYUV420Layout(const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_STRIDE, const uint32_t in_SLICE_HEIGHT) {
+    if ((in_STRIDE < (in_WIDTH + 15) / 16 * 16) || (in_SLICE_HEIGHT < in_HEIGHT) || (in_SLICE_HEIGHT % 2 != 0)) {
+        fprintf(stderr, "stride or slice height too small for planar YUV 4:2:0\n");
+        return false;
+    }
+
+    return true;
+}
+
+
+
+bool jpegEncodeYUV420(uint8_t ** const out_jpegData, size_t * out_jpegSize, const uint8_t * const in_IMAGE, const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_STRIDE, const uint32_t in_SLICE_HEIGHT, const uint32_t in_QUALITY) {
+    if (!jpegIsValidYUV420Layout(in_WIDTH, in_HEIGHT, in_STRIDE, in_SLICE_HEIGHT)) {
+        return false;
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    unsigned long outsize = 0;
+    uint8_t *outbuffer = NULL;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &outbuffer, &outsize);
+    cinfo.image_width = in_WIDTH;
+    cinfo.image_height = in_HEIGHT;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
     jpeg_set_defaults(&cinfo);
     jpeg_set_quality(&cinfo, in_QUALITY, TRUE);
+
+    // the planes go straight into the DCT, no colour conversion and no downsampling
+    cinfo.raw_data_in = TRUE;
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 2;
+    cinfo.comp_info[1].h_samp_factor = 1;
+    cinfo.comp_info[1].v_samp_factor = 1;
+    cinfo.comp_info[2].h_samp_factor = 1;
+    cinfo.comp_info[2].v_samp_factor = 1;
     jpeg_start_compress(&cinfo, TRUE);
-    size_t row_stride = in_WIDTH * 3;
+
+    uint8_t *planes[3];
+    jpegYUV420Planes((uint8_t *)in_IMAGE, in_STRIDE, in_SLICE_HEIGHT, planes);
+    JSAMPROW rowsY[16];
+    JSAMPROW rowsU[8];
+    JSAMPROW rowsV[8];
+    JSAMPARRAY rows[3] = { rowsY, rowsU, rowsV };
+    const uint32_t lastRowUV = (in_HEIGHT + 1) / 2 - 1;
 
     while (cinfo.next_scanline < cinfo.image_height) {
-        row_pointer[0] = &in_IMAGE[cinfo.next_scanline * row_stride];
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        // rows below the image repeat the last one
+        for (uint32_t r = 0; r < 16; r++) {
+            rowsY[r] = planes[0] + MIN(cinfo.next_scanline + r, in_HEIGHT - 1) * in_STRIDE;
+        }
+
+        for (uint32_t r = 0; r < 8; r++) {
+            const uint32_t y = MIN(cinfo.next_scanline / 2 + r, lastRowUV);
+            rowsU[r] = planes[1] + y * (in_STRIDE / 2);
+            rowsV[r] = planes[2] + y * (in_STRIDE / 2);
+        }
+
+        jpeg_write_raw_data(&cinfo, rows, 16);
     }
 
     jpeg_finish_compress(&cinfo);
@@ -110,7 +830,71 @@ bool jpegEncode(uint8_t ** const out_jpegData, size_t * out_jpegSize, uint8_t *
 
 
 
-bool jpegRead(uint8_t ** const out_image, uint32_t * const out_width, uint32_t * const out_height, uint32_t * const out_numChannels, const char * const in_FILE_PATH, const bool in_FLIP_Y) {
+bool jpegDecodeYUV420(uint8_t * const out_image, const uint32_t in_STRIDE, const uint32_t in_SLICE_HEIGHT, const size_t in_IMAGE_SIZE, uint32_t *out_width, uint32_t *out_height, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, in_JPEG_DATA, in_JPEG_SIZE);
+    jpeg_read_header(&cinfo, TRUE);
+
+    *out_width = cinfo.image_width;
+    *out_height = cinfo.image_height;
+
+    const bool isGray = cinfo.num_components == 1;
+    const bool is420 = (cinfo.num_components == 3) && (cinfo.jpeg_color_space == JCS_YCbCr) && (cinfo.comp_info[0].h_samp_factor == 2) && (cinfo.comp_info[0].v_samp_factor == 2) && (cinfo.comp_info[1].h_samp_factor == 1) && (cinfo.comp_info[1].v_samp_factor == 1) && (cinfo.comp_info[2].h_samp_factor == 1) && (cinfo.comp_info[2].v_samp_factor == 1);
+    const size_t imageSize = in_STRIDE * in_SLICE_HEIGHT + 2 * (in_STRIDE / 2) * (in_SLICE_HEIGHT / 2);
+
+    if (!(isGray || is420) || !jpegIsValidYUV420Layout(cinfo.image_width, cinfo.image_height, in_STRIDE, in_SLICE_HEIGHT) || (imageSize > in_IMAGE_SIZE)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    // the coefficients leave the IDCT as they are, no upsampling and no colour conversion
+    cinfo.raw_data_out = TRUE;
+    cinfo.out_color_space = isGray ? JCS_GRAYSCALE : JCS_YCbCr;
+    jpeg_start_decompress(&cinfo);
+
+    uint8_t *planes[3];
+    jpegYUV420Planes(out_image, in_STRIDE, in_SLICE_HEIGHT, planes);
+    const uint32_t rowsPerCall = cinfo.max_v_samp_factor * DCTSIZE;
+    const uint32_t heightUV = in_SLICE_HEIGHT / 2;
+    uint8_t *scratch = malloc(in_STRIDE);
+    JSAMPROW rowsY[16];
+    JSAMPROW rowsU[8];
+    JSAMPROW rowsV[8];
+    JSAMPARRAY rows[3] = { rowsY, rowsU, rowsV };
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        // rows past the slice go to scratch
+        for (uint32_t r = 0; r < rowsPerCall; r++) {
+            const uint32_t y = cinfo.output_scanline + r;
+            rowsY[r] = (y < in_SLICE_HEIGHT) ? planes[0] + y * in_STRIDE : scratch;
+        }
+
+        for (uint32_t r = 0; !isGray && (r < rowsPerCall / 2); r++) {
+            const uint32_t y = cinfo.output_scanline / 2 + r;
+            rowsU[r] = (y < heightUV) ? planes[1] + y * (in_STRIDE / 2) : scratch;
+            rowsV[r] = (y < heightUV) ? planes[2] + y * (in_STRIDE / 2) : scratch;
+        }
+
+        jpeg_read_raw_data(&cinfo, rows, rowsPerCall);
+    }
+
+    free(scratch);
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    if (isGray) {
+        memset(planes[1], 0x80, 2 * (in_STRIDE / 2) * heightUV);
+    }
+
+    return true;
+}
+
+
+
+bool jpegRead(uint8_t ** const out_image, uint32_t * const out_width, uint32_t * const out_height, uint32_t * const out_numChannels, const char * const in_FILE_PATH, const uint32_t in_SCALE_DENOM, const bool in_FLIP_Y) {
     FILE * fp = fopen(in_FILE_PATH, "rb");
 
     if (fp == NULL) {
@@ -147,7 +931,7 @@ bool jpegRead(uint8_t ** const out_image, uint32_t * const out_width, uint32_t *
     }
 
     fclose(fp);
-    bool success = jpegDecode(out_image, out_width, out_height, out_numChannels, rawData, len, in_FLIP_Y);
+    bool success = jpegDecode(out_image, out_width, out_height, out_numChannels, rawData, len, in_SCALE_DENOM, in_FLIP_Y);
     free(rawData);
     return success;
 }
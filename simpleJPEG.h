@@ -7,12 +7,75 @@
 #include <stdint.h>
 
 
+// forward declaration of a typedef struct
+struct JPEGEncoder_s;
+typedef struct JPEGEncoder_s JPEGEncoder_s;
+struct JPEGDecoder_s;
+typedef struct JPEGDecoder_s JPEGDecoder_s;
+
+
+typedef enum {
+    JPEG_SUBSAMPLING_GRAY,
+    JPEG_SUBSAMPLING_444,
+    JPEG_SUBSAMPLING_422,
+    JPEG_SUBSAMPLING_440,
+    JPEG_SUBSAMPLING_420,
+    JPEG_SUBSAMPLING_411,
+    JPEG_SUBSAMPLING_OTHER
+} JPEGSubsampling;
+
+
+typedef struct {
+    uint32_t width;
+    uint32_t height;
+    uint32_t numComponents;
+    JPEGSubsampling subsampling;
+    bool progressive;
+} JPEGHeader_s;
+
+
 bool jpegIsJPEG(const uint8_t * const in_JPEG_DATA);
-bool jpegDecode(uint8_t **out_image, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const bool in_FLIP_Y);
+// in_SCALE_DENOM 1, 2, 4 or 8 decodes straight to 1/in_SCALE_DENOM of the size (rounded up)
+bool jpegDecode(uint8_t **out_image, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_SCALE_DENOM, const bool in_FLIP_Y);
+// Decodes into the caller's buffer with in_STRIDE bytes per row (0 for tightly packed rows). Fails without
+// decoding if the image does not fit into in_IMAGE_SIZE bytes, the out_ values still tell its size.
+bool jpegDecodeInto(uint8_t * const out_image, const uint32_t in_STRIDE, const size_t in_IMAGE_SIZE, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_SCALE_DENOM);
+// row size rounded up to in_ALIGNMENT bytes (e.g. 16 or 32 for SIMD and texture uploads)
+uint32_t jpegAlignedStride(const uint32_t in_WIDTH, const uint32_t in_NUM_CHANNELS, const uint32_t in_ALIGNMENT);
+// Decodes only the in_WIDTH x in_HEIGHT region at in_LEFT, in_TOP (clipped to the image). With libjpeg-turbo
+// the rows above are skipped and only the iMCU columns covering the region are decoded.
+bool jpegDecodeRegion(uint8_t **out_image, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_LEFT, const uint32_t in_TOP, const uint32_t in_WIDTH, const uint32_t in_HEIGHT);
+// Decodes bands of MCU rows on in_NUM_THREADS threads, splitting the stream at its restart markers. Falls
+// back to jpegDecode for JPEGs without restart intervals (or progressive ones).
+bool jpegDecodeParallel(uint8_t **out_image, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_NUM_THREADS);
 bool jpegEncode(uint8_t ** const out_jpegData, size_t * out_jpegSize, uint8_t * const in_IMAGE, const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_NUM_CHANNELS, const uint32_t in_QUALITY);
+// Planar YUV 4:2:0 in the OMX_COLOR_FormatYUV420PackedPlanar layout (U and V follow Y at half the stride and
+// half the slice height), handed to and taken from libjpeg as raw data without colour conversion or
+// resampling. The stride has to cover the width rounded up to 16. Decoding only takes 4:2:0 and grayscale
+// baseline JPEGs (chroma then set to 128) and fails if the image does not fit.
+bool jpegEncodeYUV420(uint8_t ** const out_jpegData, size_t * out_jpegSize, const uint8_t * const in_IMAGE, const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_STRIDE, const uint32_t in_SLICE_HEIGHT, const uint32_t in_QUALITY);
+bool jpegDecodeYUV420(uint8_t * const out_image, const uint32_t in_STRIDE, const uint32_t in_SLICE_HEIGHT, const size_t in_IMAGE_SIZE, uint32_t *out_width, uint32_t *out_height, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE);
 bool jpegIsJPEGFile(const char * const in_FILE_PATH);
-bool jpegRead(uint8_t ** const out_image, uint32_t * const out_width, uint32_t * const out_height, uint32_t * const out_numChannels, const char * const in_FILE_PATH, const bool in_FLIP_Y);
+bool jpegRead(uint8_t ** const out_image, uint32_t * const out_width, uint32_t * const out_height, uint32_t * const out_numChannels, const char * const in_FILE_PATH, const uint32_t in_SCALE_DENOM, const bool in_FLIP_Y);
 bool jpegWrite(const char * const in_FILE_PATH, uint8_t * const in_IMAGE, const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_NUM_CHANNELS, const uint32_t in_QUALITY);
+// largest scale denominator (up to 8) that still leaves at least in_MIN_WIDTH x in_MIN_HEIGHT
+uint32_t jpegScaleDenom(const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_MIN_WIDTH, const uint32_t in_MIN_HEIGHT);
+// scans the markers up to the frame header (SOFn) without decoding anything, false if there is none
+bool jpegReadHeader(JPEGHeader_s * const out_header, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE);
+
+// Persistent encoder for many small frames: the libjpeg object, its parameters and tables and the output
+// buffer (starting at in_BUFFER_SIZE, growing to the largest JPEG so far) are kept between frames.
+// *out_jpegData belongs to the encoder and stays valid until the next frame. in_STRIDE 0 means packed rows.
+JPEGEncoder_s * jpegEncoderInit(const uint32_t in_QUALITY, const size_t in_BUFFER_SIZE);
+void jpegEncoderDeinit(JPEGEncoder_s * const in_out_encoder);
+void jpegEncoderSetQuality(JPEGEncoder_s * const in_out_encoder, const uint32_t in_QUALITY);
+bool jpegEncoderEncode(JPEGEncoder_s * const in_out_encoder, const uint8_t ** const out_jpegData, size_t * const out_jpegSize, const uint8_t * const in_IMAGE, const uint32_t in_WIDTH, const uint32_t in_HEIGHT, const uint32_t in_STRIDE, const uint32_t in_NUM_CHANNELS);
+
+// persistent counterpart of jpegDecodeInto
+JPEGDecoder_s * jpegDecoderInit(void);
+void jpegDecoderDeinit(JPEGDecoder_s * const in_out_decoder);
+bool jpegDecoderDecode(JPEGDecoder_s * const in_out_decoder, uint8_t * const out_image, const uint32_t in_STRIDE, const size_t in_IMAGE_SIZE, uint32_t *out_width, uint32_t *out_height, uint32_t *out_numChannels, const uint8_t * const in_JPEG_DATA, const size_t in_JPEG_SIZE, const uint32_t in_SCALE_DENOM);
+
 void jpegFree(uint8_t ** const in_out_image);
 
 
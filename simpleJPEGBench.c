@@ -0,0 +1,421 @@
+//
+//  simpleJPEGBench.c
+//  OMXPlayground
+//
+//  CPU side JPEG decoding with libjpeg, for comparison with image_decode.
+//
+
+#include "simpleJPEGBench.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <jpeglib.h>
+
+#include "bufferPool.h"
+#include "cHelper.h"
+#include "mmapHelper.h"
+#include "simpleJPEG.h"
+
+
+
+static double seconds(const struct timespec *start, const struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+
+
+// bilinear, interleaved channels
+static void resize(uint8_t *dst, uint32_t dstWidth, uint32_t dstHeight, const uint8_t *src, uint32_t srcWidth, uint32_t srcHeight, uint32_t numChannels) {
+    for (uint32_t y = 0; y < dstHeight; y++) {
+        const float sy = (y + 0.5f) * srcHeight / dstHeight - 0.5f;
+        const uint32_t y0 = (sy < 0) ? 0 : (uint32_t)sy;
+        const uint32_t y1 = (y0 + 1 < srcHeight) ? y0 + 1 : y0;
+        const float fy = (sy < 0) ? 0 : sy - y0;
+
+        for (uint32_t x = 0; x < dstWidth; x++) {
+            const float sx = (x + 0.5f) * srcWidth / dstWidth - 0.5f;
+            const uint32_t x0 = (sx < 0) ? 0 : (uint32_t)sx;
+            const uint32_t x1 = (x0 + 1 < srcWidth) ? x0 + 1 : x0;
+            const float fx = (sx < 0) ? 0 : sx - x0;
+
+            for (uint32_t c = 0; c < numChannels; c++) {
+                const float top = src[(y0 * srcWidth + x0) * numChannels + c] * (1 - fx) + src[(y0 * srcWidth + x1) * numChannels + c] * fx;
+                const float bottom = src[(y1 * srcWidth + x0) * numChannels + c] * (1 - fx) + src[(y1 * srcWidth + x1) * numChannels + c] * fx;
+                dst[(y * dstWidth + x) * numChannels + c] = (uint8_t)(top * (1 - fy) + bottom * fy + 0.5f);
+            }
+        }
+    }
+}
+
+
+
+// decodes at 1/scaleDenom and resizes the result to the thumbnail size, returns seconds per thumbnail
+static double thumbnail(const MapFile_s *map, uint32_t scaleDenom, uint32_t thumbWidth, uint32_t thumbHeight, int iterations) {
+    uint8_t *thumb = malloc(thumbWidth * thumbHeight * 3);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        uint8_t *image;
+        uint32_t width, height, numChannels;
+        bool success = jpegDecode(&image, &width, &height, &numChannels, map->data, map->len, scaleDenom, false);
+        assert(success);
+        assert(numChannels <= 3);
+        resize(thumb, thumbWidth, thumbHeight, image, width, height, numChannels);
+        jpegFree(&image);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(thumb);
+    return seconds(&start, &end) / iterations;
+}
+
+
+
+static void scaledDecodeBenchmark(const MapFile_s *map) {
+    const uint32_t thumbWidth = 160;
+    const uint32_t thumbHeight = 120;
+    const int iterations = 20;
+
+    JPEGHeader_s header;
+    bool success = jpegReadHeader(&header, map->data, map->len);
+    assert(success);
+    const uint32_t scaleDenom = jpegScaleDenom(header.width, header.height, thumbWidth, thumbHeight);
+
+    for (uint32_t denom = 1; denom <= 8; denom *= 2) {
+        double s = thumbnail(map, denom, thumbWidth, thumbHeight, iterations);
+        printf(COLOR_YELLOW "%d x %d -> %d x %d, decoded at 1/%d: %.2f ms%s\n" COLOR_NC, header.width, header.height, thumbWidth, thumbHeight, denom, s * 1000, (denom == scaleDenom) ? " (jpegScaleDenom)" : "");
+    }
+}
+
+
+
+// crops the full size image afterwards, as the caller had to before jpegDecodeRegion
+static double decodeAndCrop(const MapFile_s *map, uint32_t left, uint32_t top, uint32_t width, uint32_t height, int iterations) {
+    uint8_t *crop = malloc(width * height * 3);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        uint8_t *image;
+        uint32_t imageWidth, imageHeight, numChannels;
+        bool success = jpegDecode(&image, &imageWidth, &imageHeight, &numChannels, map->data, map->len, 1, false);
+        assert(success);
+
+        for (uint32_t y = 0; y < height; y++) {
+            memcpy(crop + y * width * numChannels, image + ((top + y) * imageWidth + left) * numChannels, width * numChannels);
+        }
+
+        jpegFree(&image);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(crop);
+    return seconds(&start, &end) / iterations;
+}
+
+
+
+static double decodeRegion(const MapFile_s *map, uint32_t left, uint32_t top, uint32_t width, uint32_t height, int iterations) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        uint8_t *image;
+        uint32_t imageWidth, imageHeight, numChannels;
+        bool success = jpegDecodeRegion(&image, &imageWidth, &imageHeight, &numChannels, map->data, map->len, left, top, width, height);
+        assert(success);
+        assert((imageWidth == width) && (imageHeight == height));
+        jpegFree(&image);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return seconds(&start, &end) / iterations;
+}
+
+
+
+static void regionDecodeBenchmark(const MapFile_s *map) {
+    const uint32_t regions[][4] = {
+        { 0, 0, 160, 120 },
+        { 420, 315, 160, 120 },
+        { 840, 630, 160, 120 },
+        { 250, 187, 500, 375 },
+    };
+    const int numRegions = sizeof(regions) / sizeof(regions[0]);
+    const int iterations = 20;
+
+    for (int r = 0; r < numRegions; r++) {
+        const uint32_t *region = regions[r];
+        double sCrop = decodeAndCrop(map, region[0], region[1], region[2], region[3], iterations);
+        double sRegion = decodeRegion(map, region[0], region[1], region[2], region[3], iterations);
+        printf(COLOR_YELLOW "%d x %d at %d, %d: %.2f ms (decode and crop), %.2f ms (jpegDecodeRegion)\n" COLOR_NC, region[2], region[3], region[0], region[1], sCrop * 1000, sRegion * 1000);
+    }
+}
+
+
+
+// a noisy test pattern with a restart marker after every MCU row, like camera JPEGs
+static void encodeWithRestarts(uint8_t **jpegData, unsigned long *jpegSize, uint32_t width, uint32_t height) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    *jpegData = NULL;
+    jpeg_mem_dest(&cinfo, jpegData, jpegSize);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, TRUE);
+    cinfo.restart_in_rows = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+
+    JSAMPROW row = malloc(width * 3);
+    srand(1);
+
+    while (cinfo.next_scanline < height) {
+        for (uint32_t x = 0; x < width * 3; x++) {
+            row[x] = ((x * 7 + cinfo.next_scanline * 3) & 0xFF) ^ (rand() & 0x0F);
+        }
+
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+
+    free(row);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+}
+
+
+
+static void parallelDecodeBenchmark() {
+    const uint32_t width = 3000;
+    const uint32_t height = 2000;
+    const int iterations = 5;
+    uint8_t *jpegData;
+    unsigned long jpegSize;
+    encodeWithRestarts(&jpegData, &jpegSize, width, height);
+
+    uint8_t *reference;
+    uint32_t w, h, c;
+    jpegDecode(&reference, &w, &h, &c, jpegData, jpegSize, 1, false);
+
+    for (uint32_t numThreads = 1; numThreads <= 8; numThreads *= 2) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (int i = 0; i < iterations; i++) {
+            uint8_t *image;
+            bool success = jpegDecodeParallel(&image, &w, &h, &c, jpegData, jpegSize, numThreads);
+            assert(success);
+            assert(memcmp(image, reference, width * height * c) == 0);
+            jpegFree(&image);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf(COLOR_YELLOW "%d x %d with restart markers, %d threads: %.2f ms\n" COLOR_NC, width, height, numThreads, seconds(&start, &end) / iterations * 1000);
+    }
+
+    jpegFree(&reference);
+    free(jpegData);
+}
+
+
+
+// a batch of decodes at mixed scales, into fresh allocations or into pooled buffers with aligned rows
+static double batchDecode(const MapFile_s *map, BufferPool_s *pool, int batchSize) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < batchSize; i++) {
+        const uint32_t scaleDenom = 1 << (i % 4);
+        uint8_t *image;
+        uint32_t width, height, numChannels;
+
+        if (pool) {
+            JPEGHeader_s header;
+            bool success = jpegReadHeader(&header, map->data, map->len);
+            assert(success);
+            const uint32_t stride = jpegAlignedStride(header.width, header.numComponents, 32);
+            const size_t size = stride * header.height;
+            image = bufferPoolGet(pool, size);
+            success = jpegDecodeInto(image, jpegAlignedStride((header.width + scaleDenom - 1) / scaleDenom, header.numComponents, 32), size, &width, &height, &numChannels, map->data, map->len, scaleDenom);
+            assert(success);
+            bufferPoolPut(pool, image);
+        } else {
+            bool success = jpegDecode(&image, &width, &height, &numChannels, map->data, map->len, scaleDenom, false);
+            assert(success);
+            jpegFree(&image);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return seconds(&start, &end) / batchSize;
+}
+
+
+
+static void pooledDecodeBenchmark(const MapFile_s *map) {
+    const int batchSize = 64;
+    BufferPool_s *pool = bufferPoolInit(4, 32);
+    double sMalloc = batchDecode(map, NULL, batchSize);
+    double sPool = batchDecode(map, pool, batchSize);
+    printf(COLOR_YELLOW "batch of %d at mixed scales: %.2f ms (jpegDecode), %.2f ms (jpegDecodeInto, pooled and 32 byte aligned rows)\n" COLOR_NC, batchSize, sMalloc * 1000, sPool * 1000);
+    bufferPoolDeinit(pool);
+}
+
+
+
+// RGB888 through libjpeg's colour conversion against planar YUV 4:2:0 as raw data
+static void rawYUVBenchmark(const MapFile_s *map) {
+    const int iterations = 20;
+    JPEGHeader_s header;
+    bool success = jpegReadHeader(&header, map->data, map->len);
+    assert(success);
+    const uint32_t stride = jpegAlignedStride(header.width, 1, 32);
+    const uint32_t sliceHeight = (header.height + 15) & ~15;
+    const size_t yuvSize = stride * sliceHeight + 2 * (stride / 2) * (sliceHeight / 2);
+    uint8_t *yuv = malloc(yuvSize);
+    uint8_t *rgb = NULL;
+    uint8_t *jpegData;
+    size_t jpegSize;
+    uint32_t width, height, numChannels;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        jpegFree(&rgb);
+        success = jpegDecode(&rgb, &width, &height, &numChannels, map->data, map->len, 1, false);
+        assert(success);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sDecodeRGB = seconds(&start, &end) / iterations;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        success = jpegDecodeYUV420(yuv, stride, sliceHeight, yuvSize, &width, &height, map->data, map->len);
+        assert(success);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sDecodeYUV = seconds(&start, &end) / iterations;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        success = jpegEncode(&jpegData, &jpegSize, rgb, width, height, numChannels, 85);
+        assert(success);
+        jpegFree(&jpegData);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sEncodeRGB = seconds(&start, &end) / iterations;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++) {
+        success = jpegEncodeYUV420(&jpegData, &jpegSize, yuv, width, height, stride, sliceHeight, 85);
+        assert(success);
+        jpegFree(&jpegData);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sEncodeYUV = seconds(&start, &end) / iterations;
+
+    printf(COLOR_YELLOW "%d x %d decode: %.2f ms (RGB888, %d bytes), %.2f ms (YUV420 raw, %zu bytes)\n" COLOR_NC, width, height, sDecodeRGB * 1000, width * height * numChannels, sDecodeYUV * 1000, yuvSize);
+    printf(COLOR_YELLOW "%d x %d encode: %.2f ms (RGB888), %.2f ms (YUV420 raw)\n" COLOR_NC, width, height, sEncodeRGB * 1000, sEncodeYUV * 1000);
+
+    jpegFree(&rgb);
+    free(yuv);
+}
+
+
+
+// small frames at a high rate, where setting up libjpeg for every frame shows
+static void contextReuseBenchmark() {
+    const uint32_t width = 320;
+    const uint32_t height = 240;
+    const int numFrames = 500;
+    uint8_t *image = malloc(width * height * 3);
+    uint8_t *decoded = malloc(width * height * 3);
+    struct timespec start, end;
+
+    for (uint32_t i = 0; i < width * height * 3; i++) {
+        image[i] = (i * 7 + (i / (width * 3)) * 3) & 0xFF;
+    }
+
+    uint8_t *jpegData;
+    size_t jpegSize;
+    uint32_t w, h, c;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < numFrames; i++) {
+        bool success = jpegEncode(&jpegData, &jpegSize, image, width, height, 3, 75);
+        assert(success);
+        jpegFree(&jpegData);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sEncode = seconds(&start, &end) / numFrames;
+
+    JPEGEncoder_s *encoder = jpegEncoderInit(75, 0);
+    const uint8_t *encoderData;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < numFrames; i++) {
+        bool success = jpegEncoderEncode(encoder, &encoderData, &jpegSize, image, width, height, 0, 3);
+        assert(success);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sEncoder = seconds(&start, &end) / numFrames;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < numFrames; i++) {
+        bool success = jpegDecodeInto(decoded, 0, width * height * 3, &w, &h, &c, encoderData, jpegSize, 1);
+        assert(success);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sDecode = seconds(&start, &end) / numFrames;
+
+    JPEGDecoder_s *decoder = jpegDecoderInit();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < numFrames; i++) {
+        bool success = jpegDecoderDecode(decoder, decoded, 0, width * height * 3, &w, &h, &c, encoderData, jpegSize, 1);
+        assert(success);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sDecoder = seconds(&start, &end) / numFrames;
+
+    printf(COLOR_YELLOW "%d x %d encode: %.0f fps (jpegEncode), %.0f fps (JPEGEncoder_s)\n" COLOR_NC, width, height, 1 / sEncode, 1 / sEncoder);
+    printf(COLOR_YELLOW "%d x %d decode: %.0f fps (jpegDecodeInto), %.0f fps (JPEGDecoder_s)\n" COLOR_NC, width, height, 1 / sDecode, 1 / sDecoder);
+
+    jpegDecoderDeinit(decoder);
+    jpegEncoderDeinit(encoder);
+    free(decoded);
+    free(image);
+}
+
+
+
+void simpleJPEGBench() {
+    MapFile_s map;
+    initMapFile(&map, "36903_9_1.jpg", MAP_RO);
+    scaledDecodeBenchmark(&map);
+    regionDecodeBenchmark(&map);
+    pooledDecodeBenchmark(&map);
+    rawYUVBenchmark(&map);
+    freeMapFile(&map);
+
+    parallelDecodeBenchmark();
+    contextReuseBenchmark();
+}
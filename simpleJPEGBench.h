@@ -0,0 +1,13 @@
+//
+//  simpleJPEGBench.h
+//  OMXPlayground
+//
+
+#ifndef simpleJPEGBench_h
+#define simpleJPEGBench_h
+
+
+void simpleJPEGBench(void);
+
+
+#endif /* simpleJPEGBench_h */
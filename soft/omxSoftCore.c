@@ -0,0 +1,1226 @@
+//
+//  omxSoftCore.c
+//  OMXPlayground
+//
+//  Setting OMX_SOFT_COMMAND_DELAY_MS in the environment delays every OMX_EventCmdComplete by that many
+//  milliseconds, which is useful to shake out code that does not wait for command completion.
+//
+//  Lock order: sTunnelMutex before any component mutex. A component mutex is never held while waiting for
+//  another one, except for the supplier and consumer of a tunnel, which are only locked together (in that
+//  order) while holding sTunnelMutex.
+//
+
+#include "omxSoftCore.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "omxHelper.h"
+
+
+
+typedef struct {
+    OMX_BUFFERHEADERTYPE header;
+    bool ownsData;
+} OMXSoftBuffer_s;
+
+
+
+static const OMXSoftComponentType_s *sComponentTypes[] = {
+    &omxSoftImageDecode,
+    &omxSoftImageEncode,
+    &omxSoftResize,
+};
+
+static const OMX_U32 sNumComponentTypes = sizeof(sComponentTypes) / sizeof(sComponentTypes[0]);
+
+// serializes enabling/disabling of the two ends of a tunnel, taken before any component mutex
+static pthread_mutex_t sTunnelMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static inline OMXSoftComponent_s *omxSoftComponent(OMX_HANDLETYPE hComponent) {
+    return (OMXSoftComponent_s *)((OMX_COMPONENTTYPE *)hComponent)->pComponentPrivate;
+}
+
+
+
+static inline void omxSoftSignal(OMXSoftComponent_s *component) {
+    component->signalled = true;
+    pthread_cond_signal(&component->cond);
+}
+
+
+
+OMXSoftPort_s *omxSoftPort(OMXSoftComponent_s *component, OMX_U32 nPortIndex) {
+    const OMX_U32 startPort = component->type->startPort;
+
+    if ((nPortIndex < startPort) || (nPortIndex > startPort + 1)) {
+        return NULL;
+    }
+
+    return &component->ports[nPortIndex - startPort];
+}
+
+
+
+OMXSoftPort_s *omxSoftInputPort(OMXSoftComponent_s *component) {
+    return &component->ports[0];
+}
+
+
+
+OMXSoftPort_s *omxSoftOutputPort(OMXSoftComponent_s *component) {
+    return &component->ports[1];
+}
+
+
+
+void omxSoftInitPort(OMXSoftPort_s *port, OMX_U32 nPortIndex, OMX_DIRTYPE eDir, OMX_U32 nBufferCount, OMX_U32 nBufferSize) {
+    memset(port, 0, sizeof(*port));
+    OMX_PARAM_PORTDEFINITIONTYPE *definition = &port->definition;
+    OMX_INIT_STRUCTURE_P(definition, sizeof(*definition));
+    definition->nPortIndex = nPortIndex;
+    definition->eDir = eDir;
+    definition->nBufferCountActual = nBufferCount;
+    definition->nBufferCountMin = nBufferCount;
+    definition->nBufferSize = nBufferSize;
+    definition->bEnabled = OMX_TRUE;
+    definition->bPopulated = OMX_FALSE;
+    definition->eDomain = OMX_PortDomainImage;
+    definition->nBufferAlignment = 16;
+
+    OMX_CONFIG_RECTTYPE *inputCrop = &port->inputCrop;
+    OMX_INIT_STRUCTURE_P(inputCrop, sizeof(*inputCrop));
+    inputCrop->nPortIndex = nPortIndex;
+}
+
+
+
+void omxSoftAddPortFormat(OMXSoftPort_s *port, OMX_IMAGE_CODINGTYPE eCompressionFormat, OMX_COLOR_FORMATTYPE eColorFormat) {
+    assert(port->numFormats < OMX_SOFT_MAX_FORMATS);
+    OMX_IMAGE_PARAM_PORTFORMATTYPE *format = &port->formats[port->numFormats];
+    OMX_INIT_STRUCTURE_P(format, sizeof(*format));
+    format->nPortIndex = port->definition.nPortIndex;
+    format->nIndex = port->numFormats;
+    format->eCompressionFormat = eCompressionFormat;
+    format->eColorFormat = eColorFormat;
+    port->numFormats++;
+
+    if (port->numFormats == 1) {
+        port->definition.format.image.eCompressionFormat = eCompressionFormat;
+        port->definition.format.image.eColorFormat = eColorFormat;
+    }
+}
+
+
+
+bool omxSoftIsPortFormatSupported(const OMXSoftPort_s *port, OMX_IMAGE_CODINGTYPE eCompressionFormat, OMX_COLOR_FORMATTYPE eColorFormat) {
+    for (OMX_U32 i = 0; i < port->numFormats; i++) {
+        const OMX_IMAGE_PARAM_PORTFORMATTYPE *format = &port->formats[i];
+
+        if (eCompressionFormat != OMX_IMAGE_CodingUnused) {
+            if ((format->eCompressionFormat == eCompressionFormat) || (eCompressionFormat == OMX_IMAGE_CodingAutoDetect)) {
+                return true;
+            }
+        } else if (format->eColorFormat == eColorFormat) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+static void omxSoftQueueBuffer(OMXSoftPort_s *port, OMX_BUFFERHEADERTYPE *buffer) {
+    assert(port->queueCount < OMX_SOFT_MAX_BUFFERS);
+    port->queue[(port->queueHead + port->queueCount) % OMX_SOFT_MAX_BUFFERS] = buffer;
+    port->queueCount++;
+}
+
+
+
+OMX_BUFFERHEADERTYPE *omxSoftPeekBuffer(OMXSoftPort_s *port) {
+    return (port->queueCount > 0) ? port->queue[port->queueHead] : NULL;
+}
+
+
+
+OMX_BUFFERHEADERTYPE *omxSoftPopBuffer(OMXSoftPort_s *port) {
+    OMX_BUFFERHEADERTYPE *buffer = omxSoftPeekBuffer(port);
+
+    if (buffer) {
+        port->queueHead = (port->queueHead + 1) % OMX_SOFT_MAX_BUFFERS;
+        port->queueCount--;
+    }
+
+    return buffer;
+}
+
+
+
+static void omxSoftUnqueueBuffer(OMXSoftPort_s *port, OMX_BUFFERHEADERTYPE *buffer) {
+    OMX_U32 count = port->queueCount;
+    port->queueCount = 0;
+
+    for (OMX_U32 i = 0; i < count; i++) {
+        OMX_BUFFERHEADERTYPE *b = port->queue[(port->queueHead + i) % OMX_SOFT_MAX_BUFFERS];
+
+        if (b != buffer) {
+            port->queue[(port->queueHead + port->queueCount) % OMX_SOFT_MAX_BUFFERS] = b;
+            port->queueCount++;
+        }
+    }
+}
+
+
+
+static void omxSoftAddBuffer(OMXSoftPort_s *port, OMX_BUFFERHEADERTYPE *buffer) {
+    assert(port->numBuffers < OMX_SOFT_MAX_BUFFERS);
+    port->buffers[port->numBuffers++] = buffer;
+    port->definition.bPopulated = (port->numBuffers >= port->definition.nBufferCountActual) ? OMX_TRUE : OMX_FALSE;
+}
+
+
+
+static bool omxSoftRemoveBuffer(OMXSoftPort_s *port, OMX_BUFFERHEADERTYPE *buffer) {
+    for (OMX_U32 i = 0; i < port->numBuffers; i++) {
+        if (port->buffers[i] == buffer) {
+            port->buffers[i] = port->buffers[--port->numBuffers];
+            port->definition.bPopulated = OMX_FALSE;
+            omxSoftUnqueueBuffer(port, buffer);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+
+void omxSoftReturnBuffer(OMXSoftComponent_s *component, OMXSoftPort_s *port, OMX_BUFFERHEADERTYPE *buffer) {
+    const bool isOutput = port->definition.eDir == OMX_DirOutput;
+
+    if (port->tunnel) {
+        OMXSoftComponent_s *peer = port->tunnel;
+        const OMX_U32 peerPortIndex = port->tunnelPortIndex;
+        pthread_mutex_unlock(&component->mutex);
+        pthread_mutex_lock(&peer->mutex);
+        OMXSoftPort_s *peerPort = omxSoftPort(peer, peerPortIndex);
+
+        // the peer may have torn the tunnel down in the meantime
+        for (OMX_U32 i = 0; i < peerPort->numBuffers; i++) {
+            if (peerPort->buffers[i] == buffer) {
+                omxSoftQueueBuffer(peerPort, buffer);
+                omxSoftSignal(peer);
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&peer->mutex);
+        pthread_mutex_lock(&component->mutex);
+        return;
+    }
+
+    pthread_mutex_unlock(&component->mutex);
+
+    if (isOutput) {
+        component->callbacks.FillBufferDone(&component->omx, component->pAppData, buffer);
+    } else {
+        component->callbacks.EmptyBufferDone(&component->omx, component->pAppData, buffer);
+    }
+
+    pthread_mutex_lock(&component->mutex);
+}
+
+
+
+void omxSoftEvent(OMXSoftComponent_s *component, OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2) {
+    pthread_mutex_unlock(&component->mutex);
+    component->callbacks.EventHandler(&component->omx, component->pAppData, eEvent, nData1, nData2, NULL);
+    pthread_mutex_lock(&component->mutex);
+}
+
+
+
+static void omxSoftCopyImageFormat(OMXSoftPort_s *dst, const OMXSoftPort_s *src) {
+    OMX_IMAGE_PORTDEFINITIONTYPE *image = &dst->definition.format.image;
+    image->nFrameWidth = src->definition.format.image.nFrameWidth;
+    image->nFrameHeight = src->definition.format.image.nFrameHeight;
+    image->nStride = src->definition.format.image.nStride;
+    image->nSliceHeight = src->definition.format.image.nSliceHeight;
+    image->eCompressionFormat = src->definition.format.image.eCompressionFormat;
+    image->eColorFormat = src->definition.format.image.eColorFormat;
+    dst->definition.nBufferSize = src->definition.nBufferSize;
+}
+
+
+
+void omxSoftPortSettingsChanged(OMXSoftComponent_s *component, OMXSoftPort_s *port) {
+    if (port->tunnel) {
+        // the tunneled input port takes over the new format, as with the real components
+        OMXSoftComponent_s *peer = port->tunnel;
+        const OMX_U32 peerPortIndex = port->tunnelPortIndex;
+        OMXSoftPort_s copy = *port;
+        pthread_mutex_unlock(&component->mutex);
+        pthread_mutex_lock(&peer->mutex);
+        omxSoftCopyImageFormat(omxSoftPort(peer, peerPortIndex), &copy);
+        pthread_mutex_unlock(&peer->mutex);
+        pthread_mutex_lock(&component->mutex);
+    }
+
+    omxSoftEvent(component, OMX_EventPortSettingsChanged, port->definition.nPortIndex, OMX_IndexParamPortDefinition);
+}
+
+
+
+static OMX_BUFFERHEADERTYPE *omxSoftNewBuffer(OMXSoftPort_s *port, OMX_PTR pAppPrivate, OMX_U32 nSizeBytes, OMX_U8 *pBuffer) {
+    OMXSoftBuffer_s *buffer = calloc(1, sizeof(OMXSoftBuffer_s));
+    assert(buffer != NULL);
+    OMX_BUFFERHEADERTYPE *header = &buffer->header;
+    OMX_INIT_STRUCTURE_P(header, sizeof(*header));
+    buffer->ownsData = (pBuffer == NULL);
+
+    if (buffer->ownsData) {
+        int ret = posix_memalign((void **)&pBuffer, 32, nSizeBytes);
+        assert(ret == 0);
+    }
+
+    header->pBuffer = pBuffer;
+    header->nAllocLen = nSizeBytes;
+    header->pAppPrivate = pAppPrivate;
+    header->pPlatformPrivate = buffer;
+
+    if (port->definition.eDir == OMX_DirInput) {
+        header->nInputPortIndex = port->definition.nPortIndex;
+    } else {
+        header->nOutputPortIndex = port->definition.nPortIndex;
+    }
+
+    return header;
+}
+
+
+
+static void omxSoftDeleteBuffer(OMX_BUFFERHEADERTYPE *header) {
+    OMXSoftBuffer_s *buffer = (OMXSoftBuffer_s *)header->pPlatformPrivate;
+
+    if (buffer->ownsData) {
+        free(header->pBuffer);
+    }
+
+    free(buffer);
+}
+
+
+
+
+
+
+// Called with component->mutex held, which has to be dropped to respect the lock order. The peer may run in
+// between, so nothing read from the component before this call is still valid.
+static void omxSoftLockTunnels(OMXSoftComponent_s *component) {
+    pthread_mutex_unlock(&component->mutex);
+    pthread_mutex_lock(&sTunnelMutex);
+    pthread_mutex_lock(&component->mutex);
+}
+
+
+
+// Called for either end of a tunnel when its port gets enabled. The output port supplies the buffers,
+// which get allocated once both ends are enabled.
+static void omxSoftEnableTunnel(OMXSoftComponent_s *component, OMXSoftPort_s *port) {
+    omxSoftLockTunnels(component);
+    OMXSoftComponent_s *peer = port->tunnel;
+    port->tunnelEnabled = true;
+    pthread_mutex_unlock(&component->mutex);
+    pthread_mutex_lock(&peer->mutex);
+    OMXSoftPort_s *peerPort = omxSoftPort(peer, port->tunnelPortIndex);
+    const bool peerEnabled = peerPort->tunnelEnabled;
+    pthread_mutex_unlock(&peer->mutex);
+    pthread_mutex_lock(&component->mutex);
+
+    if (peerEnabled) {
+        OMXSoftComponent_s *supplier = (port->definition.eDir == OMX_DirOutput) ? component : peer;
+        OMXSoftComponent_s *consumer = (supplier == component) ? peer : component;
+        OMXSoftPort_s *supplierPort = (supplier == component) ? port : peerPort;
+        OMXSoftPort_s *consumerPort = (supplier == component) ? peerPort : port;
+        OMX_BUFFERHEADERTYPE *headers[OMX_SOFT_MAX_BUFFERS];
+        pthread_mutex_unlock(&component->mutex);
+
+        pthread_mutex_lock(&supplier->mutex);
+        pthread_mutex_lock(&consumer->mutex);
+        OMX_U32 count = supplierPort->definition.nBufferCountActual;
+        OMX_U32 size = supplierPort->definition.nBufferSize;
+
+        if (consumerPort->definition.nBufferCountActual > count) {
+            count = consumerPort->definition.nBufferCountActual;
+        }
+
+        if (consumerPort->definition.nBufferSize > size) {
+            size = consumerPort->definition.nBufferSize;
+        }
+
+        supplierPort->definition.nBufferCountActual = count;
+        consumerPort->definition.nBufferCountActual = count;
+        pthread_mutex_unlock(&consumer->mutex);
+
+        for (OMX_U32 i = 0; i < count; i++) {
+            headers[i] = omxSoftNewBuffer(supplierPort, NULL, size, NULL);
+            headers[i]->nInputPortIndex = consumerPort->definition.nPortIndex;
+            omxSoftAddBuffer(supplierPort, headers[i]);
+            omxSoftQueueBuffer(supplierPort, headers[i]);
+        }
+
+        omxSoftSignal(supplier);
+        pthread_mutex_unlock(&supplier->mutex);
+
+        pthread_mutex_lock(&consumer->mutex);
+
+        for (OMX_U32 i = 0; i < count; i++) {
+            omxSoftAddBuffer(consumerPort, headers[i]);
+        }
+
+        omxSoftSignal(consumer);
+        pthread_mutex_unlock(&consumer->mutex);
+        pthread_mutex_lock(&component->mutex);
+    }
+
+    pthread_mutex_unlock(&sTunnelMutex);
+}
+
+
+
+// The supplier frees the tunnel buffers, the consumer's disable completes once they are gone.
+static void omxSoftDisableTunnel(OMXSoftComponent_s *component, OMXSoftPort_s *port) {
+    omxSoftLockTunnels(component);
+    port->tunnelEnabled = false;
+
+    if (port->definition.eDir == OMX_DirOutput) {
+        OMXSoftComponent_s *peer = port->tunnel;
+        const OMX_U32 peerPortIndex = port->tunnelPortIndex;
+        OMX_BUFFERHEADERTYPE *headers[OMX_SOFT_MAX_BUFFERS];
+        const OMX_U32 count = port->numBuffers;
+        memcpy(headers, port->buffers, count * sizeof(OMX_BUFFERHEADERTYPE *));
+        port->numBuffers = 0;
+        port->queueCount = 0;
+        port->definition.bPopulated = OMX_FALSE;
+        pthread_mutex_unlock(&component->mutex);
+
+        pthread_mutex_lock(&peer->mutex);
+        OMXSoftPort_s *peerPort = omxSoftPort(peer, peerPortIndex);
+
+        for (OMX_U32 i = 0; i < count; i++) {
+            omxSoftRemoveBuffer(peerPort, headers[i]);
+            omxSoftDeleteBuffer(headers[i]);
+        }
+
+        omxSoftSignal(peer);
+        pthread_mutex_unlock(&peer->mutex);
+        pthread_mutex_lock(&component->mutex);
+    }
+
+    pthread_mutex_unlock(&sTunnelMutex);
+}
+
+
+
+
+
+
+static void omxSoftReturnQueuedBuffers(OMXSoftComponent_s *component, OMXSoftPort_s *port) {
+    if (port->tunnel) {
+        return;
+    }
+
+    OMX_BUFFERHEADERTYPE *buffer;
+
+    while ((buffer = omxSoftPopBuffer(port))) {
+        // flushed output buffers carry neither data nor the flags of their last use
+        if (port->definition.eDir == OMX_DirOutput) {
+            buffer->nFilledLen = 0;
+            buffer->nFlags = 0;
+        }
+
+        omxSoftReturnBuffer(component, port, buffer);
+    }
+}
+
+
+
+static bool omxSoftIsValidTransition(OMX_STATETYPE from, OMX_STATETYPE to) {
+    switch (from) {
+        case OMX_StateLoaded:
+            return (to == OMX_StateIdle) || (to == OMX_StateWaitForResources);
+
+        case OMX_StateIdle:
+            return (to == OMX_StateLoaded) || (to == OMX_StateExecuting) || (to == OMX_StatePause);
+
+        case OMX_StateExecuting:
+            return (to == OMX_StateIdle) || (to == OMX_StatePause);
+
+        case OMX_StatePause:
+            return (to == OMX_StateIdle) || (to == OMX_StateExecuting);
+
+        case OMX_StateWaitForResources:
+            return (to == OMX_StateLoaded) || (to == OMX_StateIdle);
+
+        default:
+            return false;
+    }
+}
+
+
+
+// returns false if the command was rejected and must not be completed
+static bool omxSoftStartCommand(OMXSoftComponent_s *component) {
+    const OMX_U32 nParam = component->activeCommand.nParam;
+
+    switch (component->activeCommand.command) {
+        case OMX_CommandStateSet:
+            if (nParam == component->state) {
+                omxSoftEvent(component, OMX_EventError, OMX_ErrorSameState, 0);
+                return false;
+            }
+
+            if (!omxSoftIsValidTransition(component->state, nParam)) {
+                omxSoftEvent(component, OMX_EventError, OMX_ErrorIncorrectStateTransition, 0);
+                return false;
+            }
+
+            if ((nParam == OMX_StateIdle) && (component->state != OMX_StateLoaded)) {
+                for (int p = 0; p < 2; p++) {
+                    omxSoftReturnQueuedBuffers(component, &component->ports[p]);
+                }
+
+                if (component->type->reset) {
+                    component->type->reset(component);
+                }
+            }
+
+            return true;
+
+        case OMX_CommandPortDisable: {
+            OMXSoftPort_s *port = omxSoftPort(component, nParam);
+            omxSoftReturnQueuedBuffers(component, port);
+
+            if (port->tunnel) {
+                omxSoftDisableTunnel(component, port);
+            }
+
+            return true;
+        }
+
+        case OMX_CommandPortEnable: {
+            OMXSoftPort_s *port = omxSoftPort(component, nParam);
+
+            if (port->tunnel && (component->state != OMX_StateLoaded)) {
+                omxSoftEnableTunnel(component, port);
+            }
+
+            return true;
+        }
+
+        case OMX_CommandFlush: {
+            omxSoftReturnQueuedBuffers(component, omxSoftPort(component, nParam));
+
+            if (component->type->reset) {
+                component->type->reset(component);
+            }
+
+            return true;
+        }
+
+        default:
+            omxSoftEvent(component, OMX_EventError, OMX_ErrorNotImplemented, 0);
+            return false;
+    }
+}
+
+
+
+static bool omxSoftIsCommandDone(OMXSoftComponent_s *component) {
+    const OMX_U32 nParam = component->activeCommand.nParam;
+
+    switch (component->activeCommand.command) {
+        case OMX_CommandStateSet:
+            for (int p = 0; p < 2; p++) {
+                const OMXSoftPort_s *port = &component->ports[p];
+
+                if (!port->definition.bEnabled) {
+                    continue;
+                }
+
+                if ((nParam == OMX_StateIdle) && (component->state == OMX_StateLoaded) && !port->tunnel && !port->definition.bPopulated) {
+                    return false;
+                }
+
+                if ((nParam == OMX_StateLoaded) && (port->numBuffers > 0)) {
+                    return false;
+                }
+            }
+
+            return true;
+
+        case OMX_CommandPortDisable:
+            return omxSoftPort(component, nParam)->numBuffers == 0;
+
+        case OMX_CommandPortEnable: {
+            const OMXSoftPort_s *port = omxSoftPort(component, nParam);
+
+            if ((component->state == OMX_StateLoaded) || (component->state == OMX_StateWaitForResources)) {
+                return true;
+            }
+
+            return port->tunnel ? (port->numBuffers > 0) : (port->definition.bPopulated == OMX_TRUE);
+        }
+
+        default:
+            return true;
+    }
+}
+
+
+
+static void omxSoftCompleteCommand(OMXSoftComponent_s *component) {
+    if (component->activeCommand.command == OMX_CommandStateSet) {
+        component->state = component->activeCommand.nParam;
+    }
+
+    if (component->commandDelayMs > 0) {
+        pthread_mutex_unlock(&component->mutex);
+        usleep(component->commandDelayMs * 1000);
+        pthread_mutex_lock(&component->mutex);
+    }
+
+    omxSoftEvent(component, OMX_EventCmdComplete, component->activeCommand.command, component->activeCommand.nParam);
+}
+
+
+
+static void *omxSoftThread(void *arg) {
+    OMXSoftComponent_s *component = (OMXSoftComponent_s *)arg;
+    pthread_mutex_lock(&component->mutex);
+
+    while (!component->quit) {
+        component->signalled = false;
+        bool progress = true;
+
+        while (progress) {
+            progress = false;
+
+            if (!component->commandActive && (component->numCommands > 0)) {
+                component->activeCommand.command = component->commands[0].command;
+                component->activeCommand.nParam = component->commands[0].nParam;
+                component->numCommands--;
+                memmove(&component->commands[0], &component->commands[1], component->numCommands * sizeof(component->commands[0]));
+                component->commandActive = omxSoftStartCommand(component);
+                progress = true;
+            }
+
+            if (component->commandActive && omxSoftIsCommandDone(component)) {
+                component->commandActive = false;
+                omxSoftCompleteCommand(component);
+                progress = true;
+            }
+        }
+
+        if ((component->state == OMX_StateExecuting) && component->type->process) {
+            component->type->process(component);
+        }
+
+        while (!component->signalled && !component->quit) {
+            pthread_cond_wait(&component->cond, &component->mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&component->mutex);
+    return NULL;
+}
+
+
+
+
+
+
+static OMX_ERRORTYPE omxSoftGetComponentVersion(OMX_HANDLETYPE hComponent, OMX_STRING pComponentName, OMX_VERSIONTYPE *pComponentVersion, OMX_VERSIONTYPE *pSpecVersion, OMX_UUIDTYPE *pComponentUUID) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    strncpy(pComponentName, component->type->name, 128);
+    pComponentVersion->nVersion = 0;
+    pSpecVersion->nVersion = OMX_VERSION;
+    memset(pComponentUUID, 0, sizeof(OMX_UUIDTYPE));
+    snprintf((char *)*pComponentUUID, sizeof(OMX_UUIDTYPE), "soft:%p", (void *)component);
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftSendCommand(OMX_HANDLETYPE hComponent, OMX_COMMANDTYPE Cmd, OMX_U32 nParam1, OMX_PTR pCmdData) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    pthread_mutex_lock(&component->mutex);
+
+    switch (Cmd) {
+        case OMX_CommandStateSet:
+            if (component->numCommands == OMX_SOFT_MAX_COMMANDS) {
+                omxErr = OMX_ErrorInsufficientResources;
+                break;
+            }
+
+            component->commands[component->numCommands].command = Cmd;
+            component->commands[component->numCommands].nParam = nParam1;
+            component->numCommands++;
+            break;
+
+        case OMX_CommandPortDisable:
+        case OMX_CommandPortEnable:
+        case OMX_CommandFlush:
+            for (int p = 0; p < 2; p++) {
+                OMXSoftPort_s *port = &component->ports[p];
+
+                if ((nParam1 != OMX_ALL) && (nParam1 != port->definition.nPortIndex)) {
+                    continue;
+                }
+
+                if (component->numCommands == OMX_SOFT_MAX_COMMANDS) {
+                    omxErr = OMX_ErrorInsufficientResources;
+                    break;
+                }
+
+                // like the VideoCore, bEnabled flips immediately so buffers can be allocated right away
+                if (Cmd != OMX_CommandFlush) {
+                    port->definition.bEnabled = (Cmd == OMX_CommandPortEnable) ? OMX_TRUE : OMX_FALSE;
+                }
+
+                component->commands[component->numCommands].command = Cmd;
+                component->commands[component->numCommands].nParam = port->definition.nPortIndex;
+                component->numCommands++;
+            }
+
+            if ((nParam1 != OMX_ALL) && !omxSoftPort(component, nParam1)) {
+                omxErr = OMX_ErrorBadPortIndex;
+            }
+
+            break;
+
+        default:
+            omxErr = OMX_ErrorNotImplemented;
+    }
+
+    omxSoftSignal(component);
+    pthread_mutex_unlock(&component->mutex);
+    return omxErr;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftGetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nParamIndex, OMX_PTR pParam) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    OMX_ERRORTYPE omxErr = OMX_ErrorUnsupportedIndex;
+    pthread_mutex_lock(&component->mutex);
+
+    if (component->type->getParameter) {
+        omxErr = component->type->getParameter(component, nParamIndex, pParam);
+    }
+
+    if (omxErr != OMX_ErrorUnsupportedIndex) {
+        pthread_mutex_unlock(&component->mutex);
+        return omxErr;
+    }
+
+    omxErr = OMX_ErrorNone;
+
+    switch (nParamIndex) {
+        case OMX_IndexParamAudioInit:
+        case OMX_IndexParamVideoInit:
+        case OMX_IndexParamOtherInit:
+        case OMX_IndexParamImageInit: {
+            OMX_PORT_PARAM_TYPE *ports = (OMX_PORT_PARAM_TYPE *)pParam;
+            ports->nPorts = (nParamIndex == OMX_IndexParamImageInit) ? 2 : 0;
+            ports->nStartPortNumber = (nParamIndex == OMX_IndexParamImageInit) ? component->type->startPort : 0;
+            break;
+        }
+
+        case OMX_IndexParamPortDefinition: {
+            OMX_PARAM_PORTDEFINITIONTYPE *definition = (OMX_PARAM_PORTDEFINITIONTYPE *)pParam;
+            OMXSoftPort_s *port = omxSoftPort(component, definition->nPortIndex);
+
+            if (!port) {
+                omxErr = OMX_ErrorBadPortIndex;
+                break;
+            }
+
+            *definition = port->definition;
+            break;
+        }
+
+        case OMX_IndexParamImagePortFormat: {
+            OMX_IMAGE_PARAM_PORTFORMATTYPE *format = (OMX_IMAGE_PARAM_PORTFORMATTYPE *)pParam;
+            OMXSoftPort_s *port = omxSoftPort(component, format->nPortIndex);
+
+            if (!port) {
+                omxErr = OMX_ErrorBadPortIndex;
+                break;
+            }
+
+            if (format->nIndex >= port->numFormats) {
+                omxErr = OMX_ErrorNoMore;
+                break;
+            }
+
+            format->eCompressionFormat = port->formats[format->nIndex].eCompressionFormat;
+            format->eColorFormat = port->formats[format->nIndex].eColorFormat;
+            break;
+        }
+
+        case OMX_IndexParamBrcmSupportsSlices: {
+            OMX_CONFIG_PORTBOOLEANTYPE *supportsSlices = (OMX_CONFIG_PORTBOOLEANTYPE *)pParam;
+            OMXSoftPort_s *port = omxSoftPort(component, supportsSlices->nPortIndex);
+
+            if (!port) {
+                omxErr = OMX_ErrorBadPortIndex;
+                break;
+            }
+
+            supportsSlices->bEnabled = port->supportsSlices;
+            break;
+        }
+
+        default:
+            omxErr = OMX_ErrorUnsupportedIndex;
+    }
+
+    pthread_mutex_unlock(&component->mutex);
+    return omxErr;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftSetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pParam) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    OMX_ERRORTYPE omxErr = OMX_ErrorUnsupportedIndex;
+    pthread_mutex_lock(&component->mutex);
+
+    if (component->type->setParameter) {
+        omxErr = component->type->setParameter(component, nIndex, pParam);
+    }
+
+    if (omxErr != OMX_ErrorUnsupportedIndex) {
+        if ((omxErr == OMX_ErrorNone) && component->type->updatePorts) {
+            component->type->updatePorts(component);
+        }
+
+        pthread_mutex_unlock(&component->mutex);
+        return omxErr;
+    }
+
+    omxErr = OMX_ErrorNone;
+
+    switch (nIndex) {
+        case OMX_IndexParamPortDefinition: {
+            const OMX_PARAM_PORTDEFINITIONTYPE *definition = (const OMX_PARAM_PORTDEFINITIONTYPE *)pParam;
+            OMXSoftPort_s *port = omxSoftPort(component, definition->nPortIndex);
+
+            if (!port) {
+                omxErr = OMX_ErrorBadPortIndex;
+                break;
+            }
+
+            if (port->definition.bEnabled && (component->state != OMX_StateLoaded)) {
+                omxErr = OMX_ErrorIncorrectStateOperation;
+                break;
+            }
+
+            const OMX_IMAGE_PORTDEFINITIONTYPE *image = &definition->format.image;
+
+            if (!omxSoftIsPortFormatSupported(port, image->eCompressionFormat, image->eColorFormat)) {
+                omxErr = OMX_ErrorUnsupportedSetting;
+                break;
+            }
+
+            if (definition->nBufferCountActual < port->definition.nBufferCountMin) {
+                omxErr = OMX_ErrorBadParameter;
+                break;
+            }
+
+            port->definition.nBufferCountActual = definition->nBufferCountActual;
+            port->definition.format.image.nFrameWidth = image->nFrameWidth;
+            port->definition.format.image.nFrameHeight = image->nFrameHeight;
+            port->definition.format.image.nStride = image->nStride;
+            port->definition.format.image.nSliceHeight = image->nSliceHeight;
+            port->definition.format.image.bFlagErrorConcealment = image->bFlagErrorConcealment;
+            port->definition.format.image.eColorFormat = image->eColorFormat;
+
+            if (image->eCompressionFormat != OMX_IMAGE_CodingAutoDetect) {
+                port->definition.format.image.eCompressionFormat = image->eCompressionFormat;
+            }
+
+            break;
+        }
+
+        case OMX_IndexParamImagePortFormat: {
+            const OMX_IMAGE_PARAM_PORTFORMATTYPE *format = (const OMX_IMAGE_PARAM_PORTFORMATTYPE *)pParam;
+            OMXSoftPort_s *port = omxSoftPort(component, format->nPortIndex);
+
+            if (!port) {
+                omxErr = OMX_ErrorBadPortIndex;
+                break;
+            }
+
+            if (!omxSoftIsPortFormatSupported(port, format->eCompressionFormat, format->eColorFormat)) {
+                omxErr = OMX_ErrorUnsupportedSetting;
+                break;
+            }
+
+            port->definition.format.image.eColorFormat = format->eColorFormat;
+
+            if (format->eCompressionFormat != OMX_IMAGE_CodingAutoDetect) {
+                port->definition.format.image.eCompressionFormat = format->eCompressionFormat;
+            }
+
+            break;
+        }
+
+        default:
+            omxErr = OMX_ErrorUnsupportedIndex;
+    }
+
+    if ((omxErr == OMX_ErrorNone) && component->type->updatePorts) {
+        component->type->updatePorts(component);
+    }
+
+    pthread_mutex_unlock(&component->mutex);
+    return omxErr;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftGetExtensionIndex(OMX_HANDLETYPE hComponent, OMX_STRING cParameterName, OMX_INDEXTYPE *pIndexType) {
+    return OMX_ErrorUnsupportedIndex;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftGetState(OMX_HANDLETYPE hComponent, OMX_STATETYPE *pState) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    pthread_mutex_lock(&component->mutex);
+    *pState = component->state;
+    pthread_mutex_unlock(&component->mutex);
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftComponentTunnelRequest(OMX_HANDLETYPE hComp, OMX_U32 nPort, OMX_HANDLETYPE hTunneledComp, OMX_U32 nTunneledPort, OMX_TUNNELSETUPTYPE *pTunnelSetup) {
+    // tunnels are set up by OMX_SetupTunnel directly
+    return OMX_ErrorNotImplemented;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftRegisterBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE **ppBuffer, OMX_U32 nPortIndex, OMX_PTR pAppPrivate, OMX_U32 nSizeBytes, OMX_U8 *pBuffer) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    pthread_mutex_lock(&component->mutex);
+    OMXSoftPort_s *port = omxSoftPort(component, nPortIndex);
+
+    if (!port) {
+        omxErr = OMX_ErrorBadPortIndex;
+    } else if (!port->definition.bEnabled || port->tunnel) {
+        omxErr = OMX_ErrorIncorrectStateOperation;
+    } else if (nSizeBytes < port->definition.nBufferSize) {
+        omxErr = OMX_ErrorBadParameter;
+    } else if (port->numBuffers == OMX_SOFT_MAX_BUFFERS) {
+        omxErr = OMX_ErrorInsufficientResources;
+    } else {
+        *ppBuffer = omxSoftNewBuffer(port, pAppPrivate, nSizeBytes, pBuffer);
+        omxSoftAddBuffer(port, *ppBuffer);
+        omxSoftSignal(component);
+    }
+
+    pthread_mutex_unlock(&component->mutex);
+    return omxErr;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftUseBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE **ppBufferHdr, OMX_U32 nPortIndex, OMX_PTR pAppPrivate, OMX_U32 nSizeBytes, OMX_U8 *pBuffer) {
+    if (pBuffer == NULL) {
+        return OMX_ErrorBadParameter;
+    }
+
+    return omxSoftRegisterBuffer(hComponent, ppBufferHdr, nPortIndex, pAppPrivate, nSizeBytes, pBuffer);
+}
+
+
+
+static OMX_ERRORTYPE omxSoftAllocateBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE **ppBuffer, OMX_U32 nPortIndex, OMX_PTR pAppPrivate, OMX_U32 nSizeBytes) {
+    return omxSoftRegisterBuffer(hComponent, ppBuffer, nPortIndex, pAppPrivate, nSizeBytes, NULL);
+}
+
+
+
+static OMX_ERRORTYPE omxSoftFreeBuffer(OMX_HANDLETYPE hComponent, OMX_U32 nPortIndex, OMX_BUFFERHEADERTYPE *pBuffer) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    pthread_mutex_lock(&component->mutex);
+    OMXSoftPort_s *port = omxSoftPort(component, nPortIndex);
+
+    if (!port) {
+        omxErr = OMX_ErrorBadPortIndex;
+    } else if (!omxSoftRemoveBuffer(port, pBuffer)) {
+        omxErr = OMX_ErrorBadParameter;
+    } else {
+        omxSoftDeleteBuffer(pBuffer);
+        omxSoftSignal(component);
+    }
+
+    pthread_mutex_unlock(&component->mutex);
+    return omxErr;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftQueueClientBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE *pBuffer, OMX_DIRTYPE eDir) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    OMX_ERRORTYPE omxErr = OMX_ErrorNone;
+    pthread_mutex_lock(&component->mutex);
+    OMX_U32 nPortIndex = (eDir == OMX_DirInput) ? pBuffer->nInputPortIndex : pBuffer->nOutputPortIndex;
+    OMXSoftPort_s *port = omxSoftPort(component, nPortIndex);
+
+    if (!port || (port->definition.eDir != eDir)) {
+        omxErr = OMX_ErrorBadPortIndex;
+    } else if ((component->state != OMX_StateExecuting) && (component->state != OMX_StatePause) && (component->state != OMX_StateIdle)) {
+        omxErr = OMX_ErrorIncorrectStateOperation;
+    } else if (!port->definition.bEnabled) {
+        omxErr = OMX_ErrorIncorrectStateOperation;
+    } else {
+        omxSoftQueueBuffer(port, pBuffer);
+        omxSoftSignal(component);
+    }
+
+    pthread_mutex_unlock(&component->mutex);
+    return omxErr;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftEmptyThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE *pBuffer) {
+    return omxSoftQueueClientBuffer(hComponent, pBuffer, OMX_DirInput);
+}
+
+
+
+static OMX_ERRORTYPE omxSoftFillThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE *pBuffer) {
+    return omxSoftQueueClientBuffer(hComponent, pBuffer, OMX_DirOutput);
+}
+
+
+
+static OMX_ERRORTYPE omxSoftSetCallbacks(OMX_HANDLETYPE hComponent, OMX_CALLBACKTYPE *pCallbacks, OMX_PTR pAppData) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    pthread_mutex_lock(&component->mutex);
+    component->callbacks = *pCallbacks;
+    component->pAppData = pAppData;
+    pthread_mutex_unlock(&component->mutex);
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftComponentDeInit(OMX_HANDLETYPE hComponent) {
+    OMXSoftComponent_s *component = omxSoftComponent(hComponent);
+    pthread_mutex_lock(&component->mutex);
+    component->quit = true;
+    omxSoftSignal(component);
+    pthread_mutex_unlock(&component->mutex);
+    pthread_join(component->thread, NULL);
+
+    if (component->type->deinit) {
+        component->type->deinit(component);
+    }
+
+    for (int p = 0; p < 2; p++) {
+        OMXSoftPort_s *port = &component->ports[p];
+
+        // buffers the client did not free, tunnel buffers belong to the supplier
+        if (!port->tunnel || (port->definition.eDir == OMX_DirOutput)) {
+            for (OMX_U32 i = 0; i < port->numBuffers; i++) {
+                omxSoftDeleteBuffer(port->buffers[i]);
+            }
+        }
+    }
+
+    pthread_cond_destroy(&component->cond);
+    pthread_mutex_destroy(&component->mutex);
+    free(component);
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE omxSoftGetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pConfig) {
+    return omxSoftGetParameter(hComponent, nIndex, pConfig);
+}
+
+
+
+static OMX_ERRORTYPE omxSoftSetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pConfig) {
+    if (nIndex == OMX_IndexParamPortDefinition) {
+        return OMX_ErrorUnsupportedIndex;
+    }
+
+    return omxSoftSetParameter(hComponent, nIndex, pConfig);
+}
+
+
+
+
+
+
+OMX_ERRORTYPE OMX_Init(void) {
+    return OMX_ErrorNone;
+}
+
+
+
+OMX_ERRORTYPE OMX_Deinit(void) {
+    return OMX_ErrorNone;
+}
+
+
+
+OMX_ERRORTYPE OMX_ComponentNameEnum(OMX_STRING cComponentName, OMX_U32 nNameLength, OMX_U32 nIndex) {
+    if (nIndex >= sNumComponentTypes) {
+        return OMX_ErrorNoMore;
+    }
+
+    snprintf(cComponentName, nNameLength, "%s", sComponentTypes[nIndex]->name);
+    return OMX_ErrorNone;
+}
+
+
+
+OMX_ERRORTYPE OMX_GetHandle(OMX_HANDLETYPE *pHandle, OMX_STRING cComponentName, OMX_PTR pAppData, OMX_CALLBACKTYPE *pCallBacks) {
+    const OMXSoftComponentType_s *type = NULL;
+
+    for (OMX_U32 i = 0; i < sNumComponentTypes; i++) {
+        if (strcmp(sComponentTypes[i]->name, cComponentName) == 0) {
+            type = sComponentTypes[i];
+        }
+    }
+
+    if (!type) {
+        return OMX_ErrorComponentNotFound;
+    }
+
+    OMXSoftComponent_s *component = calloc(1, sizeof(OMXSoftComponent_s));
+    assert(component != NULL);
+    OMX_COMPONENTTYPE *omx = &component->omx;
+    OMX_INIT_STRUCTURE_P(omx, sizeof(*omx));
+    omx->pComponentPrivate = component;
+    omx->pApplicationPrivate = pAppData;
+    omx->GetComponentVersion = omxSoftGetComponentVersion;
+    omx->SendCommand = omxSoftSendCommand;
+    omx->GetParameter = omxSoftGetParameter;
+    omx->SetParameter = omxSoftSetParameter;
+    omx->GetConfig = omxSoftGetConfig;
+    omx->SetConfig = omxSoftSetConfig;
+    omx->GetExtensionIndex = omxSoftGetExtensionIndex;
+    omx->GetState = omxSoftGetState;
+    omx->ComponentTunnelRequest = omxSoftComponentTunnelRequest;
+    omx->UseBuffer = omxSoftUseBuffer;
+    omx->AllocateBuffer = omxSoftAllocateBuffer;
+    omx->FreeBuffer = omxSoftFreeBuffer;
+    omx->EmptyThisBuffer = omxSoftEmptyThisBuffer;
+    omx->FillThisBuffer = omxSoftFillThisBuffer;
+    omx->SetCallbacks = omxSoftSetCallbacks;
+    omx->ComponentDeInit = omxSoftComponentDeInit;
+
+    component->type = type;
+    component->callbacks = *pCallBacks;
+    component->pAppData = pAppData;
+    component->state = OMX_StateLoaded;
+
+    const char *delay = getenv("OMX_SOFT_COMMAND_DELAY_MS");
+    component->commandDelayMs = delay ? atoi(delay) : 0;
+
+    pthread_mutex_init(&component->mutex, NULL);
+    pthread_cond_init(&component->cond, NULL);
+    type->init(component);
+
+    if (type->updatePorts) {
+        type->updatePorts(component);
+    }
+
+    int ret = pthread_create(&component->thread, NULL, omxSoftThread, component);
+    assert(ret == 0);
+
+    *pHandle = omx;
+    return OMX_ErrorNone;
+}
+
+
+
+OMX_ERRORTYPE OMX_FreeHandle(OMX_HANDLETYPE hComponent) {
+    return omxSoftComponentDeInit(hComponent);
+}
+
+
+
+OMX_ERRORTYPE OMX_SetupTunnel(OMX_HANDLETYPE hOutput, OMX_U32 nPortOutput, OMX_HANDLETYPE hInput, OMX_U32 nPortInput) {
+    OMXSoftComponent_s *output = hOutput ? omxSoftComponent(hOutput) : NULL;
+    OMXSoftComponent_s *input = hInput ? omxSoftComponent(hInput) : NULL;
+    OMXSoftPort_s outputCopy;
+
+    if (output) {
+        pthread_mutex_lock(&output->mutex);
+        OMXSoftPort_s *port = omxSoftPort(output, nPortOutput);
+
+        if (!port || (port->definition.eDir != OMX_DirOutput)) {
+            pthread_mutex_unlock(&output->mutex);
+            return OMX_ErrorBadPortIndex;
+        }
+
+        port->tunnel = input;
+        port->tunnelPortIndex = nPortInput;
+        outputCopy = *port;
+        pthread_mutex_unlock(&output->mutex);
+    }
+
+    if (input) {
+        pthread_mutex_lock(&input->mutex);
+        OMXSoftPort_s *port = omxSoftPort(input, nPortInput);
+
+        if (!port || (port->definition.eDir != OMX_DirInput)) {
+            pthread_mutex_unlock(&input->mutex);
+            return OMX_ErrorBadPortIndex;
+        }
+
+        port->tunnel = output;
+        port->tunnelPortIndex = nPortOutput;
+
+        if (output) {
+            omxSoftCopyImageFormat(port, &outputCopy);
+        }
+
+        pthread_mutex_unlock(&input->mutex);
+    }
+
+    return OMX_ErrorNone;
+}
+
+
+
+// the soft build does not link libbcm_host
+void bcm_host_init(void) {
+}
+
+
+
+void bcm_host_deinit(void) {
+}
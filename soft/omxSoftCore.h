@@ -0,0 +1,122 @@
+//
+//  omxSoftCore.h
+//  OMXPlayground
+//
+//  Software stand-in for the VideoCore OpenMAX IL core. Implements the OMX_* core entry points and the
+//  component function table on top of one worker thread per component, so the pipelines in this
+//  project can run (and be profiled) on any Linux box. Only what the playground uses is implemented.
+//
+
+#ifndef omxSoftCore_h
+#define omxSoftCore_h
+
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Broadcom.h>
+#include <IL/OMX_Component.h>
+#include <IL/OMX_Core.h>
+
+
+#define OMX_SOFT_MAX_BUFFERS 16
+#define OMX_SOFT_MAX_FORMATS 8
+#define OMX_SOFT_MAX_COMMANDS 16
+
+
+struct OMXSoftComponent_s;
+typedef struct OMXSoftComponent_s OMXSoftComponent_s;
+
+
+typedef struct {
+    OMX_PARAM_PORTDEFINITIONTYPE definition;
+    OMX_IMAGE_PARAM_PORTFORMATTYPE formats[OMX_SOFT_MAX_FORMATS];
+    OMX_U32 numFormats;
+    OMX_BOOL supportsSlices;
+    OMX_CONFIG_RECTTYPE inputCrop;
+
+    OMX_BUFFERHEADERTYPE *buffers[OMX_SOFT_MAX_BUFFERS];   // all buffers of the port
+    OMX_U32 numBuffers;
+    OMX_BUFFERHEADERTYPE *queue[OMX_SOFT_MAX_BUFFERS];     // buffers currently owned by the component
+    OMX_U32 queueHead;
+    OMX_U32 queueCount;
+
+    OMXSoftComponent_s *tunnel;
+    OMX_U32 tunnelPortIndex;
+    bool tunnelEnabled;
+} OMXSoftPort_s;
+
+
+typedef struct {
+    const char *name;
+    OMX_U32 startPort;
+
+    void (*init)(OMXSoftComponent_s *component);
+    void (*deinit)(OMXSoftComponent_s *component);
+
+    // component specific indices, return OMX_ErrorUnsupportedIndex to fall back to the generic ones
+    OMX_ERRORTYPE (*getParameter)(OMXSoftComponent_s *component, OMX_INDEXTYPE nIndex, OMX_PTR pParam);
+    OMX_ERRORTYPE (*setParameter)(OMXSoftComponent_s *component, OMX_INDEXTYPE nIndex, OMX_PTR pParam);
+
+    // recompute derived port fields (stride, slice height, buffer size) after a parameter change
+    void (*updatePorts)(OMXSoftComponent_s *component);
+
+    // called from the worker thread with the component locked while Executing
+    void (*process)(OMXSoftComponent_s *component);
+
+    // drop any partially processed frame (flush, Executing -> Idle)
+    void (*reset)(OMXSoftComponent_s *component);
+} OMXSoftComponentType_s;
+
+
+struct OMXSoftComponent_s {
+    OMX_COMPONENTTYPE omx;      // handed out as OMX_HANDLETYPE
+    const OMXSoftComponentType_s *type;
+    void *priv;
+
+    OMX_CALLBACKTYPE callbacks;
+    OMX_PTR pAppData;
+
+    OMX_STATETYPE state;
+    OMXSoftPort_s ports[2];
+
+    struct {
+        OMX_COMMANDTYPE command;
+        OMX_U32 nParam;
+    } commands[OMX_SOFT_MAX_COMMANDS], activeCommand;
+    OMX_U32 numCommands;
+    bool commandActive;
+    OMX_U32 commandDelayMs;
+
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool signalled;
+    bool quit;
+};
+
+
+extern const OMXSoftComponentType_s omxSoftImageEncode;
+extern const OMXSoftComponentType_s omxSoftImageDecode;
+extern const OMXSoftComponentType_s omxSoftResize;
+
+
+// helpers for the component implementations, all expect the component to be locked
+OMXSoftPort_s *omxSoftPort(OMXSoftComponent_s *component, OMX_U32 nPortIndex);
+OMXSoftPort_s *omxSoftInputPort(OMXSoftComponent_s *component);
+OMXSoftPort_s *omxSoftOutputPort(OMXSoftComponent_s *component);
+void omxSoftInitPort(OMXSoftPort_s *port, OMX_U32 nPortIndex, OMX_DIRTYPE eDir, OMX_U32 nBufferCount, OMX_U32 nBufferSize);
+void omxSoftAddPortFormat(OMXSoftPort_s *port, OMX_IMAGE_CODINGTYPE eCompressionFormat, OMX_COLOR_FORMATTYPE eColorFormat);
+bool omxSoftIsPortFormatSupported(const OMXSoftPort_s *port, OMX_IMAGE_CODINGTYPE eCompressionFormat, OMX_COLOR_FORMATTYPE eColorFormat);
+
+OMX_BUFFERHEADERTYPE *omxSoftPeekBuffer(OMXSoftPort_s *port);
+OMX_BUFFERHEADERTYPE *omxSoftPopBuffer(OMXSoftPort_s *port);
+
+// these unlock the component while the client (or tunnel peer) is called back
+void omxSoftReturnBuffer(OMXSoftComponent_s *component, OMXSoftPort_s *port, OMX_BUFFERHEADERTYPE *buffer);
+void omxSoftEvent(OMXSoftComponent_s *component, OMX_EVENTTYPE eEvent, OMX_U32 nData1, OMX_U32 nData2);
+void omxSoftPortSettingsChanged(OMXSoftComponent_s *component, OMXSoftPort_s *port);
+
+
+#endif /* omxSoftCore_h */
@@ -0,0 +1,369 @@
+//
+//  omxSoftImage.c
+//  OMXPlayground
+//
+//  Byte orders follow what the VideoCore components produce: RGB888 is R,G,B in memory, BGR888 is B,G,R,
+//  ABGR8888 is R,G,B,A, ARGB8888 is B,G,R,A and RGB565 is a little endian 16 bit word.
+//
+
+#include "omxSoftImage.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+static inline uint8_t clamp8(int32_t v) {
+    return (v < 0) ? 0 : ((v > 255) ? 255 : v);
+}
+
+
+
+static inline void ycbcrToRGB(uint8_t Y, uint8_t Cb, uint8_t Cr, uint8_t rgb[3]) {
+    const int32_t cb = Cb - 128;
+    const int32_t cr = Cr - 128;
+    rgb[0] = clamp8(Y + ((91881 * cr) >> 16));
+    rgb[1] = clamp8(Y - ((22554 * cb + 46802 * cr) >> 16));
+    rgb[2] = clamp8(Y + ((116130 * cb) >> 16));
+}
+
+
+
+static inline void rgbToYCbCr(const uint8_t rgb[3], uint8_t ycbcr[3]) {
+    const int32_t r = rgb[0];
+    const int32_t g = rgb[1];
+    const int32_t b = rgb[2];
+    ycbcr[0] = clamp8((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+    ycbcr[1] = clamp8(((-11059 * r - 21709 * g + 32768 * b + 32768) >> 16) + 128);
+    ycbcr[2] = clamp8(((32768 * r - 27439 * g - 5329 * b + 32768) >> 16) + 128);
+}
+
+
+
+bool omxSoftIsSupportedColorFormat(OMX_COLOR_FORMATTYPE eColorFormat) {
+    return omxSoftBytesPerPixel(eColorFormat) > 0;
+}
+
+
+
+bool omxSoftIsPlanar(OMX_COLOR_FORMATTYPE eColorFormat) {
+    return eColorFormat == OMX_COLOR_FormatYUV420PackedPlanar;
+}
+
+
+
+OMX_U32 omxSoftBytesPerPixel(OMX_COLOR_FORMATTYPE eColorFormat) {
+    switch (eColorFormat) {
+        case OMX_COLOR_FormatYUV420PackedPlanar:
+            return 1;
+
+        case OMX_COLOR_Format16bitRGB565:
+            return 2;
+
+        case OMX_COLOR_Format24bitRGB888:
+        case OMX_COLOR_Format24bitBGR888:
+            return 3;
+
+        case OMX_COLOR_Format32bitABGR8888:
+        case OMX_COLOR_Format32bitARGB8888:
+            return 4;
+
+        default:
+            return 0;
+    }
+}
+
+
+
+OMX_U32 omxSoftStride(OMX_COLOR_FORMATTYPE eColorFormat, OMX_U32 nWidth) {
+    return OMX_SOFT_ALIGN(nWidth * omxSoftBytesPerPixel(eColorFormat), 32);
+}
+
+
+
+OMX_U32 omxSoftSliceSize(OMX_COLOR_FORMATTYPE eColorFormat, OMX_U32 nStride, OMX_U32 nSliceHeight) {
+    if (omxSoftIsPlanar(eColorFormat)) {
+        return nStride * nSliceHeight + 2 * (nStride / 2) * (nSliceHeight / 2);
+    }
+
+    return nStride * nSliceHeight;
+}
+
+
+
+void omxSoftImageAlloc(OMXSoftImage_s *image, OMX_COLOR_FORMATTYPE eColorFormat, OMX_U32 nWidth, OMX_U32 nHeight, OMX_U32 nStride) {
+    image->eColorFormat = eColorFormat;
+    image->nWidth = nWidth;
+    image->nHeight = nHeight;
+    image->nStride = (nStride > 0) ? nStride : omxSoftStride(eColorFormat, nWidth);
+    image->nSliceHeight = omxSoftIsPlanar(eColorFormat) ? OMX_SOFT_ALIGN(nHeight, 16) : nHeight;
+    image->pData = calloc(1, omxSoftSliceSize(eColorFormat, image->nStride, image->nSliceHeight));
+    assert(image->pData != NULL);
+}
+
+
+
+void omxSoftImageFree(OMXSoftImage_s *image) {
+    free(image->pData);
+    image->pData = NULL;
+}
+
+
+
+static inline OMX_U8 *planeU(const OMXSoftImage_s *image) {
+    return image->pData + image->nStride * image->nSliceHeight;
+}
+
+
+
+static inline OMX_U8 *planeV(const OMXSoftImage_s *image) {
+    return planeU(image) + (image->nStride / 2) * (image->nSliceHeight / 2);
+}
+
+
+
+void omxSoftImageFromSlice(OMXSoftImage_s *image, OMX_U32 nRow, OMX_U32 nRows, const OMX_U8 *pSlice, OMX_U32 nSliceHeight) {
+    const OMX_U32 stride = image->nStride;
+    memcpy(image->pData + nRow * stride, pSlice, nRows * stride);
+
+    if (omxSoftIsPlanar(image->eColorFormat)) {
+        const OMX_U32 chromaStride = stride / 2;
+        const OMX_U32 chromaRows = (nRows + 1) / 2;
+        const OMX_U8 *sliceU = pSlice + stride * nSliceHeight;
+        const OMX_U8 *sliceV = sliceU + chromaStride * (nSliceHeight / 2);
+        memcpy(planeU(image) + (nRow / 2) * chromaStride, sliceU, chromaRows * chromaStride);
+        memcpy(planeV(image) + (nRow / 2) * chromaStride, sliceV, chromaRows * chromaStride);
+    }
+}
+
+
+
+void omxSoftImageToSlice(const OMXSoftImage_s *image, OMX_U32 nRow, OMX_U32 nRows, OMX_U8 *pSlice, OMX_U32 nSliceHeight) {
+    const OMX_U32 stride = image->nStride;
+    memcpy(pSlice, image->pData + nRow * stride, nRows * stride);
+
+    if (omxSoftIsPlanar(image->eColorFormat)) {
+        const OMX_U32 chromaStride = stride / 2;
+        const OMX_U32 chromaRows = (nRows + 1) / 2;
+        OMX_U8 *sliceU = pSlice + stride * nSliceHeight;
+        OMX_U8 *sliceV = sliceU + chromaStride * (nSliceHeight / 2);
+        memcpy(sliceU, planeU(image) + (nRow / 2) * chromaStride, chromaRows * chromaStride);
+        memcpy(sliceV, planeV(image) + (nRow / 2) * chromaStride, chromaRows * chromaStride);
+    }
+}
+
+
+
+void omxSoftReadPixel(const OMXSoftImage_s *image, OMX_U32 x, OMX_U32 y, uint8_t rgba[4]) {
+    const OMX_U8 *p = image->pData + y * image->nStride + x * omxSoftBytesPerPixel(image->eColorFormat);
+    rgba[3] = 255;
+
+    switch (image->eColorFormat) {
+        case OMX_COLOR_FormatYUV420PackedPlanar: {
+            const OMX_U32 c = (y / 2) * (image->nStride / 2) + x / 2;
+            ycbcrToRGB(*p, planeU(image)[c], planeV(image)[c], rgba);
+            break;
+        }
+
+        case OMX_COLOR_Format16bitRGB565: {
+            const uint16_t v = p[0] | (p[1] << 8);
+            rgba[0] = ((v >> 11) & 0x1F) * 255 / 31;
+            rgba[1] = ((v >> 5) & 0x3F) * 255 / 63;
+            rgba[2] = (v & 0x1F) * 255 / 31;
+            break;
+        }
+
+        case OMX_COLOR_Format24bitRGB888:
+            rgba[0] = p[0];
+            rgba[1] = p[1];
+            rgba[2] = p[2];
+            break;
+
+        case OMX_COLOR_Format24bitBGR888:
+            rgba[0] = p[2];
+            rgba[1] = p[1];
+            rgba[2] = p[0];
+            break;
+
+        case OMX_COLOR_Format32bitABGR8888:
+            rgba[0] = p[0];
+            rgba[1] = p[1];
+            rgba[2] = p[2];
+            rgba[3] = p[3];
+            break;
+
+        case OMX_COLOR_Format32bitARGB8888:
+            rgba[0] = p[2];
+            rgba[1] = p[1];
+            rgba[2] = p[0];
+            rgba[3] = p[3];
+            break;
+
+        default:
+            assert(false);
+    }
+}
+
+
+
+void omxSoftWritePixel(OMXSoftImage_s *image, OMX_U32 x, OMX_U32 y, const uint8_t rgba[4]) {
+    OMX_U8 *p = image->pData + y * image->nStride + x * omxSoftBytesPerPixel(image->eColorFormat);
+
+    switch (image->eColorFormat) {
+        case OMX_COLOR_FormatYUV420PackedPlanar: {
+            uint8_t ycbcr[3];
+            rgbToYCbCr(rgba, ycbcr);
+            *p = ycbcr[0];
+
+            if (((x | y) & 1) == 0) {
+                const OMX_U32 c = (y / 2) * (image->nStride / 2) + x / 2;
+                planeU(image)[c] = ycbcr[1];
+                planeV(image)[c] = ycbcr[2];
+            }
+
+            break;
+        }
+
+        case OMX_COLOR_Format16bitRGB565: {
+            const uint16_t v = ((rgba[0] >> 3) << 11) | ((rgba[1] >> 2) << 5) | (rgba[2] >> 3);
+            p[0] = v & 0xFF;
+            p[1] = v >> 8;
+            break;
+        }
+
+        case OMX_COLOR_Format24bitRGB888:
+            p[0] = rgba[0];
+            p[1] = rgba[1];
+            p[2] = rgba[2];
+            break;
+
+        case OMX_COLOR_Format24bitBGR888:
+            p[0] = rgba[2];
+            p[1] = rgba[1];
+            p[2] = rgba[0];
+            break;
+
+        case OMX_COLOR_Format32bitABGR8888:
+            p[0] = rgba[0];
+            p[1] = rgba[1];
+            p[2] = rgba[2];
+            p[3] = rgba[3];
+            break;
+
+        case OMX_COLOR_Format32bitARGB8888:
+            p[0] = rgba[2];
+            p[1] = rgba[1];
+            p[2] = rgba[0];
+            p[3] = rgba[3];
+            break;
+
+        default:
+            assert(false);
+    }
+}
+
+
+
+void omxSoftReadRow(const OMXSoftImage_s *image, OMX_U32 y, uint8_t *out_row) {
+    if (omxSoftIsPlanar(image->eColorFormat)) {
+        const OMX_U8 *Y = image->pData + y * image->nStride;
+        const OMX_U8 *U = planeU(image) + (y / 2) * (image->nStride / 2);
+        const OMX_U8 *V = planeV(image) + (y / 2) * (image->nStride / 2);
+
+        for (OMX_U32 x = 0; x < image->nWidth; x++) {
+            out_row[3 * x + 0] = Y[x];
+            out_row[3 * x + 1] = U[x / 2];
+            out_row[3 * x + 2] = V[x / 2];
+        }
+
+        return;
+    }
+
+    uint8_t rgba[4];
+
+    for (OMX_U32 x = 0; x < image->nWidth; x++) {
+        omxSoftReadPixel(image, x, y, rgba);
+        memcpy(&out_row[3 * x], rgba, 3);
+    }
+}
+
+
+
+void omxSoftWriteRow(OMXSoftImage_s *image, OMX_U32 y, const uint8_t *in_row, OMX_U32 nComponents) {
+    if (omxSoftIsPlanar(image->eColorFormat)) {
+        OMX_U8 *Y = image->pData + y * image->nStride;
+        OMX_U8 *U = planeU(image) + (y / 2) * (image->nStride / 2);
+        OMX_U8 *V = planeV(image) + (y / 2) * (image->nStride / 2);
+
+        for (OMX_U32 x = 0; x < image->nWidth; x++) {
+            Y[x] = in_row[nComponents * x];
+
+            if (((x | y) & 1) == 0) {
+                U[x / 2] = (nComponents == 3) ? in_row[3 * x + 1] : 128;
+                V[x / 2] = (nComponents == 3) ? in_row[3 * x + 2] : 128;
+            }
+        }
+
+        return;
+    }
+
+    uint8_t rgba[4] = { 0, 0, 0, 255 };
+
+    for (OMX_U32 x = 0; x < image->nWidth; x++) {
+        if (nComponents == 3) {
+            memcpy(rgba, &in_row[3 * x], 3);
+        } else {
+            rgba[0] = rgba[1] = rgba[2] = in_row[x];
+        }
+
+        omxSoftWritePixel(image, x, y, rgba);
+    }
+}
+
+
+
+void omxSoftImageResize(OMXSoftImage_s *dst, const OMXSoftImage_s *src, OMX_S32 nLeft, OMX_S32 nTop, OMX_U32 nWidth, OMX_U32 nHeight) {
+    if ((nWidth == 0) || (nHeight == 0)) {
+        nLeft = 0;
+        nTop = 0;
+        nWidth = src->nWidth;
+        nHeight = src->nHeight;
+    }
+
+    // 16.16 fixed point source position of the destination pixel centers
+    const int64_t stepX = ((int64_t)nWidth << 16) / dst->nWidth;
+    const int64_t stepY = ((int64_t)nHeight << 16) / dst->nHeight;
+    const int64_t maxX = (int64_t)(src->nWidth - 1) << 16;
+    const int64_t maxY = (int64_t)(src->nHeight - 1) << 16;
+
+    for (OMX_U32 y = 0; y < dst->nHeight; y++) {
+        int64_t sy = ((int64_t)nTop << 16) + y * stepY + stepY / 2 - 32768;
+        sy = (sy < 0) ? 0 : ((sy > maxY) ? maxY : sy);
+        const OMX_U32 y0 = sy >> 16;
+        const OMX_U32 y1 = (y0 + 1 < src->nHeight) ? y0 + 1 : y0;
+        const int32_t fy = sy & 0xFFFF;
+
+        for (OMX_U32 x = 0; x < dst->nWidth; x++) {
+            int64_t sx = ((int64_t)nLeft << 16) + x * stepX + stepX / 2 - 32768;
+            sx = (sx < 0) ? 0 : ((sx > maxX) ? maxX : sx);
+            const OMX_U32 x0 = sx >> 16;
+            const OMX_U32 x1 = (x0 + 1 < src->nWidth) ? x0 + 1 : x0;
+            const int32_t fx = sx & 0xFFFF;
+
+            uint8_t p00[4], p01[4], p10[4], p11[4], out[4];
+            omxSoftReadPixel(src, x0, y0, p00);
+            omxSoftReadPixel(src, x1, y0, p01);
+            omxSoftReadPixel(src, x0, y1, p10);
+            omxSoftReadPixel(src, x1, y1, p11);
+
+            for (int c = 0; c < 4; c++) {
+                const int32_t top = p00[c] * (65536 - fx) + p01[c] * fx;
+                const int32_t bottom = p10[c] * (65536 - fx) + p11[c] * fx;
+                out[c] = (((int64_t)top * (65536 - fy) + (int64_t)bottom * fy) + (1LL << 31)) >> 32;
+            }
+
+            omxSoftWritePixel(dst, x, y, out);
+        }
+    }
+}
@@ -0,0 +1,58 @@
+//
+//  omxSoftImage.h
+//  OMXPlayground
+//
+//  Pixel layouts and a scalar resizer shared by the software OMX components.
+//
+
+#ifndef omxSoftImage_h
+#define omxSoftImage_h
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define OMX_SKIP64BIT
+#include <IL/OMX_Image.h>
+
+
+#define OMX_SOFT_ALIGN(x, a) (((x) + (a) - 1) & ~((a) - 1))
+
+
+// An image as it is laid out in an OMX buffer. Planar formats store nSliceHeight rows of Y followed by
+// nSliceHeight / 2 rows of U and V with half the stride, which is also how a single slice is laid out.
+typedef struct {
+    OMX_COLOR_FORMATTYPE eColorFormat;
+    OMX_U32 nWidth;
+    OMX_U32 nHeight;
+    OMX_U32 nStride;
+    OMX_U32 nSliceHeight;
+    OMX_U8 *pData;
+} OMXSoftImage_s;
+
+
+bool omxSoftIsSupportedColorFormat(OMX_COLOR_FORMATTYPE eColorFormat);
+bool omxSoftIsPlanar(OMX_COLOR_FORMATTYPE eColorFormat);
+OMX_U32 omxSoftBytesPerPixel(OMX_COLOR_FORMATTYPE eColorFormat);
+OMX_U32 omxSoftStride(OMX_COLOR_FORMATTYPE eColorFormat, OMX_U32 nWidth);
+OMX_U32 omxSoftSliceSize(OMX_COLOR_FORMATTYPE eColorFormat, OMX_U32 nStride, OMX_U32 nSliceHeight);
+
+// nStride 0 picks the smallest stride the components accept
+void omxSoftImageAlloc(OMXSoftImage_s *image, OMX_COLOR_FORMATTYPE eColorFormat, OMX_U32 nWidth, OMX_U32 nHeight, OMX_U32 nStride);
+void omxSoftImageFree(OMXSoftImage_s *image);
+
+// copy nRows rows between a slice (laid out with nSliceHeight) and the image, starting at image row nRow
+void omxSoftImageFromSlice(OMXSoftImage_s *image, OMX_U32 nRow, OMX_U32 nRows, const OMX_U8 *pSlice, OMX_U32 nSliceHeight);
+void omxSoftImageToSlice(const OMXSoftImage_s *image, OMX_U32 nRow, OMX_U32 nRows, OMX_U8 *pSlice, OMX_U32 nSliceHeight);
+
+void omxSoftReadPixel(const OMXSoftImage_s *image, OMX_U32 x, OMX_U32 y, uint8_t rgba[4]);
+void omxSoftWritePixel(OMXSoftImage_s *image, OMX_U32 x, OMX_U32 y, const uint8_t rgba[4]);
+
+// rows in the 3 channel layout libjpeg expects (JCS_RGB, or JCS_YCbCr for planar images)
+void omxSoftReadRow(const OMXSoftImage_s *image, OMX_U32 y, uint8_t *out_row);
+void omxSoftWriteRow(OMXSoftImage_s *image, OMX_U32 y, const uint8_t *in_row, OMX_U32 nComponents);
+
+void omxSoftImageResize(OMXSoftImage_s *dst, const OMXSoftImage_s *src, OMX_S32 nLeft, OMX_S32 nTop, OMX_U32 nWidth, OMX_U32 nHeight);
+
+
+#endif /* omxSoftImage_h */
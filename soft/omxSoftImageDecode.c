@@ -0,0 +1,254 @@
+//
+//  omxSoftImageDecode.c
+//  OMXPlayground
+//
+//  OMX.broadcom.image_decode on top of libjpeg. The output port is reconfigured (and
+//  OMX_EventPortSettingsChanged sent) as soon as the SOF marker has been seen, unless the enabled output
+//  port already has the right size. The image itself is decoded once the whole stream
+//  (OMX_BUFFERFLAG_EOS) arrived. Output is always YUV420PackedPlanar.
+//
+
+#include "omxSoftCore.h"
+#include "omxSoftImage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+
+
+typedef struct {
+    OMX_U8 *data;
+    size_t dataSize;
+    size_t dataCapacity;
+    bool eos;
+
+    bool headerParsed;
+    bool decoded;
+    OMXSoftImage_s frame;
+    OMX_U32 frameSize;
+    OMX_U32 frameSent;
+} OMXSoftImageDecode_s;
+
+
+
+static void init(OMXSoftComponent_s *component) {
+    component->priv = calloc(1, sizeof(OMXSoftImageDecode_s));
+
+    OMXSoftPort_s *input = omxSoftInputPort(component);
+    omxSoftInitPort(input, 320, OMX_DirInput, 3, 81920);
+    omxSoftAddPortFormat(input, OMX_IMAGE_CodingJPEG, OMX_COLOR_FormatUnused);
+
+    OMXSoftPort_s *output = omxSoftOutputPort(component);
+    omxSoftInitPort(output, 321, OMX_DirOutput, 1, 0);
+    omxSoftAddPortFormat(output, OMX_IMAGE_CodingUnused, OMX_COLOR_FormatYUV420PackedPlanar);
+}
+
+
+
+static void reset(OMXSoftComponent_s *component) {
+    OMXSoftImageDecode_s *decode = component->priv;
+    decode->dataSize = 0;
+    decode->eos = false;
+    decode->headerParsed = false;
+    decode->decoded = false;
+    decode->frameSent = 0;
+}
+
+
+
+static void deinit(OMXSoftComponent_s *component) {
+    OMXSoftImageDecode_s *decode = component->priv;
+    omxSoftImageFree(&decode->frame);
+    free(decode->data);
+    free(decode);
+}
+
+
+
+// an output port set up ahead of the stream gets the layout decodeFrame will produce
+static void updatePorts(OMXSoftComponent_s *component) {
+    OMX_PARAM_PORTDEFINITIONTYPE *definition = &omxSoftOutputPort(component)->definition;
+    OMX_IMAGE_PORTDEFINITIONTYPE *image = &definition->format.image;
+    image->nStride = omxSoftStride(image->eColorFormat, image->nFrameWidth);
+    image->nSliceHeight = OMX_SOFT_ALIGN(image->nFrameHeight, 16);
+    definition->nBufferSize = omxSoftSliceSize(image->eColorFormat, image->nStride, image->nSliceHeight);
+}
+
+
+
+static OMX_ERRORTYPE getParameter(OMXSoftComponent_s *component, OMX_INDEXTYPE nIndex, OMX_PTR pParam) {
+    if (nIndex != OMX_IndexParamNumAvailableStreams) {
+        return OMX_ErrorUnsupportedIndex;
+    }
+
+    OMX_PARAM_U32TYPE *numAvailableStreams = (OMX_PARAM_U32TYPE *)pParam;
+    numAvailableStreams->nU32 = ((OMXSoftImageDecode_s *)component->priv)->headerParsed ? 1 : 0;
+    return OMX_ErrorNone;
+}
+
+
+
+// scans the marker segments up to SOFn, returns false if more data is needed
+static bool parseHeader(const OMX_U8 *data, size_t size, OMX_U32 *pWidth, OMX_U32 *pHeight) {
+    size_t pos = 2;
+
+    while (pos + 4 <= size) {
+        if (data[pos] != 0xFF) {
+            pos++;
+            continue;
+        }
+
+        const OMX_U8 marker = data[pos + 1];
+
+        if ((marker == 0xFF) || (marker == 0xD8) || (marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD7))) {
+            pos++;
+            continue;
+        }
+
+        const size_t length = (data[pos + 2] << 8) | data[pos + 3];
+        const bool isSOF = (marker >= 0xC0) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC);
+
+        if (isSOF) {
+            if (pos + 9 > size) {
+                return false;
+            }
+
+            *pHeight = (data[pos + 5] << 8) | data[pos + 6];
+            *pWidth = (data[pos + 7] << 8) | data[pos + 8];
+            return true;
+        }
+
+        pos += 2 + length;
+    }
+
+    return false;
+}
+
+
+
+static void decodeFrame(OMXSoftImageDecode_s *decode) {
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_error_mgr jerr;
+    dinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&dinfo);
+    jpeg_mem_src(&dinfo, decode->data, decode->dataSize);
+    jpeg_read_header(&dinfo, TRUE);
+    dinfo.out_color_space = (dinfo.num_components == 1) ? JCS_GRAYSCALE : JCS_YCbCr;
+    jpeg_start_decompress(&dinfo);
+
+    JSAMPROW row = malloc(dinfo.output_width * dinfo.output_components);
+
+    while (dinfo.output_scanline < dinfo.output_height) {
+        const OMX_U32 y = dinfo.output_scanline;
+        jpeg_read_scanlines(&dinfo, &row, 1);
+        omxSoftWriteRow(&decode->frame, y, row, dinfo.output_components);
+    }
+
+    free(row);
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_decompress(&dinfo);
+}
+
+
+
+static void process(OMXSoftComponent_s *component) {
+    OMXSoftImageDecode_s *decode = component->priv;
+    OMXSoftPort_s *input = omxSoftInputPort(component);
+    OMXSoftPort_s *output = omxSoftOutputPort(component);
+    OMX_BUFFERHEADERTYPE *buffer;
+
+    while (!decode->eos && (buffer = omxSoftPopBuffer(input))) {
+        if (decode->dataSize + buffer->nFilledLen > decode->dataCapacity) {
+            decode->dataCapacity = 2 * (decode->dataSize + buffer->nFilledLen);
+            decode->data = realloc(decode->data, decode->dataCapacity);
+        }
+
+        memcpy(decode->data + decode->dataSize, buffer->pBuffer + buffer->nOffset, buffer->nFilledLen);
+        decode->dataSize += buffer->nFilledLen;
+        decode->eos = (buffer->nFlags & OMX_BUFFERFLAG_EOS) != 0;
+        buffer->nFilledLen = 0;
+        omxSoftReturnBuffer(component, input, buffer);
+
+        if (component->state != OMX_StateExecuting) {
+            return;
+        }
+    }
+
+    if (!decode->headerParsed) {
+        OMX_U32 width, height;
+
+        if (!parseHeader(decode->data, decode->dataSize, &width, &height)) {
+            if (decode->eos) {
+                omxSoftEvent(component, OMX_EventError, OMX_ErrorStreamCorrupt, 0);
+                reset(component);
+            }
+
+            return;
+        }
+
+        OMXSoftImage_s *frame = &decode->frame;
+        omxSoftImageFree(frame);
+        omxSoftImageAlloc(frame, OMX_COLOR_FormatYUV420PackedPlanar, width, height, 0);
+        decode->frameSize = omxSoftSliceSize(frame->eColorFormat, frame->nStride, frame->nSliceHeight);
+        decode->headerParsed = true;
+
+        OMX_PARAM_PORTDEFINITIONTYPE *definition = &output->definition;
+        OMX_IMAGE_PORTDEFINITIONTYPE *image = &definition->format.image;
+        const bool changed = (image->nFrameWidth != width) || (image->nFrameHeight != height);
+        image->nFrameWidth = width;
+        image->nFrameHeight = height;
+        image->nStride = frame->nStride;
+        image->nSliceHeight = frame->nSliceHeight;
+        image->eColorFormat = frame->eColorFormat;
+        definition->nBufferSize = decode->frameSize;
+
+        if (changed || !definition->bEnabled) {
+            omxSoftPortSettingsChanged(component, output);
+            return;
+        }
+    }
+
+    if (!decode->eos) {
+        return;
+    }
+
+    if (!decode->decoded) {
+        decodeFrame(decode);
+        decode->decoded = true;
+        decode->frameSent = 0;
+    }
+
+    while ((component->state == OMX_StateExecuting) && (buffer = omxSoftPopBuffer(output))) {
+        const OMX_U32 remaining = decode->frameSize - decode->frameSent;
+        buffer->nOffset = 0;
+        buffer->nFilledLen = (remaining < buffer->nAllocLen) ? remaining : buffer->nAllocLen;
+        buffer->nFlags = 0;
+        memcpy(buffer->pBuffer, decode->frame.pData + decode->frameSent, buffer->nFilledLen);
+        decode->frameSent += buffer->nFilledLen;
+
+        if (decode->frameSent == decode->frameSize) {
+            buffer->nFlags = OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_EOS;
+            reset(component);
+            omxSoftReturnBuffer(component, output, buffer);
+            return;
+        }
+
+        omxSoftReturnBuffer(component, output, buffer);
+    }
+}
+
+
+
+const OMXSoftComponentType_s omxSoftImageDecode = {
+    .name = "OMX.broadcom.image_decode",
+    .startPort = 320,
+    .init = init,
+    .deinit = deinit,
+    .getParameter = getParameter,
+    .updatePorts = updatePorts,
+    .process = process,
+    .reset = reset,
+};
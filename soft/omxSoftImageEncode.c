@@ -0,0 +1,236 @@
+//
+//  omxSoftImageEncode.c
+//  OMXPlayground
+//
+//  OMX.broadcom.image_encode on top of libjpeg. Input slices are collected into a frame which is
+//  compressed once the last row arrived, the JPEG is then handed out in as many output buffers as needed.
+//
+
+#include "omxSoftCore.h"
+#include "omxSoftImage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+
+
+typedef struct {
+    OMX_U32 nQFactor;
+    OMXSoftImage_s frame;
+    OMX_U32 rowsReceived;
+    OMX_U32 nFlags;
+
+    unsigned char *jpeg;
+    unsigned long jpegSize;
+    unsigned long jpegSent;
+} OMXSoftImageEncode_s;
+
+
+
+static void init(OMXSoftComponent_s *component) {
+    OMXSoftImageEncode_s *encode = calloc(1, sizeof(OMXSoftImageEncode_s));
+    encode->nQFactor = 75;
+    component->priv = encode;
+
+    OMXSoftPort_s *input = omxSoftInputPort(component);
+    omxSoftInitPort(input, 340, OMX_DirInput, 1, 0);
+    omxSoftAddPortFormat(input, OMX_IMAGE_CodingUnused, OMX_COLOR_FormatYUV420PackedPlanar);
+    omxSoftAddPortFormat(input, OMX_IMAGE_CodingUnused, OMX_COLOR_Format24bitRGB888);
+    omxSoftAddPortFormat(input, OMX_IMAGE_CodingUnused, OMX_COLOR_Format24bitBGR888);
+    omxSoftAddPortFormat(input, OMX_IMAGE_CodingUnused, OMX_COLOR_Format32bitABGR8888);
+    omxSoftAddPortFormat(input, OMX_IMAGE_CodingUnused, OMX_COLOR_Format32bitARGB8888);
+    omxSoftAddPortFormat(input, OMX_IMAGE_CodingUnused, OMX_COLOR_Format16bitRGB565);
+    input->definition.format.image.nFrameWidth = 160;
+    input->definition.format.image.nFrameHeight = 120;
+    input->supportsSlices = OMX_TRUE;
+
+    OMXSoftPort_s *output = omxSoftOutputPort(component);
+    omxSoftInitPort(output, 341, OMX_DirOutput, 1, 65536);
+    omxSoftAddPortFormat(output, OMX_IMAGE_CodingJPEG, OMX_COLOR_FormatUnused);
+}
+
+
+
+static void reset(OMXSoftComponent_s *component) {
+    OMXSoftImageEncode_s *encode = component->priv;
+    free(encode->jpeg);
+    encode->jpeg = NULL;
+    encode->jpegSize = 0;
+    encode->jpegSent = 0;
+    encode->rowsReceived = 0;
+    encode->nFlags = 0;
+}
+
+
+
+static void deinit(OMXSoftComponent_s *component) {
+    OMXSoftImageEncode_s *encode = component->priv;
+    reset(component);
+    omxSoftImageFree(&encode->frame);
+    free(encode);
+}
+
+
+
+static void updatePorts(OMXSoftComponent_s *component) {
+    OMX_IMAGE_PORTDEFINITIONTYPE *image = &omxSoftInputPort(component)->definition.format.image;
+    const OMX_U32 minStride = omxSoftStride(image->eColorFormat, image->nFrameWidth);
+
+    if (image->nStride < (OMX_S32)minStride) {
+        image->nStride = minStride;
+    }
+
+    if ((image->nSliceHeight == 0) || (image->nSliceHeight > image->nFrameHeight)) {
+        image->nSliceHeight = image->nFrameHeight;
+    }
+
+    if (omxSoftIsPlanar(image->eColorFormat)) {
+        image->nSliceHeight = OMX_SOFT_ALIGN(image->nSliceHeight, 16);
+    }
+
+    omxSoftInputPort(component)->definition.nBufferSize = omxSoftSliceSize(image->eColorFormat, image->nStride, image->nSliceHeight);
+}
+
+
+
+static OMX_ERRORTYPE getParameter(OMXSoftComponent_s *component, OMX_INDEXTYPE nIndex, OMX_PTR pParam) {
+    if (nIndex != OMX_IndexParamQFactor) {
+        return OMX_ErrorUnsupportedIndex;
+    }
+
+    OMX_IMAGE_PARAM_QFACTORTYPE *qFactor = (OMX_IMAGE_PARAM_QFACTORTYPE *)pParam;
+    qFactor->nQFactor = ((OMXSoftImageEncode_s *)component->priv)->nQFactor;
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE setParameter(OMXSoftComponent_s *component, OMX_INDEXTYPE nIndex, OMX_PTR pParam) {
+    if (nIndex != OMX_IndexParamQFactor) {
+        return OMX_ErrorUnsupportedIndex;
+    }
+
+    OMX_IMAGE_PARAM_QFACTORTYPE *qFactor = (OMX_IMAGE_PARAM_QFACTORTYPE *)pParam;
+
+    if ((qFactor->nQFactor < 1) || (qFactor->nQFactor > 100)) {
+        return OMX_ErrorBadParameter;
+    }
+
+    ((OMXSoftImageEncode_s *)component->priv)->nQFactor = qFactor->nQFactor;
+    return OMX_ErrorNone;
+}
+
+
+
+static void compressFrame(OMXSoftImageEncode_s *encode) {
+    const OMXSoftImage_s *frame = &encode->frame;
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &encode->jpeg, &encode->jpegSize);
+
+    cinfo.image_width = frame->nWidth;
+    cinfo.image_height = frame->nHeight;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = omxSoftIsPlanar(frame->eColorFormat) ? JCS_YCbCr : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, encode->nQFactor, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    JSAMPROW row = malloc(frame->nWidth * 3);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        omxSoftReadRow(frame, cinfo.next_scanline, row);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+
+    free(row);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    encode->jpegSent = 0;
+}
+
+
+
+static void process(OMXSoftComponent_s *component) {
+    OMXSoftImageEncode_s *encode = component->priv;
+    OMXSoftPort_s *input = omxSoftInputPort(component);
+    OMXSoftPort_s *output = omxSoftOutputPort(component);
+    const OMX_IMAGE_PORTDEFINITIONTYPE *image = &input->definition.format.image;
+
+    while (component->state == OMX_StateExecuting) {
+        if (encode->jpeg) {
+            OMX_BUFFERHEADERTYPE *buffer = omxSoftPopBuffer(output);
+
+            if (!buffer) {
+                return;
+            }
+
+            const unsigned long remaining = encode->jpegSize - encode->jpegSent;
+            buffer->nOffset = 0;
+            buffer->nFilledLen = (remaining < buffer->nAllocLen) ? remaining : buffer->nAllocLen;
+            buffer->nFlags = 0;
+            memcpy(buffer->pBuffer, encode->jpeg + encode->jpegSent, buffer->nFilledLen);
+            encode->jpegSent += buffer->nFilledLen;
+
+            if (encode->jpegSent == encode->jpegSize) {
+                buffer->nFlags = OMX_BUFFERFLAG_ENDOFFRAME | (encode->nFlags & OMX_BUFFERFLAG_EOS);
+                reset(component);
+            }
+
+            omxSoftReturnBuffer(component, output, buffer);
+            continue;
+        }
+
+        OMX_BUFFERHEADERTYPE *buffer = omxSoftPopBuffer(input);
+
+        if (!buffer) {
+            return;
+        }
+
+        OMXSoftImage_s *frame = &encode->frame;
+
+        if ((frame->eColorFormat != image->eColorFormat) || (frame->nWidth != image->nFrameWidth) || (frame->nHeight != image->nFrameHeight) || (frame->nStride != (OMX_U32)image->nStride)) {
+            omxSoftImageFree(frame);
+            omxSoftImageAlloc(frame, image->eColorFormat, image->nFrameWidth, image->nFrameHeight, image->nStride);
+        }
+
+        if (buffer->nFilledLen > 0) {
+            OMX_U32 rows = image->nFrameHeight - encode->rowsReceived;
+
+            if (rows > image->nSliceHeight) {
+                rows = image->nSliceHeight;
+            }
+
+            omxSoftImageFromSlice(frame, encode->rowsReceived, rows, buffer->pBuffer + buffer->nOffset, image->nSliceHeight);
+            encode->rowsReceived += rows;
+        }
+
+        encode->nFlags |= buffer->nFlags;
+        const bool endOfFrame = (encode->rowsReceived >= image->nFrameHeight) || (buffer->nFlags & (OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_EOS));
+        buffer->nFilledLen = 0;
+        omxSoftReturnBuffer(component, input, buffer);
+
+        if (endOfFrame && (encode->rowsReceived > 0)) {
+            compressFrame(encode);
+        }
+    }
+}
+
+
+
+const OMXSoftComponentType_s omxSoftImageEncode = {
+    .name = "OMX.broadcom.image_encode",
+    .startPort = 340,
+    .init = init,
+    .deinit = deinit,
+    .getParameter = getParameter,
+    .setParameter = setParameter,
+    .updatePorts = updatePorts,
+    .process = process,
+    .reset = reset,
+};
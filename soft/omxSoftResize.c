@@ -0,0 +1,261 @@
+//
+//  omxSoftResize.c
+//  OMXPlayground
+//
+//  OMX.broadcom.resize with a bilinear filter. Input slices are collected into a frame, which is then
+//  cropped (OMX_IndexConfigCommonInputCrop), scaled and converted and handed out slice by slice. The crop is
+//  latched with the first slice of a frame, so it can be changed between frames while executing.
+//
+
+#include "omxSoftCore.h"
+#include "omxSoftImage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+typedef struct {
+    OMXSoftImage_s inputFrame;
+    OMX_CONFIG_RECTTYPE frameCrop;
+    OMX_U32 rowsReceived;
+    OMX_U32 nFlags;
+
+    OMXSoftImage_s outputFrame;
+    bool outputPending;
+    OMX_U32 rowsSent;
+} OMXSoftResize_s;
+
+
+
+static const OMX_COLOR_FORMATTYPE sColorFormats[] = {
+    OMX_COLOR_FormatYUV420PackedPlanar,
+    OMX_COLOR_Format32bitABGR8888,
+    OMX_COLOR_Format32bitARGB8888,
+    OMX_COLOR_Format24bitRGB888,
+    OMX_COLOR_Format24bitBGR888,
+    OMX_COLOR_Format16bitRGB565,
+};
+
+
+
+static void init(OMXSoftComponent_s *component) {
+    component->priv = calloc(1, sizeof(OMXSoftResize_s));
+
+    for (int p = 0; p < 2; p++) {
+        OMXSoftPort_s *port = &component->ports[p];
+        omxSoftInitPort(port, 60 + p, (p == 0) ? OMX_DirInput : OMX_DirOutput, 1, 0);
+
+        for (size_t i = 0; i < sizeof(sColorFormats) / sizeof(sColorFormats[0]); i++) {
+            omxSoftAddPortFormat(port, OMX_IMAGE_CodingUnused, sColorFormats[i]);
+        }
+
+        port->definition.format.image.nFrameWidth = 160;
+        port->definition.format.image.nFrameHeight = 64;
+        port->supportsSlices = OMX_TRUE;
+    }
+}
+
+
+
+static void reset(OMXSoftComponent_s *component) {
+    OMXSoftResize_s *resize = component->priv;
+    resize->rowsReceived = 0;
+    resize->nFlags = 0;
+    resize->outputPending = false;
+    resize->rowsSent = 0;
+}
+
+
+
+static void deinit(OMXSoftComponent_s *component) {
+    OMXSoftResize_s *resize = component->priv;
+    omxSoftImageFree(&resize->inputFrame);
+    omxSoftImageFree(&resize->outputFrame);
+    free(resize);
+}
+
+
+
+static void updatePorts(OMXSoftComponent_s *component) {
+    for (int p = 0; p < 2; p++) {
+        OMX_PARAM_PORTDEFINITIONTYPE *definition = &component->ports[p].definition;
+        OMX_IMAGE_PORTDEFINITIONTYPE *image = &definition->format.image;
+        const OMX_U32 minStride = omxSoftStride(image->eColorFormat, image->nFrameWidth);
+
+        if (image->nStride < (OMX_S32)minStride) {
+            image->nStride = minStride;
+        }
+
+        if ((image->nSliceHeight == 0) || (image->nSliceHeight > image->nFrameHeight)) {
+            image->nSliceHeight = image->nFrameHeight;
+        }
+
+        if (omxSoftIsPlanar(image->eColorFormat)) {
+            image->nSliceHeight = OMX_SOFT_ALIGN(image->nSliceHeight, 16);
+        }
+
+        definition->nBufferSize = omxSoftSliceSize(image->eColorFormat, image->nStride, image->nSliceHeight);
+    }
+}
+
+
+
+static OMX_ERRORTYPE getParameter(OMXSoftComponent_s *component, OMX_INDEXTYPE nIndex, OMX_PTR pParam) {
+    if (nIndex != OMX_IndexConfigCommonInputCrop) {
+        return OMX_ErrorUnsupportedIndex;
+    }
+
+    OMX_CONFIG_RECTTYPE *inputCrop = (OMX_CONFIG_RECTTYPE *)pParam;
+    OMXSoftPort_s *port = omxSoftPort(component, inputCrop->nPortIndex);
+
+    if (!port || (port->definition.eDir != OMX_DirInput)) {
+        return OMX_ErrorBadPortIndex;
+    }
+
+    inputCrop->nLeft = port->inputCrop.nLeft;
+    inputCrop->nTop = port->inputCrop.nTop;
+    inputCrop->nWidth = port->inputCrop.nWidth;
+    inputCrop->nHeight = port->inputCrop.nHeight;
+    return OMX_ErrorNone;
+}
+
+
+
+static OMX_ERRORTYPE setParameter(OMXSoftComponent_s *component, OMX_INDEXTYPE nIndex, OMX_PTR pParam) {
+    if (nIndex != OMX_IndexConfigCommonInputCrop) {
+        return OMX_ErrorUnsupportedIndex;
+    }
+
+    const OMX_CONFIG_RECTTYPE *inputCrop = (const OMX_CONFIG_RECTTYPE *)pParam;
+    OMXSoftPort_s *port = omxSoftPort(component, inputCrop->nPortIndex);
+
+    if (!port || (port->definition.eDir != OMX_DirInput)) {
+        return OMX_ErrorBadPortIndex;
+    }
+
+    if ((inputCrop->nLeft < 0) || (inputCrop->nTop < 0)) {
+        return OMX_ErrorBadParameter;
+    }
+
+    port->inputCrop.nLeft = inputCrop->nLeft;
+    port->inputCrop.nTop = inputCrop->nTop;
+    port->inputCrop.nWidth = inputCrop->nWidth;
+    port->inputCrop.nHeight = inputCrop->nHeight;
+    return OMX_ErrorNone;
+}
+
+
+
+static void resizeFrame(OMXSoftComponent_s *component) {
+    OMXSoftResize_s *resize = component->priv;
+    const OMX_IMAGE_PORTDEFINITIONTYPE *image = &omxSoftOutputPort(component)->definition.format.image;
+    OMXSoftImage_s *frame = &resize->outputFrame;
+
+    if ((frame->eColorFormat != image->eColorFormat) || (frame->nWidth != image->nFrameWidth) || (frame->nHeight != image->nFrameHeight) || (frame->nStride != (OMX_U32)image->nStride)) {
+        omxSoftImageFree(frame);
+        omxSoftImageAlloc(frame, image->eColorFormat, image->nFrameWidth, image->nFrameHeight, image->nStride);
+    }
+
+    const OMX_CONFIG_RECTTYPE *crop = &resize->frameCrop;
+    omxSoftImageResize(frame, &resize->inputFrame, crop->nLeft, crop->nTop, crop->nWidth, crop->nHeight);
+    resize->outputPending = true;
+    resize->rowsSent = 0;
+}
+
+
+
+static void process(OMXSoftComponent_s *component) {
+    OMXSoftResize_s *resize = component->priv;
+    OMXSoftPort_s *input = omxSoftInputPort(component);
+    OMXSoftPort_s *output = omxSoftOutputPort(component);
+    const OMX_IMAGE_PORTDEFINITIONTYPE *inputImage = &input->definition.format.image;
+    const OMX_IMAGE_PORTDEFINITIONTYPE *outputImage = &output->definition.format.image;
+
+    while (component->state == OMX_StateExecuting) {
+        if (resize->outputPending) {
+            OMX_BUFFERHEADERTYPE *buffer = omxSoftPopBuffer(output);
+
+            if (!buffer) {
+                return;
+            }
+
+            OMX_U32 rows = outputImage->nFrameHeight - resize->rowsSent;
+
+            if (rows > outputImage->nSliceHeight) {
+                rows = outputImage->nSliceHeight;
+            }
+
+            omxSoftImageToSlice(&resize->outputFrame, resize->rowsSent, rows, buffer->pBuffer, outputImage->nSliceHeight);
+            resize->rowsSent += rows;
+            buffer->nOffset = 0;
+            buffer->nFlags = 0;
+            buffer->nFilledLen = omxSoftSliceSize(outputImage->eColorFormat, outputImage->nStride, outputImage->nSliceHeight);
+
+            if (resize->rowsSent >= outputImage->nFrameHeight) {
+                // the last slice is only filled as far as there are rows
+                if (!omxSoftIsPlanar(outputImage->eColorFormat)) {
+                    buffer->nFilledLen = rows * outputImage->nStride;
+                }
+
+                buffer->nFlags = OMX_BUFFERFLAG_ENDOFFRAME | (resize->nFlags & OMX_BUFFERFLAG_EOS);
+                reset(component);
+            }
+
+            omxSoftReturnBuffer(component, output, buffer);
+            continue;
+        }
+
+        OMX_BUFFERHEADERTYPE *buffer = omxSoftPopBuffer(input);
+
+        if (!buffer) {
+            return;
+        }
+
+        OMXSoftImage_s *frame = &resize->inputFrame;
+
+        if ((frame->eColorFormat != inputImage->eColorFormat) || (frame->nWidth != inputImage->nFrameWidth) || (frame->nHeight != inputImage->nFrameHeight) || (frame->nStride != (OMX_U32)inputImage->nStride)) {
+            omxSoftImageFree(frame);
+            omxSoftImageAlloc(frame, inputImage->eColorFormat, inputImage->nFrameWidth, inputImage->nFrameHeight, inputImage->nStride);
+        }
+
+        if (buffer->nFilledLen > 0) {
+            if (resize->rowsReceived == 0) {
+                resize->frameCrop = input->inputCrop;
+            }
+
+            OMX_U32 rows = inputImage->nFrameHeight - resize->rowsReceived;
+
+            if (rows > inputImage->nSliceHeight) {
+                rows = inputImage->nSliceHeight;
+            }
+
+            omxSoftImageFromSlice(frame, resize->rowsReceived, rows, buffer->pBuffer + buffer->nOffset, inputImage->nSliceHeight);
+            resize->rowsReceived += rows;
+        }
+
+        resize->nFlags |= buffer->nFlags;
+        const bool endOfFrame = (resize->rowsReceived >= inputImage->nFrameHeight) || (buffer->nFlags & (OMX_BUFFERFLAG_ENDOFFRAME | OMX_BUFFERFLAG_EOS));
+        buffer->nFilledLen = 0;
+        omxSoftReturnBuffer(component, input, buffer);
+
+        if (endOfFrame && (resize->rowsReceived > 0)) {
+            resizeFrame(component);
+        }
+    }
+}
+
+
+
+const OMXSoftComponentType_s omxSoftResize = {
+    .name = "OMX.broadcom.resize",
+    .startPort = 60,
+    .init = init,
+    .deinit = deinit,
+    .getParameter = getParameter,
+    .setParameter = setParameter,
+    .updatePorts = updatePorts,
+    .process = process,
+    .reset = reset,
+};